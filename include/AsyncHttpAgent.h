@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef ASYNCHTTPAGENT_H_
+#define ASYNCHTTPAGENT_H_
+
+#include "HttpAgent.h"
+#include "Resolver.h"
+#include "Selector.h"
+#include "EventAgent.h"
+#include "Mutex.h"
+#include "jh_list.h"
+#include "jh_vector.h"
+
+/**
+ * @file AsyncHttpAgent.h
+ * @brief An HTTP/1.1 client that never blocks the calling thread.
+ *
+ * Every request is run on one Selector's thread: the host is looked up with
+ *  the Resolver, connected to with Socket::connectAsync and the response is
+ *  parsed as it arrives.  Any number of requests can be in flight at once on
+ *  that one thread.  Each request has a deadline, kept on the shared timer,
+ *  covering everything from send to the end of the response.
+ *
+ * Connections are kept open between requests to the same host:port as in 
+ *  HttpAgent, with no more than the per host limit open at once.  Requests
+ *  beyond the limit wait for a connection to come free.
+ *
+ * With a pipeline depth above 1, idempotent requests that would otherwise
+ *  wait are instead written straight away to a busy connection, behind the
+ *  ones already on it, and the responses are read back in order.  Only
+ *  connections that have already given a keep-alive HTTP/1.1 response are
+ *  used this way.  If a connection is lost, the requests still waiting for
+ *  a response on it are sent again on another one.
+ */
+
+/**
+ * Implemented by users of AsyncHttpAgent.
+ */
+class AsyncHttpListener
+{
+public:
+	/**
+	 * A request started with AsyncHttpAgent::send has finished.  Called on
+	 *  the dispatcher that was passed to send.
+	 *
+	 * @param id	What send returned
+	 * @param err	kNoError if a whole response arrived, whatever its 
+	 *				response code.  Otherwise kConnectionFailed, kReadFailed
+	 *				or kTimedOut.
+	 * @param res	The response, only valid during the call.  Its response
+	 *				code is -1 if no status line arrived.
+	 * @param body	The body, unless the request had a BodyHandler
+	 */
+	virtual void handleResponse( int id, JetHead::ErrCode err, 
+								 HttpResponse &res, 
+								 const JHSTD::string &body ) = 0;
+	
+protected:
+	virtual ~AsyncHttpListener() {}
+};
+
+class AsyncHttpAgent : protected JetHead::SocketListener, 
+					   protected JetHead::ResolverListener
+{
+public:
+	//! Deadline for a request unless send is told otherwise, in ms
+	static const uint32_t kDefaultTimeout = 30 * 1000;
+	
+	//! Most connections open to one host:port at once
+	static const int kDefaultMaxPerHost = 4;
+	
+	//! How long a connection is kept idle, in ms
+	static const uint32_t kDefaultIdleTimeout = 30 * 1000;
+	
+	//! Most requests on one connection at once, 1 means no pipelining
+	static const int kDefaultPipelineDepth = 1;
+	
+	//! Run every request on selector's thread
+	AsyncHttpAgent( Selector *selector );
+	
+	/**
+	 * Closes every connection.  Must not be destroyed while any response
+	 *  is still to be delivered, cancelled or not.
+	 */
+	~AsyncHttpAgent();
+	
+	/**
+	 * Start sending req, calling listener's handleResponse on dispatcher's
+	 *  thread when the response has arrived or the request has failed.  The
+	 *  listener is never called from inside this call.  May be called from
+	 *  any thread.
+	 *
+	 * @param req		Copied before send returns
+	 * @param body		Sent after the header, req must say how long it is
+	 * @param handler	If not NULL gets the body with handleData, called on
+	 *					the selector's thread, as it arrives.  Its 
+	 *					handleSocket is never used.  Must live until 
+	 *					handleResponse.
+	 * @param timeoutMs	How long before the request fails with kTimedOut
+	 * @return an id for the request, passed to handleResponse and cancel
+	 */
+	int send( HttpRequest &req, AsyncHttpListener *listener, 
+			  IEventDispatcher *dispatcher,
+			  const JHSTD::string &body = "", BodyHandler *handler = NULL,
+			  uint32_t timeoutMs = kDefaultTimeout );
+	
+	/**
+	 * Stop the request id.  If called on the listener's dispatcher's thread
+	 *  its handleResponse won't be called afterwards.
+	 */
+	void cancel( int id );
+	
+	//! Change the per host limit, existing connections aren't closed
+	void setMaxPerHost( int maxPerHost ) { mMaxPerHost = maxPerHost; }
+	
+	//! Change how long connections are kept idle, 0 to never keep them
+	void setIdleTimeout( uint32_t idleTimeoutMs ) { mIdleTimeout = idleTimeoutMs; }
+	
+	//! Change how many requests can be written to a connection at once
+	void setPipelineDepth( int depth ) { mPipelineDepth = depth; }
+	
+	/**
+	 * Ask for bodies to be sent gzip or deflate coded, as 
+	 *  HttpAgent::setAcceptEncoding.  Applies to requests sent after.
+	 */
+	void setAcceptEncoding( bool accept ) { mAcceptEncoding = accept; }
+	
+protected:
+	//! For SocketListener
+	void handleConnected( JetHead::Socket *socket, bool success );
+	void handleData( JetHead::Socket *socket );
+	bool handleClose( JetHead::Socket *socket );
+	
+	//! For ResolverListener
+	void handleResolved( const char *name, int error,
+						 const JetHead::vector<JetHead::Socket::Address> &addrs );
+	
+private:
+	struct Connection;
+	
+	struct Request
+	{
+		Request() : mAppender( mBody ) {}
+		
+		int						mId;
+		JHSTD::string			mHost;
+		int						mPort;
+		
+		//! The header and body, as sent
+		JHSTD::string			mData;
+		bool					mHead;
+		bool					mIdempotent;
+		bool					mClose;
+		bool					mAcceptEncoding;
+		
+		AsyncHttpListener		*mListener;
+		IEventDispatcher		*mDispatcher;
+		BodyHandler				*mHandler;
+		uint32_t				mTimeout;
+		
+		//! Fires at the deadline, we hold a reference so we can remove it
+		AsyncEventAgent1<AsyncHttpAgent, int>	*mTimer;
+		
+		Connection				*mConn;
+		HttpResponse			*mResponse;
+		JHSTD::string			mBody;
+		JetHead::ErrCode		mError;
+		bool					mCancelled;
+		
+		//! Created for a coded response, passes it to mHandler or mAppender
+		ContentDecoder			*mDecoder;
+		AppendBodyHandler		mAppender;
+	};
+	
+	struct Connection : public HttpParserListener
+	{
+		enum State
+		{
+			kResolving,
+			kConnecting,
+			kIdle,
+			kBusy
+		};
+		
+		Connection() : mBuffer( kBufferSize ), 
+			mParser( HttpParser::kResponse, this ) {}
+		
+		//! For HttpParserListener, the response goes to the first request
+		void handleStatusLine( int major, int minor, int code,
+							   const char *reason, int reasonLen );
+		void handleField( const char *name, int nameLen,
+						  const char *value, int valueLen );
+		void handleHeaderEnd();
+		void handleBody( const char *data, int len );
+		
+		JetHead::Socket			*mSock;
+		JHSTD::string			mHost;
+		int						mPort;
+		State					mState;
+		
+		//! Addresses still to try connecting to
+		JetHead::vector<JetHead::Socket::Address>	mAddrs;
+		
+		//! May hold the start of the next response as well as this one
+		JetHead::CircularBuffer	mBuffer;
+		
+		//! Written to the connection, the first is the one being read
+		JetHead::list<Request*>	mRequests;
+		
+		//! Has this connection finished a response before?
+		bool					mReused;
+		
+		//! Did that response allow more than one request at once?
+		bool					mPipelining;
+		bool					mKeepAlive;
+		uint64_t				mIdleSince;
+		
+		//! Parses the response to the first request
+		HttpParser				mParser;
+	};
+	
+	//! Size of each connection's read buffer
+	static const int kBufferSize = 16 * 1024;
+	
+	//! Run on the selector, start or queue req
+	void start( Request *req );
+	
+	//! Run on the selector for cancel
+	void doCancel( int id );
+	
+	//! Run on the selector by the destructor
+	void shutdown();
+	
+	//! Give req a connection if one is free, otherwise leave it queued
+	bool assign( Request *req );
+	
+	//! Find a busy connection req can be pipelined on
+	Connection *findPipeline( Request *req );
+	
+	//! Start any queued requests for host:port that can now go
+	void startQueued( const JHSTD::string &host, int port );
+	
+	//! Connect conn to its next address
+	void connectNext( Connection *conn );
+	
+	//! Add req to conn's requests and write it
+	void sendRequest( Connection *conn, Request *req );
+	
+	//! Start reading the response to conn's first request
+	void startResponse( Connection *conn );
+	
+	//! Parse whatever is in conn's buffer
+	void process( Connection *conn );
+	
+	//! conn's request is done, hand it back and free or close conn
+	void finish( Connection *conn, JetHead::ErrCode err );
+	
+	//! Something went wrong with conn, fail or retry its request
+	void fail( Connection *conn, JetHead::ErrCode err );
+	
+	//! Queue conn's requests again, ahead of the rest, and close it
+	void requeue( Connection *conn );
+	
+	/**
+	 * Take req off conn.  Anything sent behind it is queued again since the
+	 *  responses can't be matched up once one is missing.
+	 */
+	void abandon( Connection *conn, Request *req );
+	
+	//! Send req's result to its dispatcher
+	void complete( Request *req, JetHead::ErrCode err );
+	
+	//! Run on a request's dispatcher
+	void deliver( Request *req );
+	
+	//! A request's deadline has passed
+	void handleTimeout( int id );
+	
+	//! Take req's deadline off the timer
+	void releaseTimer( Request *req );
+	
+	//! Free req without telling anyone
+	void destroy( Request *req );
+	
+	//! Close conn and forget it
+	void closeConnection( Connection *conn );
+	
+	Connection *findConnection( JetHead::Socket *sock );
+	
+	//! Close idle connections older than mIdleTimeout
+	void expireIdle();
+	
+	Selector				*mSelector;
+	volatile int					mNextId;
+	int								mMaxPerHost;
+	uint32_t						mIdleTimeout;
+	int								mPipelineDepth;
+	bool							mAcceptEncoding;
+	
+	JetHead::vector<Connection*>	mConnections;
+	
+	//! Waiting for a connection, oldest first
+	JetHead::list<Request*>			mQueued;
+	
+	//! Protects mDelivering
+	Mutex							mLock;
+	
+	//! Sent to their dispatchers but not yet delivered
+	JetHead::list<Request*>			mDelivering;
+};
+
+#endif // ASYNCHTTPAGENT_H_
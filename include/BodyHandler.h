@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef JH_BODYHANDLER_H_
+#define JH_BODYHANDLER_H_
+
+#include "Socket.h"
+#include "File.h"
+#include "IReaderWriter.h"
+#include "jh_string.h"
+
+#include <sys/uio.h>
+
+/**
+ * Takes the pieces of a message body as they arrive.  Handlers can be
+ *  chained, a stage that transforms the body (e.g. ChunkedDecoder) is a
+ *  BodyHandler that passes what it makes on to the next one.
+ */
+class BodyHandler
+{
+public:
+	BodyHandler() : mStop( false ) {} 
+	virtual ~BodyHandler() {}
+	virtual void handleData( const char *buf, int len ) = 0;
+	virtual int handleSocket( JetHead::Socket &sock, int len ) = 0;
+	virtual void setStop( bool stop ) { mStop = stop; }
+	
+	/**
+	 * Take several pieces at once.  By default each is passed to 
+	 *  handleData in turn, handlers that can take them together (e.g. 
+	 *  with one writev) should.
+	 */
+	virtual void handleDatav( const struct iovec *iov, int count )
+	{
+		for ( int i = 0; i < count; i++ )
+		{
+			if ( iov[ i ].iov_len > 0 )
+				handleData( (const char*)iov[ i ].iov_base, 
+							iov[ i ].iov_len );
+		}
+	}
+	
+protected:
+	// Derived classes may implement handleData and/or handleSocket
+	// to prematurely terminate handling of data.
+	bool mStop;
+};
+
+class FileBodyHandler : public BodyHandler
+{
+public:
+	FileBodyHandler( JetHead::File &f ) : mFile( f ) {}
+	virtual ~FileBodyHandler() {}
+	
+	void handleData( const char *buf, int len )
+	{
+		mFile.write( buf, len );
+	}
+	
+	//! Moves the body straight from the socket to the file with spliceTo
+	int handleSocket( JetHead::Socket &sock, int len )
+	{
+		return (int)sock.spliceTo( mFile, len );
+	}
+	
+private:
+	JetHead::File &mFile;
+};
+
+//! Appends the body to a string
+class AppendBodyHandler : public BodyHandler
+{
+public:
+	AppendBodyHandler( JHSTD::string &str ) : mString( str ) {}
+	virtual ~AppendBodyHandler() {}
+	
+	void handleData( const char *buf, int len ) { mString.append( buf, len ); }
+	
+	//! Reads up to len bytes from sock onto the string
+	int handleSocket( JetHead::Socket &sock, int len );
+	
+private:
+	JHSTD::string	&mString;
+};
+
+/**
+ * Writes the body to anything that can be written to, usually the end of
+ *  a chain that is sending a body (e.g. a ChunkedEncoder writing to a 
+ *  Socket).  Stops at the first write error, see hasFailed.
+ */
+class WriterBodyHandler : public BodyHandler
+{
+public:
+	WriterBodyHandler( JetHead::IReaderWriter &writer ) 
+		: mWriter( writer ), mFailed( false ) {}
+	virtual ~WriterBodyHandler() {}
+	
+	void handleData( const char *buf, int len );
+	
+	//! Writes all the pieces, with one writev unless it comes up short
+	void handleDatav( const struct iovec *iov, int count );
+	
+	//! Copies up to len bytes from sock to the writer
+	int handleSocket( JetHead::Socket &sock, int len );
+	
+	//! Has a write failed?
+	bool hasFailed() const { return mFailed; }
+	
+private:
+	JetHead::IReaderWriter	&mWriter;
+	bool					mFailed;
+};
+
+#endif // JH_BODYHANDLER_H_
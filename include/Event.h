@@ -50,7 +50,8 @@ public:
 	typedef int Id;
 	
 	Event( Id event_id, int priority = PRIORITY_NORMAL ) : 
-		mEventId( event_id ), mPriority( priority ) {}
+		mEventId( event_id ), mPriority( priority ), mEnqueueTime( 0 ),
+		mTraceFlow( 0 ) {}
 	virtual ~Event() {}
 	
 	static const Id kInvalidEventId = -1;
@@ -67,9 +68,23 @@ public:
 		mPriority = priority;
 	}
 	
+	/**
+	 * Monotonic time in micro seconds (see TimeUtils::getMonotonicMicros) 
+	 *  of when this event was last put on an EventQueue, 0 if it never was.
+	 */
+	uint64_t getEnqueueTime() { return mEnqueueTime; }
+	
+	/**
+	 * The TraceRecorder flow started when this event was last queued, 0 if
+	 *  it was queued while the TraceRecorder was stopped.
+	 */
+	uint32_t getTraceFlow() { return mTraceFlow; }
+	
 private:
 	Id		mEventId;
 	int 	mPriority;
+	uint64_t mEnqueueTime;
+	uint32_t mTraceFlow;
 	
 	friend class EventQueue;
 };
@@ -30,6 +30,8 @@
 
 #include "Event.h"
 
+#include <string.h>
+
 /**
  *	@brief EventAgent class
  *
@@ -65,9 +67,31 @@ public:
 	 *  that will handle this delivery.
 	 */
 	virtual void* getDeliveryTarget() = 0;
+
+	/**
+	 *  @brief What method is this going to?
+	 *
+	 *  Used to identify the handler when reporting on slow events, returns
+	 *  the address of the method deliver() will call or NULL if unknown.
+	 */
+	virtual const void* getDeliveryMethod() { return NULL; }
  protected:
 	virtual ~EventAgent() {}
 
+	/**
+	 *  Get an address for a pointer to member function suitable for
+	 *  printing.  With the Itanium C++ ABI used by gcc the first word of a
+	 *  pointer to member function is the function address for non-virtual
+	 *  methods, or 1 plus the vtable offset for virtual ones.
+	 */
+	template<typename MethodType>
+	static const void* getMethodAddress(MethodType method)
+	{
+		const void *addr = NULL;
+		memcpy(&addr, &method, sizeof(addr));
+		return addr;
+	}
+
 };
 
 
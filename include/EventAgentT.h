@@ -58,6 +58,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -96,6 +101,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -137,6 +147,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -181,6 +196,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -231,6 +251,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -289,6 +314,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	ParamType1		mParam1;
@@ -348,6 +378,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -414,6 +449,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -483,6 +523,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -559,6 +604,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -638,6 +688,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -680,6 +735,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -715,6 +775,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -753,6 +818,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	ParamType1		mParam1;
@@ -795,6 +865,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	ParamType1		mParam1;
@@ -838,6 +913,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -888,6 +968,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -941,6 +1026,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	ParamType1		mParam1;
@@ -997,6 +1087,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -1057,6 +1152,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	ParamType1		mParam1;
@@ -1121,6 +1221,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -1189,6 +1294,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	ParamType1		mParam1;
@@ -1238,6 +1348,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	StoreType1		mParam1;
@@ -1281,6 +1396,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	StoreType1		mParam1;
@@ -1330,6 +1450,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	StoreType1		mParam1;
@@ -1383,6 +1508,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	StoreType1		mParam1;
@@ -1442,6 +1572,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -1507,6 +1642,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -1579,6 +1719,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -1655,6 +1800,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -1739,6 +1889,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -1826,6 +1981,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -1870,6 +2030,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
  protected:
@@ -1906,6 +2071,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	ParamType1		mParam1;
@@ -1944,6 +2114,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	ParamType1		mParam1;
@@ -1987,6 +2162,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	ParamType1		mParam1;
@@ -2032,6 +2212,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	ParamType1		mParam1;
@@ -2083,6 +2268,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	ParamType1		mParam1;
@@ -2136,6 +2326,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	ParamType1		mParam1;
@@ -2194,6 +2389,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	ParamType1		mParam1;
@@ -2254,6 +2454,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	ParamType1		mParam1;
@@ -2318,6 +2523,11 @@ public:
 	{
 		return (void*)mObject;
 	}
+
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
 	
 	ClassType		*mObject;
 	event_method_t	mMethod;
@@ -2387,6 +2597,11 @@ public:
 		return (void*)mObject;
 	}
 
+	const void* getDeliveryMethod()
+	{
+		return EventAgent::getMethodAddress(mMethod);
+	}
+
 	ClassType		*mObject;
 	event_method_t	mMethod;
 	ParamType1		mParam1;
@@ -61,11 +61,63 @@ private:
 	JetHead::list<EventListenerNode*> mEventList;
 };
 
+/**
+ * Describes a handler that ran longer than its dispatcher's stall threshold.
+ *  Times are in micro seconds.
+ */
+struct StallReport
+{
+	//! Name of the dispatcher (normally its thread name)
+	const char	*mDispatcher;
+
+	//! The event's id, kInvalidEventId for Selector file events
+	Event::Id	mEventId;
+
+	/**
+	 * The object that handled the event.  For EventAgents this is the 
+	 *  delivery target, for file events the SelectorListener and NULL for
+	 *  other events.
+	 */
+	void		*mTarget;
+
+	//! For EventAgents the address of the method called, otherwise NULL
+	const void	*mMethod;
+
+	//! The fd for Selector file events, otherwise -1
+	int			mFd;
+
+	/**
+	 * How long the event waited before its handler started.  For events this
+	 *  is the time since it was queued, for file events the time since poll
+	 *  returned.
+	 */
+	uint64_t	mQueueWait;
+
+	//! How long the handler ran
+	uint64_t	mRunTime;
+};
+
+/**
+ * Implemented by anyone that wants to be told about stalled handlers rather
+ *  than having them logged.  Called on the stalled dispatcher's thread.
+ */
+class StallListener
+{
+public:
+	virtual void handleStall( const StallReport &report ) = 0;
+
+protected:
+	virtual ~StallListener() {}  // just for compile warning
+};
+
 class EventDispatcher : public IEventDispatcher
 {
 public:
 	EventDispatcher();
 	virtual ~EventDispatcher();
+
+	//! Default stall threshold in milliseconds
+	static const uint32_t kDefaultStallThreshold = 100;
 	
 	/**
 	 * Send a event to the queue.
@@ -128,6 +180,18 @@ public:
 	 */
 	int removeEventListener( IEventListener *listener, int event_id );
 
+	/**
+	 * Any handler that runs longer than msecs will generate a StallReport.
+	 *  Zero disables stall reports for this dispatcher.
+	 */
+	void setStallThreshold( uint32_t msecs ) { mStallThreshold = msecs * 1000; }
+	
+	/**
+	 * Set the listener told about stalls in every dispatcher.  If NULL, the
+	 *  default, stalls are logged as warnings.
+	 */
+	static void setStallListener( StallListener *listener );
+
 protected:
 	struct SyncEventHolder : public Event
 	{
@@ -152,16 +216,57 @@ protected:
 	 */
 	virtual const Thread *getDispatcherThread() { return NULL; }
 	
+	/**
+	 * Publish metrics for this dispatcher and its queue to the 
+	 *  MetricsRegistry labeled with name.  Normally called by a derived class
+	 *  with the name of its thread.
+	 */
+	void setMetricsName( const char *name );
+	
 	bool handleEvent( Event *ev );
 
+	/**
+	 * Check a handler's run time against the stall threshold and report it
+	 *  if it's over.  mDispatcher is filled in for the caller.
+	 */
+	void checkStall( StallReport &report )
+	{
+		if ( mStallThreshold != 0 and report.mRunTime >= mStallThreshold )
+			reportStall( report );
+	}
+	
+	//! Name given to setMetricsName, empty if it was never called.
+	const char *getMetricsName() { return mMetricsName.c_str(); }
+
 	EventQueue mQueue;
 	
 private:	
 	void handleSyncEvent( Event *ev );
+
+	void reportStall( StallReport &report );
 	
 	EventDispatcherHelper mDispatcher;
 	Condition mSyncWait;
 	Mutex mSyncLock;
+	
+	JHSTD::string mMetricsName;
+	
+	//! Number of events handled, NULL until setMetricsName is called
+	SmartPtr<Counter> mEventsDispatched;
+
+	//! Micro seconds events waited in the queue, NULL until setMetricsName
+	SmartPtr<Histogram> mQueueWait;
+
+	//! Micro seconds handlers ran for, NULL until setMetricsName
+	SmartPtr<Histogram> mRunTime;
+
+	//! Number of stall reports, NULL until setMetricsName
+	SmartPtr<Counter> mStalls;
+	
+	//! Stall threshold in micro seconds, 0 if disabled
+	uint64_t mStallThreshold;
+
+	static StallListener *sStallListener;
 };
 
 #endif // _JH_EVENTDISPATCHER_H_
@@ -33,6 +33,7 @@
 #include "Mutex.h"
 #include "Event.h"
 #include "jh_list.h"
+#include "Metrics.h"
 
 /**
  * A Class for queuing events.  This is used internally by EventDispatcher.  
@@ -87,12 +88,26 @@ public:
 	 */
 	void Flush();
 	
+	/**
+	 * Publish the depth of this queue to the MetricsRegistry as 
+	 *  jh_eventqueue_depth{queue="name"}.
+	 */
+	void setMetricsName( const char *name );
+	
 private:
 	Event *pollEventInternal();
 	
+	//! Track a change in the number of queued events, must hold mLock
+	void updateDepth( int delta )
+	{
+		if ( mDepth != NULL )
+			mDepth->add( delta );
+	}
+	
 	JetHead::list<Event*> mQueue;
 	Mutex		mLock;
 	Condition	mWait;
+	SmartPtr<Gauge>	mDepth;
 };
 
 
@@ -29,6 +29,92 @@
 #define FIELDMAP_H_
 
 #include "jh_list.h"
+#include "jh_types.h"
+
+/**
+ *	@brief Case-insensitive hash table from field names to field types
+ *
+ *	Used to look up a field name in one probe instead of comparing it
+ *	against every name a FieldMap knows.  The table is sized so that
+ *	the hash seed can be chosen to give every name its own slot, making
+ *	the hash perfect for that set of names.  Passing the seed that does
+ *	this for a fixed list of names saves searching for it.  If no such
+ *	seed is found the table still works, with linear probing.
+ *
+ *	Tables are immutable once built, so they can be shared between
+ *	threads without locking.
+ */
+class FieldTable
+{
+public:
+	/**
+	 *	Build a table of count names, the i'th having the type first + i.
+	 *	The names must outlive the table.
+	 */
+	FieldTable( const char *const *names, int count, int first, 
+				uint32_t seed = 0 );
+	
+	~FieldTable();
+	
+	//! Look up len bytes of name, ignoring case. -1 if it isn't here.
+	int find( const char *name, int len ) const;
+	
+	/**
+	 *	Get a table with all of this table's names, then any of extra's
+	 *	that this one doesn't have.  Each pair is only merged once, the
+	 *	result is kept as long as this table and returned again after.
+	 */
+	const FieldTable *merge( const FieldTable *extra ) const;
+	
+	//! Does every name have a slot of its own?
+	bool isPerfect() const { return mPerfect; }
+	
+	//! The hash used, also exposed so seeds can be chosen offline
+	static uint32_t hash( const char *name, int len, uint32_t seed );
+	
+private:
+	struct Entry
+	{
+		const char	*mName;
+		int			mLen;
+		int			mType;
+		uint32_t	mHash;
+	};
+	
+	//! A table merged from this one and mExtra
+	struct Merged
+	{
+		const FieldTable	*mExtra;
+		FieldTable			*mTable;
+		Merged				*mNext;
+	};
+	
+	FieldTable( const FieldTable &base, const FieldTable &extra );
+	
+	//! Place mNames into mSlots, looking for a perfect seed from seed on
+	void build( uint32_t seed );
+	
+	//! Place everything with seed, returning true if nothing collided
+	bool place( uint32_t seed );
+	
+	//! Seeds tried when looking for a perfect one
+	static const int kMaxSeedTries = 1024;
+	
+	//! Every name in the table, in order of precedence
+	Entry			*mNames;
+	int				mCount;
+	
+	Entry			*mSlots;
+	uint32_t		mMask;
+	uint32_t		mSeed;
+	bool			mPerfect;
+	
+	mutable Merged * volatile	mMerged;
+	
+	// Not copyable
+	FieldTable( const FieldTable & );
+	FieldTable &operator=( const FieldTable & );
+};
 
 /**
  *	@brief Field mapping base interface
@@ -81,6 +167,14 @@ public:
 
 	virtual FieldType getFieldType(const char *field) const = 0;
 	virtual const char *getFieldTypeString(FieldType type) const = 0;
+	
+	/**
+	 *	Get a table of every field this map knows, if it has one.  When all
+	 *	of a header's maps have tables, fields are looked up in a table
+	 *	merged from them instead of asking each map's getFieldType in turn.
+	 *	The table must live as long as the process.
+	 */
+	virtual const FieldTable *getFieldTable() const { return NULL; }
 };
 
 
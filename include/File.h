@@ -204,6 +204,9 @@ namespace JetHead
 		//! used internally to set the error code from errno.
 		void setError() const;
 		
+		// Moves data to and from files by fd (sendFile, spliceTo)
+		friend class Socket;
+		
 		Selector 		*mSelector;
 		FileListener	*mListener;		
 		uint8_t 		*mMapAddress;	
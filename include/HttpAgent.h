@@ -32,75 +32,42 @@
 #include "HttpResponse.h"
 #include "CircularBuffer.h"
 #include "Socket.h"
+#include "HttpConnectionPool.h"
+#include "HttpParser.h"
+#include "BodyHandler.h"
+#include "HttpContentCoding.h"
 #include "jh_string.h"
 
 #define TEST_BUFFER_SIZE 64*1024
 
-class BodyHandler
+/**
+ * A simple synchronous HTTP/1.1 client.  Connections are kept open between 
+ *  requests in an HttpConnectionPool (the shared one unless changed with
+ *  setConnectionPool), a connection goes back to the pool only once its 
+ *  response has been read to the end as framed by Content-Length or chunked
+ *  encoding.
+ */
+class HttpAgent : protected HttpParserListener
 {
 public:
-	BodyHandler() : mStop( false ) {} 
-	virtual ~BodyHandler() {}
-	virtual void handleData( const char *buf, int len ) = 0;
-	virtual int handleSocket( JetHead::Socket &sock, int len ) = 0;
-	virtual void setStop( bool stop ) { mStop = stop; }
+	HttpAgent();
+	~HttpAgent();
 	
-protected:
-	// Derived classes may implement handleData and/or handleSocket
-	// to prematurely terminate handling of data.
-	bool mStop;
-};
-
-class FileBodyHandler : public BodyHandler
-{
-public:
-	FileBodyHandler( JetHead::File &f ) : mFile( f ) {}
-	virtual ~FileBodyHandler() {}
-	
-	void handleData( const char *buf, int len )
-	{
-		mFile.write( buf, len );
-	}
-	
-	int handleSocket( JetHead::Socket &sock, int len )
-	{
-		char buf[TEST_BUFFER_SIZE];
-		int total_read = 0;
-		
-		while (len)
-		{
-			int read = 0;
-			int attempt_read = TEST_BUFFER_SIZE;
-
-			if (len < TEST_BUFFER_SIZE)
-				attempt_read = len;
-
-			read = sock.read(buf, attempt_read);
-
-			if (read < 0)
-			{
-				printf("ERROR READING = %d\n", read);
-				break;
-			}
-
-			mFile.write( buf, read );
-
-			len -= read;
-			total_read += read;
-		}
-		
-		return total_read;
-	}
+	/**
+	 * Use pool for connections from now on, NULL to open a new connection
+	 *  for each request and close it afterwards.  The pool must outlive 
+	 *  this agent.
+	 */
+	void setConnectionPool( HttpConnectionPool *pool ) { mPool = pool; }
 	
-private:
-	JetHead::File &mFile;
-};
-
-class HttpAgent
-{
-public:
-	HttpAgent();
-	~HttpAgent() {}
+	/**
+	 * Ask for bodies to be sent gzip or deflate coded (unless a request 
+	 *  has its own Accept-Encoding) and decode them before they reach the
+	 *  BodyHandler.  The response's Content-Encoding and Content-Length are
+	 *  left as they arrived.  Off by default, and does nothing unless 
+	 *  ContentCoding::isSupported.
+	 */
+	void setAcceptEncoding( bool accept ) { mAcceptEncoding = accept; }
 	
 	int get( const URI &uri, HttpResponse &res, BodyHandler *handler = NULL );
 	int get( HttpRequest &req, HttpResponse &res, BodyHandler *handler = NULL );
@@ -111,9 +78,54 @@ public:
 protected:
 	static const int kMaxMessageSize = 2048;
 	
+	//! How long to wait for a connection, in ms
+	static const int kConnectTimeout = 10 * 1000;
+	
+	//! How long to wait for each read of the response, in seconds
+	static const int kReadTimeout = 5;
+	
 private:
+	/**
+	 * Send req and read the response, setting mReusable.  Returns 
+	 *  kConnectionClosed if the connection failed before any of the 
+	 *  response arrived.
+	 */
+	int exchange( HttpRequest &req, HttpResponse &res, 
+				  const JHSTD::string &toSend, BodyHandler *handler );
+	
+	//! Read until parser has the whole response
+	int readResponse( HttpParser &parser );
+	
+	//! For HttpParserListener, the header goes to mResponse and the body 
+	//!  to mHandler
+	void handleStatusLine( int major, int minor, int code,
+						   const char *reason, int reasonLen );
+	void handleField( const char *name, int nameLen,
+					  const char *value, int valueLen );
+	void handleHeaderEnd();
+	void handleBody( const char *data, int len );
+	
+	//! Get mSock from mPool or a new connection
+	int openConnection( const URI &uri, bool &reused );
+	
+	//! Give mSock back to the pool or close it
+	void closeConnection( bool reusable );
+	
 	JetHead::CircularBuffer	mBuffer;
-	JetHead::Socket			mSock;
+	JetHead::Socket			*mSock;
+	HttpConnectionPool		*mPool;
+	
+	//! Can the connection be used again after the current response?
+	bool					mReusable;
+	
+	//! Where the response being read goes
+	HttpResponse			*mResponse;
+	BodyHandler				*mHandler;
+	
+	bool					mAcceptEncoding;
+	
+	//! Put in front of mHandler for a coded body
+	ContentDecoder			mDecoder;
 };
 
 
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef JH_HTTPCHUNKED_H_
+#define JH_HTTPCHUNKED_H_
+
+#include "BodyHandler.h"
+#include "jh_types.h"
+#include "jh_string.h"
+
+/**
+ * @file HttpChunked.h
+ * @brief Streaming chunked transfer coding, as BodyHandler stages.
+ *
+ * ChunkedDecoder takes a chunked body in whatever pieces it arrives in and
+ *  passes the data, without the framing, to the next BodyHandler.  
+ *  ChunkedEncoder does the opposite, framing whatever it's given as chunks
+ *  for the next BodyHandler, so a body can be sent as it is made without
+ *  knowing its length or holding it all.  Either can sit between a Socket 
+ *  and a BodyHandler:
+ *
+ *  @code
+ *  FileBodyHandler file( f );
+ *  ChunkedDecoder decoder( &file );
+ *  while ( not decoder.isDone() and decoder.handleSocket( sock, 64 * 1024 ) > 0 )
+ *		;
+ *
+ *  WriterBodyHandler writer( sock );
+ *  ChunkedEncoder encoder( &writer );
+ *  encoder.handleData( data, len );
+ *  encoder.addTrailer( "Content-MD5", md5 );
+ *  encoder.finish();
+ *  @endcode
+ */
+
+class HttpParserListener;
+
+class ChunkedDecoder : public BodyHandler
+{
+public:
+	enum State
+	{
+		kSize,
+		kData,
+		kDataEnd,
+		kTrailer,
+		kDone,
+		kError
+	};
+	
+	//! Longest chunk size or trailer line that will be accepted
+	static const int kMaxLineSize = 8 * 1024;
+	
+	//! No limit on the size of a chunk
+	static const int64_t kNoLimit = INT64_MAX;
+	
+	/**
+	 * @param next gets the decoded data, may be NULL to throw it away.
+	 * @param maxChunkSize bigger chunks are an error.
+	 */
+	ChunkedDecoder( BodyHandler *next = NULL, int64_t maxChunkSize = kNoLimit );
+	virtual ~ChunkedDecoder();
+	
+	//! Get ready for the next body
+	void reset();
+	
+	/**
+	 * Decode the next len bytes of the body.  Stops at the end of the body,
+	 *  so anything after it is not used.
+	 *
+	 * @return the number of bytes used, or -1 if the body is malformed in
+	 *  which case nothing more will be decoded until reset.
+	 */
+	int decode( const char *data, int len );
+	
+	/**
+	 * Tell us len bytes of chunk data were used by someone else, e.g. they
+	 *  read them straight from the socket.  Only valid in kData and for up
+	 *  to getRemaining bytes.
+	 */
+	void skip( int64_t len );
+	
+	State getState() const { return mState; }
+	bool isDone() const { return mState == kDone; }
+	
+	//! Bytes left in the current chunk
+	int64_t getRemaining() const { return mRemaining; }
+	
+	void setNext( BodyHandler *next ) { mNext = next; }
+	void setMaxChunkSize( int64_t size ) { mMaxChunkSize = size; }
+	
+	//! Trailer fields go to listener's handleTrailer
+	void setTrailerListener( HttpParserListener *listener )
+	{
+		mTrailerListener = listener;
+	}
+	
+	//! As decode, anything after the end of the body is dropped
+	void handleData( const char *buf, int len );
+	
+	/**
+	 * Read up to len bytes of the body from sock.  Chunk data is read by 
+	 *  the next handler's handleSocket so it can avoid a copy.
+	 *
+	 * @return bytes read, 0 at the end of the stream or -1 on an error.
+	 */
+	int handleSocket( JetHead::Socket &sock, int len );
+	
+	void setStop( bool stop );
+	
+private:
+	// Not copyable
+	ChunkedDecoder( const ChunkedDecoder & );
+	ChunkedDecoder &operator=( const ChunkedDecoder & );
+	
+	int parseLine( const char *line, int len );
+	
+	BodyHandler			*mNext;
+	HttpParserListener	*mTrailerListener;
+	int64_t				mMaxChunkSize;
+	State				mState;
+	int64_t				mRemaining;
+	
+	//! A line that hasn't all arrived yet, allocated when first needed
+	char				*mLine;
+	int					mLineLen;
+};
+
+class ChunkedEncoder : public BodyHandler
+{
+public:
+	//! Bigger pieces are split into chunks of this size
+	static const int kDefaultMaxChunkSize = 64 * 1024;
+	
+	//! The longest chunk size line formatSize makes
+	static const int kMaxSizeLine = 24;
+	
+	/**
+	 * @param next gets the encoded body.
+	 * @param maxChunkSize pieces bigger than this are split.
+	 */
+	ChunkedEncoder( BodyHandler *next, int maxChunkSize = kDefaultMaxChunkSize );
+	virtual ~ChunkedEncoder() {}
+	
+	//! Get ready for the next body, dropping any trailers
+	void reset();
+	
+	//! Send buf as one or more chunks, nothing is sent for an empty piece
+	void handleData( const char *buf, int len );
+	
+	//! Send the pieces, a chunk at a time
+	void handleDatav( const struct iovec *iov, int count );
+	
+	//! Read up to len bytes from sock and send them on as chunks
+	int handleSocket( JetHead::Socket &sock, int len );
+	
+	void setStop( bool stop );
+	
+	//! Add a field to send in the trailer, before finish
+	void addTrailer( const char *name, const char *value );
+	
+	//! Send the last chunk and the trailer, ending the body
+	void finish();
+	
+	//! Has finish been called?
+	bool isFinished() const { return mFinished; }
+	
+	/**
+	 * Write the size line for a chunk of len bytes, "<hex>\r\n", to buf
+	 *  which must have room for kMaxSizeLine bytes.
+	 *
+	 * @return the length of the line
+	 */
+	static int formatSize( char *buf, uint64_t len );
+	
+private:
+	BodyHandler		*mNext;
+	int				mMaxChunkSize;
+	bool			mFinished;
+	JHSTD::string	mTrailers;
+};
+
+#endif // JH_HTTPCHUNKED_H_
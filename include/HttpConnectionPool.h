@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef HTTPCONNECTIONPOOL_H_
+#define HTTPCONNECTIONPOOL_H_
+
+#include "Socket.h"
+#include "Mutex.h"
+#include "Condition.h"
+#include "Metrics.h"
+#include "jh_string.h"
+#include "jh_vector.h"
+
+/**
+ * @file HttpConnectionPool.h
+ * @brief Keeps HTTP/1.1 connections open between requests.
+ *
+ * Connections are kept per host:port.  A connection that is handed back
+ *  after a response was read to its end is kept idle for reuse by the next 
+ *  request to the same place, most recently used first.  Idle connections 
+ *  are closed once they have been idle longer than the idle timeout and are
+ *  checked with Socket::isIdleUsable before being handed out again, so one 
+ *  the server has closed in the meantime is never reused.
+ *
+ * No more than the per host limit of connections to one host:port are open
+ *  at once, in use or idle.  Asking for another waits until one is released
+ *  or the connect timeout passes.
+ *
+ * Safe to share between threads, each connection is only ever given to one
+ *  user at a time.
+ */
+class HttpConnectionPool
+{
+public:
+	//! Most connections open to one host:port at once
+	static const int kDefaultMaxPerHost = 4;
+	
+	//! How long a connection is kept idle, in ms
+	static const uint32_t kDefaultIdleTimeout = 30 * 1000;
+	
+	//! The pool HttpAgents use unless told otherwise
+	static HttpConnectionPool *getInstance();
+	
+	HttpConnectionPool( int maxPerHost = kDefaultMaxPerHost, 
+						uint32_t idleTimeoutMs = kDefaultIdleTimeout );
+	
+	//! Closes every idle connection, none may still be in use
+	~HttpConnectionPool();
+	
+	/**
+	 * Get a connection to host:port, either an idle one or a newly 
+	 *  connected one.  Waits up to timeoutMs for the connect, or for another
+	 *  user to release one if the host is at its limit.
+	 *
+	 * @param reused set to true if the connection has been used before,
+	 *  such a connection may still have been closed by the server just as it
+	 *  was handed out.
+	 * @return the connection, to be handed back with release, or NULL with
+	 *  errno set if no connection could be had.
+	 */
+	JetHead::Socket *acquire( const char *host, int port, int timeoutMs,
+							  bool &reused );
+	
+	/**
+	 * Hand back a connection from acquire.  If reusable is true it is kept 
+	 *  for the next request, so it must be at the end of a response with 
+	 *  nothing more to come.  Otherwise it is closed.
+	 */
+	void release( JetHead::Socket *sock, bool reusable );
+	
+	//! Change the per host limit, existing connections aren't closed
+	void setMaxPerHost( int maxPerHost );
+	
+	//! Change how long connections are kept idle, 0 to never keep them
+	void setIdleTimeout( uint32_t idleTimeoutMs );
+	
+	//! Close every idle connection
+	void flush();
+	
+	//! Number of idle connections to host:port
+	int getIdleCount( const char *host, int port );
+	
+private:
+	struct Connection
+	{
+		JetHead::Socket	*mSock;
+		uint64_t		mIdleSince;
+	};
+	
+	struct Host
+	{
+		JHSTD::string					mName;
+		int								mPort;
+		
+		//! Connections handed out by acquire and not released
+		JetHead::vector<JetHead::Socket*>	mInUse;
+		
+		//! Most recently released last
+		JetHead::vector<Connection>		mIdle;
+	};
+	
+	//! Find host:port, adding it if create is set, must hold mLock
+	Host *findHost( const char *name, int port, bool create );
+	
+	//! Take out idle connections older than mIdleTimeout, must hold mLock
+	void expireIdle( JetHead::vector<JetHead::Socket*> &closing );
+	
+	Mutex							mLock;
+	
+	//! A slot freed up.  Waiters may be after any host, so always broadcast
+	Condition						mReleased;
+	
+	JetHead::vector<Host*>			mHosts;
+	int								mMaxPerHost;
+	uint32_t						mIdleTimeout;
+	
+	SmartPtr<Counter>				mConnects;
+	SmartPtr<Counter>				mReuses;
+	
+	static HttpConnectionPool		*mSingleton;
+};
+
+#endif // HTTPCONNECTIONPOOL_H_
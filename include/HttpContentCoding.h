@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef JH_HTTPCONTENTCODING_H_
+#define JH_HTTPCONTENTCODING_H_
+
+#include "BodyHandler.h"
+#include "jh_types.h"
+
+/**
+ * @file HttpContentCoding.h
+ * @brief Streaming gzip and deflate content-coding, as BodyHandler stages.
+ *
+ * ContentDecoder inflates a body as it arrives and passes the result on to 
+ *  the next BodyHandler, ContentEncoder does the opposite.  Both work on 
+ *  whatever pieces they are given and hold no more than zlib's state and 
+ *  one kBufferSize output buffer, so bodies are never held whole.
+ *
+ * The coding is done by zlib, which is only used when built with JH_ZLIB.
+ *  Without it only identity is supported: ContentCoding::choose never picks
+ *  anything else and the stages fail if asked to.
+ */
+
+struct z_stream_s;
+
+class ContentCoding
+{
+public:
+	enum Coding
+	{
+		kIdentity,
+		kGzip,
+		kDeflate,
+		kUnknown
+	};
+	
+	//! Were we built with zlib?
+	static bool isSupported();
+	
+	//! The coding named by a Content-Encoding value, kIdentity for NULL
+	static Coding parse( const char *value );
+	
+	//! The name of a coding for Content-Encoding
+	static const char *getName( Coding coding );
+	
+	/**
+	 * Pick the coding to send a response in from the request's 
+	 *  Accept-Encoding value (may be NULL).  gzip is preferred over deflate
+	 *  at equal q-values, codings with q=0 are never picked.
+	 */
+	static Coding choose( const char *acceptEncoding );
+	
+	//! What to ask for in Accept-Encoding, NULL if nothing but identity
+	static const char *getAcceptEncoding();
+};
+
+class ContentDecoder : public BodyHandler
+{
+public:
+	//! Size of the buffer output is made in
+	static const int kBufferSize = 16 * 1024;
+	
+	//! No limit on the decoded size
+	static const int64_t kNoLimit = INT64_MAX;
+	
+	/**
+	 * @param next gets the decoded body, may be NULL to throw it away.
+	 * @param coding how the body is coded.
+	 */
+	ContentDecoder( BodyHandler *next = NULL, 
+					ContentCoding::Coding coding = ContentCoding::kIdentity );
+	virtual ~ContentDecoder();
+	
+	//! Get ready for the next body, coded with coding
+	void reset( ContentCoding::Coding coding );
+	
+	/**
+	 * Decode the next len bytes of the body.  A gzip body may be more than
+	 *  one gzip member, anything after the end of a deflate body is dropped.
+	 *
+	 * @return 0, or -1 if the body is malformed, too big or the coding 
+	 *  isn't supported, after which nothing more is decoded until reset.
+	 */
+	int decode( const char *data, int len );
+	
+	//! The body has all arrived, @return 0 if it was complete and valid
+	int finish();
+	
+	//! A body that decodes to more than size bytes is an error
+	void setMaxSize( int64_t size ) { mMaxSize = size; }
+	
+	//! Bytes passed on to next so far
+	int64_t getDecodedSize() const { return mDecodedSize; }
+	
+	bool hasFailed() const { return mFailed; }
+	
+	void setNext( BodyHandler *next ) { mNext = next; }
+	
+	//! As decode, see hasFailed for errors
+	void handleData( const char *buf, int len );
+	
+	//! Read up to len bytes from sock and decode them
+	int handleSocket( JetHead::Socket &sock, int len );
+	
+	void setStop( bool stop );
+	
+private:
+	// Not copyable
+	ContentDecoder( const ContentDecoder & );
+	ContentDecoder &operator=( const ContentDecoder & );
+	
+	//! Start zlib for mCoding, -1 if it can't be
+	int start( bool raw );
+	void end();
+	
+	//! Pass len decoded bytes on, -1 if that goes over the limit
+	int output( const char *data, int len );
+	
+	BodyHandler				*mNext;
+	ContentCoding::Coding	mCoding;
+	struct z_stream_s		*mStream;
+	char					*mBuffer;
+	int64_t					mMaxSize;
+	int64_t					mDecodedSize;
+	
+	//! Has any input been seen, deflate is only started once it has
+	bool					mStarted;
+	bool					mDone;
+	bool					mFailed;
+};
+
+class ContentEncoder : public BodyHandler
+{
+public:
+	//! Size of the buffer output is made in
+	static const int kBufferSize = 16 * 1024;
+	
+	//! zlib's default level, 6
+	static const int kDefaultLevel = -1;
+	
+	/**
+	 * zlib's default memory level.  Each step down halves the memory used
+	 *  for matching (128K at 8) at some cost in compression.  The window
+	 *  takes another 128K.
+	 */
+	static const int kDefaultMemLevel = 8;
+	
+	/**
+	 * @param next gets the coded body.
+	 * @param coding how to code it, kIdentity passes it on as is.
+	 * @param level 1 (fastest) to 9 (smallest), or kDefaultLevel.
+	 * @param memLevel 1 to 9, see kDefaultMemLevel.
+	 */
+	ContentEncoder( BodyHandler *next, ContentCoding::Coding coding,
+					int level = kDefaultLevel, 
+					int memLevel = kDefaultMemLevel );
+	virtual ~ContentEncoder();
+	
+	//! Get ready for the next body, coded with coding
+	void reset( ContentCoding::Coding coding );
+	
+	//! Code the next piece of the body, output comes as buffers fill
+	void handleData( const char *buf, int len );
+	
+	//! Read up to len bytes from sock and code them
+	int handleSocket( JetHead::Socket &sock, int len );
+	
+	void setStop( bool stop );
+	
+	/**
+	 * Pass on everything coded so far, for a body sent as it's made with 
+	 *  gaps between the pieces.  Costs a little compression each time.
+	 */
+	void flush();
+	
+	//! End the body, passing on the rest of it
+	void finish();
+	
+	//! Has the coding failed (or was it unsupported)?
+	bool hasFailed() const { return mFailed; }
+	
+private:
+	// Not copyable
+	ContentEncoder( const ContentEncoder & );
+	ContentEncoder &operator=( const ContentEncoder & );
+	
+	//! Run deflate over the input with flush, passing on the output
+	void run( int flush );
+	void end();
+	
+	BodyHandler				*mNext;
+	ContentCoding::Coding	mCoding;
+	int						mLevel;
+	int						mMemLevel;
+	struct z_stream_s		*mStream;
+	char					*mBuffer;
+	bool					mFinished;
+	bool					mFailed;
+};
+
+#endif // JH_HTTPCONTENTCODING_H_
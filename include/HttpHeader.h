@@ -85,6 +85,7 @@ public:
 		kFieldReferer,
 		kFieldRetryAfter,
 		kFieldServer,
+		kFieldSetCookie,
 		kFieldTE,
 		kFieldTrailer,
 		kFieldTransferEncoding,
@@ -112,6 +113,14 @@ private:
 
 	//! Return the header string given the field ID
 	const char *getFieldTypeString(FieldType fieldType) const;
+	
+	//! Return the table of all HTTP 1.1 fields, built on first use
+	const FieldTable *getFieldTable() const;
+	
+	//! Seed that gives the HTTP 1.1 field names a perfect hash
+	static const uint32_t kSeed = 157;
+	
+	static FieldTable * volatile sTable;
 };
 
 
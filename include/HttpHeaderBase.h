@@ -41,6 +41,7 @@
 #include "IReaderWriter.h"
 #include "CircularBuffer.h"
 #include "FieldMap.h"
+#include "HttpParser.h"
 #include "Socket.h"
 
 /**
@@ -56,10 +57,13 @@
  *	will parse and generate fields appropriately.  This can be further
  *	extended in derived classes, adding additional FieldMaps.
  *
+ *	A header can also be filled in by passing it to an HttpParser as its
+ *	listener, which is much cheaper than parseFirstLine and parseLine.
+ *
  *	@see FieldMap
  *	@see HttpFieldMap
  */
-class HttpHeaderBase
+class HttpHeaderBase : public HttpParserListener
 {
 public:
 	//! Allocate a new header 
@@ -83,8 +87,9 @@ public:
 	 *	The HttpHeaderBase will generate an HTTP-style header from the
 	 *	list of fields the user has specified (parsed) and write the
 	 *	header to the IReaderWriter specified, along with the specified data
-	 *  
-	 *  @note This requires making a copy of the supplied data!
+	 *	using one IReaderWriter::writev.  Neither is copied.
+	 *
+	 *	@return the header length plus len, or < 0 if the write failed
 	 */
 	int send( JetHead::IReaderWriter *writer, const uint8_t* data, int len ) const;
 
@@ -103,12 +108,24 @@ public:
 	 *	@brief Retrieve string value of a field
 	 *
 	 *	This method retrives the string value associated with the
-	 *	field specified.
+	 *	field specified.  If the field appears more than once the first
+	 *	is returned.  The string is only valid until the header is next
+	 *	changed.
 	 *
 	 *	@return		Errors:			NULL
 	 */
 	const char *getField( FieldMap::FieldType type ) const;
 	
+	/**
+	 *	@brief Retrieve string value of a repeated field
+	 *
+	 *	For fields like Set-Cookie that can appear many times, get the
+	 *	n'th (from 0) value of the field.
+	 *
+	 *	@return		Errors:			NULL if there are no more
+	 */
+	const char *getField( FieldMap::FieldType type, int n ) const;
+	
 	/**
 	 *	@brief Retrieve int value of a field
 	 *
@@ -133,6 +150,16 @@ public:
 	JetHead::ErrCode getFieldInt64( FieldMap::FieldType type,
 									int64_t &value ) const;
 	
+	/**
+	 *	@brief Check for a token in a list valued field
+	 *
+	 *	For fields like Connection and Transfer-Encoding that hold a comma
+	 *	separated list of tokens.
+	 *
+	 *	@return	true if token is one of the field's tokens, ignoring case
+	 */
+	bool hasFieldToken( FieldMap::FieldType type, const char *token ) const;
+	
 	/** 
 	 *  @brief Remove a field from a fieldmap
 	 *
@@ -150,7 +177,7 @@ public:
 	 *	Given the field ID and some data to set as the value of that
 	 *	header, add a new header field.
 	 *
-	 *	@return	true if successful, false if too many fields
+	 *	@return	true, there is no limit on the number of fields
 	 */	
 	bool addField( FieldMap::FieldType type, const char *data );
 
@@ -160,7 +187,7 @@ public:
 	 *	Given the field ID and an int value for that field, add a new
 	 *	header field.
 	 *
-	 *	@return	true if successful, false if too many fields
+	 *	@return	true, there is no limit on the number of fields
 	 */	
 	bool addFieldDecimal( FieldMap::FieldType type, int32_t data );
 
@@ -170,7 +197,7 @@ public:
 	 *	Given the field ID and an int64 value for that field, add a new
 	 *	header field.
 	 *
-	 *	@return	true if successful, false if too many fields
+	 *	@return	true, there is no limit on the number of fields
 	 */	
 	bool addFieldDecimal64(FieldMap::FieldType type, int64_t data);
 
@@ -180,7 +207,7 @@ public:
 	 *	Given the field ID and an int value for that field, add a new
 	 *	header field in hex
 	 *
-	 *	@return	true if successful, false if too many fields
+	 *	@return	true, there is no limit on the number of fields
 	 */	
 	bool addFieldHex( FieldMap::FieldType type, uint32_t data );
 	
@@ -220,6 +247,14 @@ public:
 	 */
 	virtual int parseLine( const JetHead::CircularBuffer &buf );
 	
+	/**
+	 *	@brief Add a field found by an HttpParser
+	 *
+	 *	As parseLine, fields not in any of the FieldMaps are dropped.
+	 */
+	virtual void handleField( const char *name, int nameLen,
+							  const char *value, int valueLen );
+	
 	/**
 	 * the return value for the end of header condition returned
 	 * by the searchForLine method
@@ -287,31 +322,37 @@ private:
 
 	/**
 	 * Structure to store mappings of FieldMap::FieldType to string
-	 * data values
+	 * data values, which are kept '\0' terminated in mArena
 	 */
 	struct HeaderField 
 	{	
-		//! Default constructor, doesn't have to do much
-		HeaderField() : mType(0), mData( NULL ) {}
-
-		//! Free up the space we've allocated
-		~HeaderField() { delete [] mData; }
-		
-		//! Set the data for this field
-		void setData( const char *data );
-
-		//! Set the field type for this field 
-		void setType( FieldMap::FieldType field ) { mType = field; }
-		
 		//! The field type
 		FieldMap::FieldType mType;
 
-		//! The value for this field
-		char *mData;
+		//! Where the value starts in mArena
+		int mOffset;
+		
+		//! Length of the value, not counting the '\0'
+		int mLen;
 	};
 	
+	//! Add a field whose value is len bytes of data
+	void appendField( FieldMap::FieldType type, const char *data, int len );
+	
+	//! Add len bytes of data to the last field, after a space
+	void extendLastField( const char *data, int len );
+	
+	//! Make sure there is room for len more bytes at the end of mArena
+	void reserveArena( int len );
+	
+	//! Move the fields together, leaving out the values of removed ones
+	void compactArena();
+	
 	//! Look up a field ID by name
 	FieldMap::FieldType getFieldType(const char *field) const;
+	
+	//! Look up a field ID by the first len bytes of name
+	FieldMap::FieldType getFieldType(const char *name, int len) const;
 
 	//! Look up a field string by ID
 	const char *getFieldTypeString(FieldMap::FieldType type) const;
@@ -322,17 +363,37 @@ private:
 	//! The initial reserved size for the message
 	static const int kDefaultMessageSize = 2048;
 	
-	//! The maximum number of fields in this header
-	static const int kMaxFields = 32;
+	//! The initial size of mArena
+	static const int kDefaultArenaSize = 512;
 	
-	//! The fields
-	HeaderField	mFields[ kMaxFields ];
-
-	//! How many fields have we used
-	int 		mNumFields;
+	//! The fields, in the order they were added
+	JetHead::vector<HeaderField> mFields;
+	
+	//! Every field's value, one after the other
+	char		*mArena;
+	
+	//! How much of mArena is used, and how big it is
+	int			mArenaLen;
+	int			mArenaSize;
+	
+	//! How much of mArena is values of fields that have been removed
+	int			mArenaFree;
+	
+	//! Was the last field handleField saw kept, for continuation lines?
+	bool		mLastFieldKept;
 
 	//! The mapping from field names to FieldType 
 	JetHead::list<FieldMap*> mFieldMappings;
+	
+	/**
+	 *	All of mFieldMappings' tables merged, when every map has one.  It
+	 *	is owned by the first map's table and shared with any other header
+	 *	that has the same maps.
+	 */
+	const FieldTable *mIndex;
+	
+	//! Does every map have a table, so that mIndex can be used?
+	bool		mIndexed;
 };
 
 #endif // HTTPHEADER_BASE_H_
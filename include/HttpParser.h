@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef HTTPPARSER_H_
+#define HTTPPARSER_H_
+
+#include "jh_types.h"
+#include "CircularBuffer.h"
+#include "HttpChunked.h"
+
+/**
+ * @file HttpParser.h
+ * @brief Incremental HTTP/1.x message parser.
+ *
+ * HttpParser is fed a message in whatever pieces it arrives in and calls
+ *  an HttpParserListener as each part of it is recognised.  It keeps its
+ *  place between calls, so nothing is ever scanned twice, and it doesn't
+ *  allocate: names, values and body data are passed as pointers into the
+ *  bytes being parsed.  Only a line split across two calls is copied, into
+ *  a fixed buffer inside the parser.
+ *
+ * It understands request and status lines, header fields, bodies framed by
+ *  Content-Length, chunked transfer coding (including trailers, decoded by
+ *  a ChunkedDecoder) and, for responses, bodies that run until the 
+ *  connection closes.
+ */
+
+/**
+ * Implemented by whatever wants the parts of a message.  Every pointer 
+ *  passed is only valid during the call and is not NUL terminated.
+ */
+class HttpParserListener
+{
+public:
+	virtual ~HttpParserListener() {}
+	
+	//! The first line of a request
+	virtual void handleRequestLine( const char *method, int methodLen,
+									const char *uri, int uriLen,
+									int major, int minor ) {}
+	
+	//! The first line of a response
+	virtual void handleStatusLine( int major, int minor, int code,
+								   const char *reason, int reasonLen ) {}
+	
+	/**
+	 * A header field, with white space trimmed from the value.  A field 
+	 *  folded onto more than one line (obsolete, but still seen) comes as a
+	 *  call per line, the later ones having a nameLen of 0.
+	 */
+	virtual void handleField( const char *name, int nameLen,
+							  const char *value, int valueLen ) {}
+	
+	//! All the header fields have been passed
+	virtual void handleHeaderEnd() {}
+	
+	//! The next piece of the body, with any chunked framing removed
+	virtual void handleBody( const char *data, int len ) {}
+	
+	//! A field from the trailer of a chunked body, as handleField
+	virtual void handleTrailer( const char *name, int nameLen,
+								const char *value, int valueLen ) {}
+	
+	//! The whole message has been parsed
+	virtual void handleMessageEnd() {}
+};
+
+class HttpParser
+{
+public:
+	enum Type
+	{
+		kRequest,
+		kResponse
+	};
+	
+	enum State
+	{
+		kFirstLine,
+		kField,
+		kBody,
+		kChunkSize,
+		kChunkData,
+		kChunkEnd,
+		kTrailer,
+		kToClose,
+		kDone,
+		kError
+	};
+	
+	//! Longest line that will be accepted
+	static const int kMaxLineSize = 8 * 1024;
+	
+	HttpParser( Type type, HttpParserListener *listener );
+	
+	/**
+	 * Get ready for the next message.  For a response, head says whether 
+	 *  it's the answer to a HEAD request and so has no body whatever its
+	 *  header says.
+	 */
+	void reset( bool head = false );
+	
+	/**
+	 * Parse the next len bytes of the message.  Stops at the end of the 
+	 *  message, so anything after it can be parsed as the next one after a
+	 *  reset.
+	 *
+	 * @return the number of bytes used, or -1 if the message is malformed
+	 *  in which case nothing more will be parsed until reset.
+	 */
+	int parse( const char *data, int len );
+	
+	/**
+	 * Parse and remove as much of buf as makes up the message, as above.
+	 *  Anything after the end of the message is left in buf.
+	 */
+	int parse( JetHead::CircularBuffer &buf );
+	
+	/**
+	 * The connection has closed.  Ends a body that runs until then.
+	 *
+	 * @return 0 if the message is complete, -1 if it was cut short
+	 */
+	int finish();
+	
+	State getState() const { return mState; }
+	
+	//! Has the whole message been parsed?
+	bool isDone() const { return mState == kDone; }
+	
+	//! Has any of the message arrived since reset?
+	bool isStarted() const { return mStarted; }
+	
+	/**
+	 * Can the connection be used for another message after this one?  Only
+	 *  meaningful once the header has been parsed.
+	 */
+	bool isKeepAlive() const { return mKeepAlive; }
+	
+	//! Version of the message, from its first line
+	int getMajor() const { return mMajor; }
+	int getMinor() const { return mMinor; }
+	
+	//! Response code, for a response
+	int getCode() const { return mCode; }
+	
+	//! Bytes of the body or current chunk not yet parsed, in kBody or kChunkData
+	int64_t getRemaining() const { return mRemaining; }
+	
+	/**
+	 * Step over len bytes of body the caller has dealt with itself, for 
+	 *  example by reading them straight from a socket.  Must be no more than
+	 *  getRemaining.
+	 */
+	void skip( int64_t len );
+	
+	//! Chunks bigger than size are an error, by default there is no limit
+	void setMaxChunkSize( int64_t size ) { mDecoder.setMaxChunkSize( size ); }
+	
+	/**
+	 * Split a field line into its name and value, trimming white space.  A
+	 *  continuation line (one starting with white space) has no name and 
+	 *  gets a nameLen of 0.
+	 *
+	 * @return 0, or -1 if the line isn't a field
+	 */
+	static int splitField( const char *line, int len, 
+						   const char *&name, int &nameLen,
+						   const char *&value, int &valueLen );
+	
+private:
+	//! Passes the data from mDecoder on to the listener
+	class BodyForwarder : public BodyHandler
+	{
+	public:
+		BodyForwarder( HttpParserListener *listener ) : mListener( listener ) {}
+		
+		void handleData( const char *buf, int len ) 
+		{ 
+			mListener->handleBody( buf, len ); 
+		}
+		
+		int handleSocket( JetHead::Socket &sock, int len ) { return -1; }
+		
+	private:
+		HttpParserListener	*mListener;
+	};
+	
+	//! Handle one line, without its line ending
+	int parseLine( const char *line, int len );
+	
+	int parseFirstLine( const char *line, int len );
+	int parseField( const char *line, int len );
+	int parseVersion( const char *str, int len );
+	
+	//! Note the fields that decide how the body is framed
+	int checkField( const char *name, int nameLen, 
+					const char *value, int valueLen );
+	
+	//! The header is done, work out how the body is framed
+	int startBody();
+	
+	void endMessage();
+	
+	//! Called for body bytes, ending the message if the body ends
+	void bodyUsed( int64_t len );
+	
+	//! Follow mDecoder's state, ending the message when it's done
+	void chunkUsed();
+	
+	Type					mType;
+	HttpParserListener		*mListener;
+	State					mState;
+	bool					mHead;
+	bool					mStarted;
+	
+	int						mMajor;
+	int						mMinor;
+	int						mCode;
+	
+	//! A 1xx response that comes ahead of the real one and is skipped
+	bool					mInterim;
+	
+	bool					mKeepAlive;
+	bool					mChunked;
+	bool					mEncoded;
+	int64_t					mContentLength;
+	int64_t					mRemaining;
+	
+	BodyForwarder			mForwarder;
+	ChunkedDecoder			mDecoder;
+	
+	//! A line that hasn't all arrived yet
+	char					mLine[ kMaxLineSize ];
+	int						mLineLen;
+};
+
+#endif // HTTPPARSER_H_
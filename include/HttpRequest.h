@@ -56,10 +56,22 @@ public:
 	void getVersion( int& major, int& minor );
 
 	void setMethod( MethodType type ) { mMethod = type; }
+	
+	//! Can this request be sent again without changing what it does?
+	bool isIdempotent() const 
+	{ 
+		return mMethod != kMethodPost and mMethod != kMethodConnect and 
+			mMethod != kMethodUnknown;
+	}
 	void setURI( const URI &uri ) { mUri = uri; }
 
 	int parseFirstLine( const JetHead::CircularBuffer &buf );
 	
+	//! Take the method, URI and version from an HttpParser
+	void handleRequestLine( const char *method, int methodLen,
+							const char *uri, int uriLen,
+							int major, int minor );
+	
 protected:
 	virtual int buildFirstLine() const;
 
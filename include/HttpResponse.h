@@ -41,14 +41,44 @@ public:
 
 	const char *getResponseString() const;
 
+	//! The protocol version of a parsed response, 1.1 until parsed
+	void getVersion( int& major, int& minor ) const 
+	{ 
+		major = mMajor; 
+		minor = mMinor; 
+	}
+	
+	/**
+	 * Will the server keep the connection open after this response?  
+	 *  HTTP/1.1 does unless told "Connection: close", HTTP/1.0 only if 
+	 *  told "Connection: keep-alive".
+	 */
+	bool isKeepAlive() const;
+	
+	/**
+	 * Is this response never followed by a body, whatever its header says?
+	 *  True for 1xx, 204 and 304 responses and for any response to a HEAD.
+	 */
+	bool isBodyless( bool head ) const
+	{
+		return head or mResponseCode / 100 == 1 or mResponseCode == 204 or
+			mResponseCode == 304;
+	}
+
 	int parseFirstLine( const JetHead::CircularBuffer &buf );
 	
+	//! Take the code and version from an HttpParser
+	void handleStatusLine( int major, int minor, int code,
+						   const char *reason, int reasonLen );
+	
 private:
 	int buildFirstLine() const;
 
 	const char *getResponseString( int code ) const;
 
 	int mResponseCode;
+	int mMajor;
+	int mMinor;
 };
 
 #endif // HTTPRESPONSE_H_
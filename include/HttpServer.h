@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef HTTPSERVER_H_
+#define HTTPSERVER_H_
+
+#include "TcpServer.h"
+#include "HttpParser.h"
+#include "HttpChunked.h"
+#include "HttpContentCoding.h"
+#include "HttpRequest.h"
+#include "HttpResponse.h"
+#include "EventThread.h"
+#include "Mutex.h"
+#include "jh_list.h"
+#include "jh_vector.h"
+
+/**
+ * @file HttpServer.h
+ * @brief An event driven HTTP/1.1 server for embedding in applications.
+ *
+ * Connections are accepted and read by a TcpServer, and requests are parsed
+ *  as they arrive with an HttpParser on the thread of the worker that owns
+ *  the connection.  Each complete request is routed by its path to an 
+ *  HttpRequestHandler, which is run on one of a pool of EventThreads so a
+ *  slow handler never holds up the connections.
+ *
+ * Connections are kept alive between requests unless the client asks for
+ *  them not to be, and pipelined requests are handed to handlers straight
+ *  away.  Responses may be finished in any order but are always written in 
+ *  the order the requests came.  Bodies can be sent all at once, in chunks 
+ *  as they are made, or straight from a file with sendfile.
+ */
+
+class HttpServer;
+class HttpExchange;
+
+/**
+ * Implemented by users of HttpServer to answer requests.
+ */
+class HttpRequestHandler
+{
+public:
+	/**
+	 * Answer a request.  Called on one of the server's handler threads.  Fill
+	 *  in exchange->getResponse() and send it with one of HttpExchange's send
+	 *  methods, either now or later from any thread.  Every exchange must be
+	 *  answered, it isn't freed until it is.
+	 */
+	virtual void handleRequest( HttpExchange *exchange ) = 0;
+	
+protected:
+	//! Virtual does-nothing destructor to avoid compiler warning
+	virtual ~HttpRequestHandler() {}
+};
+
+/**
+ * One request to an HttpServer and the response to it.  The response is 
+ *  sent with exactly one of send, sendFile or startChunked, which fill in 
+ *  the fields that frame the body (Content-Length, Transfer-Encoding and 
+ *  Connection).  The exchange belongs to the server once the response has
+ *  been finished and must not be used after.
+ */
+class HttpExchange
+{
+public:
+	HttpRequest &getRequest() { return mRequest; }
+	HttpResponse &getResponse() { return mResponse; }
+	
+	//! The body of the request, if it had one
+	const JHSTD::string &getBody() const { return mBody; }
+	
+	//! Send the response with len bytes of body (copied) and finish
+	void send( const void *body = NULL, int len = 0 );
+	
+	//! As above
+	void send( const JHSTD::string &body ) { send( body.data(), body.size() ); }
+	
+	/**
+	 * Send the response with len bytes of file from offset as the body, and
+	 *  finish.  The exchange takes the file and closes it once it is sent.
+	 *  len is cut down to what the file holds past offset.
+	 */
+	void sendFile( JetHead::File *file, int64_t offset, int64_t len );
+	
+	/**
+	 * Send the response header for a body of unknown length, to be sent
+	 *  with sendChunk and ended with finish.  HTTP/1.0 clients get the body
+	 *  as is and the connection closed after it.
+	 */
+	void startChunked();
+	
+	/**
+	 * Send the next piece of a body started with startChunked.  Pieces 
+	 *  bigger than ChunkedEncoder::kDefaultMaxChunkSize go as more than one
+	 *  chunk.  When compressing, each piece is flushed through the 
+	 *  compressor so it isn't held back waiting for more.
+	 */
+	void sendChunk( const void *data, int len );
+	
+	/**
+	 * Add a field to the trailer of a body started with startChunked, sent
+	 *  by finish.  HTTP/1.0 clients don't get a trailer.
+	 */
+	void addTrailer( const char *name, const char *value );
+	
+	//! End a body started with startChunked
+	void finish();
+	
+private:
+	//! Posts what mEncoder makes as pieces
+	class PieceWriter : public BodyHandler
+	{
+	public:
+		PieceWriter( HttpExchange *exchange ) : mExchange( exchange ) {}
+		
+		void handleData( const char *buf, int len );
+		void handleDatav( const struct iovec *iov, int count );
+		int handleSocket( JetHead::Socket &sock, int len ) { return -1; }
+		
+	private:
+		HttpExchange	*mExchange;
+	};
+	
+
+	//! A piece of the response on its way to the connection
+	struct Piece
+	{
+		Piece( HttpExchange *exchange ) 
+			: mExchange( exchange ), mFile( NULL ), mOffset( 0 ), mLen( 0 ),
+			  mSent( 0 ), mLast( false ) {}
+		
+		~Piece();
+		
+		HttpExchange		*mExchange;
+		JHSTD::string		mData;
+		
+		//! If set the piece is mLen bytes of this from mOffset, not mData
+		JetHead::File		*mFile;
+		int64_t				mOffset;
+		int64_t				mLen;
+		
+		//! How much has been written so far
+		int64_t				mSent;
+		
+		//! Is this the end of the response?
+		bool				mLast;
+	};
+	
+	struct Connection;
+	
+	HttpExchange( HttpServer *server, Connection *conn );
+	~HttpExchange();
+	
+	//! Fill in the framing fields and get the header, len -1 for chunked
+	const char *prepareHeader( int64_t len );
+	
+	//! How to code a body of len bytes (-1 if not known) for this client
+	ContentCoding::Coding chooseCoding( int64_t len );
+	
+	//! Note the coding in the response's header
+	void addCodingFields( ContentCoding::Coding coding );
+	
+	//! Hand a piece to the connection's thread
+	void post( Piece *piece );
+	
+	//! A piece with just data in it
+	void post( const char *data, int len, bool last );
+	
+	HttpServer			*mServer;
+	
+	//! Where pieces go, NULL once the connection has gone.  Uses mServer's lock.
+	Selector			*mSelector;
+	int					mPosted;
+	bool				mHandlerDone;
+	
+	//! Only used on the connection's thread, NULL once it has gone
+	Connection			*mConn;
+	JetHead::list<Piece*>	mPieces;
+	bool				mFinished;
+	
+	HttpRequest			mRequest;
+	HttpResponse		mResponse;
+	JHSTD::string		mBody;
+	int					mMajor;
+	int					mMinor;
+	bool				mHead;
+	bool				mKeepAlive;
+	bool				mTooLarge;
+	
+	//! Only used by the handler
+	bool				mStarted;
+	bool				mChunked;
+	PieceWriter			mWriter;
+	ChunkedEncoder		mEncoder;
+	
+	//! Set while finish has mEncoder send the last chunk
+	bool				mEnding;
+	
+	//! Compresses a body sent with sendChunk, if it's being compressed
+	ContentEncoder		*mCoder;
+	
+	friend class HttpServer;
+};
+
+class HttpServer : protected JetHead::TcpServerListener
+{
+public:
+	//! Default limit on the size of a request body
+	static const int kDefaultMaxBodySize = 1024 * 1024;
+	
+	//! Default limit on requests read from a connection ahead of the response
+	static const int kDefaultMaxPipelined = 16;
+	
+	//! Bodies smaller than this are never compressed
+	static const int kMinCompressSize = 256;
+	
+	/**
+	 * Create a server.  Nothing happens until start is called.
+	 *
+	 * @param numHandlerThreads	how many threads to run handlers on.
+	 * @param numWorkers	how many threads to spread connections over, 0
+	 *						means one per processor.
+	 * @param name			used for thread and metrics names.
+	 */
+	HttpServer( int numHandlerThreads = 1, int numWorkers = 1, 
+				const char *name = "HttpServer" );
+	
+	//! Stops the server if it is still running
+	virtual ~HttpServer();
+	
+	/**
+	 * Send requests whose path is prefix, or starts with prefix and then a 
+	 *  '/', to handler.  The longest matching prefix wins, "/" matches every
+	 *  path.  Requests that match nothing get a 404.  Call before start.
+	 */
+	void addHandler( const char *prefix, HttpRequestHandler *handler );
+	
+	/**
+	 * Start accepting connections.  If addr's port is 0 the OS will pick one,
+	 *  use getPort to find out which.
+	 *
+	 * @return 0 on success, -1 if we couldn't bind or listen.
+	 */
+	int start( const JetHead::Socket::Address &addr );
+	
+	/**
+	 * Stop accepting connections and wait up to drainMs for the responses
+	 *  already asked for to be sent, then close every connection.  Must not
+	 *  be called from a handler.
+	 */
+	void stop( uint32_t drainMs = 0 );
+	
+	//! The port we are listening on, or 0 if we are not started.
+	int getPort() const { return mTcpServer.getPort(); }
+	
+	//! Close connections idle for msecs, 0 (the default) never.  Call before start.
+	void setIdleTimeout( uint32_t msecs ) { mTcpServer.setIdleTimeout( msecs ); }
+	
+	//! Answer requests with bodies larger than size with a 413.
+	void setMaxBodySize( int size ) { mMaxBodySize = size; }
+	
+	/**
+	 * Stop reading from a connection while it has num requests waiting for 
+	 *  responses.  1 turns off pipelining.
+	 */
+	void setMaxPipelined( int num ) { mMaxPipelined = num < 1 ? 1 : num; }
+	
+	/**
+	 * Compress response bodies for clients whose Accept-Encoding allows 
+	 *  gzip or deflate.  Bodies sent with send that are under 
+	 *  kMinCompressSize or that compression wouldn't shrink, files, partial
+	 *  content and responses that already have a Content-Encoding are sent
+	 *  as they are.  Off by default, and does nothing unless 
+	 *  ContentCoding::isSupported.
+	 */
+	void setCompression( bool compress ) { mCompress = compress; }
+	
+private:
+	typedef HttpExchange::Piece Piece;
+	typedef HttpExchange::Connection Connection;
+	
+	struct Route
+	{
+		JHSTD::string		mPrefix;
+		HttpRequestHandler	*mHandler;
+	};
+	
+	//! For TcpServerListener, called on the connection's worker thread
+	bool handleConnection( JetHead::TcpConnection *conn );
+	void handleData( JetHead::TcpConnection *conn );
+	void handleWritable( JetHead::TcpConnection *conn );
+	void handleClose( JetHead::TcpConnection *conn );
+	void handleDrain( JetHead::TcpConnection *conn );
+	
+	//! Route a complete request to its handler
+	void dispatch( HttpExchange *exchange );
+	
+	//! Run a handler, on a handler thread
+	void runHandler( HttpExchange *exchange, HttpRequestHandler *handler );
+	
+	//! Take a piece of a response, on the connection's thread
+	void output( Piece *piece );
+	
+	//! Answer a request ourselves, with an empty body
+	void sendError( HttpExchange *exchange, int code );
+	
+	JetHead::TcpServer					mTcpServer;
+	JetHead::vector<EventThread*>		mHandlerThreads;
+	JetHead::vector<Route>				mRoutes;
+	
+	//! Used to pick the next handler thread, round robin
+	volatile uint32_t	mNextThread;
+	
+	int					mMaxBodySize;
+	int					mMaxPipelined;
+	bool				mCompress;
+	
+	//! Protects every exchange's mSelector, mPosted and mHandlerDone
+	Mutex				mLock;
+	
+	friend class HttpExchange;
+	friend struct HttpExchange::Connection;
+};
+
+#endif // HTTPSERVER_H_
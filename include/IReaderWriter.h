@@ -32,6 +32,8 @@
 #include "JetHead.h"
 #include "jh_types.h"
 
+#include <sys/uio.h>
+
 namespace JetHead
 {
 	/**
@@ -48,6 +50,30 @@ namespace JetHead
 		virtual int write(const void *buffer, int length) = 0;
 		virtual ErrCode close() = 0;
 		
+		/**
+		 *	@brief Write several buffers, one after another
+		 *
+		 *	Like write this can write less than everything asked for.  This
+		 *	default writes each buffer in turn, stopping after a short write,
+		 *	implementations that can should do it in one call.
+		 */
+		virtual int writev(const struct iovec *iov, int count)
+		{
+			int bytesWritten = 0;
+			
+			for (int i = 0; i < count; i++)
+			{
+				int result = write(iov[i].iov_base, iov[i].iov_len);
+				if (result < 0)
+					return bytesWritten > 0 ? bytesWritten : result;
+				
+				bytesWritten += result;
+				if (result < (int)iov[i].iov_len)
+					break;
+			}
+			return bytesWritten;
+		}
+		
 		/**
 		 *	@brief writeAll helper method
 		 *
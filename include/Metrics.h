@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef JH_METRICS_H_
+#define JH_METRICS_H_
+
+#include "jh_types.h"
+#include "RefCount.h"
+#include "Mutex.h"
+#include "jh_list.h"
+#include "jh_vector.h"
+#include "jh_string.h"
+
+/**
+ * @file Metrics.h
+ * @brief Process wide counters, gauges and histograms.
+ *
+ * Subsystems publish into the MetricsRegistry by asking it for a named
+ *  metric once (usually in a constructor) and holding on to the returned
+ *  SmartPtr.  Updating a metric after that is just an atomic add, counters
+ *  and histograms are sharded by thread so that busy threads don't fight
+ *  over the same cache line.  Reading a metric sums all of the shards, so
+ *  reads are expensive compared to updates and are only expected to be done
+ *  when someone asks for a snapshot.
+ *
+ * Metric names follow the Prometheus conventions (i.e. "jh_socket_bytes_read_total")
+ *  and labels are a preformatted list of key="value" pairs without the
+ *  enclosing braces (i.e. "dispatcher=\"Selector\"").
+ */
+
+class MetricsRegistry;
+
+/**
+ * Base class of all metrics.  Metrics are reference counted, when the last
+ *  reference goes away the metric removes itself from the registry.
+ */
+class Metric : public RefCount
+{
+public:
+	enum Type {
+		kCounter,
+		kGauge,
+		kHistogram
+	};
+	
+	//! What kind of metric is this?
+	Type getType() const { return mType; }
+	
+	//! The name this metric was registered with
+	const char *getName() const { return mName.c_str(); }
+	
+	//! The labels this metric was registered with, may be an empty string
+	const char *getLabels() const { return mLabels.c_str(); }
+	
+	//! Number of shards used by sharded metrics
+	static const int kNumShards = 16;
+
+protected:
+	Metric( Type type, const char *name, const char *labels );
+	virtual ~Metric() {}
+
+	//! Remove ourself from the registry and delete
+	void onRefCountZero() const;
+	
+	/**
+	 * Get the shard used by the calling thread.  Threads are assigned shards
+	 *  round robin the first time they update a metric.
+	 */
+	static int getShard()
+	{
+		if ( sShard < 0 )
+			sShard = assignShard();
+		return sShard;
+	}
+	
+	//! Size we pad shards to so that two shards don't share a cache line
+	static const int kCacheLineSize = 64;
+	
+private:
+	static int assignShard();
+	
+	Type			mType;
+	JHSTD::string	mName;
+	JHSTD::string	mLabels;
+
+	static __thread int sShard;
+	static volatile int sNextShard;
+};
+
+/**
+ * A monotonically increasing 64 bit count, i.e. bytes written or events
+ *  dispatched.
+ */
+class Counter : public Metric
+{
+public:
+	//! Add n to the counter.
+	void increment( int64_t n = 1 )
+	{
+		__sync_fetch_and_add( &mShards[ getShard() ].mValue, n );
+	}
+
+	//! Sum of all shards.
+	int64_t getValue() const;
+
+protected:
+	Counter( const char *name, const char *labels );
+	virtual ~Counter() {}
+
+private:
+	struct Shard
+	{
+		volatile int64_t	mValue;
+		char				mPad[ kCacheLineSize - sizeof( int64_t ) ];
+	};
+	
+	Shard mShards[ kNumShards ];
+	
+	friend class MetricsRegistry;
+};
+
+/**
+ * A value that can go up and down, i.e. a queue depth.  A gauge is a single
+ *  atomic word rather than being sharded since set() needs a single value 
+ *  to replace.
+ */
+class Gauge : public Metric
+{
+public:
+	//! Replace the current value
+	void set( int64_t value ) { mValue = value; __sync_synchronize(); }
+	
+	//! Add n (which may be negative) to the current value
+	void add( int64_t n ) { __sync_fetch_and_add( &mValue, n ); }
+
+	//! Current value
+	int64_t getValue() const { return mValue; }
+	
+protected:
+	Gauge( const char *name, const char *labels );
+	virtual ~Gauge() {}
+
+private:
+	volatile int64_t mValue;
+	
+	friend class MetricsRegistry;
+};
+
+/**
+ * A distribution of values.  Values are placed in power of two buckets so
+ *  bucket 0 holds 0, bucket 1 holds 1, bucket 2 holds 2-3, bucket 3 holds 4-7
+ *  and so on.  The last bucket holds everything that doesn't fit in the 
+ *  others.  The unit of the values is up to the user, for times it is
+ *  normally micro seconds.
+ */
+class Histogram : public Metric
+{
+public:
+	static const int kNumBuckets = 32;
+
+	//! A copy of the histogram at one point in time
+	struct Snapshot
+	{
+		Snapshot();
+		
+		//! Number of values in each bucket (not cumulative)
+		uint64_t	mBuckets[ kNumBuckets ];
+
+		//! Number of values observed
+		uint64_t	mCount;
+
+		//! Sum of all values observed
+		uint64_t	mSum;
+
+		//! Mean of all values observed, 0 if nothing observed
+		uint64_t getMean() const;
+		
+		/**
+		 * Estimate the value at a percentile (0.0 - 100.0).  The result is
+		 *  the upper limit of the bucket the percentile falls in.
+		 */
+		uint64_t getPercentile( double percentile ) const;
+	};
+	
+	//! Add a value to the distribution
+	void observe( uint64_t value )
+	{
+		Shard &s = mShards[ getShard() ];
+		__sync_fetch_and_add( &s.mBuckets[ getBucket( value ) ], 1 );
+		__sync_fetch_and_add( &s.mCount, 1 );
+		__sync_fetch_and_add( &s.mSum, value );
+	}
+
+	//! Sum all the shards into snap.
+	void getSnapshot( Snapshot &snap ) const;
+	
+	//! Which bucket will value land in.
+	static int getBucket( uint64_t value )
+	{
+		if ( value == 0 )
+			return 0;
+
+		int bucket = 64 - __builtin_clzll( value );
+		return bucket < kNumBuckets ? bucket : kNumBuckets - 1;
+	}
+	
+	//! The largest value that will land in bucket i, last bucket is UINT64_MAX
+	static uint64_t getBucketLimit( int i );
+
+protected:
+	Histogram( const char *name, const char *labels );
+	virtual ~Histogram() {}
+
+private:
+	struct Shard
+	{
+		volatile uint64_t	mBuckets[ kNumBuckets ];
+		volatile uint64_t	mCount;
+		volatile uint64_t	mSum;
+		char				mPad[ kCacheLineSize ];
+	};
+
+	Shard mShards[ kNumShards ];
+	
+	friend class MetricsRegistry;
+};
+
+/**
+ *  @brief Singleton that tracks all metrics in the process
+ *
+ *  Asking for a metric with a name and labels that already exists returns
+ *  the existing metric, so unrelated code can safely publish into the same
+ *  counter.  Asking for an existing name with a different type is an error
+ *  and will return NULL.
+ */
+class MetricsRegistry
+{
+public:
+	//! Get the singleton MetricsRegistry
+	static MetricsRegistry *getInstance();
+	
+	//! Destroy the registry (until the next call to getInstance)
+	static void destroyRegistry();
+	
+	//! Find or create a counter.
+	SmartPtr<Counter> getCounter( const char *name, const char *labels = NULL );
+	
+	//! Find or create a gauge.
+	SmartPtr<Gauge> getGauge( const char *name, const char *labels = NULL );
+	
+	//! Find or create a histogram.
+	SmartPtr<Histogram> getHistogram( const char *name, const char *labels = NULL );
+
+	//! One metric's value at the time of a snapshot
+	struct Sample
+	{
+		JHSTD::string		mName;
+		JHSTD::string		mLabels;
+		Metric::Type		mType;
+
+		//! The value of a counter or gauge
+		int64_t				mValue;
+
+		//! The value of a histogram
+		Histogram::Snapshot	mHistogram;
+	};
+
+	/**
+	 * Copy the current value of every registered metric into samples, 
+	 *  sorted by name.  If the GCHeap is enabled its statistics are 
+	 *  included as gauges.
+	 */
+	void snapshot( JetHead::vector<Sample> &samples );
+	
+	/**
+	 * Format a snapshot in the Prometheus text exposition format.
+	 */
+	void writeText( JHSTD::string &out );
+	
+	//! Number of metrics currently registered
+	int getNumMetrics();
+	
+protected:
+	//! Prevent non-singleton usage
+	MetricsRegistry();
+
+	/**
+	 *  Prevent anyone from destroying this in any way other than
+	 *  destroyRegistry
+	 */
+	~MetricsRegistry();
+
+private:
+	//! Find a live metric and take a reference to it, must hold mLock
+	SmartPtr<Metric> findMetric( const char *name, const char *labels );
+
+	//! Add a new metric in sorted order, must hold mLock
+	void addMetric( Metric *metric );
+	
+	//! Called when a metric's ref count reaches zero.
+	void removeMetric( const Metric *metric );
+
+	//! Everything we are tracking, sorted by name.
+	JetHead::list<Metric*>	mMetrics;
+	
+	//! Locking for mMetrics
+	Mutex mLock;
+	
+	//! Our singleton 
+	static MetricsRegistry *mSingleton;
+	
+	friend class Metric;
+};
+
+#endif // JH_METRICS_H_
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef JH_METRICS_SERVER_H_
+#define JH_METRICS_SERVER_H_
+
+#include "Socket.h"
+#include "Selector.h"
+
+/**
+ * @brief Serve the MetricsRegistry text exposition on a local port.
+ *
+ * Each connection to the server is sent the current contents of the
+ *  MetricsRegistry in the Prometheus text format and is then closed, so
+ *  "nc 127.0.0.1 <port>" is enough to scrape a process.  The server only
+ *  binds to the loopback interface.
+ */
+class MetricsServer : public JetHead::SocketListener
+{
+public:
+	MetricsServer();
+	virtual ~MetricsServer();
+
+	/**
+	 * Start listening on 127.0.0.1:port.  If port is 0 the OS will pick a
+	 *  port, use getPort to find out which.
+	 *
+	 * @return 0 on success, -1 if the bind or listen failed.
+	 */
+	int start( int port );
+
+	//! Stop listening
+	void stop();
+
+	//! The port we are listening on, or 0 if we are not started
+	int getPort();
+	
+private:
+	void handleData( JetHead::Socket *socket ) {}
+	bool handleAccept( JetHead::ServerSocket *server, JetHead::Socket *socket );
+	
+	JetHead::ServerSocket	*mSocket;
+	Selector				mSelector;
+};
+
+#endif // JH_METRICS_SERVER_H_
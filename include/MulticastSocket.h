@@ -38,6 +38,12 @@ namespace JetHead
 	 * A multicast socket.  Note that multicast implies that this is a UDP
 	 * (datagram) socket, since it is impossible to have a 2-way
 	 * stream-oriented connection on a multicast group.
+	 *
+	 * IPv6 groups work the same way once the socket has been bound to an
+	 * IPv6 address (Socket::Address( port, AF_INET6 ) for example).  IPv6
+	 * picks interfaces by index rather than address, so the versions of
+	 * joinGroup and setInterface that take an interface name are the
+	 * natural ones to use there.
 	 */ 
 	
 	class MulticastSocket : public ServerSocket
@@ -63,9 +69,16 @@ namespace JetHead
 		 */
 		int joinGroup(const Socket::Address& addr, const Socket::Address& ifAddr);
 	
+		/**
+		 * @brief Join the group on the interface called ifName (like "eth0")
+		 *
+		 * @note Returns the exit code of the setsockopt call
+		 */
+		int joinGroup(const Socket::Address& addr, const char* ifName);
+	
 	
 		/**
-		 * @brief Set the TTL on packets you send to this group
+		 * @brief Set the TTL (hop limit for IPv6) on packets you send to this group
 		 *
 		 * @note Returns the exit code of the setsockopt call
 		 */
@@ -105,6 +118,16 @@ namespace JetHead
 	
 		//! Are we in the group?
 		bool mInGroup;
+		
+		//! The interface we joined on, IPv6 only
+		unsigned mIfIndex;
+		
+		//! Join on an interface given by address (IPv4) or index (IPv6)
+		int joinGroup(const Socket::Address& addr, 
+					  const Socket::Address& ifAddr, unsigned ifIndex);
+		
+		//! Find the index of the interface that has addr, 0 if none do
+		static unsigned getInterfaceIndex(const Socket::Address& addr);
 	
 	};
 };
@@ -58,6 +58,24 @@ public:
 			Mutex::ExitCriticalSection();
 	}
 	
+	/**
+	 * Take a reference only if someone still holds one.  For registries
+	 *  that keep objects without a reference of their own, once the count
+	 *  has reached zero onRefCountZero is coming and the object must not
+	 *  be handed out again.
+	 *
+	 * @return true if a reference was taken
+	 */
+	bool TryAddRef() const
+	{
+		Mutex::EnterCriticalSection();
+		bool live = ( mRefCount > 0 );
+		if ( live )
+			mRefCount++;
+		Mutex::ExitCriticalSection();
+		return live;
+	}
+	
 	int getRefCountForDebug() const { return mRefCount; }
  
 protected:
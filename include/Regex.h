@@ -31,6 +31,44 @@
 #include "jh_vector.h"
 #include "jh_string.h"
 #include "JetHead.h"
+#include "RegexProgram.h"
+
+/**
+ * The result of parsing a string with a Regex, along with the scratch space
+ *  and lazily built DFA the parse needs.  Reusing one for many parses saves
+ *  allocating those every time.  Works with any Regex, though it starts 
+ *  over whenever it is used with a different one than last time.
+ */
+class RegexMatch
+{
+public:
+	RegexMatch() : mMatched( false ) {}
+	
+	//! Did the last parse match?
+	bool matched() const { return mMatched; }
+	
+	//! As Regex::getData, for the last parse with this RegexMatch.
+	const JHSTD::string &getData( int i ) const;
+	
+	//! As Regex::getNumGroups, for the last parse with this RegexMatch.
+	int getNumGroups() const;
+	
+private:
+	struct GroupData
+	{
+		GroupData() : start_pos( 0 ), end_pos( 0 ) {}
+		int start_pos;
+		int end_pos;
+		std::string string;
+	};
+	
+	RegexProgram::Cache	mCache;
+	JetHead::vector<RegexProgram::Span>	mSpans;
+	JetHead::vector<GroupData>	mGroups;
+	bool	mMatched;
+	
+	friend class Regex;
+};
 
 /**
 	Regex is a regular expression parsing class.  It takes a regular expression
@@ -49,6 +87,16 @@
 	consider rolling your own parse.  If you have complexe strings to parse
 	then this class might be your choice.  Also keep in mind that how you write
 	your RE will make a large difference in performance.
+	
+	prepare compiles the tree into a RegexProgram so parse runs in time 
+	linear in the length of the string, whatever the RE.  A group inside a 
+	repetition adds one entry to getData for every time it matched.  To 
+	match a string against many REs at once see RegexSet.
+	
+	A prepared Regex is never changed by parsing with a RegexMatch, so one 
+	can be shared by many threads as long as each parses with a RegexMatch 
+	of its own.  parse without one keeps its result in the Regex, and so 
+	must only be used by one thread at a time.
  */ 
 class Regex
 {
@@ -73,6 +121,13 @@ public:
 	 */
 	 bool	parse( const JHSTD::string &string );
 
+	/**
+	 * Same as above, but the groups are kept in match rather than in this 
+	 *  Regex, to be got at with match.getData.  Any number of threads may 
+	 *  call this at once, each with its own match.
+	 */
+	bool	parse( const JHSTD::string &string, RegexMatch &match ) const;
+
 	/**
 	 * If the RE contains any groups, the strings for the match of all groups
 	 *  can be accessed with this call.  You must have successfully parsed a 
@@ -165,42 +220,27 @@ private:
 		int		mGroupNum;
 	};
 
-	struct GroupData
-	{
-		GroupData() : start_pos( 0 ), end_pos( 0 ) {}
-		int start_pos;
-		int end_pos;
-		std::string string;
-	};
-	
-	struct ParseData
-	{
-		ParseData( const JHSTD::string &s ) : string( s ), cur_pos( 0 ), 
-			backtrack_pos( 0 ), match_count( 0 ) {}
-		
-		JHSTD::string string;
-		int cur_pos;
-		int backtrack_pos;
-		int match_count;
-		//JetHead::vector<GroupData>	groups;
-	};
-
 	void dumpElement( Element *cur_node, std::string &dump );
-	bool processElement( Element *cur_node, ParseData *data );
-	bool processTerminal( Element *cur_node, ParseData *data );
-	bool processChildrenComplete( Element *cur_node, ParseData *data );
-	bool processSubTree( Element *cur_node, ParseData *data );
-	void backtrackGroups( ParseData *data );
+	
+	void compile();
+	void compileSequence( Element *sequence );
+	void compileRepeat( Element *element );
+	void compileAtom( Element *element );
 	
 	enum State {
 		STATE_INIT,
-		STATE_PREPARED,
-		STATE_PARSED
+		STATE_PREPARED
 	} mState;
 	
 	Element	mRoot;
-	JetHead::vector<GroupData>	mGroups;
 	RegexPrepareError mErrorData;
+	
+	RegexProgram	mProgram;
+	
+	//! Result of parse without a RegexMatch
+	RegexMatch		mMatch;
+	
+	friend class RegexSet;
 };
 
 #endif // JH_REGEX_H_
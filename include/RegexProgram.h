@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef JH_REGEXPROGRAM_H_
+#define JH_REGEXPROGRAM_H_
+
+#include "jh_vector.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * The compiled form of one or more regular expressions, a program for a 
+ *  Thompson NFA.  Regex compiles its tree into one of these and RegexSet
+ *  joins many of them together, then they run it to match strings in time
+ *  linear in the length of the string.
+ *
+ * Whether a string matches is decided by a DFA that is built lazily, a 
+ *  state at a time as strings need them, and cached between calls.  Where
+ *  the groups matched is found by running the program on a Pike VM, which 
+ *  follows the same leftmost-first, greedy choices a backtracker would.
+ *
+ * Matches are anchored at the start of the string and may end anywhere.  A
+ *  program finished for searching also tries each later starting point, in
+ *  the same single pass over the string.
+ *
+ * Once finished a program is never changed by running it.  The DFA and the
+ *  Pike VM's threads live in a Cache supplied by the caller, so any number
+ *  of threads can run one program at once, each with its own Cache.
+ */
+class RegexProgram
+{
+public:
+	//! A set of bytes, what a terminal or class matches
+	struct ByteSet
+	{
+		ByteSet() { memset( mBits, 0, sizeof( mBits ) ); }
+		
+		bool has( uint8_t c ) const 
+		{ 
+			return ( mBits[ c >> 5 ] & ( 1U << ( c & 31 ) ) ) != 0; 
+		}
+		
+		void add( uint8_t c ) { mBits[ c >> 5 ] |= 1U << ( c & 31 ); }
+		
+		void invert()
+		{
+			for ( int i = 0; i < 8; i++ )
+				mBits[ i ] = ~mBits[ i ];
+		}
+		
+		uint32_t mBits[ 8 ];
+	};
+	
+	enum OpCode {
+		OP_BYTE,		// Consume a byte in set mX
+		OP_SPLIT,		// Try mX, then mY
+		OP_JUMP,		// Go to mX
+		OP_OPEN,		// A group starts here
+		OP_CLOSE,		// The innermost open group ends here
+		OP_MATCH		// Pattern mX matched
+	};
+	
+	//! Where a group matched, the groups are in the order they opened
+	struct Span
+	{
+		int		mStart;
+		int		mEnd;
+	};
+	
+	/**
+	 * What running a program needs to keep between calls.  A Cache may be
+	 *  used with any program, it starts over whenever it is used with a 
+	 *  different one than last time, or the same one after it was finished
+	 *  again.  It must only be used by one thread at a time.
+	 */
+	class Cache
+	{
+	public:
+		Cache() : mSerial( 0 ), mFreeCapture( -1 ), mGeneration( 0 ), 
+			mDfaStart( -1 ) {}
+		
+	private:
+		//! A Pike VM thread, mCapture is the last group event on its path
+		struct Thread
+		{
+			int		mPc;
+			int		mCapture;
+		};
+		
+		/**
+		 * Group opens and closes are kept as lists linked back from the 
+		 *  newest one, shared between the threads that have them in common.
+		 *  Nodes are reference counted and reused so memory stays bounded by
+		 *  the number of live threads rather than the length of the string.
+		 */
+		struct CaptureNode
+		{
+			int		mPrev;
+			int		mPos;
+			int		mRefs;
+			bool	mOpen;
+		};
+		
+		/**
+		 * A DFA state is the set of NFA instructions that consume a byte 
+		 *  reachable at some point in the string, along with the patterns 
+		 *  that have matched by then.  A pattern that has matched has 
+		 *  nothing more to say, so its instructions are dropped from the 
+		 *  state.  The entries are mCount entries of mDfaInsts from mFirst, 
+		 *  the patterns first as -1 - pattern.  Its transitions are 
+		 *  mNumClasses entries of mDfaNext from index * mNumClasses.
+		 */
+		struct DfaState
+		{
+			int			mFirst;
+			int			mCount;
+			int			mMatches;
+			uint32_t	mHash;
+			int			mHashNext;
+		};
+		
+		void nextGeneration();
+		
+		//! Serial number of the program this was last used with
+		uint32_t					mSerial;
+		
+		JetHead::vector<Thread>		mThreads[ 2 ];
+		JetHead::vector<Thread>		mStack;
+		JetHead::vector<CaptureNode> mCaptures;
+		int							mFreeCapture;
+		JetHead::vector<int>		mVisited;
+		int							mGeneration;
+		
+		// The lazy DFA
+		JetHead::vector<DfaState>	mDfaStates;
+		JetHead::vector<int>		mDfaInsts;
+		JetHead::vector<int>		mDfaNext;
+		JetHead::vector<int>		mDfaWork;
+		JetHead::vector<int>		mDfaMatched;
+		JetHead::vector<int>		mDfaHash;
+		int							mDfaStart;
+		
+		friend class RegexProgram;
+	};
+	
+	RegexProgram();
+	
+	//! Throw the program away to build a new one.
+	void clear();
+	
+	/**
+	 * Add an instruction to the end of the program.
+	 *
+	 * @return its index, which jumps and splits use to refer to it.
+	 */
+	int emit( OpCode op, int x = 0, int y = 0 );
+	
+	//! Point the jump or split at pc somewhere else.
+	void setTarget( int pc, int x ) { mProgram[ pc ].mX = x; }
+	void setSecondTarget( int pc, int y ) { mProgram[ pc ].mY = y; }
+	
+	//! Index of set for OP_BYTE, adding it if it isn't there yet.
+	int addSet( const ByteSet &set );
+	
+	//! Index the next instruction will get
+	int size() const { return mProgram.size(); }
+	
+	/**
+	 * Add a copy of other to the end of this program, its OP_MATCH becoming
+	 *  a match for pattern.  other must not be finished for searching.
+	 *
+	 * @return the index its first instruction got.
+	 */
+	int append( const RegexProgram &other, int pattern );
+	
+	/**
+	 * Get ready to run, must be called after the last instruction is added.
+	 *  With search set matches may start anywhere in the string.  Which 
+	 *  bytes can start a match is worked out so that a search can skip 
+	 *  straight past the bytes that can't, using memchr when only one can.
+	 */
+	void finish( bool search = false );
+	
+	//! Does the program have any groups?
+	bool hasGroups() const { return mHasGroups; }
+	
+	/**
+	 * Run the DFA over len bytes of str.  Stops at the first match if 
+	 *  patterns is NULL, otherwise adds every pattern that matched to 
+	 *  patterns, in the order they matched.
+	 *
+	 * @return true if anything matched.
+	 */
+	bool match( Cache &cache, const char *str, int len, 
+				JetHead::vector<int> *patterns = NULL ) const;
+	
+	/**
+	 * Run the Pike VM over len bytes of str to find where its groups 
+	 *  matched.  A group inside a repetition gets a Span every time it 
+	 *  matched.
+	 *
+	 * @return true if it matched.
+	 */
+	bool capture( Cache &cache, const char *str, int len, 
+				  JetHead::vector<Span> &groups ) const;
+	
+private:
+	struct Inst
+	{
+		OpCode	mOp;
+		int		mX;
+		int		mY;
+		int		mPattern;
+	};
+	
+	typedef Cache::Thread Thread;
+	typedef Cache::CaptureNode CaptureNode;
+	typedef Cache::DfaState DfaState;
+	
+	//! When the DFA takes this many bytes it is thrown away and restarted.
+	static const int kMaxDfaMemory = 256 * 1024;
+	static const int kDfaHashSize = 256;
+	
+	void computeByteClasses();
+	void prepareCache( Cache &cache ) const;
+	
+	void addThread( Cache &cache, JetHead::vector<Thread> &list, int pc, 
+					int capture, int pos ) const;
+	int newCapture( Cache &cache, int prev, int pos, bool open ) const;
+	void releaseCapture( Cache &cache, int capture ) const;
+	
+	int dfaStep( Cache &cache, int state, uint8_t c ) const;
+	int dfaState( Cache &cache, bool &flushed ) const;
+	void addClosure( Cache &cache, int pc ) const;
+	void clearDfa( Cache &cache ) const;
+	
+	JetHead::vector<Inst>		mProgram;
+	JetHead::vector<ByteSet>	mSets;
+	int							mStart;
+	bool						mHasGroups;
+	
+	// Bytes that can start a match, for searching
+	bool						mPrefilter;
+	ByteSet						mFirstBytes;
+	int							mFirstByte;
+	
+	uint8_t						mByteClass[ 256 ];
+	int							mNumClasses;
+	
+	//! Changes every time the program is finished, 0 until it is
+	uint32_t					mSerial;
+	static uint32_t				sNextSerial;
+};
+
+#endif // JH_REGEXPROGRAM_H_
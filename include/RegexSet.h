@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef JH_REGEXSET_H_
+#define JH_REGEXSET_H_
+
+#include "Regex.h"
+
+/**
+ * RegexSet matches a string against many regular expressions at once.  The
+ *  REs are compiled into one RegexProgram, so a single pass over the string
+ *  finds every one that matches, however many there are.  Only whether 
+ *  each RE matched is reported, use a Regex to get at its groups.
+ *
+ * match is anchored like Regex::parse, search looks for each RE anywhere in
+ *  the string.  A search skips over bytes that can't start a match of any
+ *  RE with memchr, or a table lookup when more than one byte can, so a set
+ *  of REs that start with rare bytes is very cheap to search for.
+ *
+ * Like Regex, once the REs are added a RegexSet can be shared by many 
+ *  threads if each passes its own RegexProgram::Cache to match and search.
+ */
+class RegexSet
+{
+public:
+	RegexSet();
+	~RegexSet();
+	
+	/**
+	 * Add a regular expression to the set.  The set is compiled again each 
+	 *  time, so add all of them before matching.
+	 *
+	 * @return the index that match and search report it by, or -1 if it 
+	 *  could not be prepared, in which case getPrepareError says why.
+	 */
+	int add( const JHSTD::string &regex );
+	
+	//! Number of REs in the set
+	int size() const { return mPatterns.size(); }
+	
+	/**
+	 * Find every RE that matches at the start of string.  As with 
+	 *  Regex::parse text may remain after the match.
+	 *
+	 * @param matches set to the indexes of the REs that matched, in order.
+	 * @return true if any matched.
+	 */
+	bool match( const JHSTD::string &string, JetHead::vector<int> &matches )
+	{
+		return match( string, matches, mAnchoredCache );
+	}
+	
+	//! Same as match but the REs may match anywhere in string.
+	bool search( const JHSTD::string &string, JetHead::vector<int> &matches )
+	{
+		return search( string, matches, mSearchCache );
+	}
+	
+	/**
+	 * Same as the above, but with the DFA and scratch space kept in cache.
+	 *  Any number of threads may call these at once, each with its own 
+	 *  cache.  A cache is best kept for either match or search, it starts 
+	 *  over when switched from one to the other.
+	 */
+	bool match( const JHSTD::string &string, JetHead::vector<int> &matches, 
+				RegexProgram::Cache &cache ) const;
+	bool search( const JHSTD::string &string, JetHead::vector<int> &matches,
+				 RegexProgram::Cache &cache ) const;
+	
+	//! Why the last failed add failed.
+	const Regex::RegexPrepareError &getPrepareError() { return mErrorData; }
+	
+private:
+	void compile( RegexProgram &program, bool search );
+	bool run( const RegexProgram &program, RegexProgram::Cache &cache, 
+			  const JHSTD::string &string, 
+			  JetHead::vector<int> &matches ) const;
+	
+	JetHead::vector<Regex*>	mPatterns;
+	Regex::RegexPrepareError mErrorData;
+	
+	RegexProgram	mAnchored;
+	RegexProgram	mSearch;
+	
+	// For match and search without a cache
+	RegexProgram::Cache	mAnchoredCache;
+	RegexProgram::Cache	mSearchCache;
+};
+
+#endif // JH_REGEXSET_H_
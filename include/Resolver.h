@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef JH_RESOLVER_H_
+#define JH_RESOLVER_H_
+
+#include "Socket.h"
+#include "EventThread.h"
+#include "Mutex.h"
+#include "Metrics.h"
+#include "jh_list.h"
+#include "jh_vector.h"
+
+/**
+ * @file Resolver.h
+ * @brief Host name lookups that don't block the caller and are cached.
+ *
+ * Lookups are done with getaddrinfo on a small pool of worker threads and the
+ *  results are sent back to the caller's dispatcher (a Selector or an 
+ *  EventThread) with an EventAgent, so the ResolverListener is always called
+ *  on the thread that asked.  Simultaneous lookups of the same name share one
+ *  call to getaddrinfo.
+ *
+ * Answers are kept for a fixed time (getaddrinfo doesn't tell us the real 
+ *  TTL) and failures are kept for a shorter time so that a missing host 
+ *  doesn't cost a trip to the DNS server every time it is asked for.  No 
+ *  global lock is held at any point, a slow name server only holds up the 
+ *  lookups that are waiting on it.
+ */
+
+namespace JetHead
+{
+	/**
+	 * Implemented by users of Resolver::resolveAsync.
+	 */
+	class ResolverListener
+	{
+	public:
+		/**
+		 * A lookup started by resolveAsync has finished.  Called on the 
+		 *  dispatcher that was passed to resolveAsync.
+		 *
+		 * @param name	The name that was looked up
+		 * @param error	0 on success or the EAI_* error from getaddrinfo
+		 * @param addrs	Every address found for name, port 0
+		 */
+		virtual void handleResolved( const char *name, int error,
+								const JetHead::vector<Socket::Address> &addrs ) = 0;
+		
+	protected:
+		virtual ~ResolverListener() {}
+	};
+	
+	class Resolver
+	{
+	public:
+		/**
+		 * Look up name, the way resolve does it, putting what was found in
+		 *  addrs and returning 0 or an EAI_* error.  Can be replaced with 
+		 *  setLookupFunction to test against a stub.
+		 */
+		typedef int (*LookupFunc)( const char *name, 
+								   JetHead::vector<Socket::Address> &addrs );
+		
+		//! How long a successful lookup is remembered, in ms
+		static const uint32_t kDefaultCacheTtl = 60 * 1000;
+
+		//! How long a failed lookup is remembered, in ms
+		static const uint32_t kDefaultNegativeTtl = 5 * 1000;
+		
+		//! Most names remembered at once
+		static const int kMaxCacheEntries = 256;
+		
+		//! Number of lookups that can be waiting on getaddrinfo at once
+		static const int kNumWorkers = 2;
+		
+		//! The Resolver used by Socket::Address::setAddress
+		static Resolver *getInstance();
+		
+		/**
+		 * Create a resolver with its own cache and workers.  Most code should
+		 *  share getInstance instead.  Must not be destroyed while any 
+		 *  resolveAsync calls are outstanding.
+		 */
+		Resolver( const char *name = "Resolver" );
+		~Resolver();
+		
+		/**
+		 * Look up name on this thread, using and filling the cache.  
+		 *
+		 * @return 0 or the EAI_* error from getaddrinfo
+		 */
+		int resolve( const char *name, JetHead::vector<Socket::Address> &addrs );
+		
+		/**
+		 * Look up name on a worker thread and call listener's 
+		 *  handleResolved on dispatcher's thread when done.  The listener is
+		 *  always called from dispatcher, never from inside this call, even 
+		 *  if the answer was in the cache.
+		 */
+		void resolveAsync( const char *name, ResolverListener *listener, 
+						   IEventDispatcher *dispatcher );
+		
+		/**
+		 * Forget every resolveAsync that will call listener.  If called on
+		 *  the listener's dispatcher's thread it is safe to delete listener
+		 *  straight afterwards.
+		 */
+		void cancel( ResolverListener *listener );
+		
+		//! Change how long answers are cached, in ms, 0 for not at all
+		void setCacheTtl( uint32_t positiveMs, uint32_t negativeMs );
+		
+		//! Forget everything cached
+		void flushCache();
+		
+		//! Replace getaddrinfo, NULL to go back to it
+		void setLookupFunction( LookupFunc func );
+		
+		/**
+		 * The default LookupFunc, IPv6 and IPv4 addresses from getaddrinfo 
+		 *  in the order it prefers them (see gai.conf).
+		 */
+		static int getaddrinfoLookup( const char *name, 
+									  JetHead::vector<Socket::Address> &addrs );
+		
+	private:
+		struct CacheEntry
+		{
+			JHSTD::string						mName;
+			int									mError;
+			JetHead::vector<Socket::Address>	mAddrs;
+			uint64_t							mExpires;
+		};
+		
+		struct Request
+		{
+			JHSTD::string						mName;
+			ResolverListener					*mListener;
+			IEventDispatcher					*mDispatcher;
+			int									mError;
+			JetHead::vector<Socket::Address>	mAddrs;
+			
+			//! Set once the results are on their way to mDispatcher
+			bool								mDone;
+			bool								mCancelled;
+		};
+		
+		//! Look in the cache, must hold mLock
+		bool findCached( const char *name, int &error, 
+						 JetHead::vector<Socket::Address> &addrs );
+		
+		//! Add to the cache, must hold mLock
+		void addCached( const char *name, int error, 
+						const JetHead::vector<Socket::Address> &addrs );
+		
+		//! Run on a worker to look up name for every Request waiting on it
+		void doLookup( JHSTD::string *name );
+		
+		//! Send req back to its dispatcher, must hold mLock
+		void complete( Request *req, int error, 
+					   const JetHead::vector<Socket::Address> &addrs );
+		
+		//! Run on the requester's dispatcher
+		void deliver( Request *req );
+		
+		const char						*mName;
+		Mutex							mLock;
+		
+		//! Started by the first resolveAsync
+		JetHead::vector<EventThread*>	mWorkers;
+		int								mNextWorker;
+		JetHead::vector<CacheEntry>		mCache;
+		JetHead::list<Request*>			mRequests;
+		uint32_t						mCacheTtl;
+		uint32_t						mNegativeTtl;
+		LookupFunc						mLookup;
+		
+		SmartPtr<Counter>				mLookups;
+		SmartPtr<Counter>				mCacheHits;
+		
+		static Resolver					*mSingleton;
+	};
+};
+
+#endif // JH_RESOLVER_H_
@@ -28,12 +28,18 @@
 #ifndef JH_SELECTOR_H_
 #define JH_SELECTOR_H_
 
-#include "jh_list.h"
+#include "jh_vector.h"
 #include "EventThread.h"
 #include "Mutex.h"
 
 #include <sys/poll.h>
 
+#ifdef __linux__
+//! Use epoll rather than poll so the cost of a wakeup doesn't grow with the
+//!  number of fds being watched.
+#define JH_SELECTOR_USE_EPOLL
+#endif
+
 /** This interface is must be implemented by any class that want to revieve 
  *   information about file events.  
  */
@@ -126,33 +132,20 @@ public:
 	 */
 	void removeListener( int fd, SelectorListener *listener );
 	
+	/**
+	 * Change the events an existing listener is interested in.  This is
+	 *  cheaper than removing and adding the listener, especially when called
+	 *  on the selector's thread.
+	 *
+	 * @param fd the file descriptor that was previously added.
+	 * @param listener the interface previously added.
+	 * @param events the new set of events to listen for.
+	 */
+	void setListenerEvents( int fd, SelectorListener *listener, short events );
+	
 private:
 	struct ListenerNode
 	{
-		//! Default constructor, does nothing
-		ListenerNode() {}
-
-		//! Things on this fd should be handled by this listener
-		ListenerNode( int fd, SelectorListener *listener ) : mFd( fd ), 
-			mListener( listener ) {}
-
-		//! Is this Listener the same as the other?
-		bool operator==( const ListenerNode &other )
-		{
-			// Must match FDs, and if listeners are non-NULL, they
-			// must match too.
-			if ( mFd == other.mFd and
-				( ( ( mListener == NULL) or ( other.mListener == NULL ) ) or
-					( mListener == other.mListener ) ) )
-			{
-				return true;
-			}
-			else
-			{
-				return false;
-			}
-		}
-		
 		//! The FD
 		int mFd;
 
@@ -164,6 +157,9 @@ private:
 
 		//! Some opaque private data that is passed back to the listener
 		jh_ptr_int_t mPrivateData;
+
+		//! The next listener on the same fd
+		ListenerNode *mNext;
 	};
 	
 	enum {
@@ -174,17 +170,44 @@ private:
 		PIPE_WRITER = 1
 	};
 	
-	//! How many FDs can one selector be polling at once?
-	static const int kMaxPollFds = 64;
+	//! How many fds can we get events for from one call to poll?
+	static const int kMaxEventsPerPoll = 256;
+
+	//! Set in mPolledEvents for fds that are in the poll set
+	static const int kPolled = 0x10000;
+
+	//! Set in mPolledEvents for fds that are already in mChangedFds
+	static const int kChanged = 0x20000;
+
+	//! Set in mPolledEvents for fds that are in mReadyFds
+	static const int kAlwaysReady = 0x40000;
 	
-	//! Trigger a call to fillPollFds when it is safe to do so
+	//! Trigger a call to updatePollSet when it is safe to do so
 	void updateListeners();	
 
-	//! Call everyone that is listening for events on this fd
-	bool callListeners( int fd, uint32_t events );
+	/**
+	 * Call everyone that is listening for events on this fd.  wakeTime is
+	 *  when poll returned and is used to report how long the callback waited.
+	 */
+	bool callListeners( int fd, uint32_t events, uint64_t wakeTime );
+
+	//! Bring the set of fds we poll on up to date with mFds
+	void updatePollSet();
 
-	//! Fill up the pollfds we will be calling poll on.
-	void fillPollFds( struct pollfd *fds, int &numFds );
+	/**
+	 * Wait for something to happen, fills in fds with up to maxFds fds that
+	 *  have events.  Returns the number of fds filled in or -1 on error.
+	 */
+	int waitForEvents( struct pollfd *fds, int maxFds );
+	
+	//! Get the first listener on fd, must hold mLock
+	ListenerNode *getListeners( int fd )
+	{
+		return ( fd >= 0 and (unsigned)fd < mFds.size() ) ? mFds[ fd ] : NULL;
+	}
+
+	//! Note that the listeners on fd have changed, must hold mLock
+	void fdChanged( int fd );
 	
 	// Event Dispatcher overrides
 
@@ -201,13 +224,33 @@ private:
 	const Thread *getDispatcherThread();
 	
 	/**
-	 * Find the ListenerNode corresponding to this fd (and optionally
-	 * this listener).
+	 * The listeners on each fd, indexed by fd.  Listeners on the same fd
+	 *  are chained through ListenerNode::mNext.
 	 */
-	ListenerNode *findListener( int fd, SelectorListener *listener = NULL );
-	
-	//! The list of ListenerNodes
-	JetHead::list<ListenerNode*> mList;
+	JetHead::vector<ListenerNode*> mFds;
+
+	//! Fds whose listeners have changed since the last updatePollSet
+	JetHead::vector<int> mChangedFds;
+
+	/**
+	 * What we are currently polling for on each fd, indexed by fd, plus the
+	 *  kPolled and kChanged flags.
+	 */
+	JetHead::vector<int> mPolledEvents;
+
+#ifdef JH_SELECTOR_USE_EPOLL
+	//! Our epoll instance
+	int				mEpollFd;
+
+	//! Fds epoll refused (regular files) which poll treats as always ready
+	JetHead::vector<struct pollfd> mReadyFds;
+#else
+	//! The set of fds we hand to poll, rebuilt by updatePollSet
+	JetHead::vector<struct pollfd> mPollFds;
+#endif
+
+	//! Bumped whenever a listener is removed, used by callListeners
+	uint32_t		mGeneration;
 
 	//! The lock on my internal state
 	Mutex			mLock;
@@ -229,7 +272,7 @@ private:
 	//! Am I running?
 	bool			mRunning;
 
-	//! Should I update the pollfds that I am polling on?
+	//! Should I update the fds that I am polling on?
 	bool			mUpdateFds;
 
 	/**
@@ -237,6 +280,18 @@ private:
 	 * have been properly handled
 	 */
 	Condition		mCondition;
+
+	//! Number of fds we are polling on (not counting our pipe)
+	SmartPtr<Gauge>		mFdsGauge;
+
+	//! Our contribution to mFdsGauge
+	int				mPolledFds;
+
+	//! Number of times poll has returned
+	SmartPtr<Counter>	mWakeups;
+
+	//! Micro seconds spent in each SelectorListener callback
+	SmartPtr<Histogram>	mCallbackTime;
 };
 
 #endif // JH_SELECTOR_H_
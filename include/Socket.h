@@ -41,6 +41,7 @@ namespace JetHead
 {
 	class Socket;
 	class ServerSocket;
+	class DatagramBatch;
 	
 	//! A socket listener gets a little more information about IO events than most
 	class SocketListener
@@ -82,6 +83,31 @@ namespace JetHead
 		 */
 		virtual bool handleClose(Socket *socket) { return false; }
 		
+		/**
+		 *	@brief Notify when a socket's write queue has drained
+		 *
+		 *	This method is called when data queued with writeAsync had
+		 *	grown past the socket's high watermark and has now been sent
+		 *	down to its low watermark.  It is a good time to queue more.
+		 *
+		 *	@param		socket		[in]		Socket that can take more data
+		 */
+		virtual void handleWritable(Socket *socket) {}
+		
+		/**
+		 *	@brief Notify when a burst of datagrams has been received
+		 *
+		 *	This method is called instead of handleData on a UDP socket
+		 *	that has had setReceiveBatch called.  Every datagram that was
+		 *	waiting (up to the batch's capacity) has already been read into
+		 *	batch, which belongs to the socket and is reused for the next
+		 *	burst.
+		 *
+		 *	@param		socket		[in]		Socket the datagrams arrived on
+		 *	@param		batch		[in]		The datagrams
+		 */
+		virtual void handleDatagrams(Socket *socket, DatagramBatch &batch) {}
+		
 		
 		/**
 		 *	@brief Notify when a ServerSocket receives a new connection
@@ -138,74 +164,100 @@ namespace JetHead
 	class Socket : public SelectorListener, public IReaderWriter
 	{
 	public:
-		//! A convenient representation of an (IP, port) pair
+		//! A convenient representation of an (IP, port) pair, IPv4 or IPv6
 		class Address
 		{
 		public:		
-			//! Default constructor (255.255.255.255, 0)
+			//! Default constructor (0.0.0.0, 0)
 			Address()
 			{
-				mAddr.sin_family = AF_INET;
-				mAddr.sin_port = 0;
-				mAddr.sin_addr.s_addr = INADDR_ANY;
-				mLen = sizeof( struct sockaddr_in );
+				setAny( AF_INET, 0 );
 			}
 			
-			//! Do a DNS lookup on this name, set port (or use 0 as a default)
+			/**
+			 * Take a numeric IPv4 or IPv6 address or do a DNS lookup on this
+			 *  name, set port (or use 0 as a default)
+			 */
 			Address( const char *name, int port = 0 )
 			{
-				mAddr.sin_family = AF_INET;
-				mAddr.sin_port = htons( port );
+				setAny( AF_INET, port );
 				setAddress( name );
-				mLen = sizeof( struct sockaddr_in );			
 			}			
 	
 			//! Set from an in_addr
 			Address( struct in_addr addr, int port = 0 )
 			{
-				mAddr.sin_family = AF_INET;
-				mAddr.sin_port = htons( port );
-				mAddr.sin_addr = addr;
-				mLen = sizeof( struct sockaddr_in );
+				setAny( AF_INET, port );
+				((struct sockaddr_in*)&mAddr)->sin_addr = addr;
+			}
+	
+			//! Set from an in6_addr
+			Address( const struct in6_addr &addr, int port = 0 )
+			{
+				setAny( AF_INET6, port );
+				((struct sockaddr_in6*)&mAddr)->sin6_addr = addr;
 			}
 	
-			//! Set the port, but not the IP address
-			explicit Address( int port )
+			//! Set the port, but not the IP address (0.0.0.0 or ::)
+			explicit Address( int port, int family = AF_INET )
 			{
-				mAddr.sin_family = AF_INET;
-				mAddr.sin_port = htons( port );						
-				mAddr.sin_addr.s_addr = INADDR_ANY;
-				mLen = sizeof( struct sockaddr_in );			
+				setAny( family, port );
 			}			
 	
+			//! Copy, as operator= does
+			Address( const Address &rhs )
+			{
+				memcpy( &mAddr, &rhs.mAddr, rhs.mLen );
+				mLen = rhs.mLen;
+			}
+	
 			//! Does nothing virtual destructor, avoid compiler warnings
 			~Address() {}
 			
-			//! Convert in_addr to dotted-quad string
+			//! AF_INET or AF_INET6
+			int getFamily() const { return mAddr.ss_family; }
+			
+			//! Is this an IPv6 address?
+			bool isIPv6() const { return mAddr.ss_family == AF_INET6; }
+			
+			//! Convert to a dotted-quad or IPv6 string
 			const char *getName() const
 			{
-				return inet_ntop( AF_INET, &mAddr.sin_addr, mName,
-								  INET_ADDRSTRLEN );
+				if ( isIPv6() )
+					return inet_ntop( AF_INET6, 
+						&((const struct sockaddr_in6*)&mAddr)->sin6_addr, 
+						mName, sizeof( mName ) );
+				
+				return inet_ntop( AF_INET, 
+					&((const struct sockaddr_in*)&mAddr)->sin_addr, 
+					mName, sizeof( mName ) );
 			}
 	
 			//! Get the port we are storing
-			uint16_t getPort() const { return ntohs( mAddr.sin_port ); }
+			uint16_t getPort() const 
+			{ 
+				// The port is in the same place for both families
+				return ntohs( ((const struct sockaddr_in*)&mAddr)->sin_port ); 
+			}
 			
-			//! Set the host (doing a DNS lookup)
+			/**
+			 * Set the host, keeping the port.  Numeric addresses of either 
+			 *  family are used as is, anything else is looked up with the 
+			 *  Resolver and the first address found is used.  If nothing is
+			 *  found the address is left as 0.0.0.0.
+			 */
 			void setAddress( const char *name );
 	
 			//! Set the port, performs endian conversion
 			void setPort( uint16_t port )
 			{
-				mAddr.sin_port = htons( port );						
+				((struct sockaddr_in*)&mAddr)->sin_port = htons( port );
 			}
 			
 			//! Be explicit about our assignment operator
 			Address& operator=(const Address& rhs)
 			{
-				mAddr.sin_family = rhs.mAddr.sin_family;
-				mAddr.sin_addr.s_addr = rhs.mAddr.sin_addr.s_addr;
-				mAddr.sin_port = rhs.mAddr.sin_port;
+				memcpy( &mAddr, &rhs.mAddr, rhs.mLen );
 				mLen = rhs.mLen;
 				return *this;
 			}
@@ -213,24 +265,45 @@ namespace JetHead
 			//! Compare for equality
 			bool operator == (const Address& rhs) const
 			{
-				return mAddr.sin_addr.s_addr == rhs.mAddr.sin_addr.s_addr and
-					mAddr.sin_port == rhs.mAddr.sin_port and
-					mLen == rhs.mLen;
+				if ( mLen != rhs.mLen or getFamily() != rhs.getFamily() or
+					 getPort() != rhs.getPort() )
+					return false;
+				
+				if ( isIPv6() )
+					return memcmp( 
+						&((const struct sockaddr_in6*)&mAddr)->sin6_addr,
+						&((const struct sockaddr_in6*)&rhs.mAddr)->sin6_addr,
+						sizeof( struct in6_addr ) ) == 0;
+				
+				return ((const struct sockaddr_in*)&mAddr)->sin_addr.s_addr == 
+					((const struct sockaddr_in*)&rhs.mAddr)->sin_addr.s_addr;
 			}
 			
 		private:
 			//! Initialize from a sockaddr
-			Address( const struct sockaddr_in *addr, int len )
+			Address( const struct sockaddr *addr, int len )
 			{
 				setSockaddr( addr, len );
 			}
 	
 			//! Copy out of a sockaddr
-			void setSockaddr( const struct sockaddr_in *addr, int len )
+			void setSockaddr( const struct sockaddr *addr, int len )
 			{
+				if ( len > (int)sizeof( mAddr ) )
+					len = sizeof( mAddr );
 				memcpy( &mAddr, addr, len );
 				mLen = len;
 			}
+			
+			//! Set to the wildcard address of family
+			void setAny( int family, int port )
+			{
+				memset( &mAddr, 0, sizeof( mAddr ) );
+				mAddr.ss_family = family;
+				mLen = family == AF_INET6 ? sizeof( struct sockaddr_in6 ) : 
+					sizeof( struct sockaddr_in );
+				setPort( port );
+			}
 	
 			//! Convert to const sockaddr*
 			const struct sockaddr *getAddr( int &len ) const 
@@ -240,17 +313,19 @@ namespace JetHead
 			}
 			
 			//! Our host
-			struct sockaddr_in	mAddr;
+			struct sockaddr_storage	mAddr;
 	
-			//! The size of mAddr
-			int					mLen;
+			//! The size of what is in mAddr
+			int						mLen;
 	
 			//! Used to hold the value returned by getName()
-			mutable char		mName[INET_ADDRSTRLEN];
+			mutable char			mName[INET6_ADDRSTRLEN];
 			
 			friend class Socket;
 			friend class ServerSocket;
 			friend class MulticastSocket;
+			friend class DatagramBatch;
+			friend class Resolver;
 		};
 	
 		//! Default constructor, uses TCP unless told otherwise
@@ -262,9 +337,40 @@ namespace JetHead
 		//! Connect to this host/port
 		int connect( const Socket::Address &addr );
 	
-		//! Connect to this host/port, unless it takes too long
+		/**
+		 * Connect to this host/port, unless it takes more than timeout 
+		 *  seconds.  A timeout of 0 doesn't wait, so only a connection made
+		 *  at once succeeds.
+		 */
 		int connect( const Socket::Address &addr, int timeout );
 		
+		/**
+		 * Connect to this host/port, unless it takes more than msecs.  On 
+		 *  timeout returns -1 with errno set to ETIMEDOUT.  msecs of 0 or
+		 *  less waits as long as the connect takes.
+		 */
+		int connectMs( const Socket::Address &addr, int msecs );
+		
+		/**
+		 * Connect to the first of addrs that answers, trying them in order
+		 *  but starting the next attempt kConnectAttemptDelay ms after the 
+		 *  last rather than waiting for it to fail ("Happy Eyeballs", RFC 
+		 *  8305).  A slow or broken path to one address family costs a 
+		 *  short delay rather than a full connect timeout.  msecs of 0 
+		 *  waits until every attempt has failed.
+		 */
+		int connectMs( const JetHead::vector<Socket::Address> &addrs, int msecs );
+		
+		/**
+		 * Look up host and connect to port on it as above, alternating 
+		 *  between the IPv6 and IPv4 addresses found starting with the 
+		 *  family the resolver preferred.
+		 */
+		int connect( const char *host, int port, int msecs = 0 );
+		
+		//! How long to give one connect attempt before starting the next
+		static const int kConnectAttemptDelay = 250;
+		
 		//! Connect, will trigger a call to handleConnect if/when successful
 		int connectAsync( const Socket::Address& addr );
 	
@@ -287,6 +393,74 @@ namespace JetHead
 	
 		//! Write 'len' bytes to the socket.  Return the number actually written.
 		int write( const void *buffer, int len );
+		
+		/**
+		 * 	Write count buffers with one sendmsg.  Blocks and times out just
+		 * 	like write.  Return the number of bytes actually written.
+		 */
+		int writev( const struct iovec *iov, int count );
+		
+		/**
+		 * 	@brief Write without blocking, queueing whatever the socket won't
+		 * 	take right now
+		 *
+		 * 	The queued data is sent from the selector's thread when the socket
+		 * 	becomes writable.  Small writes are coalesced and the queue is
+		 * 	flushed with one scatter-gather send per wakeup.  Nothing is ever
+		 * 	dropped, so callers should stop writing while isWriteBlocked()
+		 * 	and wait for SocketListener::handleWritable.
+		 *
+		 * 	Only works on a connected TCP socket with a selector and listener.
+		 * 	If called from a thread other than the selector's the call is
+		 * 	passed to the selector's thread and waits for it.
+		 *
+		 * 	@return len, or -1 if the socket can't be written to
+		 */
+		int writeAsync( const void *buffer, int len );
+		
+		/**
+		 * The queue under writeAsync, for callers that watch the socket 
+		 *  from their own selector listener (as TcpConnection does) and 
+		 *  call flushWriteQueue when it is writable.  Writes what the 
+		 *  socket will take without blocking and queues the rest, keeping 
+		 *  no more than limit bytes queued if limit is above 0.  Passing
+		 *  the high watermark or the limit makes isWriteBlocked true.
+		 *
+		 * @return the number of bytes written or queued, less than len if
+		 *  the limit was reached, or -1 if the socket failed
+		 */
+		int writeQueued( const void *buffer, int len, int limit = 0 );
+		
+		//! Send as much of the queue as the socket will take, -1 on error
+		int flushWriteQueue();
+		
+		/**
+		 * Once a blocked queue has drained to the low watermark clear 
+		 *  isWriteBlocked and return true, the time to tell whoever is 
+		 *  writing that it can go on (writeAsync calls handleWritable).
+		 */
+		bool checkWriteDrained();
+		
+		//! Number of bytes queued by writeAsync that have not been sent yet
+		int getPendingWrite() const;
+		
+		/**
+		 * Has the write queue grown past the high watermark?  Stays true 
+		 *  until it drains down to the low watermark.
+		 */
+		bool isWriteBlocked() const { return mWriteBlocked; }
+		
+		/**
+		 * Set the write queue sizes, in bytes, at which isWriteBlocked 
+		 *  becomes true (high) and handleWritable is called (low).
+		 */
+		void setWriteWatermarks( int low, int high );
+		
+		//! Default low watermark for the writeAsync queue
+		static const int kDefaultLowWatermark = 16 * 1024;
+		
+		//! Default high watermark for the writeAsync queue
+		static const int kDefaultHighWatermark = 64 * 1024;
 	
 		//! Call recvfrom (get some data, tell me who it is from)
 		int recvfrom(void* buf, int len, Socket::Address& addr, int flags=0);
@@ -331,6 +505,83 @@ namespace JetHead
 		 */
 		int sendmsg(const JetHead::vector<iovec> &buffers,
 					const Socket::Address *addr = NULL, int flags=0);
+		
+		//! As above, for count buffers that aren't in a vector
+		int sendmsg(const struct iovec *buffers, int count,
+					const Socket::Address *addr = NULL, int flags=0);
+		
+		/**
+		 * 	@brief Receive as many datagrams as are waiting into batch
+		 *
+		 * 	Uses recvmmsg(2) where it exists so a whole burst costs one
+		 * 	system call.  Waits (subject to the read timeout) for the first
+		 * 	datagram unless flags has MSG_DONTWAIT, but never for the rest.
+		 * 	Anything already in batch is replaced.
+		 *
+		 * 	@return Number of datagrams received or -1 on error
+		 */
+		int recvmmsg(DatagramBatch &batch, int flags=0);
+		
+		/**
+		 * 	@brief Send the datagrams in batch starting at first
+		 *
+		 * 	Uses sendmmsg(2) where it exists.  The socket may not take them
+		 * 	all, call again with first moved on by the return value to send
+		 * 	the rest.
+		 *
+		 * 	@return Number of datagrams sent or -1 on error
+		 */
+		int sendmmsg(const DatagramBatch &batch, int first=0, int flags=0);
+		
+		/**
+		 * 	@brief Read datagrams in bursts when our selector says we are
+		 * 	readable and hand them to SocketListener::handleDatagrams
+		 *
+		 * 	@param count most datagrams read per burst, 0 goes back to
+		 * 	calling handleData
+		 * 	@param maxSize largest datagram expected, longer ones are
+		 * 	truncated
+		 */
+		void setReceiveBatch(int count, int maxSize=kDefaultDatagramSize);
+		
+		/**
+		 * 	@brief Have the kernel timestamp received datagrams (SO_TIMESTAMP)
+		 *
+		 * 	Without this DatagramBatch timestamps are the time recvmmsg
+		 * 	returned rather than the time each datagram arrived.
+		 */
+		int setReceiveTimestamps(bool enable);
+		
+		//! Big enough for anything that fits in an ethernet frame
+		static const int kDefaultDatagramSize = 1500;
+	
+		/**
+		 * 	@brief Send len bytes of file starting at offset
+		 *
+		 * 	Uses sendfile(2) so the data goes from the page cache to the 
+		 * 	socket without being copied through user space, falling back to
+		 * 	reading and writing where that isn't possible.  The file's 
+		 * 	position is not changed.  Honours the write timeout; on a 
+		 * 	non-blocking socket sends what fits.
+		 *
+		 * 	@return Number of bytes sent, or -1 if nothing could be sent
+		 */
+		int64_t sendFile( File &file, jh_off64_t offset, int64_t len );
+		
+		/**
+		 * 	@brief Receive len bytes straight into file at its current 
+		 * 	position
+		 *
+		 * 	Uses splice(2) through a pipe kept by the socket so the data 
+		 * 	isn't copied through user space, falling back to reading and
+		 * 	writing where that isn't possible.  Stops early at end of 
+		 * 	stream.  Honours the read timeout; on a non-blocking socket takes
+		 * 	what is there.
+		 *
+		 * 	@return Number of bytes received, or -1 if nothing could be 
+		 * 	received because of an error
+		 */
+		int64_t spliceTo( File &file, int64_t len );
 	
 		//! Close the socket
 		JetHead::ErrCode close();
@@ -382,11 +633,47 @@ namespace JetHead
 		static int getHardwareAddress(	const char *if_name,
 										char *out_addr );
 	
-		//! Set the amount of time we are willing to wait on a read
-		void setReadTimeout(int t) { mReadTimeout = t; }
+		//! Set the amount of time, in seconds, we are willing to wait on a read
+		void setReadTimeout(int t) { mReadTimeout = t * 1000; }
+		
+		/**
+		 * Set the amount of time, in milliseconds, read and recvfrom will wait
+		 *  for data.  0 waits forever.  On timeout they return -1 with errno
+		 *  set to ETIMEDOUT.
+		 */
+		void setReadTimeoutMs( int msecs ) { mReadTimeout = msecs; }
+		
+		/**
+		 * Set the amount of time, in milliseconds, write will wait for the 
+		 *  socket to take all of the data.  0 waits forever.  On timeout
+		 *  write returns what it managed to send, or -1 with errno set to 
+		 *  ETIMEDOUT if that was nothing.
+		 */
+		void setWriteTimeoutMs( int msecs ) { mWriteTimeout = msecs; }
+		
+		/**
+		 * Put the socket in (or take it out of) non-blocking mode.  When 
+		 *  non-blocking, read, write and accept return -1 with errno set to
+		 *  EAGAIN rather than waiting.
+		 *
+		 * @return 0 on success, -1 on error
+		 */
+		int setNonBlocking( bool nonBlocking );
+		
+		//! Are we in non-blocking mode?
+		bool isNonBlocking() const { return mNonBlocking; }
+		
+		//! Total bytes received on this socket
+		uint64_t getBytesRead() const { return mBytesRead; }
+
+		//! Total bytes sent on this socket
+		uint64_t getBytesWritten() const { return mBytesWritten; }
 		
 		//! Are we TCP?  
 		bool isSockStream() const { return mSockStream; }
+		
+		//! AF_INET or AF_INET6, follows the address we connect or bind to
+		int getFamily() const { return mFamily; }
 	
 		/**
 		 * @brief Set keepalive checking
@@ -407,6 +694,14 @@ namespace JetHead
 		 * @return true if OK, false if an error occurred
 		 */
 		bool setKeepAlive(int timeout);
+		
+		/**
+		 * Turn off (or back on) Nagle's algorithm (see TCP_NODELAY) so small
+		 *  writes go out without waiting for the last one to be acked.
+		 *
+		 * @return 0 on success, -1 on error
+		 */
+		int setNoDelay( bool noDelay );
 	
 		/**
 		 * @brief Check the health of the socket based on the given
@@ -433,6 +728,18 @@ namespace JetHead
 		 */
 		int checkSocketHealth(uint32_t thresholdSeconds = 15);
 		
+		/**
+		 * @brief Check that an idle connection can still be used
+		 *
+		 * Meant for connections kept open between requests, such as 
+		 * HttpConnectionPool's.  Doesn't block or consume anything.
+		 *
+		 * @return false if the socket isn't connected, the peer has
+		 * closed or reset it, or there is data waiting that nobody asked
+		 * for.
+		 */
+		bool isIdleUsable();
+		
 	protected:
 		//! Wrap the supplied fd, which better be a socket
 		Socket( int fd );
@@ -480,23 +787,168 @@ namespace JetHead
 	
 		//! Are we a TCP socket?
 		bool mSockStream;
+		
+		//! The address family mFd was created with
+		int mFamily;
+
+		//! Has setNonBlocking( true ) been called?
+		bool mNonBlocking;
 	
 		//! Pointer to parent socket (set by ServerSocket, default self)
 		Socket		*mParent;
 		
 		/**
 		 * Do we have a read timeout?  If 0, no biggie, if non-zero, wait
-		 * at most that many seconds for a read.
+		 * at most that many milliseconds for a read.
 		 */
 		int mReadTimeout;
+
+		//! Same as mReadTimeout but for writes
+		int mWriteTimeout;
+		
+		/**
+		 * Wait until one of events is ready on our fd or it is deadline 
+		 *  (a getMonotonicMicros time).  Returns 1 if ready, 0 on timeout
+		 *  (with errno set to ETIMEDOUT) or -1 on error.
+		 */
+		int waitForEvents( short events, uint64_t deadline );
+		
+		//! Work out the deadline for a timeout in msecs from now
+		static uint64_t getDeadline( int msecs );
+		
+		//! Connect, giving up at deadline as waitForEvents does
+		int connectBy( const Socket::Address &addr, uint64_t deadline );
 	
 		//! The last address we read from (ONLY for UDP sockets)
 		Address mLastDatagramSender;
+
+		//! Update byte counts after a successful read, returns res
+		int countRead( int res );
+
+		//! Update byte counts after a successful write, returns res
+		int countWritten( int res );
+		
+		//! Most buffers writev will step through itself with a timeout set
+		static const int kMaxWritevBuffers = 16;
+
+		//! Bytes received, also published as jh_socket_bytes_read_total
+		uint64_t mBytesRead;
+
+		//! Bytes sent, also published as jh_socket_bytes_written_total
+		uint64_t mBytesWritten;
+		
+		//! Data waiting to go out, see writeAsync
+		struct WriteQueue;
+
+		//! Created by the first write that has to queue
+		WriteQueue *mWriteQueue;
+		
+		int mLowWatermark;
+		int mHighWatermark;
+		
+		//! Set when the queue passes mHighWatermark
+		bool mWriteBlocked;
+		
+		//! Listen for POLLOUT only while there is something queued
+		void updateWriteEvents();
+		
+		/**
+		 * Sockets are created for IPv4.  When we are asked to connect or bind
+		 *  to an address of another family swap mFd for a socket of that
+		 *  family, keeping the fd number and any options already set.
+		 */
+		int setFamily( int family );
+		
+		//! Carry the options we know about from one socket to another
+		static void copySocketOptions( int from, int to );
+		
+		//! Make fd our socket, it must be connected if we are TCP
+		void adoptFd( int fd, int family );
+		
+		//! Used by spliceTo, opened on first use
+		int mSplicePipe[ 2 ];
+		
+		//! Wait for events unless we are non-blocking, see sendFile
+		int waitIfBlocking( short events, uint64_t deadline );
+		
+		//! sendFile and spliceTo when the zero-copy calls can't be used
+		int64_t copyToSocket( int fd, jh_off64_t offset, int64_t len, 
+							  uint64_t deadline );
+		int64_t copyFromSocket( int fd, int64_t len, uint64_t deadline );
+		
+		//! Used by processFileEvents, see setReceiveBatch
+		DatagramBatch *mReceiveBatch;
 	
 		// This is needed so that accept can call the protected constructor 
 		//  and setConnected on the new socket that it creates.  Looks like a 
 		//  derived class can call protected methods only on itself.  (BP)
 		friend class ServerSocket;
+		
+		// Drives the fd directly from its own selector listener
+		friend class TcpConnection;
+	};
+	
+	/**
+	 * A preallocated ring of datagram buffers, each with the address it came 
+	 *  from or is going to and the time it was received.  Used with 
+	 *  Socket::recvmmsg and Socket::sendmmsg to move many datagrams per 
+	 *  system call.  Nothing is allocated after construction.
+	 */
+	class DatagramBatch
+	{
+	public:
+		//! Room for count datagrams of up to maxSize bytes each
+		DatagramBatch( int count, int maxSize = Socket::kDefaultDatagramSize );
+		~DatagramBatch();
+		
+		//! Number of datagrams held
+		int size() const { return mSize; }
+		
+		//! Most datagrams that can be held
+		int capacity() const { return mCapacity; }
+		
+		//! Largest datagram that can be held
+		int getMaxSize() const { return mMaxSize; }
+		
+		//! Forget all the datagrams held
+		void clear() { mSize = 0; }
+		
+		/**
+		 * Copy a datagram in to be sent to addr, or to the connected peer if
+		 *  addr is NULL.  Returns -1 if full or len is more than getMaxSize.
+		 */
+		int add( const void *data, int len, const Socket::Address *addr = NULL );
+		
+		//! The bytes of datagram i
+		const uint8_t *getData( int i ) const;
+		
+		//! Length of datagram i
+		int getLength( int i ) const;
+		
+		//! Where datagram i came from
+		const Socket::Address &getAddress( int i ) const;
+		
+		//! When datagram i was received, in microseconds since the epoch
+		uint64_t getTimestamp( int i ) const;
+		
+		//! Was datagram i longer than getMaxSize (and so cut short)?
+		bool isTruncated( int i ) const;
+		
+	private:
+		// No copying
+		DatagramBatch( const DatagramBatch& );
+		DatagramBatch &operator=( const DatagramBatch& );
+		
+		//! Per datagram header, control and bookkeeping
+		struct Message;
+		
+		Message		*mMessages;
+		uint8_t		*mData;
+		int			mCapacity;
+		int			mMaxSize;
+		int			mSize;
+		
+		friend class Socket;
 	};
 	
 	class ServerSocket : public Socket
@@ -510,6 +962,13 @@ namespace JetHead
 	
 		//! Bind to this address.  You probably want Socket::Address(int port)
 		int bind( const Socket::Address &addr );
+		
+		/**
+		 * Bind to port on every IPv6 and IPv4 address.  Uses one IPv6 socket
+		 *  that also accepts IPv4 (as IPv4-mapped addresses), or falls back 
+		 *  to IPv4 only if the system has no IPv6.
+		 */
+		int bindDualStack( int port );
 	
 		//! Listen for at most this many UNACCEPTED connections
 		int listen( int backlog );
@@ -517,6 +976,22 @@ namespace JetHead
 		//! Block, waiting for the next incoming connection, and return that to me.
 		Socket *accept();
 		
+		/**
+		 * Allow other sockets to bind to the same address and port (see 
+		 *  SO_REUSEPORT), the kernel will spread incoming connections between
+		 *  them.  Must be called before bind.
+		 *
+		 * @return 0 on success, -1 on error
+		 */
+		int setReusePort( bool reuse );
+		
+		/**
+		 * When non-blocking, the most connections we will accept each time
+		 *  the selector tells us there are some waiting.
+		 */
+		static const int kMaxAcceptsPerEvent = 64;
+
+		
 	protected:
 		//! Handle IO from the selector
 		void processFileEvents( int fd, short events, jh_ptr_int_t private_data );
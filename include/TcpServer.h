@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef JH_TCPSERVER_H_
+#define JH_TCPSERVER_H_
+
+#include "Socket.h"
+#include "Selector.h"
+#include "Metrics.h"
+#include "Condition.h"
+#include "jh_vector.h"
+
+/**
+ * @file TcpServer.h
+ * @brief A TCP server that spreads its connections over a pool of selectors.
+ *
+ * A TcpServer accepts connections on one or more acceptor threads and hands
+ *  each new connection off to one of a fixed pool of worker Selectors, round
+ *  robin.  From then on everything about that connection happens on that 
+ *  worker's thread, so a TcpServerListener never has to lock per connection
+ *  state.  All sockets are non-blocking; writes that the kernel won't take are
+ *  queued per connection and flushed when the socket becomes writable.  
+ *
+ * Serving large numbers of connections (tens of thousands) mostly requires
+ *  raising the process's open file limit (RLIMIT_NOFILE), each connection 
+ *  only costs a few hundred bytes until it has to queue writes.
+ */
+
+namespace JetHead
+{
+	class TcpServer;
+	class TcpConnection;
+	
+	/**
+	 * Implemented by the user of a TcpServer.  Every method is called on the 
+	 *  thread of the worker that owns the connection.
+	 */
+	class TcpServerListener
+	{
+	public:
+		/**
+		 * A new connection has been accepted.  Return false to close it 
+		 *  straight away, handleClose will not be called for it.
+		 */
+		virtual bool handleConnection( TcpConnection *conn ) { return true; }
+		
+		//! There is data to read on conn.
+		virtual void handleData( TcpConnection *conn ) = 0;
+
+		/**
+		 * A write on conn had to stop (see TcpConnection::write) and the
+		 *  queued data has now drained below the low watermark.
+		 */
+		virtual void handleWritable( TcpConnection *conn ) {}
+		
+		/**
+		 * conn is closed, by either side or because it was idle, and will be
+		 *  deleted when this returns.
+		 */
+		virtual void handleClose( TcpConnection *conn ) {}
+		
+		/**
+		 * The server is stopping, finish up with conn and close it.  The 
+		 *  default closes it right away.
+		 */
+		virtual void handleDrain( TcpConnection *conn );
+		
+	protected:
+		//! Virtual does-nothing destructor to avoid compiler warning
+		virtual ~TcpServerListener() {}
+	};
+	
+	/**
+	 * One connection accepted by a TcpServer.  Only use it from the thread of
+	 *  the worker that owns it, i.e. from TcpServerListener callbacks or from
+	 *  events sent to getSelector().  The TcpServer deletes it once it closes.
+	 */
+	class TcpConnection : public SelectorListener
+	{
+	public:
+		/**
+		 * Read up to len bytes.  
+		 *
+		 * @return the number of bytes read, 0 if there is nothing to read 
+		 *  right now or -1 if the other side has closed or the connection 
+		 *  failed.  In that case the connection will be closed once the
+		 *  current callback returns.
+		 */
+		int read( void *buffer, int len );
+		
+		/**
+		 * Write len bytes.  Whatever the socket won't take right away is 
+		 *  queued.  If the queue fills, or grows past the high watermark, we
+		 *  stop reading from the connection until it drains below the low
+		 *  watermark and handleWritable is called.
+		 *
+		 * @return the number of bytes written or queued, less than len if 
+		 *  the queue is full, -1 if the connection is closing or failed.
+		 */
+		int write( const void *buffer, int len );
+		
+		/**
+		 * Send len bytes of file from offset straight to the socket (see
+		 *  Socket::sendFile) without copying them through the write queue.
+		 *  Nothing is sent until anything queued has gone.  If the socket 
+		 *  won't take it all we stop reading from the connection and call
+		 *  handleWritable when it can take more, as for write.
+		 *
+		 * @return the number of bytes sent, maybe 0, or -1 if the connection
+		 *  is closing or failed.
+		 */
+		int64_t sendFile( File &file, jh_off64_t offset, int64_t len );
+		
+		/**
+		 * Stop (or start again) reading from the connection, for when the
+		 *  listener can't take any more for now.
+		 */
+		void setReadPaused( bool paused );
+		
+		//! Number of bytes waiting to be read from the socket, -1 on error
+		int getBytesAvailable() { return mSocket->getBytesAvailable(); }
+		
+		//! Number of bytes written but not yet handed to the socket.
+		int getPendingWrite() const { return mSocket->getPendingWrite(); }
+		
+		//! Are we waiting for the write queue to drain?
+		bool isWriteBlocked() const { return mWriteBlocked; }
+		
+		/**
+		 * Close once everything queued has been written.  Nothing more will
+		 *  be read from or may be written to the connection.
+		 */
+		void close();
+		
+		//! Close now, throwing away anything queued.
+		void abort();
+		
+		//! Get the address of the other side of the connection
+		int getRemoteAddress( Socket::Address &addr ) 
+		{ 
+			return mSocket->getRemoteAddress( addr ); 
+		}
+		
+		//! Turn Nagle's algorithm off (or back on), see Socket::setNoDelay
+		int setNoDelay( bool noDelay ) 
+		{ 
+			return mSocket->setNoDelay( noDelay ); 
+		}
+		
+		//! Set the opaque private data associated with this connection
+		void setPrivateData( jh_ptr_int_t pd ) { mPrivateData = pd; }
+		
+		//! Get back the private data associated with this connection
+		jh_ptr_int_t getPrivateData() const { return mPrivateData; }
+		
+		//! The selector (and thread) this connection lives on
+		Selector *getSelector();
+		
+		//! The server that accepted this connection
+		TcpServer *getServer() { return mServer; }
+		
+	private:
+		struct Worker;
+		
+		TcpConnection( TcpServer *server, Worker *worker, Socket *socket );
+		virtual ~TcpConnection();
+
+		//! For SelectorListener
+		void processFileEvents( int fd, short events, 
+								jh_ptr_int_t private_data );
+
+		//! Write as much of the queue as the socket will take
+		void flush();
+
+		//! Tell our selector what we now want to hear about
+		void updateEvents();
+
+		//! Tear down, unless we are in a callback then do it when it returns
+		void destroy();
+
+		//! Called around user callbacks so they can close us safely
+		void enterCallback() { mCallbackDepth++; }
+		void leaveCallback();
+
+		//! Note activity for the idle timeout
+		void touch();
+
+		TcpServer		*mServer;
+		Worker			*mWorker;
+		
+		//! Queues what it won't take right away, see Socket::writeQueued
+		Socket			*mSocket;
+		
+		//! The events we are registered with our selector for
+		short			mEvents;
+		
+		int				mCallbackDepth;
+		bool			mWriteBlocked;
+		bool			mWaitWritable;
+		bool			mReadPaused;
+		bool			mClosing;
+		bool			mPeerClosed;
+		bool			mDestroyPending;
+		bool			mAccepted;
+		
+		jh_ptr_int_t	mPrivateData;
+		
+		//! Last time (getMonotonicMicros) we read or wrote
+		uint64_t		mLastActivity;
+
+		//! Our worker's connections, least recently active first
+		TcpConnection	*mPrev;
+		TcpConnection	*mNext;
+		
+		friend class TcpServer;
+	};
+
+	class TcpServer : protected SocketListener
+	{
+	public:
+		//! Default size of a connection's write queue
+		static const int kDefaultWriteBufferSize = 64 * 1024;
+		
+		/**
+		 * Create a server.  Nothing happens until start is called.
+		 *
+		 * @param listener told about everything that happens on connections.
+		 * @param numWorkers how many worker selectors to spread connections
+		 *  over, 0 means one per processor.
+		 * @param numAcceptors how many sockets (each on their own selector)
+		 *  to accept connections on.  More than one needs SO_REUSEPORT.
+		 * @param name used for thread and metrics names.
+		 */
+		TcpServer( TcpServerListener *listener, int numWorkers = 0,
+				   int numAcceptors = 1, const char *name = "TcpServer" );
+		
+		//! Stops the server (without draining) if it is still running
+		virtual ~TcpServer();
+		
+		/**
+		 * Start accepting connections.  If addr's port is 0 the OS will pick
+		 *  one, use getPort to find out which.
+		 *
+		 * @return 0 on success, -1 if we couldn't bind or listen.
+		 */
+		int start( const Socket::Address &addr, int backlog = 1024 );
+		
+		/**
+		 * Stop accepting connections, ask the listener to drain every open 
+		 *  connection and wait up to drainMs for them all to close.  Anything
+		 *  still open after that is aborted.  Must not be called from a 
+		 *  worker thread.
+		 */
+		void stop( uint32_t drainMs = 0 );
+		
+		//! The port we are listening on, or 0 if we are not started.
+		int getPort() const { return mPort; }
+		
+		//! Number of currently open connections.
+		int getNumConnections() const { return mNumConnections; }
+
+		//! Number of worker selectors
+		int getNumWorkers() const { return mWorkers.size(); }
+		
+		/**
+		 * Close connections that have not read or written anything for 
+		 *  msecs.  0, the default, disables the idle timeout.  Call before 
+		 *  start.
+		 */
+		void setIdleTimeout( uint32_t msecs ) { mIdleTimeout = msecs; }
+		
+		//! Set the most that will be queued for any one connection
+		void setWriteBufferSize( int size ) { mWriteBufferSize = size; }
+		
+		/**
+		 * Stop reading from a connection when more than high bytes are 
+		 *  queued for it and start again (calling handleWritable) when it 
+		 *  drains to low bytes.  The defaults are the write buffer size and
+		 *  a quarter of it.  Only applies to connections accepted after the
+		 *  call.
+		 */
+		void setWriteWatermarks( int low, int high );
+		
+	private:
+		typedef TcpConnection::Worker Worker;
+		
+		//! For SocketListener, called on an acceptor thread
+		bool handleAccept( ServerSocket *server, Socket *socket );
+		void handleData( Socket *socket ) {}
+		
+		//! Called by a connection as it goes away
+		void connectionClosed();
+		
+		//! Close and delete the acceptors and their selectors
+		void stopAcceptors();
+		
+		TcpServerListener	*mListener;
+		JHSTD::string		mName;
+		int					mNumAcceptors;
+		
+		JetHead::vector<Worker*>		mWorkers;
+		JetHead::vector<Selector*>		mAcceptSelectors;
+		JetHead::vector<ServerSocket*>	mAcceptors;
+		
+		//! Used to pick the next worker, round robin
+		volatile uint32_t	mNextWorker;
+		
+		volatile int		mNumConnections;
+		volatile bool		mStopping;
+		int					mPort;
+		
+		uint32_t			mIdleTimeout;
+		int					mWriteBufferSize;
+
+		//! -1 until setWriteWatermarks, then the defaults no longer apply
+		int					mLowWatermark;
+		int					mHighWatermark;
+		
+		int getLowWatermark() const 
+		{ 
+			return mLowWatermark >= 0 ? mLowWatermark : mWriteBufferSize / 4;
+		}
+		
+		int getHighWatermark() const 
+		{ 
+			return mHighWatermark >= 0 ? mHighWatermark : mWriteBufferSize;
+		}
+		
+		//! Protects nothing but is needed to wait for connections to drain
+		Mutex				mLock;
+		Condition			mDrained;
+		
+		SmartPtr<Gauge>		mConnectionsGauge;
+		SmartPtr<Counter>	mAccepted;
+		
+		friend class TcpConnection;
+	};
+};
+
+#endif // JH_TCPSERVER_H_
@@ -30,6 +30,7 @@
 
 #include <stdint.h>
 #include <sys/time.h>
+#include <time.h>
 
 namespace TimeUtils
 {
@@ -78,6 +79,24 @@ namespace TimeUtils
 #endif		
 	}
 
+	/**
+	 * Get a time in micro seconds that only moves forward, suitable for
+	 *  measuring how long something took.  Falls back to the wall clock
+	 *  where there is no monotonic clock.
+	 */
+	inline uint64_t getMonotonicMicros()
+	{
+#ifdef CLOCK_MONOTONIC
+		struct timespec t;
+		clock_gettime( CLOCK_MONOTONIC, &t );
+		return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+#else
+		struct timeval tv;
+		gettimeofday( &tv, NULL );
+		return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+	}
+
 	inline void setTimeStruct( struct timespec *t, uint32_t msecs )
 	{
 		t->tv_sec = msecs / 1000;
@@ -33,6 +33,7 @@
 #include "Mutex.h"
 #include "TimerManager.h"
 #include "jh_list.h"
+#include "Metrics.h"
 
 class TimerListener
 {
@@ -242,6 +243,9 @@ protected:
 
 	//! Number of ticks we have seen
 	uint32_t mTicks;
+
+	//! Number of nodes in mList, published as jh_timer_pending
+	SmartPtr<Gauge> mPending;
 };
 
 #endif // JH_TIMER_H_
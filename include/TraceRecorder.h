@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef JH_TRACERECORDER_H_
+#define JH_TRACERECORDER_H_
+
+#include "jh_types.h"
+#include "TimeUtils.h"
+
+#include <stdio.h>
+
+/**
+ * @file TraceRecorder.h
+ * @brief Record timed spans and event flows for viewing in a trace viewer.
+ *
+ * While recording is started every thread that records something gets its
+ *  own fixed size ring buffer of trace records.  Only the owning thread ever
+ *  writes to a buffer so recording takes no locks, it is a couple of stores
+ *  and a clock read.  When a buffer fills the oldest records are overwritten.
+ *
+ * The recording can be written out in the Chrome trace event JSON format
+ *  which can be loaded by chrome://tracing or https://ui.perfetto.dev.  Spans
+ *  show up as slices on the thread that ran them and events sent through an
+ *  EventQueue show up as flow arrows from the sending thread to the slice in 
+ *  which the dispatcher handled them.
+ *
+ * When built with JH_TRACE_EVENTS every TRACE_BEGIN also records a span for
+ *  the function it is in.  Without it only the event system records spans.
+ */
+class TraceRecorder
+{
+public:
+	//! Number of records kept per thread unless start is told otherwise.
+	static const int kDefaultRecordsPerThread = 16384;
+
+	//! Used for spans that have no argument
+	static const int64_t kNoArg = INT64_MIN;
+	
+	/**
+	 * Start recording.  Anything recorded before the last call to start is
+	 *  dropped from the output.  recordsPerThread only applies to threads
+	 *  that have not recorded anything yet, buffers are never resized.
+	 */
+	static void start( int recordsPerThread = kDefaultRecordsPerThread );
+	
+	//! Stop recording, the recording is kept until the next start.
+	static void stop();
+
+	//! Is recording started?
+	static bool isEnabled() { return sEnabled; }
+	
+	/**
+	 * Record a span that started at begin and ended now.  name must be a 
+	 *  string that will outlive the recording (i.e. a literal or 
+	 *  __PRETTY_FUNCTION__) since only the pointer is recorded.
+	 */
+	static void span( const char *name, uint64_t begin, int64_t arg = kNoArg );
+	
+	//! Get a new id to tie the two ends of a flow together, never 0.
+	static uint32_t newFlowId() 
+	{ 
+		uint32_t id = __sync_add_and_fetch( &sNextFlowId, 1 );
+		return id != 0 ? id : __sync_add_and_fetch( &sNextFlowId, 1 );
+	}
+
+	//! Record the start of a flow, should be inside a span.
+	static void flowStart( const char *name, uint32_t id );
+
+	//! Record the end of a flow, should be inside a span.
+	static void flowEnd( const char *name, uint32_t id );
+	
+	/**
+	 * Write everything recorded since start in the Chrome trace event 
+	 *  format.  To get a consistent picture call stop first, records written
+	 *  while this is running may be torn.
+	 *
+	 * @return 0 on success, -1 on a write error.
+	 */
+	static int writeJson( FILE *out );
+
+	//! Same as above but creates or truncates filename first.
+	static int writeJson( const char *filename );
+
+private:
+	struct Record
+	{
+		uint64_t	mTime;
+		uint64_t	mDuration;
+		const char	*mName;
+		int64_t		mArg;
+		char		mPhase;
+	};
+	
+	struct ThreadBuffer
+	{
+		Record			*mRecords;
+		uint32_t		mSize;
+		
+		/**
+		 * Total number of records ever written, index is mNext % mSize.
+		 *  64 bits so it never wraps, which would jump the index when 
+		 *  mSize is not a power of two.
+		 */
+		volatile uint64_t	mNext;
+		
+		int				mTid;
+		char			mName[ 32 ];
+		ThreadBuffer	*mNextBuffer;
+	};
+	
+	static void record( char phase, const char *name, uint64_t time,
+						uint64_t duration, int64_t arg );
+	static ThreadBuffer *createBuffer();
+	
+	static volatile bool		sEnabled;
+	static volatile uint32_t	sNextFlowId;
+	static int					sRecordsPerThread;
+	static uint64_t				sStartTime;
+	
+	//! All buffers ever created, they live as long as the process.
+	static ThreadBuffer * volatile	sBuffers;
+	
+	static __thread ThreadBuffer	*sBuffer;
+	static __thread bool			sCreating;
+};
+
+/**
+ * Records a span covering its lifetime if the TraceRecorder is started.  Used
+ *  by TRACE_BEGIN when built with JH_TRACE_EVENTS.
+ */
+class TraceSpan
+{
+public:
+	TraceSpan( const char *name, int64_t arg = TraceRecorder::kNoArg ) 
+		: mName( name ), mArg( arg ), mBegin( 0 )
+	{
+		if ( TraceRecorder::isEnabled() )
+			mBegin = TimeUtils::getMonotonicMicros();
+	}
+	
+	~TraceSpan()
+	{
+		if ( mBegin != 0 )
+			TraceRecorder::span( mName, mBegin, mArg );
+	}
+	
+private:
+	const char	*mName;
+	int64_t		mArg;
+	uint64_t	mBegin;
+};
+
+#endif // JH_TRACERECORDER_H_
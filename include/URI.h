@@ -30,12 +30,16 @@
 
 #include "jh_string.h"
 #include "jh_vector.h"
+#include "URIView.h"
 
 /**
  Class to parse and generate URI's.  The names of methods follow the naming 
   used in RFC 2396 for "generic URIs".   In breif this is 
    scheme://authority/path?query#fragment.  The query part of the URI follow
    the format of param1=value&param2=value, with as many params as needed.
+  
+  Parsing copies each component once and leaves the query parameters until
+   one is asked for.  To read a URI without copying anything use URIView.
  */
 class URI
 {
@@ -77,6 +81,7 @@ public:
 	const JHSTD::string &getString() const;
 	bool setString( const char *uri );
 	bool setString( JHSTD::string &uri );
+	bool setString( const char *uri, int len );
 	
 	bool isRelative() const { return mRelative; }
 
@@ -85,8 +90,9 @@ public:
 private:
 	bool parseString();
 	void buildString() const;
-	bool parseQuery();
+	void parseQuery() const;
 	void buildQuery() const;
+	void splitAuthority();
 	
 	void copyValues(const URI& other);
 	
@@ -120,13 +126,21 @@ private:
 	bool mRelative;
 	mutable bool mModified;
 	mutable bool mModifiedQuery;
+	mutable bool mParsedQuery;
 	mutable JHSTD::string mFullString;
 	mutable JHSTD::string mQueryString;
 	JHSTD::string mScheme;
 	JHSTD::string mAuthority;
 	JHSTD::string mPath;
 	JHSTD::string mFragment;
-	JetHead::vector<QueryParam> mQueryParams;
+	mutable JetHead::vector<QueryParam> mQueryParams;
+	
+	//! Where the host ends in mAuthority and the port after it, or -1
+	int mHostLength;
+	int mPort;
+	
+	//! The default port for mScheme, -1 until looked up
+	mutable int mSchemePort;
 };
 
 #endif // JH_URI_H_
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef JH_URIVIEW_H_
+#define JH_URIVIEW_H_
+
+#include "jh_string.h"
+
+/**
+ * Parses a URI in place, without copying any of it.  Each component is kept
+ *  as an offset and length into the string that was parsed, so that string
+ *  must outlive the view and must not change while it is in use.
+ *
+ * The components follow RFC 3986, scheme://authority/path?query#fragment.
+ *  Nothing is decoded or checked while parsing, query parameters are only
+ *  found when asked for and percent-decoding is done by the caller on the 
+ *  parts that need it.  Reading a URIView never allocates.
+ */
+class URIView
+{
+public:
+	//! A piece of the parsed string, it is not nul terminated.
+	struct Part
+	{
+		Part() : mData( NULL ), mLength( 0 ) {}
+		Part( const char *data, int length ) : mData( data ), mLength( length ) {}
+		
+		bool empty() const { return mLength == 0; }
+		
+		//! Is this the same as the nul terminated str?
+		bool equals( const char *str ) const;
+		
+		//! Is this the same as the len bytes at str?
+		bool equals( const char *str, int len ) const;
+		
+		//! Make a copy
+		JHSTD::string str() const { return JHSTD::string( mData, mLength ); }
+		
+		//! Does this need decoding, i.e. does it have a '%' or a '+'?
+		bool isEncoded() const;
+		
+		/**
+		 * Percent-decode into buf.  With form set '+' decodes to a space, as
+		 *  in application/x-www-form-urlencoded query parameters.
+		 *
+		 * @return the decoded length, which is never more than mLength, or 
+		 *  -1 if it doesn't fit in size bytes or has a bad escape.
+		 */
+		int decode( char *buf, int size, bool form = false ) const;
+		
+		//! Same as above but replaces out, false on a bad escape.
+		bool decode( JHSTD::string &out, bool form = false ) const;
+		
+		const char	*mData;
+		int			mLength;
+	};
+	
+	//! One query parameter, mValue is empty when there was no '='
+	struct Param
+	{
+		Part	mKey;
+		Part	mValue;
+	};
+	
+	URIView();
+	
+	//! Parse len bytes of uri, or up to its nul when len is -1.
+	URIView( const char *uri, int len = -1 );
+	
+	//! Parse len bytes of uri, or up to its nul when len is -1.
+	void parse( const char *uri, int len = -1 );
+	
+	void clear();
+	
+	Part getScheme() const { return part( mScheme ); }
+	Part getAuthority() const { return part( mAuthority ); }
+	
+	//! The authority up to its port, brackets are kept on IPv6 addresses.
+	Part getHost() const { return part( mHost ); }
+	
+	//! The port given in the authority, -1 if there is none
+	int getPort() const { return mPort; }
+	
+	Part getPath() const { return part( mPath ); }
+	Part getQuery() const { return part( mQuery ); }
+	Part getFragment() const { return part( mFragment ); }
+	
+	//! Was there a '?', even if the query is empty?
+	bool hasQuery() const { return mQuery.mOffset >= 0; }
+	
+	//! Was there a '#', even if the fragment is empty?
+	bool hasFragment() const { return mFragment.mOffset >= 0; }
+	
+	//! No scheme and a path that does not start with '/'
+	bool isRelative() const { return mRelative; }
+	
+	/**
+	 * Step through the query parameters in order.  Start with pos at 0, 
+	 *  each call fills in param and moves pos along.  Empty parameters 
+	 *  (as in "a=1&&b=2") are skipped.
+	 *
+	 * @return false when there are no more.
+	 */
+	bool nextParam( int &pos, Param &param ) const;
+	
+	//! Same as above for a query that has been split off already.
+	static bool nextParam( const char *query, int len, int &pos, 
+						   Param &param );
+	
+	/**
+	 * Find the first query parameter named key, comparing it as it appears
+	 *  in the URI, i.e. undecoded.
+	 *
+	 * @return false if there is none.
+	 */
+	bool findParam( const char *key, Part &value ) const;
+	
+	/**
+	 * Split authority into its host and port the same way parse does.  port
+	 *  is -1 if there is none, 0 if it is empty or not a number.
+	 *
+	 * @return the length of the host.
+	 */
+	static int splitAuthority( const char *authority, int len, int &port );
+	
+private:
+	//! Where a component is, mOffset is -1 when it isn't there at all
+	struct Slice
+	{
+		void set( int offset, int length ) 
+		{ 
+			mOffset = offset; 
+			mLength = length; 
+		}
+		
+		int		mOffset;
+		int		mLength;
+	};
+	
+	Part part( const Slice &slice ) const 
+	{ 
+		if ( slice.mOffset < 0 )
+			return Part( mUri, 0 );
+		
+		return Part( mUri + slice.mOffset, slice.mLength ); 
+	}
+	
+	const char	*mUri;
+	int			mLength;
+	
+	Slice		mScheme;
+	Slice		mAuthority;
+	Slice		mHost;
+	Slice		mPath;
+	Slice		mQuery;
+	Slice		mFragment;
+	
+	int			mPort;
+	bool		mRelative;
+};
+
+#endif // JH_URIVIEW_H_
@@ -103,6 +103,20 @@ public:
 	ObjInfo *alloc( size_t size, const char *file, int line );
 	void free( ObjInfo *info );
 
+	//! Usage statistics for the heap
+	struct Stats
+	{
+		int mCurrentSize;
+		int mMaxSize;
+		int mNumTotalAllocations;
+		int mNumCurrentAllocations;
+	};
+
+	/**
+	 * Get a consistent copy of the heap statistics.
+	 */
+	void getStats( Stats &stats );
+
 	/**
 	 * Print a list of all current allocations.
 	 */
@@ -33,7 +33,6 @@
  */
 
 #include <string.h>
-#include "RefCount.h"
 
 #include <cstdarg>
 
@@ -52,28 +51,111 @@ namespace JetHead
 {
 
 #ifdef USE_JETHEAD_STRING
+	//! Length of a null terminated string
+	inline size_t string_length( const char *s ) { return strlen( s ); }
+	
+	template <class charT>
+	size_t string_length( const charT *s )
+	{
+		size_t n = 0;
+		while ( s[ n ] != 0 )
+			n++;
+		return n;
+	}
+	
+	//! First c in the n characters at s, NULL if there isn't one
+	inline const char *string_find( const char *s, size_t n, char c )
+	{
+		return (const char*)memchr( s, c, n );
+	}
+	
+	template <class charT>
+	const charT *string_find( const charT *s, size_t n, charT c )
+	{
+		for ( size_t i = 0; i < n; i++ )
+		{
+			if ( s[ i ] == c )
+				return s + i;
+		}
+		return NULL;
+	}
+	
+	//! Last c in the n characters at s, NULL if there isn't one
+	inline const char *string_rfind( const char *s, size_t n, char c )
+	{
+		return (const char*)memrchr( s, c, n );
+	}
+	
+	template <class charT>
+	const charT *string_rfind( const charT *s, size_t n, charT c )
+	{
+		while ( n > 0 )
+		{
+			if ( s[ --n ] == c )
+				return s + n;
+		}
+		return NULL;
+	}
+	
+	//! First copy of the m characters at t in the n characters at s
+	inline const char *string_find( const char *s, size_t n, const char *t, 
+									size_t m )
+	{
+		return (const char*)memmem( s, n, t, m );
+	}
+	
+	template <class charT>
+	const charT *string_find( const charT *s, size_t n, const charT *t, 
+							  size_t m )
+	{
+		for ( const charT *p = s; m <= n - ( p - s ); p++ )
+		{
+			p = string_find( p, n - ( p - s ), t[ 0 ] );
+			
+			if ( p == NULL || m > n - ( p - s ) )
+				break;
+			
+			if ( memcmp( p, t, m * sizeof( charT ) ) == 0 )
+				return p;
+		}
+		return NULL;
+	}
+	
+	/**
+	 * A string that keeps short values inline, so they never allocate, and 
+	 *  shares longer ones copy-on-write.  Anything shorter than kInlineSize 
+	 *  characters, with its null, lives in the string itself and is simply
+	 *  copied.  Longer values live in a buffer whose reference count is 
+	 *  updated atomically, so copies can be handed between threads without
+	 *  taking a lock.  As with std::string two threads must not change the 
+	 *  same string at once.
+	 */
 	template <class charT>
 	class basic_string
 	{
 	public:
 		typedef unsigned size_type;
-		static const size_type DEFAULT_ALLOCATION = 32;
 		static const size_type npos = -1;
 		static const charT null_char = 0;
 		
+		//! Room for this many characters, null included, without allocating
+		static const size_type kInlineSize = 32 / sizeof( charT );
+		
 		//! Default constructor, nothing contained in the array, 
-		basic_string()
+		basic_string() : mLength( 0 ), mCapacity( kInlineSize ), mRep( NULL )
 		{
-			mData = jh_new Rep( DEFAULT_ALLOCATION );
+			mInline[ 0 ] = null_char;
 		}
 
 		//! Copy constructor
-		basic_string(const basic_string& rhs)
+		basic_string( const basic_string& rhs ) : mLength( 0 ), 
+			mCapacity( kInlineSize ), mRep( NULL )
 		{
 			assign( rhs );
 		}
 
-		basic_string( const charT* s, size_type n = npos )
+		basic_string( const charT* s, size_type n = npos ) : mLength( 0 ), 
+			mCapacity( kInlineSize ), mRep( NULL )
 		{
 			assign( s, n );
 		}
@@ -81,7 +163,7 @@ namespace JetHead
 		//! Clean up allocated data
 		~basic_string()
 		{
-			mData = NULL;
+			release();
 		}
 		
 		basic_string& operator=( const basic_string& s )
@@ -101,52 +183,78 @@ namespace JetHead
 
 		basic_string& assign( const basic_string& s )
 		{
-			mData = s.mData;			
+			if ( &s == this )
+				return *this;
+			
+			// Short strings are quicker to copy than to share
+			if ( s.mRep == NULL )
+				return assign( s.mInline, s.mLength );
+			
+			__sync_fetch_and_add( &s.mRep->mRefs, 1 );
+			release();
+			mRep = s.mRep;
+			mLength = s.mLength;
+			mCapacity = s.mCapacity;
 			return *this;
 		}
 
 		basic_string& assign( const basic_string& s, size_type pos, size_type n )
 		{
 			if ( pos == 0 && n >= s.length() )
-				assign( s );
-			else
-				assign( s.data() + pos, n );
-
-			return *this;
+				return assign( s );
+			
+			if ( pos > s.length() )
+				pos = s.length();
+			
+			if ( n > s.length() - pos )
+				n = s.length() - pos;
+			
+			return assign( s.data() + pos, n );
 		}
 		
 		basic_string& assign( const charT* s, size_type n = npos )
 		{
 			if ( n == npos )
-				n = strlen( s );
+				n = string_length( s );
 			
-			if ( n >= capacity() )
-				mData = jh_new Rep( s, n );
-			else
-				mData->assign( s, n );
+			if ( isInside( s ) )
+			{
+				basic_string tmp( s, n );
+				return assign( tmp );
+			}
+			
+			// Anything in the buffer now can be thrown away
+			if ( mRep != NULL && ( isShared() || n >= mCapacity ) )
+				release();
 			
+			charT *buf = makeRoom( n );
+			memcpy( buf, s, n * sizeof( charT ) );
+			setLength( buf, n );
 			return *this;
 		}
 
 		const charT& operator[]( const unsigned i ) const
 		{
 			if ( length() > i )
-				return mData->const_at( i );
+				return data()[ i ];
 			else
 			{
 				// throw out_of_range
-				return mData->const_at( length() );  // this should always return a null char.
+				return data()[ length() ];  // this should always return a null char.
 			}
 		}
 		
 		charT& operator[]( const unsigned i )
 		{
+			// The caller may write through the reference
+			charT *buf = makeRoom( length() );
+			
 			if ( length() > i )
-				return mData->at( i );
+				return buf[ i ];
 			else
 			{
 				// throw out_of_range
-				return mData->at( length() );  // this should always return a null char.
+				return buf[ length() ];  // this should always return a null char.
 			}
 		}
 		
@@ -173,34 +281,41 @@ namespace JetHead
 		basic_string& append( const charT* s, size_type n = npos )
 		{
 			if ( n == npos )
-				n = strlen( s );
+				n = string_length( s );
+			
+			// s may be part of this string and move when it grows
+			size_type offset = s - data();
+			bool inside = isInside( s );
+			
+			charT *buf = makeRoom( length() + n );
 			
-			reserve( length() + n + 1 );
+			if ( inside )
+				s = buf + offset;
 			
-			charT *buf = mData->getBuffer();
 			memcpy( buf + length(), s, n * sizeof( charT ) );
-			mData->setLength( length() + n );
-			mData->at( length() ) = null_char;
+			setLength( buf, length() + n );
 			return *this;
 		}
 		
 		basic_string& append( size_type n, charT c )
 		{
-			reserve( length() + n + 1 );
+			charT *buf = makeRoom( length() + n );
 			
 			for( size_type i = 0 ; i < n ; i++ )
 			{
-				mData->at( length() + i ) = c;
+				buf[ length() + i ] = c;
 			}
 
-			mData->setLength( length() + n );
-			mData->at( length() ) = null_char;
+			setLength( buf, length() + n );
 			return *this;
 		}
 
 		void clear()
 		{
-			mData.setLength( 0 );
+			if ( isShared() )
+				release();
+			
+			setLength( makeRoom( 0 ), 0 );
 		}
 
 		basic_string substr( size_type pos = 0, size_type n = npos) const
@@ -211,7 +326,7 @@ namespace JetHead
 				return basic_string();
 			}
 			
-			if ( pos + n > length() )
+			if ( n > length() - pos )
 				n = length() - pos;
 			
 			return basic_string( data() + pos, n );
@@ -219,12 +334,12 @@ namespace JetHead
 
 		const charT* c_str() const
 		{
-			return mData->getConstBuffer();
+			return data();
 		}
 
 		const charT* data() const
 		{
-			return mData->getConstBuffer();
+			return mRep != NULL ? mRep->mData : mInline;
 		}
 		
 		size_type find( const basic_string& s, size_type pos = 0 ) const
@@ -234,40 +349,31 @@ namespace JetHead
 
 		size_type find( const charT* s, size_type pos = 0 ) const
 		{
-			return find( s, pos, strlen( s ) );
+			return find( s, pos, string_length( s ) );
 		}
 		
 		size_type find( const charT* s, size_type pos, size_type n ) const
 		{
 			if ( n == npos )
-				n = strlen( s );
+				n = string_length( s );
 			
-			for( size_type i = pos ; i < length() - n; i++)
-			{
-				bool match = true;
-				for( size_type j = 0 ; j < n ; j++ )
-				{
-					if ( mData->const_at( j + i ) != s[ j ] )
-					{
-						match = false;
-						break;
-					}
-				}
-					
-				if ( match )
-					return i;
-			}
-			return npos;
+			if ( pos > length() || n > length() - pos )
+				return npos;
+			
+			if ( n == 0 )
+				return pos;
+			
+			const charT *p = string_find( data() + pos, length() - pos, s, n );
+			return p != NULL ? p - data() : npos;
 		}
 		
 		size_type find( const charT c, size_type pos = 0 ) const
 		{
-			for( size_type i = pos ; i < length() ; i++ )
-			{
-				if( mData->const_at( i ) == c )
-					return i;
-			}
-			return npos;
+			if ( pos >= length() )
+				return npos;
+			
+			const charT *p = string_find( data() + pos, length() - pos, c );
+			return p != NULL ? p - data() : npos;
 		}
 		
 		size_type rfind( const basic_string& str, size_type pos = npos ) const
@@ -277,46 +383,49 @@ namespace JetHead
 
 		size_type rfind( const charT* s, size_type pos = npos ) const
 		{
-			return rfind( s, pos, strlen( s ) );
+			return rfind( s, pos, string_length( s ) );
 		}
 		
 		size_type rfind( const charT* s, size_type pos, size_type n ) const
 		{
 			if ( n == npos )
-				n = strlen( s );
+				n = string_length( s );
 			
-			if ( pos == npos || pos > length() )
-				pos = length();
+			if ( n > length() )
+				return npos;
+			
+			if ( pos > length() - n )
+				pos = length() - n;
 			
-			for( int i = pos ; i >= 0; i--)
+			if ( n == 0 )
+				return pos;
+			
+			// Look for the first character, then check the rest
+			for ( size_type end = pos + 1; end > 0; )
 			{
-				bool match = true;
-				for( size_type j = 0 ; j < n ; j++ )
-				{
-					if ( mData->const_at( j + i ) != s[ j ] )
-					{
-						match = false;
-						break;
-					}
-				}
-					
-				if ( match )
-					return i;
+				const charT *p = string_rfind( data(), end, s[ 0 ] );
+				
+				if ( p == NULL )
+					break;
+				
+				if ( memcmp( p, s, n * sizeof( charT ) ) == 0 )
+					return p - data();
+				
+				end = p - data();
 			}
 			return npos;
 		}
 		
 		size_type rfind( const charT c, size_type pos = npos ) const
 		{
-			if ( pos == npos )
+			if ( empty() )
+				return npos;
+			
+			if ( pos >= length() )
 				pos = length() - 1;
 			
-			for( int i = pos; i >= 0; i-- )
-			{
-				if ( mData->const_at( i ) == c )
-					return i;
-			}
-			return npos;
+			const charT *p = string_rfind( data(), pos + 1, c );
+			return p != NULL ? p - data() : npos;
 		}
 
 		
@@ -327,21 +436,21 @@ namespace JetHead
 
 		size_type find_first_of( const charT *s, size_type pos = 0 ) const
 		{
-			return find_first_of( s, pos, strlen( s ) );
+			return find_first_of( s, pos, string_length( s ) );
 		}
 
 		size_type find_first_of( const charT *s, size_type pos, size_type n ) const
 		{
 			if ( n == npos )
-				n = strlen( s );
-				
+				n = string_length( s );
+			
+			if ( n == 1 )
+				return find( s[ 0 ], pos );
+			
 			for( size_type i = pos ; i < length(); i++)
 			{
-				for ( size_type j = 0; j < n; j++ )
-				{
-					if ( mData->const_at( i ) == s[ j ] )
-						return i;
-				}
+				if ( string_find( s, n, data()[ i ] ) != NULL )
+					return i;
 			}
 			
 			return npos;
@@ -359,24 +468,27 @@ namespace JetHead
 
 		size_type find_last_of( const charT *s, size_type pos = npos ) const
 		{
-			return find_last_of( s, pos, strlen( s ) );
+			return find_last_of( s, pos, string_length( s ) );
 		}
 
 		size_type find_last_of( const charT *s, size_type pos, size_type n ) const
 		{
 			if ( n == npos )
-				n = strlen( s );
+				n = string_length( s );
 
-			if ( pos == npos )
+			if ( n == 1 )
+				return rfind( s[ 0 ], pos );
+			
+			if ( empty() )
+				return npos;
+			
+			if ( pos >= length() )
 				pos = length() - 1;
 
 			for( int i = pos; i >= 0; i--)
 			{
-				for ( size_type j = 0; j < n; j++ )
-				{
-					if ( mData->const_at( i ) == s[ j ] )
-						return i;
-				}
+				if ( string_find( s, n, data()[ i ] ) != NULL )
+					return i;
 			}
 
 			return npos;
@@ -399,63 +511,17 @@ namespace JetHead
 		
 		basic_string& insert( size_type pos1, const charT* s, size_type n )
 		{
-			if ( n == npos )
-				n = strlen( s );
-			
-			if ( pos1 >= length() )
-			{
-				// throw out_of_range
-				return *this;
-			}
-			
-			Rep *nr = mData->copyOnWrite();
-			if ( nr != NULL )
-				mData = nr;
-
-			reserve( length() + n + 1 );
-			
-			for( int i = length() - 1; i >= (int)pos1; i-- )
-			{
-				mData->at( i + n ) = mData->at( i );
-			}
-			
-			memcpy( mData->getBuffer() + pos1, s, n * sizeof( charT ) );
-			
-			mData->setLength( length() + n );
-			mData->at( length() ) = null_char;
-			return *this;
+			return replace( pos1, 0, s, n );
 		}
 		
 		basic_string& insert( size_type pos1, const charT* s )
 		{
-			return insert( pos1, s, strlen( s ) );
+			return insert( pos1, s, string_length( s ) );
 		}
 		
 		basic_string& insert( size_type pos1, size_type n, charT c )
 		{			
-			if ( pos1 >= length() )
-			{
-				// throw out_of_range
-				return *this;
-			}
-
-			Rep *nr = mData->copyOnWrite();
-			if ( nr != NULL )
-				mData = nr;
-
-			reserve( length() + n + 1 );
-			
-			for( int i = length() - 1; i >= (int)pos1; i-- )
-			{
-				mData->at( i + n ) = mData->at( i );
-			}
-			
-			for( unsigned i = 0; i < n; i++ )
-				mData->at( pos1 + i ) = c;
-
-			mData->setLength( length() + n );
-			mData->at( length() ) = null_char;
-			return *this;
+			return replace( pos1, 0, n, c );
 		}
 		
 		basic_string& replace( size_type pos1, size_type n1, const basic_string& str )
@@ -470,91 +536,53 @@ namespace JetHead
 
 		basic_string& replace( size_type pos1, size_type n1, const charT* s, size_type n2 )
 		{
-			int new_len = length() - n1 + n2;
-
-			if ( pos1 >= length() )
-				return *this;
+			if ( n2 == npos )
+				n2 = string_length( s );
 			
-			Rep *nr = mData->copyOnWrite();
-			if ( nr != NULL )
-				mData = nr;
+			if ( isInside( s ) )
+			{
+				basic_string tmp( s, n2 );
+				return replace( pos1, n1, tmp.data(), n2 );
+			}
 			
-			reserve( new_len );
-			erase( pos1, n1 );
-
-			if ( pos1 >= length() )
-				append( s, n2 );
-			else
-				insert( pos1, s, n2 );
+			charT *buf = openGap( pos1, n1, n2 );
+			
+			if ( buf != NULL )
+				memcpy( buf + pos1, s, n2 * sizeof( charT ) );
 			
 			return *this;
 		}
 
 		basic_string& replace( size_type pos1, size_type n1, const charT* s )
 		{
-			return replace( pos1, n1, s, strlen( s ) );
+			return replace( pos1, n1, s, string_length( s ) );
 		}
 
 		basic_string& replace( size_type pos1, size_type n1, size_type n2, charT c )
 		{
-			int new_len = length() - n1 + n2;
-
-			if ( pos1 >= length() )
-				return *this;
-						
-			Rep *nr = mData->copyOnWrite();
-			if ( nr != NULL )
-				mData = nr;
+			charT *buf = openGap( pos1, n1, n2 );
 			
-			reserve( new_len );
-			erase( pos1, n1 );
-
-			if ( pos1 >= length() )
-				append( n2, c );
-			else
-				insert( pos1, n2, c );
+			if ( buf != NULL )
+			{
+				for( size_type i = 0; i < n2; i++ )
+					buf[ pos1 + i ] = c;
+			}
 			
 			return *this;
 		}
 		
 		basic_string& erase( size_type pos = 0, size_type n = npos )
 		{
-			Rep *nr = mData->copyOnWrite();
-			if ( nr != NULL )
-				mData = nr;
-				
 			if ( pos >= length() )
 				return *this;
 			
-			// if we erase all the way to the end just truncate 
-			if ( n == npos || pos + n == length() )
-			{
-				if ( pos < length() )
-				{
-					mData->setLength( pos );
-					mData->at( pos ) = null_char; 
-				}
-			}
-			// otherwise we need to copy a chunck from the end back into the whole.
-			else
-			{
-				if ( pos + n > length() )
-					n = length() - pos;
-				
-				for( unsigned i = pos + n; i < length() ; i++)
-				{
-					mData->at( i - n ) = mData->at( i );
-				}
-				
-				mData->setLength( mData->length() - n );
-				mData->at( length() ) = null_char; 
-			}
+			openGap( pos, n, 0 );
 			return *this;
 		}
 
 		int compare( const basic_string& rhs ) const
 		{
-			return compare( 0, npos, rhs.mData->getConstBuffer(), rhs.length() );
+			return compare( 0, npos, rhs.data(), rhs.length() );
 		}
 
 		int compare( const char* cptr ) const
@@ -564,31 +592,23 @@ namespace JetHead
 
 		int compare( size_type pos, size_type n, const charT* s, size_type rlen = npos ) const
 		{
-			size_type str_len = strlen( s );
+			if ( rlen == npos )
+				rlen = string_length( s );
 			
-			if ( str_len < rlen )
-				rlen = str_len;
+			if ( pos > length() )
+				pos = length();
 			
-			if ( n == npos )
+			if ( n > length() - pos )
 				n = length() - pos;
 			
-			size_type i = pos;
-			while ( i <= n && i <= rlen )
-			{
-				if ( mData->const_at( i ) > s[ i ] )
-				{
-					return 1;
-				}
-				else if ( mData->const_at( i ) < s[ i ] )
-				{
-					return -1;
-				}
-				i++;
-			}
+			int res = memcmp( data() + pos, s, 
+							  ( n < rlen ? n : rlen ) * sizeof( charT ) );
 			
-			if ( n > rlen )
-				return -1;
+			if ( res != 0 )
+				return res < 0 ? -1 : 1;
 			else if ( n < rlen )
+				return -1;
+			else if ( n > rlen )
 				return 1;
 			else
 				return 0;
@@ -597,132 +617,171 @@ namespace JetHead
 		void reserve( size_t res = 0 )
 		{
 			if ( res > capacity() )
-			{
-				if ( res < ( capacity() * 2 ) )
-					res = capacity() * 2;
-				
-				Rep *new_rep = jh_new Rep( res );
-				new_rep->assign( mData->getBuffer(), mData->length() );
-				mData = new_rep;
-			}
+				makeRoom( res );
 		}
 		
+		//! How many characters fit without allocating
 		size_type capacity() const
 		{
-			if ( mData == NULL )
-				return 0;
-			else
-				return mData->capacity();
+			return mCapacity - 1;
 		}
 		
 		void resize( size_type n, charT c = 0 )
 		{
-			reserve( n + 1 );
+			charT *buf = makeRoom( n );
 			
 			for ( size_type i = length(); i < n; i++ )
-				mData->at( i ) = c;
+				buf[ i ] = c;
 			
-			mData->setLength( n );
-			mData->at( length() ) = null_char;
+			setLength( buf, n );
 		}
 	
 		//! How much is in use?
 		size_type length() const 
 		{ 
-			return mData->length();
+			return mLength;
 		}
 
 		size_type size() const 
 		{
-			return mData->length();
+			return mLength;
 		}
 
 		//! Is this empty?
 		bool empty() const 
 		{ 
-			if ( mData->length() == 0 )
-				return true;
-			else	
-				return false;
+			return mLength == 0;
 		}
 		
-	private:		
-		class Rep : public RefCount 
+	private:
+		//! A shared buffer, allocated with room for the characters after it
+		struct Rep
 		{
-		public:
-			Rep( int capacity ) : mCapacity( capacity ), mLength( 0 ), mData( NULL ) 
-			{
-				if ( capacity == 0 )
-					mData = jh_new charT[ 1 ];
-				else
-					mData = jh_new charT[ capacity ];
-					
-				mData[ 0 ] = null_char;					
-			}
+			volatile int	mRefs;
+			charT			mData[ 1 ];
+		};
+		
+		//! Once no one else has the buffer it is ours alone, so no lock
+		bool isShared() const
+		{
+			return mRep != NULL && 
+				__atomic_load_n( &mRep->mRefs, __ATOMIC_ACQUIRE ) > 1;
+		}
+		
+		//! Does s point into this string's buffer?
+		bool isInside( const charT *s ) const
+		{
+			return s >= data() && s < data() + mCapacity;
+		}
+		
+		//! Drop the buffer, going back to an empty inline string
+		void release()
+		{
+			if ( mRep != NULL && __sync_sub_and_fetch( &mRep->mRefs, 1 ) == 0 )
+				delete [] (char*)mRep;
 			
-			Rep( const charT *s, size_type n = npos ) : mCapacity( 0 ), mLength( 0 ), mData( NULL ) 
-			{
-				if ( n == npos )
-					n = strlen( s );
-				mCapacity = n + 1;
-				mData = jh_new charT[ n + 1 ];
-				assign( s, n );
-			}
-					
-			Rep *copyOnWrite() 
-			{ 
-				if ( getRefCountForDebug() > 1 )
-				{
-					Rep *nr = jh_new Rep( mCapacity );
-					nr->assign( mData, mLength );
-					return nr;
-				}
-				else
-					return NULL;
-			}
-					
-			size_type capacity() const { return mCapacity; }
-			size_type length() const { return mLength; }
+			mRep = NULL;
+			mLength = 0;
+			mCapacity = kInlineSize;
+			mInline[ 0 ] = null_char;
+		}
+		
+		/**
+		 * Get a buffer no one else shares with room for n characters and a 
+		 *  null, keeping what is in the string now.  A buffer that has to 
+		 *  grow at least doubles so appending is amortized constant time.
+		 */
+		charT *makeRoom( size_type n )
+		{
+			if ( mRep == NULL && n < mCapacity )
+				return mInline;
+			
+			if ( mRep != NULL && n < mCapacity && not isShared() )
+				return mRep->mData;
+			
+			size_type length = mLength;
 			
-			void assign( const charT *s, size_type n = npos )
+			// A copy of a short string can go back inline
+			if ( mRep != NULL && n < kInlineSize && length < kInlineSize )
 			{
-				if ( n == npos )
-					n = strlen( s );
-				if ( n >= mCapacity )
-					n = mCapacity - 1;
-				mLength = n;
-				memcpy( mData, s, n * sizeof( charT ) );
-				mData[ n ] = null_char;
+				Rep *rep = mRep;
+				memcpy( mInline, rep->mData, ( length + 1 ) * sizeof( charT ) );
+				mRep = NULL;
+				mCapacity = kInlineSize;
+				
+				if ( __sync_sub_and_fetch( &rep->mRefs, 1 ) == 0 )
+					delete [] (char*)rep;
+				
+				return mInline;
 			}
 			
-			charT *getBuffer() { return mData; }
-			const charT *getConstBuffer() const { return mData; }
-
-			charT &at( size_type i ) { return mData[ i ]; }					
-			const charT &const_at( size_type i ) const { return mData[ i ]; }					
+			size_type capacity = n + 1;
 			
-			void setLength( size_type l ) { mLength = l; }
+			if ( n >= mCapacity && capacity < mCapacity * 2 )
+				capacity = mCapacity * 2;
+			else if ( n < mCapacity )
+				capacity = mCapacity;
 			
-		protected:
-			~Rep()
+			Rep *rep = (Rep*)jh_new char[ sizeof( Rep ) + 
+										  capacity * sizeof( charT ) ];
+			rep->mRefs = 1;
+			memcpy( rep->mData, data(), ( length + 1 ) * sizeof( charT ) );
+			
+			release();
+			mRep = rep;
+			mLength = length;
+			mCapacity = capacity;
+			return rep->mData;
+		}
+		
+		/**
+		 * Replace n1 characters at pos with a gap of n2 for the caller to 
+		 *  fill in.
+		 *
+		 * @return the buffer, or NULL if pos is past the end.
+		 */
+		charT *openGap( size_type pos, size_type n1, size_type n2 )
+		{
+			if ( pos > length() )
 			{
-				delete [] mData;
+				// throw out_of_range
+				return NULL;
 			}
-						
-		private:
-			size_type mCapacity;
-			size_type mLength;
-			charT *mData;
-		};
+			
+			if ( n1 > length() - pos )
+				n1 = length() - pos;
+			
+			size_type tail = length() - pos - n1;
+			charT *buf = makeRoom( length() - n1 + n2 );
+			
+			memmove( buf + pos + n2, buf + pos + n1, tail * sizeof( charT ) );
+			setLength( buf, pos + n2 + tail );
+			return buf;
+		}
 		
-		//! The data we are using
-		SmartPtr<Rep> mData;
+		//! Set the length of buf, the unshared buffer, adding the null
+		void setLength( charT *buf, size_type n )
+		{
+			mLength = n;
+			buf[ n ] = null_char;
+		}
+		
+		size_type	mLength;
+		
+		//! Characters that fit in the buffer, null included
+		size_type	mCapacity;
+		
+		//! The shared buffer, NULL while the string is inline
+		Rep			*mRep;
+		charT		mInline[ kInlineSize ];
 	};
 	
 	template <class charT>
 	basic_string<charT> operator+( const basic_string<charT>& s1, const basic_string<charT>& s2 )
 	{
-		basic_string<charT> temp = basic_string<charT>( s1 );
+		basic_string<charT> temp;
+		temp.reserve( s1.length() + s2.length() );
+		temp.append( s1.data(), s1.length() );
 		temp.append( s2.data(), s2.length() );
 		return temp;
 	}
@@ -746,7 +805,7 @@ namespace JetHead
 	template <class charT>
 	bool operator==( const basic_string<charT>& s1, const basic_string<charT>& s2 )
 	{
-		return s1.compare( s2 ) == 0;
+		return s1.length() == s2.length() && s1.compare( s2 ) == 0;
 	}
 
 	template <class charT>
@@ -799,8 +858,8 @@ namespace JetHead
 	template <class _string>
 	int	split( const _string &str, const char *split_chars, JetHead::vector<_string> &parts )
 	{
-		unsigned pos = str.find_first_of( split_chars );
-		unsigned start = 0;
+		typename _string::size_type pos = str.find_first_of( split_chars );
+		typename _string::size_type start = 0;
 		
 		while ( pos != _string::npos )
 		{
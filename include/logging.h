@@ -49,6 +49,10 @@
 
 #include "jh_types.h"
 
+#if defined(JH_TRACE_EVENTS) && defined(__cplusplus)
+#include "TraceRecorder.h"
+#endif
+
 typedef int (command_parser_t)( char *name, int size );
 
 __BEGIN_DECLS
@@ -329,10 +333,18 @@ __END_DECLS
  *  condition that cause the exit.  This will always print the message at
  *  LOG_LVL_ERROR.  TRACE_END_ERR work in both C and C++.  In a release build
  *  all tracing is disabled except TRACE_END_ERR will still print an error.
+ *
+ * When built with JH_TRACE_EVENTS TRACE_BEGIN in C++ code also records a span
+ *  for the function in the TraceRecorder (if it has been started), 
+ *  regardless of the logging level.  See TraceRecorder.h.
  */
 #ifndef JH_VERBOSE_LOGGING
 
+#if defined(JH_TRACE_EVENTS) && defined(__cplusplus)
+#define TRACE_BEGIN(x)	TraceSpan _trace_span( JH_FUNCTION_NAME )
+#else
 #define TRACE_BEGIN(x)
+#endif
 #define TRACE_END()
 #define TRACE_END_ERR( fmt, args... )									\
 	do {																\
@@ -349,6 +361,9 @@ public:
 			volatile uint32_t& file_cats, volatile int& file_level ) :
 		mLevel( level ), mName( name ), mFile( file ), mLineNum( line ),
 		mFileCats( file_cats ), mFileLevel( file_level ), mPrintExit( true )
+#ifdef JH_TRACE_EVENTS
+		, mSpan( name )
+#endif
 	{
 		if ( (LOG_CAT_TRACE & file_cats) && (mLevel <= file_level) )
 		{
@@ -378,6 +393,9 @@ private:
 	volatile uint32_t& mFileCats;
 	volatile int& mFileLevel;
 	bool mPrintExit;
+#ifdef JH_TRACE_EVENTS
+	TraceSpan mSpan;
+#endif
 };
 
 #define TRACE_BEGIN(level)		\
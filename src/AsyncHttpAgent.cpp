@@ -0,0 +1,826 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "AsyncHttpAgent.h"
+#include "TimeUtils.h"
+
+#include "jh_memory.h"
+#include "logging.h"
+
+#include <string.h>
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+using namespace JetHead;
+
+AsyncHttpAgent::AsyncHttpAgent( Selector *selector )
+	: mSelector( selector ), mNextId( 0 ), mMaxPerHost( kDefaultMaxPerHost ),
+	mIdleTimeout( kDefaultIdleTimeout ), mPipelineDepth( kDefaultPipelineDepth ),
+	mAcceptEncoding( false ), mLock( "AsyncHttpAgent" )
+{
+}
+
+AsyncHttpAgent::~AsyncHttpAgent()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	SyncEventAgent0<AsyncHttpAgent> *agent = 
+		jh_new SyncEventAgent0<AsyncHttpAgent>( this, &AsyncHttpAgent::shutdown );
+	agent->send( mSelector );
+	
+	mSelector->removeAgentsByReceiver( this );
+}
+
+void AsyncHttpAgent::shutdown()
+{
+	Resolver::getInstance()->cancel( this );
+	
+	if ( not mQueued.empty() )
+		LOG_WARN( "Destroyed with requests outstanding" );
+	
+	while ( not mQueued.empty() )
+	{
+		destroy( mQueued.front() );
+		mQueued.pop_front();
+	}
+	
+	while ( not mConnections.empty() )
+	{
+		Connection *conn = mConnections[ mConnections.size() - 1 ];
+		
+		while ( not conn->mRequests.empty() )
+		{
+			destroy( conn->mRequests.front() );
+			conn->mRequests.pop_front();
+		}
+		
+		closeConnection( conn );
+	}
+}
+
+int AsyncHttpAgent::send( HttpRequest &req, AsyncHttpListener *listener, 
+						  IEventDispatcher *dispatcher, 
+						  const JHSTD::string &body, BodyHandler *handler,
+						  uint32_t timeoutMs )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	Request *r = jh_new Request;
+	int id = __sync_add_and_fetch( &mNextId, 1 );
+	URI uri = req.getURI();
+	
+	r->mId = id;
+	r->mHost = uri.getHost();
+	r->mPort = uri.getPort();
+	
+	// Only for the request as sent, the caller's is left as it was
+	const char *accept = mAcceptEncoding ? 
+		ContentCoding::getAcceptEncoding() : NULL;
+	
+	r->mAcceptEncoding = accept != NULL;
+	
+	if ( accept != NULL and 
+		 req.getField( HttpFieldMap::kFieldAcceptEncoding ) == NULL )
+	{
+		req.addField( HttpFieldMap::kFieldAcceptEncoding, accept );
+		r->mData = req.getHeader();
+		req.removeField( HttpFieldMap::kFieldAcceptEncoding );
+	}
+	else
+	{
+		r->mData = req.getHeader();
+	}
+	
+	r->mData += body;
+	r->mHead = req.getMethod() == HttpRequest::kMethodHead;
+	r->mIdempotent = req.isIdempotent();
+	r->mClose = req.hasFieldToken( HttpFieldMap::kFieldConnection, "close" );
+	r->mListener = listener;
+	r->mDispatcher = dispatcher;
+	r->mHandler = handler;
+	r->mTimeout = timeoutMs;
+	r->mTimer = NULL;
+	r->mConn = NULL;
+	r->mResponse = NULL;
+	r->mError = kNoError;
+	r->mCancelled = false;
+	r->mDecoder = NULL;
+	
+	// Always through the selector, even from its own thread, so the 
+	//  listener is never called from in here
+	AsyncEventAgent1<AsyncHttpAgent, Request*> *agent = 
+		jh_new AsyncEventAgent1<AsyncHttpAgent, Request*>( 
+			this, &AsyncHttpAgent::start, r );
+	agent->send( mSelector );
+	
+	return id;
+}
+
+void AsyncHttpAgent::cancel( int id )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	// Once the selector has forgotten it, the only place it can still be 
+	//  is on its way to its dispatcher
+	SyncEventAgent1<AsyncHttpAgent, int> *agent = 
+		jh_new SyncEventAgent1<AsyncHttpAgent, int>( 
+			this, &AsyncHttpAgent::doCancel, id );
+	agent->send( mSelector );
+	
+	AutoLock lock( mLock );
+	
+	for ( JetHead::list<Request*>::iterator i = mDelivering.begin(); 
+		  i != mDelivering.end(); ++i )
+	{
+		if ( (*i)->mId == id )
+			(*i)->mCancelled = true;
+	}
+}
+
+void AsyncHttpAgent::start( Request *req )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	req->mTimer = jh_new AsyncEventAgent1<AsyncHttpAgent, int>( 
+		this, &AsyncHttpAgent::handleTimeout, req->mId );
+	req->mTimer->AddRef();
+	req->mTimer->sendTimed( mSelector, req->mTimeout );
+	
+	expireIdle();
+	
+	mQueued.push_back( req );
+	startQueued( req->mHost, req->mPort );
+}
+
+void AsyncHttpAgent::doCancel( int id )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	for ( JetHead::list<Request*>::iterator i = mQueued.begin(); 
+		  i != mQueued.end(); ++i )
+	{
+		if ( (*i)->mId == id )
+		{
+			destroy( *i );
+			i.erase();
+			return;
+		}
+	}
+	
+	for ( unsigned i = 0; i < mConnections.size(); i++ )
+	{
+		Connection *conn = mConnections[ i ];
+		
+		for ( JetHead::list<Request*>::iterator j = conn->mRequests.begin(); 
+			  j != conn->mRequests.end(); ++j )
+		{
+			if ( (*j)->mId == id )
+			{
+				// Part way through, so no good to anyone else
+				Request *req = *j;
+				abandon( conn, req );
+				destroy( req );
+				return;
+			}
+		}
+	}
+}
+
+void AsyncHttpAgent::handleTimeout( int id )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	for ( JetHead::list<Request*>::iterator i = mQueued.begin(); 
+		  i != mQueued.end(); ++i )
+	{
+		if ( (*i)->mId == id )
+		{
+			Request *req = *i;
+			i.erase();
+			complete( req, kTimedOut );
+			return;
+		}
+	}
+	
+	for ( unsigned i = 0; i < mConnections.size(); i++ )
+	{
+		Connection *conn = mConnections[ i ];
+		
+		for ( JetHead::list<Request*>::iterator j = conn->mRequests.begin(); 
+			  j != conn->mRequests.end(); ++j )
+		{
+			if ( (*j)->mId == id )
+			{
+				LOG_NOTICE( "Request %d to %s timed out", id, 
+							conn->mHost.c_str() );
+				
+				Request *req = *j;
+				abandon( conn, req );
+				complete( req, kTimedOut );
+				return;
+			}
+		}
+	}
+}
+
+bool AsyncHttpAgent::assign( Request *req )
+{
+	Connection *conn = NULL;
+	int open;
+	
+	// Warmest idle connection first, dropping any that have gone bad
+	while ( true )
+	{
+		open = 0;
+		conn = NULL;
+		
+		for ( unsigned i = 0; i < mConnections.size(); i++ )
+		{
+			Connection *c = mConnections[ i ];
+			
+			if ( c->mPort != req->mPort or c->mHost != req->mHost )
+				continue;
+			
+			open++;
+			
+			if ( c->mState == Connection::kIdle and 
+				 ( conn == NULL or c->mIdleSince > conn->mIdleSince ) )
+				conn = c;
+		}
+		
+		if ( conn == NULL or conn->mSock->isIdleUsable() )
+			break;
+		
+		closeConnection( conn );
+	}
+	
+	if ( conn != NULL )
+	{
+		sendRequest( conn, req );
+		startResponse( conn );
+		return true;
+	}
+	
+	// A new connection is better than waiting behind other responses
+	if ( open >= mMaxPerHost )
+	{
+		conn = findPipeline( req );
+		
+		if ( conn == NULL )
+			return false;
+		
+		sendRequest( conn, req );
+		return true;
+	}
+	
+	conn = jh_new Connection;
+	conn->mSock = NULL;
+	conn->mHost = req->mHost;
+	conn->mPort = req->mPort;
+	conn->mState = Connection::kResolving;
+	conn->mReused = false;
+	conn->mPipelining = false;
+	conn->mKeepAlive = false;
+	conn->mIdleSince = 0;
+	conn->mRequests.push_back( req );
+	req->mConn = conn;
+	mConnections.push_back( conn );
+	
+	Resolver::getInstance()->resolveAsync( req->mHost.c_str(), this, mSelector );
+	return true;
+}
+
+AsyncHttpAgent::Connection *AsyncHttpAgent::findPipeline( Request *req )
+{
+	Connection *best = NULL;
+	
+	// Nothing goes behind a request that can't be repeated, if the 
+	//  connection is lost we couldn't tell which of them were done
+	if ( mPipelineDepth <= 1 or not req->mIdempotent )
+		return NULL;
+	
+	for ( unsigned i = 0; i < mConnections.size(); i++ )
+	{
+		Connection *c = mConnections[ i ];
+		
+		if ( c->mPort != req->mPort or c->mHost != req->mHost or 
+			 not c->mPipelining or not c->mKeepAlive or 
+			 c->mRequests.empty() or 
+			 (int)c->mRequests.size() >= mPipelineDepth )
+			continue;
+		
+		bool idempotent = true;
+		
+		for ( JetHead::list<Request*>::iterator j = c->mRequests.begin(); 
+			  j != c->mRequests.end(); ++j )
+		{
+			if ( not (*j)->mIdempotent )
+				idempotent = false;
+		}
+		
+		if ( idempotent and 
+			 ( best == NULL or c->mRequests.size() < best->mRequests.size() ) )
+			best = c;
+	}
+	
+	return best;
+}
+
+void AsyncHttpAgent::startQueued( const JHSTD::string &host, int port )
+{
+	JetHead::list<Request*>::iterator i = mQueued.begin();
+	
+	while ( i != mQueued.end() )
+	{
+		if ( (*i)->mPort != port or (*i)->mHost != host )
+		{
+			++i;
+			continue;
+		}
+		
+		// Oldest first, so if this one has to wait so do the rest
+		if ( not assign( *i ) )
+			break;
+		
+		i = i.erase();
+	}
+}
+
+void AsyncHttpAgent::handleResolved( const char *name, int error,
+									 const JetHead::vector<Socket::Address> &addrs )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	JetHead::vector<Connection*> waiting;
+	
+	for ( unsigned i = 0; i < mConnections.size(); i++ )
+	{
+		if ( mConnections[ i ]->mState == Connection::kResolving and 
+			 mConnections[ i ]->mHost == name )
+			waiting.push_back( mConnections[ i ] );
+	}
+	
+	for ( unsigned i = 0; i < waiting.size(); i++ )
+	{
+		if ( error != 0 )
+		{
+			LOG_NOTICE( "Failed to look up %s: %d", name, error );
+			fail( waiting[ i ], kConnectionFailed );
+			continue;
+		}
+		
+		waiting[ i ]->mAddrs = addrs;
+		connectNext( waiting[ i ] );
+	}
+}
+
+void AsyncHttpAgent::connectNext( Connection *conn )
+{
+	while ( not conn->mAddrs.empty() )
+	{
+		Socket::Address addr = conn->mAddrs[ 0 ];
+		conn->mAddrs.erase( 0 );
+		addr.setPort( conn->mPort );
+		
+		// A socket that failed to connect can't be used again
+		if ( conn->mSock != NULL )
+		{
+			conn->mSock->setSelector( NULL, NULL );
+			delete conn->mSock;
+		}
+		
+		conn->mSock = jh_new Socket;
+		conn->mSock->setSelector( this, mSelector );
+		
+		if ( conn->mSock->connectAsync( addr ) == 0 )
+		{
+			conn->mState = Connection::kConnecting;
+			return;
+		}
+		
+		LOG_INFO( "Failed to start connect to %s: %s", addr.getName(), 
+				  strerror( errno ) );
+	}
+	
+	fail( conn, kConnectionFailed );
+}
+
+void AsyncHttpAgent::handleConnected( Socket *socket, bool success )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	Connection *conn = findConnection( socket );
+	
+	if ( conn == NULL )
+		return;
+	
+	if ( not success )
+	{
+		LOG_INFO( "Failed to connect to %s: %s", conn->mHost.c_str(), 
+				  strerror( errno ) );
+		connectNext( conn );
+		return;
+	}
+	
+	// Only the request that opened it, nothing is pipelined on a new one
+	Request *req = conn->mRequests.front();
+	conn->mRequests.pop_front();
+	sendRequest( conn, req );
+	startResponse( conn );
+}
+
+void AsyncHttpAgent::sendRequest( Connection *conn, Request *req )
+{
+	conn->mRequests.push_back( req );
+	req->mConn = conn;
+	
+	// A failed write is noticed as a close, which fails or requeues req
+	if ( conn->mSock->writeAsync( req->mData.data(), req->mData.size() ) < 0 )
+		LOG_NOTICE( "Failed to write request %d to %s: %s", req->mId, 
+					conn->mHost.c_str(), strerror( errno ) );
+}
+
+void AsyncHttpAgent::startResponse( Connection *conn )
+{
+	Request *req = conn->mRequests.front();
+	
+	conn->mState = Connection::kBusy;
+	conn->mParser.reset( req->mHead );
+	
+	// -1 until a status line arrives
+	delete req->mResponse;
+	req->mResponse = jh_new HttpResponse;
+	req->mResponse->setResponseCode( -1 );
+	req->mBody.clear();
+	
+	delete req->mDecoder;
+	req->mDecoder = NULL;
+}
+
+void AsyncHttpAgent::handleData( Socket *socket )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	Connection *conn = findConnection( socket );
+	
+	if ( conn == NULL )
+		return;
+	
+	// Nothing should arrive on an idle connection
+	if ( conn->mRequests.empty() )
+	{
+		LOG_INFO( "Data on idle connection to %s", conn->mHost.c_str() );
+		closeConnection( conn );
+		return;
+	}
+	
+	// The parser takes everything each time, so there's always space
+	if ( conn->mBuffer.fillFromFile( socket, 
+									 conn->mBuffer.getFreeSpace() ) <= 0 )
+	{
+		handleClose( socket );
+		return;
+	}
+	
+	process( conn );
+}
+
+bool AsyncHttpAgent::handleClose( Socket *socket )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	Connection *conn = findConnection( socket );
+	
+	if ( conn == NULL )
+		return false;
+	
+	if ( conn->mRequests.empty() )
+		closeConnection( conn );
+	else if ( conn->mParser.finish() == 0 )
+	{
+		// A body that ran until the close
+		conn->mKeepAlive = false;
+		finish( conn, kNoError );
+	}
+	else
+		fail( conn, kReadFailed );
+	
+	return true;
+}
+
+void AsyncHttpAgent::process( Connection *conn )
+{
+	Request *req = conn->mRequests.front();
+	HttpParser &parser = conn->mParser;
+	
+	if ( parser.parse( conn->mBuffer ) < 0 )
+	{
+		LOG_NOTICE( "Problem parsing response from %s", conn->mHost.c_str() );
+		fail( conn, kReadFailed );
+		return;
+	}
+	
+	if ( not parser.isDone() )
+		return;
+	
+	conn->mKeepAlive = parser.isKeepAlive() and not req->mClose;
+	conn->mPipelining = conn->mKeepAlive and ( parser.getMajor() > 1 or 
+		( parser.getMajor() == 1 and parser.getMinor() >= 1 ) );
+	
+	finish( conn, kNoError );
+}
+
+void AsyncHttpAgent::finish( Connection *conn, ErrCode err )
+{
+	Request *req = conn->mRequests.front();
+	JHSTD::string host = conn->mHost;
+	int port = conn->mPort;
+	
+	conn->mRequests.pop_front();
+	req->mConn = NULL;
+	
+	// A bad coded body doesn't spoil the connection
+	if ( err == kNoError and req->mDecoder != NULL and 
+		 req->mDecoder->finish() != 0 )
+		complete( req, kReadFailed );
+	else
+		complete( req, err );
+	
+	if ( err != kNoError or not conn->mKeepAlive )
+	{
+		// The server won't answer anything sent after this
+		requeue( conn );
+	}
+	else if ( not conn->mRequests.empty() )
+	{
+		// Anything left in the buffer is the start of the next response
+		conn->mReused = true;
+		startResponse( conn );
+		process( conn );
+	}
+	else if ( mIdleTimeout > 0 and conn->mBuffer.getLength() == 0 )
+	{
+		conn->mState = Connection::kIdle;
+		conn->mReused = true;
+		conn->mIdleSince = TimeUtils::getMonotonicMicros();
+	}
+	else
+	{
+		// Anything left over wasn't asked for, so don't trust what 
+		//  would come after it
+		closeConnection( conn );
+	}
+	
+	startQueued( host, port );
+}
+
+void AsyncHttpAgent::fail( Connection *conn, ErrCode err )
+{
+	if ( conn->mRequests.empty() )
+	{
+		closeConnection( conn );
+		return;
+	}
+	
+	Request *req = conn->mRequests.front();
+	
+	// The server may have closed a kept connection just as we sent on it,
+	//  in which case nothing was done and it's safe to try again on 
+	//  another connection.  A new connection gets no second chance.
+	if ( conn->mReused and req->mIdempotent and 
+		 conn->mState == Connection::kBusy and not conn->mParser.isStarted() and
+		 conn->mBuffer.getLength() == 0 )
+	{
+		LOG_INFO( "Retrying request %d to %s", req->mId, conn->mHost.c_str() );
+		
+		JHSTD::string host = conn->mHost;
+		int port = conn->mPort;
+		
+		requeue( conn );
+		startQueued( host, port );
+		return;
+	}
+	
+	conn->mKeepAlive = false;
+	finish( conn, err );
+}
+
+void AsyncHttpAgent::requeue( Connection *conn )
+{
+	// Back to front so they stay in order, ahead of everything else
+	while ( not conn->mRequests.empty() )
+	{
+		Request *req = conn->mRequests.back();
+		conn->mRequests.pop_back();
+		req->mConn = NULL;
+		mQueued.push_front( req );
+	}
+	
+	closeConnection( conn );
+}
+
+void AsyncHttpAgent::abandon( Connection *conn, Request *req )
+{
+	JHSTD::string host = conn->mHost;
+	int port = conn->mPort;
+	
+	for ( JetHead::list<Request*>::iterator i = conn->mRequests.begin(); 
+		  i != conn->mRequests.end(); ++i )
+	{
+		if ( *i == req )
+		{
+			i.erase();
+			break;
+		}
+	}
+	
+	req->mConn = NULL;
+	requeue( conn );
+	startQueued( host, port );
+}
+
+void AsyncHttpAgent::complete( Request *req, ErrCode err )
+{
+	releaseTimer( req );
+	
+	if ( req->mResponse == NULL )
+	{
+		req->mResponse = jh_new HttpResponse;
+		req->mResponse->setResponseCode( -1 );
+	}
+	
+	req->mError = err;
+	
+	{
+		AutoLock lock( mLock );
+		mDelivering.push_back( req );
+	}
+	
+	AsyncEventAgent1<AsyncHttpAgent, Request*> *agent = 
+		jh_new AsyncEventAgent1<AsyncHttpAgent, Request*>( 
+			this, &AsyncHttpAgent::deliver, req );
+	agent->send( req->mDispatcher );
+}
+
+void AsyncHttpAgent::deliver( Request *req )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	bool cancelled;
+	
+	{
+		AutoLock lock( mLock );
+		cancelled = req->mCancelled;
+		
+		for ( JetHead::list<Request*>::iterator i = mDelivering.begin(); 
+			  i != mDelivering.end(); ++i )
+		{
+			if ( *i == req )
+			{
+				i.erase();
+				break;
+			}
+		}
+	}
+	
+	if ( not cancelled )
+		req->mListener->handleResponse( req->mId, req->mError, 
+										*req->mResponse, req->mBody );
+	
+	destroy( req );
+}
+
+void AsyncHttpAgent::Connection::handleStatusLine( int major, int minor, 
+													int code, 
+													const char *reason, 
+													int reasonLen )
+{
+	mRequests.front()->mResponse->handleStatusLine( major, minor, code, 
+													reason, reasonLen );
+}
+
+void AsyncHttpAgent::Connection::handleField( const char *name, int nameLen,
+											  const char *value, int valueLen )
+{
+	mRequests.front()->mResponse->handleField( name, nameLen, value, 
+											   valueLen );
+}
+
+void AsyncHttpAgent::Connection::handleHeaderEnd()
+{
+	Request *req = mRequests.front();
+	
+	if ( not req->mAcceptEncoding )
+		return;
+	
+	ContentCoding::Coding coding = ContentCoding::parse( 
+		req->mResponse->getField( HttpFieldMap::kFieldContentEncoding ) );
+	
+	// Anything we didn't ask for is passed on as it came
+	if ( coding == ContentCoding::kGzip or coding == ContentCoding::kDeflate )
+	{
+		req->mDecoder = jh_new ContentDecoder( req->mHandler != NULL ? 
+			req->mHandler : &req->mAppender, coding );
+	}
+}
+
+void AsyncHttpAgent::Connection::handleBody( const char *data, int len )
+{
+	Request *req = mRequests.front();
+	
+	if ( req->mDecoder != NULL )
+		req->mDecoder->decode( data, len );
+	else if ( req->mHandler != NULL )
+		req->mHandler->handleData( data, len );
+	else
+		req->mBody.append( data, len );
+}
+
+void AsyncHttpAgent::releaseTimer( Request *req )
+{
+	if ( req->mTimer != NULL )
+	{
+		req->mTimer->remove( mSelector );
+		req->mTimer->Release();
+		req->mTimer = NULL;
+	}
+}
+
+void AsyncHttpAgent::destroy( Request *req )
+{
+	releaseTimer( req );
+	delete req->mResponse;
+	delete req->mDecoder;
+	delete req;
+}
+
+void AsyncHttpAgent::closeConnection( Connection *conn )
+{
+	for ( unsigned i = 0; i < mConnections.size(); i++ )
+	{
+		if ( mConnections[ i ] == conn )
+		{
+			mConnections.erase( i );
+			break;
+		}
+	}
+	
+	if ( conn->mSock != NULL )
+	{
+		conn->mSock->setSelector( NULL, NULL );
+		delete conn->mSock;
+	}
+	
+	delete conn;
+}
+
+AsyncHttpAgent::Connection *AsyncHttpAgent::findConnection( Socket *sock )
+{
+	for ( unsigned i = 0; i < mConnections.size(); i++ )
+	{
+		if ( mConnections[ i ]->mSock == sock )
+			return mConnections[ i ];
+	}
+	
+	return NULL;
+}
+
+void AsyncHttpAgent::expireIdle()
+{
+	uint64_t now = TimeUtils::getMonotonicMicros();
+	
+	for ( unsigned i = mConnections.size(); i > 0; i-- )
+	{
+		Connection *conn = mConnections[ i - 1 ];
+		
+		if ( conn->mState == Connection::kIdle and 
+			 now - conn->mIdleSince >= mIdleTimeout * 1000ULL )
+			closeConnection( conn );
+	}
+}
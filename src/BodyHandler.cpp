@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "BodyHandler.h"
+
+#include "logging.h"
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+using namespace JetHead;
+
+void WriterBodyHandler::handleData( const char *buf, int len )
+{
+	if ( mFailed or len <= 0 )
+		return;
+	
+	if ( mWriter.writeAll( buf, len ) != len )
+	{
+		LOG_NOTICE( "Failed to write %d bytes of body", len );
+		mFailed = true;
+	}
+}
+
+void WriterBodyHandler::handleDatav( const struct iovec *iov, int count )
+{
+	if ( mFailed )
+		return;
+	
+	int res = mWriter.writev( iov, count );
+	
+	if ( res < 0 )
+	{
+		LOG_NOTICE( "Failed to write body" );
+		mFailed = true;
+		return;
+	}
+	
+	// Finish off a short write
+	for ( int i = 0; i < count; i++ )
+	{
+		int len = iov[ i ].iov_len;
+		
+		if ( res >= len )
+		{
+			res -= len;
+			continue;
+		}
+		
+		handleData( (const char*)iov[ i ].iov_base + res, len - res );
+		res = 0;
+	}
+}
+
+int WriterBodyHandler::handleSocket( Socket &sock, int len )
+{
+	char buf[ 16 * 1024 ];
+	
+	if ( len > (int)sizeof( buf ) )
+		len = sizeof( buf );
+	
+	int res = sock.read( buf, len );
+	
+	if ( res > 0 )
+		handleData( buf, res );
+	
+	return res;
+}
+
+int AppendBodyHandler::handleSocket( Socket &sock, int len )
+{
+	char buf[ 16 * 1024 ];
+	
+	if ( len > (int)sizeof( buf ) )
+		len = sizeof( buf );
+	
+	int res = sock.read( buf, len );
+	
+	if ( res > 0 )
+		mString.append( buf, res );
+	
+	return res;
+}
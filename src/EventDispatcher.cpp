@@ -28,12 +28,16 @@
 #include "EventDispatcher.h"
 #include "EventAgent.h"
 #include "Timer.h"
+#include "TimeUtils.h"
+#include "TraceRecorder.h"
 #include "logging.h"
 #include "jh_memory.h"
 
 SET_LOG_CAT( LOG_CAT_ALL );
 SET_LOG_LEVEL( LOG_LVL_NOTICE );
 
+StallListener *EventDispatcher::sStallListener = NULL;
+
 EventDispatcherHelper::EventDispatcherHelper()
 :	mLock( true )
 {
@@ -68,7 +72,10 @@ void EventDispatcherHelper::dispatchEvent( Event *ev )
 	{
 		EventAgent *agent = event_cast<EventAgent>( ev );
 		if ( agent != NULL )
+		{
+			TraceSpan span( "EventAgent::deliver" );
 			agent->deliver();
+		}
 	}
 	else
 	{
@@ -133,6 +140,7 @@ int EventDispatcherHelper::removeEventListener( IEventListener *listener, int ev
 }
 
 EventDispatcher::EventDispatcher()
+:	mStallThreshold( kDefaultStallThreshold * 1000 )
 {
 	// NOTE:  This is a sort of hacky way of preventing a bad condition from
 	// occuring.  It was found that when we are processing a signal to do
@@ -318,6 +326,59 @@ int EventDispatcher::removeEventListener( IEventListener *listener, int event_id
 	return mDispatcher.removeEventListener( listener, event_id );
 }
 
+void EventDispatcher::setMetricsName( const char *name )
+{
+	JHSTD::string labels;
+	JetHead::stl_sprintf( labels, "dispatcher=\"%s\"", name );
+
+	MetricsRegistry *metrics = MetricsRegistry::getInstance();
+	mMetricsName = name;
+	mEventsDispatched = metrics->getCounter( 
+		"jh_eventdispatcher_events_total", labels.c_str() );
+	mQueueWait = metrics->getHistogram( 
+		"jh_eventdispatcher_queue_wait_us", labels.c_str() );
+	mRunTime = metrics->getHistogram( 
+		"jh_eventdispatcher_run_time_us", labels.c_str() );
+	mStalls = metrics->getCounter( 
+		"jh_eventdispatcher_stalls_total", labels.c_str() );
+	mQueue.setMetricsName( name );
+}
+
+void EventDispatcher::setStallListener( StallListener *listener )
+{
+	sStallListener = listener;
+}
+
+void EventDispatcher::reportStall( StallReport &report )
+{
+	report.mDispatcher = mMetricsName.c_str();
+	
+	if ( mStalls != NULL )
+		mStalls->increment();
+	
+	StallListener *listener = sStallListener;
+	
+	if ( listener != NULL )
+	{
+		listener->handleStall( report );
+	}
+	else if ( report.mFd != -1 )
+	{
+		LOG_WARN( "%s stalled %llu us on fd %d listener %p (waited %llu us)",
+				  report.mDispatcher, (unsigned long long)report.mRunTime,
+				  report.mFd, report.mTarget,
+				  (unsigned long long)report.mQueueWait );
+	}
+	else
+	{
+		LOG_WARN( "%s stalled %llu us on event %d target %p method %p "
+				  "(queued %llu us)", report.mDispatcher, 
+				  (unsigned long long)report.mRunTime, report.mEventId,
+				  report.mTarget, report.mMethod, 
+				  (unsigned long long)report.mQueueWait );
+	}
+}
+
 void EventDispatcher::handleSyncEvent( Event *ev )
 {
 	TRACE_BEGIN( LOG_LVL_NOISE );
@@ -348,6 +409,45 @@ bool EventDispatcher::handleEvent( Event *ev )
 		return false;
 	}
 	
+	if ( mEventsDispatched != NULL )
+		mEventsDispatched->increment();
+
+	// Work out who is going to handle this now since ev may be gone by the
+	//  time we know if it stalled.
+	StallReport report;
+	report.mDispatcher = NULL;
+	report.mEventId = ev->getEventId();
+	report.mTarget = NULL;
+	report.mMethod = NULL;
+	report.mFd = -1;
+	
+	Event *real = ev;
+	if ( report.mEventId == Event::kSyncEventId )
+	{
+		SyncEventHolder *holder = event_cast<SyncEventHolder>( ev );
+		if ( holder != NULL )
+			real = holder->mRealEvent;
+	}
+	
+	if ( real->getEventId() == Event::kAgentEventId )
+	{
+		EventAgent *agent = event_cast<EventAgent>( real );
+		if ( agent != NULL )
+		{
+			report.mTarget = agent->getDeliveryTarget();
+			report.mMethod = agent->getDeliveryMethod();
+		}
+	}
+	report.mEventId = real->getEventId();
+	
+	uint64_t start = TimeUtils::getMonotonicMicros();
+	report.mQueueWait = ev->getEnqueueTime() != 0 ? 
+		start - ev->getEnqueueTime() : 0;
+	
+	TraceSpan span( "EventDispatcher::handleEvent", report.mEventId );
+	if ( ev->getTraceFlow() != 0 and TraceRecorder::isEnabled() )
+		TraceRecorder::flowEnd( "event", ev->getTraceFlow() );
+	
 	switch ( ev->getEventId() )
 	{
 		case Event::kShutdownEventId:
@@ -367,6 +467,16 @@ bool EventDispatcher::handleEvent( Event *ev )
 			break;
 	}
 	
+	report.mRunTime = TimeUtils::getMonotonicMicros() - start;
+	
+	if ( mQueueWait != NULL )
+	{
+		mQueueWait->observe( report.mQueueWait );
+		mRunTime->observe( report.mRunTime );
+	}
+	
+	checkStall( report );
+	
 	return done;
 }
 
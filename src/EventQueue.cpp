@@ -28,6 +28,8 @@
 #include "EventQueue.h"
 #include "logging.h"
 #include "EventAgent.h"
+#include "TimeUtils.h"
+#include "TraceRecorder.h"
 
 SET_LOG_CAT( LOG_CAT_ALL );
 SET_LOG_LEVEL( LOG_LVL_NOTICE );
@@ -41,15 +43,30 @@ EventQueue::~EventQueue()
 {
 	TRACE_BEGIN( LOG_LVL_NOISE );
 	// look at all event in the queue and delete them.
+	
+	if ( mDepth != NULL )
+		mDepth->add( -(int)mQueue.size() );
 }
 
 void EventQueue::SendEvent( Event *ev )
 {
 	TRACE_BEGIN( LOG_LVL_NOISE );
+	TraceSpan span( "EventQueue::SendEvent", ev->getEventId() );
 	
 	DebugAutoLock( mLock );
 	
 	ev->AddRef();
+	ev->mEnqueueTime = TimeUtils::getMonotonicMicros();
+	
+	if ( TraceRecorder::isEnabled() )
+	{
+		ev->mTraceFlow = TraceRecorder::newFlowId();
+		TraceRecorder::flowStart( "event", ev->mTraceFlow );
+	}
+	else
+	{
+		ev->mTraceFlow = 0;
+	}
 
 	if ( ev->getPriority() == PRIORITY_NORMAL )
 	{
@@ -75,6 +92,8 @@ void EventQueue::SendEvent( Event *ev )
 			mQueue.push_back( ev );
 		}
 	}
+
+	updateDepth( 1 );
 	
 	LOG( "queue size %d", mQueue.size() );	
 
@@ -115,6 +134,7 @@ Event *EventQueue::pollEventInternal()
 	
 	Event* ret = mQueue.front();
 	mQueue.pop_front();
+	updateDepth( -1 );
 	return ret;
 }
 
@@ -137,6 +157,7 @@ void EventQueue::Remove( Event::Id id )
 			(*i)->Release();
 			i = i.erase();
 			--i;
+			updateDepth( -1 );
 		}
 	}
 }
@@ -152,6 +173,7 @@ void EventQueue::Remove( Event *ev )
 			(*i)->Release();
 			i = i.erase();
 			--i;
+			updateDepth( -1 );
 		}
 	}	
 }
@@ -170,6 +192,7 @@ void EventQueue::RemoveAgentsByReceiver( void* receiver )
 				(*i)->Release();
 				i = i.erase();
 				--i;
+				updateDepth( -1 );
 			}
 		}
 	}
@@ -186,6 +209,26 @@ void EventQueue::Flush()
 		Event* temp = mQueue.front();
 		mQueue.pop_front();
 		temp->Release();
+		updateDepth( -1 );
 	}
 }
 
+void EventQueue::setMetricsName( const char *name )
+{
+	JHSTD::string labels;
+	JetHead::stl_sprintf( labels, "queue=\"%s\"", name );
+
+	SmartPtr<Gauge> depth = 
+		MetricsRegistry::getInstance()->getGauge( "jh_eventqueue_depth", 
+												  labels.c_str() );
+
+	DebugAutoLock( mLock );
+
+	// Move our current depth over to the new gauge
+	unsigned size = mQueue.size();
+	if ( mDepth != NULL )
+		mDepth->add( -(int)size );
+	mDepth = depth;
+	updateDepth( size );
+}
+
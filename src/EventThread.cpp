@@ -37,6 +37,7 @@ EventThread::EventThread( const char *name ) :
 	mThread( name == NULL ? "EventThread" : name, this, &EventThread::threadMain )
 {
 	TRACE_BEGIN( LOG_LVL_INFO );
+	setMetricsName( mThread.GetName() );
 	mThread.Start();
 }
 
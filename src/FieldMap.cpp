@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "FieldMap.h"
+
+#include "logging.h"
+#include "jh_memory.h"
+
+#include <string.h>
+#include <strings.h>
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+FieldTable::FieldTable( const char *const *names, int count, int first, 
+						uint32_t seed )
+	: mCount( count ), mMerged( NULL )
+{
+	mNames = jh_new Entry[ count ];
+	
+	for ( int i = 0; i < count; i++ )
+	{
+		mNames[ i ].mName = names[ i ];
+		mNames[ i ].mLen = strlen( names[ i ] );
+		mNames[ i ].mType = first + i;
+	}
+	
+	build( seed );
+}
+
+FieldTable::FieldTable( const FieldTable &base, const FieldTable &extra )
+	: mCount( 0 ), mMerged( NULL )
+{
+	mNames = jh_new Entry[ base.mCount + extra.mCount ];
+	
+	for ( int i = 0; i < base.mCount; i++ )
+		mNames[ mCount++ ] = base.mNames[ i ];
+	
+	// Earlier maps win, as they would searching the maps in order
+	for ( int i = 0; i < extra.mCount; i++ )
+	{
+		const Entry &entry = extra.mNames[ i ];
+		
+		if ( base.find( entry.mName, entry.mLen ) < 0 )
+			mNames[ mCount++ ] = entry;
+	}
+	
+	build( base.mSeed );
+}
+
+FieldTable::~FieldTable()
+{
+	while ( mMerged != NULL )
+	{
+		Merged *merged = mMerged;
+		mMerged = merged->mNext;
+		delete merged->mTable;
+		delete merged;
+	}
+	
+	delete [] mSlots;
+	delete [] mNames;
+}
+
+uint32_t FieldTable::hash( const char *name, int len, uint32_t seed )
+{
+	// FNV-1a, folding case by setting the bit that separates upper and
+	//  lower case letters.  That also folds a few punctuation characters
+	//  together, find compares the names properly anyway.
+	uint32_t h = 2166136261U ^ seed;
+	
+	for ( int i = 0; i < len; i++ )
+		h = ( h ^ ( (uint8_t)name[ i ] | 0x20 ) ) * 16777619U;
+	
+	return h ^ ( h >> 15 );
+}
+
+void FieldTable::build( uint32_t seed )
+{
+	// A quarter full gives a fair chance of finding a perfect seed quickly
+	uint32_t size = 1;
+	while ( size < (uint32_t)mCount * 4 )
+		size *= 2;
+	
+	mSlots = jh_new Entry[ size ];
+	mMask = size - 1;
+	
+	for ( int i = 0; i < kMaxSeedTries; i++ )
+	{
+		if ( place( seed + i ) )
+		{
+			mPerfect = true;
+			return;
+		}
+	}
+	
+	LOG_NOTICE( "No perfect hash for %d names, probing", mCount );
+	place( seed );
+	mPerfect = false;
+}
+
+bool FieldTable::place( uint32_t seed )
+{
+	bool perfect = true;
+	
+	mSeed = seed;
+	memset( mSlots, 0, ( mMask + 1 ) * sizeof( Entry ) );
+	
+	for ( int i = 0; i < mCount; i++ )
+	{
+		Entry entry = mNames[ i ];
+		uint32_t slot;
+		
+		entry.mHash = hash( entry.mName, entry.mLen, seed );
+		
+		for ( slot = entry.mHash & mMask; mSlots[ slot ].mName != NULL; 
+			  slot = ( slot + 1 ) & mMask )
+			perfect = false;
+		
+		mSlots[ slot ] = entry;
+	}
+	
+	return perfect;
+}
+
+int FieldTable::find( const char *name, int len ) const
+{
+	uint32_t h = hash( name, len, mSeed );
+	
+	// Never more than a quarter full, so there's always an empty slot
+	for ( uint32_t slot = h & mMask; mSlots[ slot ].mName != NULL; 
+		  slot = ( slot + 1 ) & mMask )
+	{
+		const Entry &entry = mSlots[ slot ];
+		
+		if ( entry.mHash == h and entry.mLen == len and 
+			 strncasecmp( entry.mName, name, len ) == 0 )
+			return entry.mType;
+	}
+	
+	return -1;
+}
+
+const FieldTable *FieldTable::merge( const FieldTable *extra ) const
+{
+	while ( true )
+	{
+		Merged *head = mMerged;
+		
+		for ( Merged *merged = head; merged != NULL; merged = merged->mNext )
+		{
+			if ( merged->mExtra == extra )
+				return merged->mTable;
+		}
+		
+		Merged *merged = jh_new Merged;
+		merged->mExtra = extra;
+		merged->mTable = jh_new FieldTable( *this, *extra );
+		merged->mNext = head;
+		
+		if ( __sync_bool_compare_and_swap( &mMerged, head, merged ) )
+			return merged->mTable;
+		
+		// Someone else added one first, it may be the one we want
+		delete merged->mTable;
+		delete merged;
+	}
+}
@@ -27,62 +27,28 @@
 
 #include "HttpAgent.h"
 
+#include "jh_memory.h"
 #include "logging.h"
 
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+
 SET_LOG_CAT(LOG_CAT_ALL);
 SET_LOG_LEVEL(LOG_LVL_NOISE);
 
 using namespace JetHead;
 
-HttpAgent::HttpAgent() : mBuffer( kMaxMessageSize )
+HttpAgent::HttpAgent() 
+	: mBuffer( kMaxMessageSize ), mSock( NULL ), 
+	mPool( HttpConnectionPool::getInstance() ), mReusable( false ),
+	mResponse( NULL ), mHandler( NULL ), mAcceptEncoding( false )
 {
 }
 
-int parseChunkLine( const CircularBuffer &buf, int &len )
+HttpAgent::~HttpAgent()
 {
-	TRACE_BEGIN( LOG_LVL_INFO );
-
-	char length_str[ 40 ];
-	int i = 0;
-	int j = 0;
-	int c;
-
-	if (!buf.getLength())
-		return -1;
-				
-	while ( 1 )
-	{
-		c = buf.byteAt( i++ );	
-
-		if ( c < 0 )
-			return c;
-
-		if ( c == ';' || c == '\r')
-			break;
-		length_str[ j++ ] = c;
-	}
-
-	length_str[ j ] = 0;
-
-	while ( c != '\r' )
-	{
-		c = buf.byteAt( i++ );	
-
-		if ( c < 0 )
-			return c;
-	}
-	
-	// if CRLF move past LF
-	c = buf.byteAt(i);
-	if ( c == '\n' )
-		i++;
-	else
-		return -1;
-		
-	len = strtol( length_str, NULL, 16 );
-
-	LOG( "string %s", length_str );
-	return i;
+	closeConnection( false );
 }
 
 int HttpAgent::get( const URI &uri, HttpResponse &res, BodyHandler *handler )
@@ -101,210 +67,225 @@ int HttpAgent::sendAndGet( HttpRequest &req, HttpResponse &res,
 						   const std::string& toSend, BodyHandler* handler )
 {
 	URI uri = req.getURI();
+	bool reused;
+	int err;
 
-	Socket::Address addr( uri.getHost().c_str(), uri.getPort() );
-	bool first_line = true;
-	int len;
-	int ret;
-	ErrCode err = kNoError;
-
-	mSock.setReadTimeout( 5 );
-	ret = mSock.connect( addr, 10 );
-
-	if (ret != 0)
-	{
-		LOG_NOTICE("Socket connect failed...");
-		res.setResponseCode(-1);
-		return kConnectionFailed;
-	}
-
-	ret = req.send( &mSock );
-	if (not toSend.empty())
+	do
 	{
-		if (mSock.write(toSend.c_str(), toSend.size()) != (int)toSend.size())
+		if ( openConnection( uri, reused ) != kNoError )
 		{
-			return kWriteFailed;
+			LOG_NOTICE("Socket connect failed...");
+			res.setResponseCode(-1);
+			return kConnectionFailed;
 		}
-	}
+		
+		err = exchange( req, res, toSend, handler );
+		closeConnection( err == kNoError and mReusable );
+		
+		// The server may have closed a pooled connection just as we sent
+		//  on it, in which case nothing was done and it's safe to try again
+		//  on another connection.  A new connection gets no second chance.
+	} while ( reused and ( err == kConnectionClosed or err == kWriteFailed ) and
+			  req.isIdempotent() );
+	
+	if ( err == kConnectionClosed )
+		err = kReadFailed;
+	
+	if ( err != kNoError )
+		return err;
 
-	mBuffer.clear();
-	do
+	int ret = res.getResponseCode();
+	
+	if ( !(( ret == 200 ) || ( ret == 206)) )
 	{
-		ret = mBuffer.fillFromFile(&mSock, mBuffer.getFreeSpace());
+		LOG_NOTICE("File not found... response code = %d", ret);
+		return kNotFound;
+	}
 
-		if (ret <= 0)
-		{
-			LOG_NOTICE("Socket read failed...");
-			return kReadFailed;
-		}
+	return kNoError;
+}
 
-		while (HttpHeaderBase::searchForLine(mBuffer) > 0)
-		{
-			if (first_line)
-			{
-				len = res.parseFirstLine(mBuffer);
-				first_line = false;
-			}
-			else
-			{
-				len = res.parseLine(mBuffer);
-			}
+int HttpAgent::exchange( HttpRequest &req, HttpResponse &res, 
+						 const JHSTD::string &toSend, BodyHandler *handler )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	mReusable = false;
+	
+	// Only for the request as sent, the caller's is left as it was
+	const char *accept = mAcceptEncoding ? 
+		ContentCoding::getAcceptEncoding() : NULL;
+	
+	if ( accept != NULL and 
+		 req.getField( HttpFieldMap::kFieldAcceptEncoding ) == NULL )
+		req.addField( HttpFieldMap::kFieldAcceptEncoding, accept );
+	else
+		accept = NULL;
+	
+	int sent = toSend.empty() ? req.send( mSock ) : 
+		req.send( mSock, (const uint8_t*)toSend.data(), toSend.size() );
+	
+	if ( accept != NULL )
+		req.removeField( HttpFieldMap::kFieldAcceptEncoding );
+	
+	if ( sent < 0 )
+		return kWriteFailed;
 
-			if (len < 0)
-			{
-				LOG_NOTICE("Problem parsing response...");
-			}
-			else
-			{
-				mBuffer.read(NULL, len);
-			}
-		}
+	HttpParser parser( HttpParser::kResponse, this );
+	parser.reset( req.getMethod() == HttpRequest::kMethodHead );
+	
+	mResponse = &res;
+	mHandler = handler;
+	mBuffer.clear();
+	
+	int err = readResponse( parser );
+	
+	if ( mHandler == &mDecoder )
+	{
+		if ( err == kNoError and mDecoder.finish() != 0 )
+			err = kReadFailed;
 		
-	} while (HttpHeaderBase::searchForLine(mBuffer) != HttpHeaderBase::kEOH or
-			 mBuffer.getLength() < 2);
-
-	ret = res.getResponseCode();
-
-	// read \r\n from buffer
-	mBuffer.read( NULL, 2 );			
+		mDecoder.setNext( NULL );
+	}
 	
-	// Get Body of Response.
+	mResponse = NULL;
+	mHandler = NULL;
+	
+	if ( handler != NULL )
+		handler->setStop(true);
+	
+	// Anything left over isn't part of this response, so don't trust what 
+	//  would come after it
+	mReusable = err == kNoError and parser.isKeepAlive() and 
+		not req.hasFieldToken( HttpFieldMap::kFieldConnection, "close" ) and
+		mBuffer.getLength() == 0;
+	
+	return err;
+}
 
-	int read_len, length = 0;	
-	err = res.getFieldInt( HttpFieldMap::kFieldContentLength, length );
-	if ( err == kNoError )
+int HttpAgent::readResponse( HttpParser &parser )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	while ( not parser.isDone() )
 	{
-		const char *buffer;
-		int buffer_len;
+		HttpParser::State state = parser.getState();
 		
-		while ( length > 0 )
+		if ( mBuffer.getLength() == 0 and mHandler != NULL and
+			 ( state == HttpParser::kBody or state == HttpParser::kChunkData ) )
 		{
-			buffer = (const char *)mBuffer.getBytes( 0, buffer_len );
+			// Nothing buffered, so the handler can read straight from the 
+			//  socket
+			int64_t length = parser.getRemaining();
+			int ret = mHandler->handleSocket( *mSock, 
+							length > INT32_MAX ? INT32_MAX : (int)length );
+			if ( ret <= 0 )
+			{
+				LOG_NOTICE("Body ended %lld bytes early", (long long)length);
+				return kReadFailed;
+			}
 			
-			if ( buffer_len > length )
-				buffer_len = length;
+			parser.skip( ret );
+			continue;
+		}
+		
+		if ( mBuffer.getLength() == 0 )
+		{
+			int ret = mBuffer.fillFromFile( mSock, mBuffer.getFreeSpace() );
 			
-			if ( handler != NULL )
-				handler->handleData( buffer, buffer_len );
+			if ( ret == 0 and parser.finish() == 0 )
+				break;
 			
-			mBuffer.read( NULL, buffer_len );
-			length -= buffer_len;
-
-			if (length)
+			if ( ret <= 0 )
 			{
-				ret = handler->handleSocket( mSock, length );	
-
-				if (ret < 0)
-					return kReadFailed;
-				length = 0;
+				LOG_NOTICE("Socket read failed...");
+				return parser.isStarted() ? kReadFailed : kConnectionClosed;
 			}
 		}
+		
+		if ( parser.parse( mBuffer ) < 0 )
+		{
+			LOG_NOTICE("Problem parsing response...");
+			return kReadFailed;
+		}
 	}
-	else
-	{
-		const char *encoding = res.getField( HttpFieldMap::kFieldTransferEncoding );
-
-		if ( encoding != NULL && strcmp( encoding, "chunked" ) == 0 )
-		{			
-			while ((read_len = parseChunkLine( mBuffer, length )) <= 0)
-			{
-				ret = mBuffer.fillFromFile( &mSock, mBuffer.getFreeSpace() );
-
-				if (ret < 0)
-				{
-					LOG_ERR("Socket read failed...");
-					return kReadFailed;
-				}	
-
-				if ( mBuffer.byteAt( 0 ) == '\r' )
-					mBuffer.read( NULL, 1 );
-				if ( mBuffer.byteAt( 0 ) == '\n' )
-					mBuffer.read( NULL, 1 );
-				
-			}
-
-			mBuffer.read( NULL, read_len );
-			
-			while ( length > 0 )
-			{
-				const char *buffer;
-				int buffer_len;
-			
-				while ( length > 0 )
-				{
-					buffer = (const char *)mBuffer.getBytes( 0, buffer_len );
-					
-					if ( buffer_len > length )
-						buffer_len = length;
-
-					if ( (handler != NULL ) && (buffer_len) )
-					{
-						handler->handleData( buffer, buffer_len );
-					
-						mBuffer.read( NULL, buffer_len );
-						length -= buffer_len;
-					}
-
-					if (length)
-					{
-						ret = handler->handleSocket( mSock, length );	
-
-						if (ret <= 0)
-						{
-							if (ret == 0)
-								return kNoError;
-							else
-								return kReadFailed;
-						}
-						length = 0;
-					}
-
-				}
-
-				ret = mBuffer.fillFromFile( &mSock, mBuffer.getFreeSpace() );
-
-				if (ret < 0)
-				{
-					LOG_ERR("Socket read failed...");
-					return kReadFailed;
-				}
-
-				if ( mBuffer.byteAt( 0 ) == '\r' )
-					mBuffer.read( NULL, 1 );
-				if ( mBuffer.byteAt( 0 ) == '\n' )
-					mBuffer.read( NULL, 1 );
+	
+	return kNoError;
+}
 
-				while ((read_len = parseChunkLine( mBuffer, length )) <= 0)
-				{
-					ret = mBuffer.fillFromFile( &mSock, mBuffer.getFreeSpace() );
-					if (ret < 0)
-					{
-						LOG_ERR("Socket read failed...");
-						return kReadFailed;
-					}
+void HttpAgent::handleStatusLine( int major, int minor, int code,
+								  const char *reason, int reasonLen )
+{
+	mResponse->handleStatusLine( major, minor, code, reason, reasonLen );
+}
 
-					if ( mBuffer.byteAt( 0 ) == '\r' )
-						mBuffer.read( NULL, 1 );
-					if ( mBuffer.byteAt( 0 ) == '\n' )
-						mBuffer.read( NULL, 1 );
-				}
+void HttpAgent::handleField( const char *name, int nameLen,
+							 const char *value, int valueLen )
+{
+	mResponse->handleField( name, nameLen, value, valueLen );
+}
 
-				mBuffer.read( NULL, read_len );
-			}
-			
-			err = kNoError;
-		}
+void HttpAgent::handleHeaderEnd()
+{
+	if ( not mAcceptEncoding or mHandler == NULL )
+		return;
+	
+	ContentCoding::Coding coding = ContentCoding::parse( 
+		mResponse->getField( HttpFieldMap::kFieldContentEncoding ) );
+	
+	// Anything we didn't ask for is passed on as it came
+	if ( coding == ContentCoding::kGzip or coding == ContentCoding::kDeflate )
+	{
+		mDecoder.reset( coding );
+		mDecoder.setNext( mHandler );
+		mHandler = &mDecoder;
 	}
+}
 
-	if ( handler != NULL )
-		handler->setStop(true);
+void HttpAgent::handleBody( const char *data, int len )
+{
+	if ( mHandler != NULL )
+		mHandler->handleData( data, len );
+}
 
-	if ( !(( ret == 200 ) || ( ret == 206)) )
+int HttpAgent::openConnection( const URI &uri, bool &reused )
+{
+	JHSTD::string host = uri.getHost();
+	
+	reused = false;
+	
+	if ( mPool != NULL )
 	{
-		LOG_NOTICE("File not found... response code = %d", ret);
-		return kNotFound;
+		mSock = mPool->acquire( host.c_str(), uri.getPort(), kConnectTimeout, 
+								reused );
 	}
-
-	return err;
+	else
+	{
+		mSock = jh_new Socket;
+		
+		if ( mSock->connect( host.c_str(), uri.getPort(), kConnectTimeout ) != 0 )
+		{
+			delete mSock;
+			mSock = NULL;
+		}
+	}
+	
+	if ( mSock == NULL )
+		return kConnectionFailed;
+	
+	mSock->setReadTimeout( kReadTimeout );
+	return kNoError;
 }
 
+void HttpAgent::closeConnection( bool reusable )
+{
+	if ( mSock == NULL )
+		return;
+	
+	if ( mPool != NULL )
+		mPool->release( mSock, reusable );
+	else
+		delete mSock;
+	
+	mSock = NULL;
+}
@@ -0,0 +1,471 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "HttpChunked.h"
+#include "HttpParser.h"
+
+#include "jh_memory.h"
+#include "logging.h"
+
+#include <string.h>
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+using namespace JetHead;
+
+ChunkedDecoder::ChunkedDecoder( BodyHandler *next, int64_t maxChunkSize )
+	: mNext( next ), mTrailerListener( NULL ), mMaxChunkSize( maxChunkSize ),
+	  mLine( NULL )
+{
+	reset();
+}
+
+ChunkedDecoder::~ChunkedDecoder()
+{
+	delete [] mLine;
+}
+
+void ChunkedDecoder::reset()
+{
+	mState = kSize;
+	mRemaining = 0;
+	mLineLen = 0;
+}
+
+int ChunkedDecoder::decode( const char *data, int len )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	const char *p = data;
+	const char *end = data + len;
+	
+	while ( p < end )
+	{
+		switch ( mState )
+		{
+		case kData:
+		{
+			int size = end - p;
+			
+			if ( size > mRemaining )
+				size = mRemaining;
+			
+			if ( mNext != NULL )
+				mNext->handleData( p, size );
+			
+			p += size;
+			skip( size );
+			break;
+		}
+		
+		case kDone:
+			return p - data;
+			
+		case kError:
+			return -1;
+			
+		default:
+		{
+			const char *nl = (const char*)memchr( p, '\n', end - p );
+			int part = ( nl == NULL ? end : nl ) - p;
+			
+			if ( mLineLen + part > kMaxLineSize )
+			{
+				LOG_NOTICE( "Chunk line longer than %d bytes", kMaxLineSize );
+				mState = kError;
+				return -1;
+			}
+			
+			if ( nl == NULL )
+			{
+				// Keep the start of the line until the rest arrives
+				if ( mLine == NULL )
+					mLine = jh_new char[ kMaxLineSize ];
+				
+				memcpy( mLine + mLineLen, p, part );
+				mLineLen += part;
+				return len;
+			}
+			
+			const char *line = p;
+			int line_len = part;
+			p = nl + 1;
+			
+			if ( mLineLen > 0 )
+			{
+				memcpy( mLine + mLineLen, line, line_len );
+				line = mLine;
+				line_len += mLineLen;
+				mLineLen = 0;
+			}
+			
+			// Lines should end with CRLF but a bare LF is accepted
+			if ( line_len > 0 and line[ line_len - 1 ] == '\r' )
+				line_len--;
+			
+			if ( parseLine( line, line_len ) != 0 )
+			{
+				mState = kError;
+				return -1;
+			}
+			break;
+		}
+		}
+	}
+	
+	return mState == kError ? -1 : p - data;
+}
+
+void ChunkedDecoder::skip( int64_t len )
+{
+	if ( mState != kData or len > mRemaining )
+	{
+		LOG_ERR( "Can't skip %lld bytes in state %d", (long long)len, mState );
+		return;
+	}
+	
+	mRemaining -= len;
+	
+	if ( mRemaining == 0 )
+		mState = kDataEnd;
+}
+
+int ChunkedDecoder::parseLine( const char *line, int len )
+{
+	switch ( mState )
+	{
+	case kSize:
+	{
+		int64_t size = 0;
+		int i;
+		
+		// The size may be followed by ;extensions, which we ignore
+		for ( i = 0; i < len; i++ )
+		{
+			char c = line[ i ];
+			int digit;
+			
+			if ( c >= '0' and c <= '9' )
+				digit = c - '0';
+			else if ( c >= 'a' and c <= 'f' )
+				digit = c - 'a' + 10;
+			else if ( c >= 'A' and c <= 'F' )
+				digit = c - 'A' + 10;
+			else
+				break;
+			
+			if ( size > mMaxChunkSize / 16 or 
+				 size * 16 > mMaxChunkSize - digit )
+			{
+				LOG_NOTICE( "Chunk bigger than %lld bytes", 
+							(long long)mMaxChunkSize );
+				return -1;
+			}
+			
+			size = size * 16 + digit;
+		}
+		
+		if ( i == 0 or ( i < len and line[ i ] != ';' and 
+						 line[ i ] != ' ' and line[ i ] != '\t' ) )
+		{
+			LOG_NOTICE( "Bad chunk size line \"%.*s\"", len, line );
+			return -1;
+		}
+		
+		mRemaining = size;
+		mState = size > 0 ? kData : kTrailer;
+		return 0;
+	}
+	
+	case kDataEnd:
+		if ( len != 0 )
+		{
+			LOG_NOTICE( "Missing CRLF after chunk" );
+			return -1;
+		}
+		
+		mState = kSize;
+		return 0;
+		
+	case kTrailer:
+	{
+		if ( len == 0 )
+		{
+			mState = kDone;
+			return 0;
+		}
+		
+		const char *name;
+		const char *value;
+		int name_len;
+		int value_len;
+		
+		if ( HttpParser::splitField( line, len, name, name_len, 
+									 value, value_len ) != 0 )
+			return -1;
+		
+		if ( mTrailerListener != NULL )
+			mTrailerListener->handleTrailer( name, name_len, 
+											 value, value_len );
+		return 0;
+	}
+	
+	default:
+		LOG_ERR( "Line in state %d", mState );
+		return -1;
+	}
+}
+
+void ChunkedDecoder::handleData( const char *buf, int len )
+{
+	int used = decode( buf, len );
+	
+	if ( used >= 0 and used < len )
+		LOG_NOTICE( "Dropped %d bytes after the end of the body", len - used );
+}
+
+int ChunkedDecoder::handleSocket( Socket &sock, int len )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	if ( mState == kDone or mState == kError )
+		return mState == kDone ? 0 : -1;
+	
+	if ( mState == kData and mNext != NULL )
+	{
+		if ( len > mRemaining )
+			len = mRemaining;
+		
+		int res = mNext->handleSocket( sock, len );
+		
+		if ( res > 0 )
+			skip( res );
+		
+		return res;
+	}
+	
+	// Never read past the end of the body so whatever follows it stays in
+	//  the socket.  Outside of chunk data that means reading no more than
+	//  the shortest possible rest of the body ("\n0\n\n" at most).
+	int most;
+	
+	switch ( mState )
+	{
+	case kData:
+		most = mRemaining > INT32_MAX ? INT32_MAX : (int)mRemaining;
+		break;
+	case kSize:
+		most = mLineLen > 0 ? 2 : 3;
+		break;
+	case kDataEnd:
+		most = 4;
+		break;
+	default:
+		most = 1;
+		break;
+	}
+	
+	char buf[ 16 * 1024 ];
+	
+	if ( len > most )
+		len = most;
+	if ( len > (int)sizeof( buf ) )
+		len = sizeof( buf );
+	
+	int res = sock.read( buf, len );
+	
+	if ( res > 0 and decode( buf, res ) < 0 )
+		return -1;
+	
+	return res;
+}
+
+void ChunkedDecoder::setStop( bool stop )
+{
+	mStop = stop;
+	
+	if ( mNext != NULL )
+		mNext->setStop( stop );
+}
+
+ChunkedEncoder::ChunkedEncoder( BodyHandler *next, int maxChunkSize )
+	: mNext( next ), mMaxChunkSize( maxChunkSize > 0 ? maxChunkSize : 
+									kDefaultMaxChunkSize )
+{
+	reset();
+}
+
+void ChunkedEncoder::reset()
+{
+	mFinished = false;
+	mTrailers.clear();
+}
+
+int ChunkedEncoder::formatSize( char *buf, uint64_t len )
+{
+	static const char digits[] = "0123456789abcdef";
+	char hex[ 16 ];
+	int n = 0;
+	
+	do
+	{
+		hex[ n++ ] = digits[ len & 0xf ];
+		len >>= 4;
+	} while ( len != 0 );
+	
+	int i = 0;
+	while ( n > 0 )
+		buf[ i++ ] = hex[ --n ];
+	
+	buf[ i++ ] = '\r';
+	buf[ i++ ] = '\n';
+	return i;
+}
+
+void ChunkedEncoder::handleData( const char *buf, int len )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	if ( mFinished )
+	{
+		LOG_WARN( "Data after the end of the body" );
+		return;
+	}
+	
+	while ( len > 0 )
+	{
+		int size = len > mMaxChunkSize ? mMaxChunkSize : len;
+		char line[ kMaxSizeLine ];
+		
+		// Each chunk goes on whole, so the next handler can write it at once
+		struct iovec iov[ 3 ];
+		iov[ 0 ].iov_base = line;
+		iov[ 0 ].iov_len = formatSize( line, size );
+		iov[ 1 ].iov_base = const_cast<char*>( buf );
+		iov[ 1 ].iov_len = size;
+		iov[ 2 ].iov_base = const_cast<char*>( "\r\n" );
+		iov[ 2 ].iov_len = 2;
+		
+		mNext->handleDatav( iov, 3 );
+		
+		buf += size;
+		len -= size;
+	}
+}
+
+void ChunkedEncoder::handleDatav( const struct iovec *iov, int count )
+{
+	static const int kMaxPieces = 16;
+	uint64_t total = 0;
+	
+	for ( int i = 0; i < count; i++ )
+		total += iov[ i ].iov_len;
+	
+	if ( total == 0 )
+		return;
+	
+	if ( mFinished or total > (uint64_t)mMaxChunkSize or count > kMaxPieces )
+	{
+		BodyHandler::handleDatav( iov, count );
+		return;
+	}
+	
+	// Small enough to go as one chunk
+	char line[ kMaxSizeLine ];
+	struct iovec chunk[ kMaxPieces + 2 ];
+	
+	chunk[ 0 ].iov_base = line;
+	chunk[ 0 ].iov_len = formatSize( line, total );
+	memcpy( chunk + 1, iov, count * sizeof( struct iovec ) );
+	chunk[ count + 1 ].iov_base = const_cast<char*>( "\r\n" );
+	chunk[ count + 1 ].iov_len = 2;
+	
+	mNext->handleDatav( chunk, count + 2 );
+}
+
+int ChunkedEncoder::handleSocket( Socket &sock, int len )
+{
+	char buf[ 16 * 1024 ];
+	
+	if ( len > (int)sizeof( buf ) )
+		len = sizeof( buf );
+	
+	int res = sock.read( buf, len );
+	
+	if ( res > 0 )
+		handleData( buf, res );
+	
+	return res;
+}
+
+void ChunkedEncoder::setStop( bool stop )
+{
+	mStop = stop;
+	mNext->setStop( stop );
+}
+
+void ChunkedEncoder::addTrailer( const char *name, const char *value )
+{
+	if ( mFinished )
+	{
+		LOG_WARN( "Trailer after the end of the body" );
+		return;
+	}
+	
+	mTrailers += name;
+	mTrailers += ": ";
+	mTrailers += value;
+	mTrailers += "\r\n";
+}
+
+void ChunkedEncoder::finish()
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	if ( mFinished )
+		return;
+	
+	mFinished = true;
+	
+	// The last piece may be written, and whoever owns this encoder deleted,
+	//  on another thread before handleDatav returns, so nothing here may be
+	//  touched after handing it on
+	JHSTD::string trailers;
+	trailers.swap( mTrailers );
+	
+	struct iovec iov[ 3 ];
+	iov[ 0 ].iov_base = const_cast<char*>( "0\r\n" );
+	iov[ 0 ].iov_len = 3;
+	iov[ 1 ].iov_base = const_cast<char*>( trailers.data() );
+	iov[ 1 ].iov_len = trailers.size();
+	iov[ 2 ].iov_base = const_cast<char*>( "\r\n" );
+	iov[ 2 ].iov_len = 2;
+	
+	mNext->handleDatav( iov, 3 );
+}
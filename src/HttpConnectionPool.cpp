@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "HttpConnectionPool.h"
+#include "TimeUtils.h"
+
+#include "jh_memory.h"
+#include "logging.h"
+
+#include <errno.h>
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+using namespace JetHead;
+
+HttpConnectionPool *HttpConnectionPool::mSingleton = NULL;
+
+HttpConnectionPool *HttpConnectionPool::getInstance()
+{
+	// Same as Resolver::getInstance, the metrics need the critical section
+	if ( mSingleton == NULL )
+	{
+		HttpConnectionPool *pool = jh_new HttpConnectionPool;
+		if ( not __sync_bool_compare_and_swap( &mSingleton, NULL, pool ) )
+			delete pool;
+	}
+	
+	return mSingleton;
+}
+
+HttpConnectionPool::HttpConnectionPool( int maxPerHost, uint32_t idleTimeoutMs )
+	: mLock( "HttpConnectionPool" ), mMaxPerHost( maxPerHost ), 
+	mIdleTimeout( idleTimeoutMs )
+{
+	MetricsRegistry *registry = MetricsRegistry::getInstance();
+	mConnects = registry->getCounter( "jh_http_pool_connects_total" );
+	mReuses = registry->getCounter( "jh_http_pool_reuses_total" );
+}
+
+HttpConnectionPool::~HttpConnectionPool()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	for ( unsigned i = 0; i < mHosts.size(); i++ )
+	{
+		Host *host = mHosts[ i ];
+		
+		if ( not host->mInUse.empty() )
+			LOG_WARN( "Destroyed with %d connections to %s:%d in use", 
+					  host->mInUse.size(), host->mName.c_str(), host->mPort );
+		
+		for ( unsigned j = 0; j < host->mIdle.size(); j++ )
+			delete host->mIdle[ j ].mSock;
+		
+		delete host;
+	}
+}
+
+HttpConnectionPool::Host *HttpConnectionPool::findHost( const char *name, 
+														int port, bool create )
+{
+	for ( unsigned i = 0; i < mHosts.size(); i++ )
+	{
+		if ( mHosts[ i ]->mPort == port and mHosts[ i ]->mName == name )
+			return mHosts[ i ];
+	}
+	
+	if ( not create )
+		return NULL;
+	
+	Host *host = jh_new Host;
+	host->mName = name;
+	host->mPort = port;
+	mHosts.push_back( host );
+	
+	return host;
+}
+
+void HttpConnectionPool::expireIdle( JetHead::vector<Socket*> &closing )
+{
+	uint64_t now = TimeUtils::getMonotonicMicros();
+	
+	for ( unsigned i = 0; i < mHosts.size(); i++ )
+	{
+		JetHead::vector<Connection> &idle = mHosts[ i ]->mIdle;
+		
+		// Oldest first, so stop at the first one that's still wanted
+		while ( not idle.empty() and 
+				now - idle[ 0 ].mIdleSince >= mIdleTimeout * 1000ULL )
+		{
+			closing.push_back( idle[ 0 ].mSock );
+			idle.erase( 0 );
+		}
+	}
+}
+
+Socket *HttpConnectionPool::acquire( const char *host, int port, 
+									 int timeoutMs, bool &reused )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	uint64_t start = TimeUtils::getMonotonicMicros();
+	JetHead::vector<Socket*> closing;
+	Socket *sock = NULL;
+	int remaining = timeoutMs;
+	
+	reused = false;
+	
+	mLock.Lock();
+	expireIdle( closing );
+	
+	Host *entry = findHost( host, port, true );
+	
+	while ( sock == NULL )
+	{
+		// Warmest first, anything the server has closed since goes
+		while ( not entry->mIdle.empty() )
+		{
+			Socket *idle = entry->mIdle[ entry->mIdle.size() - 1 ].mSock;
+			entry->mIdle.erase( entry->mIdle.size() - 1 );
+			
+			if ( idle->isIdleUsable() )
+			{
+				sock = idle;
+				reused = true;
+				break;
+			}
+			
+			closing.push_back( idle );
+		}
+		
+		if ( sock != NULL or (int)entry->mInUse.size() < mMaxPerHost )
+			break;
+		
+		// At the limit, wait for someone to give one back
+		remaining = timeoutMs - ( TimeUtils::getMonotonicMicros() - start ) / 1000;
+		if ( remaining <= 0 or not mReleased.Wait( mLock, remaining ) )
+		{
+			if ( entry->mIdle.empty() and 
+				 (int)entry->mInUse.size() >= mMaxPerHost )
+				break;
+		}
+	}
+	
+	bool limited = sock == NULL and (int)entry->mInUse.size() >= mMaxPerHost;
+	
+	// Hold the slot while connecting so others wait for it
+	if ( not limited )
+		entry->mInUse.push_back( sock );
+	
+	mLock.Unlock();
+	
+	for ( unsigned i = 0; i < closing.size(); i++ )
+		delete closing[ i ];
+	
+	if ( limited )
+	{
+		LOG_NOTICE( "No connection to %s:%d free in %d ms", host, port, 
+					timeoutMs );
+		errno = ETIMEDOUT;
+		return NULL;
+	}
+	
+	if ( reused )
+	{
+		mReuses->increment();
+		return sock;
+	}
+	
+	sock = jh_new Socket;
+	remaining = timeoutMs - ( TimeUtils::getMonotonicMicros() - start ) / 1000;
+	
+	if ( remaining <= 0 or sock->connect( host, port, remaining ) != 0 )
+	{
+		int err = remaining <= 0 ? ETIMEDOUT : errno;
+		LOG_NOTICE( "Failed to connect to %s:%d", host, port );
+		
+		delete sock;
+		
+		// Give up the slot we held
+		AutoLock lock( mLock );
+		for ( unsigned i = 0; i < entry->mInUse.size(); i++ )
+		{
+			if ( entry->mInUse[ i ] == NULL )
+			{
+				entry->mInUse.erase( i );
+				break;
+			}
+		}
+		mReleased.Broadcast();
+		
+		errno = err;
+		return NULL;
+	}
+	
+	mConnects->increment();
+	
+	AutoLock lock( mLock );
+	for ( unsigned i = 0; i < entry->mInUse.size(); i++ )
+	{
+		if ( entry->mInUse[ i ] == NULL )
+		{
+			entry->mInUse[ i ] = sock;
+			break;
+		}
+	}
+	
+	return sock;
+}
+
+void HttpConnectionPool::release( Socket *sock, bool reusable )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	JetHead::vector<Socket*> closing;
+	
+	if ( sock == NULL )
+		return;
+	
+	mLock.Lock();
+	
+	Host *entry = NULL;
+	for ( unsigned i = 0; i < mHosts.size() and entry == NULL; i++ )
+	{
+		JetHead::vector<Socket*> &in_use = mHosts[ i ]->mInUse;
+		
+		for ( unsigned j = 0; j < in_use.size(); j++ )
+		{
+			if ( in_use[ j ] == sock )
+			{
+				entry = mHosts[ i ];
+				in_use.erase( j );
+				break;
+			}
+		}
+	}
+	
+	if ( entry == NULL )
+	{
+		LOG_ERR( "Released a connection that wasn't acquired" );
+		reusable = false;
+	}
+	
+	if ( reusable and mIdleTimeout > 0 and 
+		 (int)( entry->mInUse.size() + entry->mIdle.size() ) < mMaxPerHost )
+	{
+		Connection conn;
+		conn.mSock = sock;
+		conn.mIdleSince = TimeUtils::getMonotonicMicros();
+		entry->mIdle.push_back( conn );
+	}
+	else
+	{
+		closing.push_back( sock );
+	}
+	
+	expireIdle( closing );
+	mReleased.Broadcast();
+	
+	mLock.Unlock();
+	
+	for ( unsigned i = 0; i < closing.size(); i++ )
+		delete closing[ i ];
+}
+
+void HttpConnectionPool::setMaxPerHost( int maxPerHost )
+{
+	AutoLock lock( mLock );
+	mMaxPerHost = maxPerHost;
+	mReleased.Broadcast();
+}
+
+void HttpConnectionPool::setIdleTimeout( uint32_t idleTimeoutMs )
+{
+	mLock.Lock();
+	mIdleTimeout = idleTimeoutMs;
+	
+	JetHead::vector<Socket*> closing;
+	expireIdle( closing );
+	mLock.Unlock();
+	
+	for ( unsigned i = 0; i < closing.size(); i++ )
+		delete closing[ i ];
+}
+
+void HttpConnectionPool::flush()
+{
+	JetHead::vector<Socket*> closing;
+	
+	mLock.Lock();
+	for ( unsigned i = 0; i < mHosts.size(); i++ )
+	{
+		for ( unsigned j = 0; j < mHosts[ i ]->mIdle.size(); j++ )
+			closing.push_back( mHosts[ i ]->mIdle[ j ].mSock );
+		mHosts[ i ]->mIdle.clear();
+	}
+	mLock.Unlock();
+	
+	for ( unsigned i = 0; i < closing.size(); i++ )
+		delete closing[ i ];
+}
+
+int HttpConnectionPool::getIdleCount( const char *host, int port )
+{
+	AutoLock lock( mLock );
+	Host *entry = findHost( host, port, false );
+	
+	return entry != NULL ? entry->mIdle.size() : 0;
+}
@@ -0,0 +1,577 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "HttpContentCoding.h"
+
+#include "jh_memory.h"
+#include "logging.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#ifdef JH_ZLIB
+#include <zlib.h>
+#endif
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+using namespace JetHead;
+
+namespace
+{
+	bool isSpace( char c )
+	{
+		return c == ' ' or c == '\t';
+	}
+	
+	//! Does the slice name match str, ignoring case?
+	bool matches( const char *name, int len, const char *str )
+	{
+		return (int)strlen( str ) == len and strncasecmp( name, str, len ) == 0;
+	}
+	
+	ContentCoding::Coding parseName( const char *name, int len )
+	{
+		if ( len == 0 or matches( name, len, "identity" ) )
+			return ContentCoding::kIdentity;
+		if ( matches( name, len, "gzip" ) or matches( name, len, "x-gzip" ) )
+			return ContentCoding::kGzip;
+		if ( matches( name, len, "deflate" ) )
+			return ContentCoding::kDeflate;
+		
+		return ContentCoding::kUnknown;
+	}
+}
+
+bool ContentCoding::isSupported()
+{
+#ifdef JH_ZLIB
+	return true;
+#else
+	return false;
+#endif
+}
+
+ContentCoding::Coding ContentCoding::parse( const char *value )
+{
+	if ( value == NULL )
+		return kIdentity;
+	
+	const char *end = value + strlen( value );
+	
+	while ( isSpace( *value ) )
+		value++;
+	while ( end > value and isSpace( end[ -1 ] ) )
+		end--;
+	
+	return parseName( value, end - value );
+}
+
+const char *ContentCoding::getName( Coding coding )
+{
+	switch ( coding )
+	{
+	case kGzip:		return "gzip";
+	case kDeflate:	return "deflate";
+	case kIdentity:	return "identity";
+	default:		return NULL;
+	}
+}
+
+ContentCoding::Coding ContentCoding::choose( const char *acceptEncoding )
+{
+	if ( acceptEncoding == NULL or not isSupported() )
+		return kIdentity;
+	
+	// q-values of gzip, deflate and *, -1 if not listed
+	double gzip = -1;
+	double deflate = -1;
+	double star = -1;
+	const char *p = acceptEncoding;
+	
+	while ( *p != '\0' )
+	{
+		while ( isSpace( *p ) or *p == ',' )
+			p++;
+		
+		const char *name = p;
+		while ( *p != '\0' and *p != ',' and *p != ';' and not isSpace( *p ) )
+			p++;
+		
+		int name_len = p - name;
+		double q = 1;
+		
+		// Parameters, of which only q means anything
+		while ( *p != '\0' and *p != ',' )
+		{
+			if ( *p == ';' )
+			{
+				p++;
+				while ( isSpace( *p ) )
+					p++;
+				
+				if ( ( *p == 'q' or *p == 'Q' ) and p[ 1 ] == '=' )
+					q = strtod( p + 2, NULL );
+			}
+			else
+			{
+				p++;
+			}
+		}
+		
+		if ( name_len == 1 and *name == '*' )
+			star = q;
+		else if ( parseName( name, name_len ) == kGzip )
+			gzip = q;
+		else if ( parseName( name, name_len ) == kDeflate )
+			deflate = q;
+	}
+	
+	if ( gzip < 0 )
+		gzip = star > 0 ? star : 0;
+	if ( deflate < 0 )
+		deflate = star > 0 ? star : 0;
+	
+	if ( gzip > 0 and gzip >= deflate )
+		return kGzip;
+	if ( deflate > 0 )
+		return kDeflate;
+	
+	return kIdentity;
+}
+
+const char *ContentCoding::getAcceptEncoding()
+{
+	return isSupported() ? "gzip, deflate" : NULL;
+}
+
+ContentDecoder::ContentDecoder( BodyHandler *next, 
+								ContentCoding::Coding coding )
+	: mNext( next ), mStream( NULL ), mBuffer( NULL ), mMaxSize( kNoLimit )
+{
+	reset( coding );
+}
+
+ContentDecoder::~ContentDecoder()
+{
+	end();
+	delete [] mBuffer;
+}
+
+void ContentDecoder::reset( ContentCoding::Coding coding )
+{
+	end();
+	
+	mCoding = coding;
+	mDecodedSize = 0;
+	mStarted = false;
+	mDone = false;
+	mFailed = false;
+	
+	if ( coding != ContentCoding::kIdentity and 
+		 ( coding == ContentCoding::kUnknown or 
+		   not ContentCoding::isSupported() ) )
+	{
+		LOG_NOTICE( "Can't decode content coding %d", coding );
+		mFailed = true;
+	}
+}
+
+int ContentDecoder::start( bool raw )
+{
+#ifdef JH_ZLIB
+	mStream = jh_new z_stream;
+	memset( mStream, 0, sizeof( z_stream ) );
+	
+	// 16 + the window size asks for a gzip wrapper, negative for none
+	int bits = mCoding == ContentCoding::kGzip ? 16 + MAX_WBITS : 
+		raw ? -MAX_WBITS : MAX_WBITS;
+	
+	if ( inflateInit2( mStream, bits ) != Z_OK )
+	{
+		LOG_ERR( "inflateInit2 failed" );
+		delete mStream;
+		mStream = NULL;
+		return -1;
+	}
+	
+	if ( mBuffer == NULL )
+		mBuffer = jh_new char[ kBufferSize ];
+	
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+void ContentDecoder::end()
+{
+#ifdef JH_ZLIB
+	if ( mStream != NULL )
+	{
+		inflateEnd( mStream );
+		delete mStream;
+		mStream = NULL;
+	}
+#endif
+}
+
+int ContentDecoder::output( const char *data, int len )
+{
+	if ( len > mMaxSize - mDecodedSize )
+	{
+		LOG_NOTICE( "Body decodes to more than %lld bytes", 
+					(long long)mMaxSize );
+		return -1;
+	}
+	
+	mDecodedSize += len;
+	
+	if ( mNext != NULL )
+		mNext->handleData( data, len );
+	
+	return 0;
+}
+
+int ContentDecoder::decode( const char *data, int len )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	if ( mFailed )
+		return -1;
+	
+	if ( len <= 0 )
+		return 0;
+	
+	if ( mCoding == ContentCoding::kIdentity )
+	{
+		if ( output( data, len ) != 0 )
+			mFailed = true;
+		
+		return mFailed ? -1 : 0;
+	}
+	
+#ifdef JH_ZLIB
+	if ( not mStarted )
+	{
+		// deflate should have a zlib wrapper but some servers send it raw,
+		//  the wrapper's first byte always says deflate with a window of
+		//  at most 32K
+		uint8_t first = data[ 0 ];
+		bool raw = mCoding == ContentCoding::kDeflate and 
+			( ( first & 0x0f ) != Z_DEFLATED or ( first >> 4 ) > 7 );
+		
+		mStarted = true;
+		
+		if ( start( raw ) != 0 )
+		{
+			mFailed = true;
+			return -1;
+		}
+	}
+	
+	if ( mDone )
+	{
+		// Another gzip member may follow
+		if ( mCoding != ContentCoding::kGzip )
+		{
+			LOG_NOTICE( "Dropped %d bytes after the end of the body", len );
+			return 0;
+		}
+		
+		inflateReset( mStream );
+		mDone = false;
+	}
+	
+	mStream->next_in = (Bytef*)data;
+	mStream->avail_in = len;
+	
+	while ( true )
+	{
+		mStream->next_out = (Bytef*)mBuffer;
+		mStream->avail_out = kBufferSize;
+		
+		int res = inflate( mStream, Z_NO_FLUSH );
+		int made = kBufferSize - mStream->avail_out;
+		
+		if ( res != Z_OK and res != Z_STREAM_END and res != Z_BUF_ERROR )
+		{
+			LOG_NOTICE( "Bad %s body: %s", ContentCoding::getName( mCoding ),
+						mStream->msg != NULL ? mStream->msg : "" );
+			mFailed = true;
+			return -1;
+		}
+		
+		if ( made > 0 and output( mBuffer, made ) != 0 )
+		{
+			mFailed = true;
+			return -1;
+		}
+		
+		if ( res == Z_STREAM_END )
+		{
+			// Another gzip member may follow
+			if ( mCoding == ContentCoding::kGzip and mStream->avail_in > 0 )
+			{
+				inflateReset( mStream );
+				continue;
+			}
+			
+			mDone = true;
+			
+			if ( mStream->avail_in > 0 )
+				LOG_NOTICE( "Dropped %d bytes after the end of the body", 
+							mStream->avail_in );
+			break;
+		}
+		
+		// Done once the input is used and there was room for all the output
+		if ( mStream->avail_in == 0 and mStream->avail_out > 0 )
+			break;
+		
+		if ( res == Z_BUF_ERROR and made == 0 )
+			break;
+	}
+	
+	return 0;
+#else
+	mFailed = true;
+	return -1;
+#endif
+}
+
+int ContentDecoder::finish()
+{
+	if ( mFailed )
+		return -1;
+	
+	// Responses to HEAD, 204 and 304 carry the header but no body at all
+	if ( mCoding == ContentCoding::kIdentity or mDone or not mStarted )
+		return 0;
+	
+	LOG_NOTICE( "%s body cut short", ContentCoding::getName( mCoding ) );
+	return -1;
+}
+
+void ContentDecoder::handleData( const char *buf, int len )
+{
+	decode( buf, len );
+}
+
+int ContentDecoder::handleSocket( Socket &sock, int len )
+{
+	char buf[ 16 * 1024 ];
+	
+	if ( len > (int)sizeof( buf ) )
+		len = sizeof( buf );
+	
+	int res = sock.read( buf, len );
+	
+	if ( res > 0 and decode( buf, res ) != 0 )
+		return -1;
+	
+	return res;
+}
+
+void ContentDecoder::setStop( bool stop )
+{
+	mStop = stop;
+	
+	if ( mNext != NULL )
+		mNext->setStop( stop );
+}
+
+ContentEncoder::ContentEncoder( BodyHandler *next, 
+								ContentCoding::Coding coding,
+								int level, int memLevel )
+	: mNext( next ), mLevel( level ), mMemLevel( memLevel ), 
+	  mStream( NULL ), mBuffer( NULL )
+{
+	reset( coding );
+}
+
+ContentEncoder::~ContentEncoder()
+{
+	end();
+	delete [] mBuffer;
+}
+
+void ContentEncoder::reset( ContentCoding::Coding coding )
+{
+	end();
+	
+	mCoding = coding;
+	mFinished = false;
+	mFailed = false;
+	
+	if ( coding == ContentCoding::kIdentity )
+		return;
+	
+#ifdef JH_ZLIB
+	if ( coding == ContentCoding::kGzip or coding == ContentCoding::kDeflate )
+	{
+		mStream = jh_new z_stream;
+		memset( mStream, 0, sizeof( z_stream ) );
+		
+		int bits = coding == ContentCoding::kGzip ? 16 + MAX_WBITS : 
+			MAX_WBITS;
+		
+		if ( deflateInit2( mStream, mLevel, Z_DEFLATED, bits, mMemLevel, 
+						   Z_DEFAULT_STRATEGY ) == Z_OK )
+		{
+			if ( mBuffer == NULL )
+				mBuffer = jh_new char[ kBufferSize ];
+			return;
+		}
+		
+		LOG_ERR( "deflateInit2 failed" );
+		delete mStream;
+		mStream = NULL;
+	}
+#endif
+	
+	LOG_NOTICE( "Can't encode content coding %d", coding );
+	mFailed = true;
+}
+
+void ContentEncoder::end()
+{
+#ifdef JH_ZLIB
+	if ( mStream != NULL )
+	{
+		deflateEnd( mStream );
+		delete mStream;
+		mStream = NULL;
+	}
+#endif
+}
+
+void ContentEncoder::run( int flush )
+{
+#ifdef JH_ZLIB
+	while ( true )
+	{
+		mStream->next_out = (Bytef*)mBuffer;
+		mStream->avail_out = kBufferSize;
+		
+		int res = deflate( mStream, flush );
+		int made = kBufferSize - mStream->avail_out;
+		
+		if ( res == Z_STREAM_ERROR )
+		{
+			LOG_ERR( "deflate failed" );
+			mFailed = true;
+			return;
+		}
+		
+		if ( made > 0 )
+			mNext->handleData( mBuffer, made );
+		
+		// Finished once there was room left over for the output
+		if ( res == Z_STREAM_END or 
+			 ( mStream->avail_in == 0 and mStream->avail_out > 0 ) )
+			return;
+	}
+#endif
+}
+
+void ContentEncoder::handleData( const char *buf, int len )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	if ( mFailed or len <= 0 )
+		return;
+	
+	if ( mFinished )
+	{
+		LOG_WARN( "Data after the end of the body" );
+		return;
+	}
+	
+	if ( mCoding == ContentCoding::kIdentity )
+	{
+		mNext->handleData( buf, len );
+		return;
+	}
+	
+#ifdef JH_ZLIB
+	mStream->next_in = (Bytef*)buf;
+	mStream->avail_in = len;
+	run( Z_NO_FLUSH );
+#endif
+}
+
+int ContentEncoder::handleSocket( Socket &sock, int len )
+{
+	char buf[ 16 * 1024 ];
+	
+	if ( len > (int)sizeof( buf ) )
+		len = sizeof( buf );
+	
+	int res = sock.read( buf, len );
+	
+	if ( res > 0 )
+		handleData( buf, res );
+	
+	return res;
+}
+
+void ContentEncoder::setStop( bool stop )
+{
+	mStop = stop;
+	mNext->setStop( stop );
+}
+
+void ContentEncoder::flush()
+{
+	if ( mFailed or mFinished or mCoding == ContentCoding::kIdentity )
+		return;
+	
+#ifdef JH_ZLIB
+	mStream->avail_in = 0;
+	run( Z_SYNC_FLUSH );
+#endif
+}
+
+void ContentEncoder::finish()
+{
+	if ( mFailed or mFinished )
+		return;
+	
+	mFinished = true;
+	
+	if ( mCoding == ContentCoding::kIdentity )
+		return;
+	
+#ifdef JH_ZLIB
+	mStream->avail_in = 0;
+	run( Z_FINISH );
+#endif
+}
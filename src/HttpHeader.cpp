@@ -82,6 +82,7 @@ static const char *gFieldTypeList[] = {
 	"Referer",
 	"Retry-After",
 	"Server",
+	"Set-Cookie",
 	"TE",
 	"Trailer",
 	"Transfer-Encoding",
@@ -93,20 +94,32 @@ static const char *gFieldTypeList[] = {
 	"WWW-Authenticate"
 };
 
+FieldTable * volatile HttpFieldMap::sTable = NULL;
+
 FieldMap::FieldType HttpFieldMap::getFieldType(const char *field) const
 {
 	TRACE_BEGIN(LOG_LVL_NOISE);
 	
-	for (int i = 0; i < kNumFields - FieldMap::kHttpFieldMapStart; ++i)
+	FieldMap::FieldType type = getFieldTable()->find(field, strlen(field));
+	
+	LOG("type %d, name %s", type, field);
+	
+	return type;
+}
+
+const FieldTable *HttpFieldMap::getFieldTable() const
+{
+	if (sTable == NULL)
 	{
-		if (strcasecmp(field, gFieldTypeList[i]) == 0)
-		{
-			LOG("type %d, name %s",
-				i+FieldMap::kHttpFieldMapStart, gFieldTypeList[i]);
-			return (FieldMap::FieldType)i + FieldMap::kHttpFieldMapStart;
-		}
+		FieldTable *table = jh_new FieldTable(gFieldTypeList, 
+			kNumFields - FieldMap::kHttpFieldMapStart, 
+			FieldMap::kHttpFieldMapStart, kSeed);
+		
+		if (not __sync_bool_compare_and_swap(&sTable, NULL, table))
+			delete table;
 	}
-	return FieldMap::kInvalidFieldType;
+	
+	return sTable;
 }
 
 const char * HttpFieldMap::getFieldTypeString(FieldType type) const
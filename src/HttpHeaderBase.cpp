@@ -31,6 +31,8 @@
 #include "jh_memory.h"
 #include "jh_types.h"
 
+#include <strings.h>
+
 
 SET_LOG_CAT(LOG_CAT_ALL);
 SET_LOG_LEVEL(LOG_LVL_NOTICE);
@@ -40,7 +42,8 @@ using namespace JetHead;
 
 
 HttpHeaderBase::HttpHeaderBase()
-	:	mNumFields(0)
+	:	mArena(NULL), mArenaLen(0), mArenaSize(0), mArenaFree(0),
+		mLastFieldKept(false), mIndex(NULL), mIndexed(true)
 {
 	mHeaderStr.reserve(kDefaultMessageSize);
 }
@@ -55,6 +58,8 @@ HttpHeaderBase::~HttpHeaderBase()
 	}
 
 	mFieldMappings.clear();
+	
+	delete[] mArena;
 }
 
 
@@ -104,13 +109,33 @@ int HttpHeaderBase::send(IReaderWriter *writer, const uint8_t* data, int len) co
 		return send(writer);
 	}
 	
-	uint8_t* temp = jh_new uint8_t[mHeaderStr.size() + len];
-	memcpy(temp, mHeaderStr.c_str(), mHeaderStr.size());
-	memcpy(temp + mHeaderStr.size(), data, len);
+	// Header and body go out together without copying them together
+	struct iovec iov[2];
+	iov[0].iov_base = const_cast<char*>(mHeaderStr.data());
+	iov[0].iov_len = mHeaderStr.size();
+	iov[1].iov_base = const_cast<uint8_t*>(data);
+	iov[1].iov_len = len;
+	
+	int total = mHeaderStr.size() + len;
+	int res = writer->writev(iov, 2);
+	
+	if (res < 0 or res == total)
+		return res;
 	
-	int res = writer->write(temp, mHeaderStr.size() + len);
-	delete[] temp;
-	return res;
+	// Finish off a short write
+	if (res < (int)mHeaderStr.size())
+	{
+		if (writer->writeAll(mHeaderStr.data() + res, 
+							 mHeaderStr.size() - res) < 0)
+			return -1;
+		res = mHeaderStr.size();
+	}
+	
+	int offset = res - mHeaderStr.size();
+	if (writer->writeAll(data + offset, len - offset) < 0)
+		return -1;
+	
+	return total;
 }
 
 
@@ -141,6 +166,21 @@ int HttpHeaderBase::addFieldMap(FieldMap *fieldMap)
 	// searched in that order.  So mappings are appended to the tail as they
 	// are added.
 	mFieldMappings.push_back(fieldMap);
+	
+	// Keep one index over all the maps rather than searching each in turn,
+	//  unless one of them can only be searched with getFieldType.
+	const FieldTable *table = fieldMap->getFieldTable();
+	
+	if (table == NULL)
+	{
+		mIndex = NULL;
+		mIndexed = false;
+	}
+	else if (mIndexed)
+	{
+		mIndex = (mIndex == NULL) ? table : mIndex->merge(table);
+	}
+	
 	return 0;
 }
 
@@ -151,6 +191,14 @@ FieldMap::FieldType HttpHeaderBase::getFieldType(const char *field) const
 	
 	FieldMap::FieldType type = FieldMap::kInvalidFieldType;
 
+	if (mIndexed)
+	{
+		if (mIndex != NULL)
+			type = mIndex->find(field, strlen(field));
+		
+		return type;
+	}
+	
 	for (JetHead::list<FieldMap*>::iterator i = mFieldMappings.begin();
 		 i != mFieldMappings.end(); ++i)
 	{
@@ -164,6 +212,26 @@ FieldMap::FieldType HttpHeaderBase::getFieldType(const char *field) const
 }
 
 
+FieldMap::FieldType HttpHeaderBase::getFieldType(const char *name,
+												 int len) const
+{
+	if (mIndexed)
+		return mIndex != NULL ? mIndex->find(name, len) : 
+			FieldMap::kInvalidFieldType;
+	
+	// FieldMaps want a C string, no known field name is anywhere near this
+	char field[64];
+	
+	if (len >= (int)sizeof(field))
+		return FieldMap::kInvalidFieldType;
+	
+	memcpy(field, name, len);
+	field[len] = '\0';
+	
+	return getFieldType(field);
+}
+
+
 const char *HttpHeaderBase::getFieldTypeString(FieldMap::FieldType type) const
 {
 	TRACE_BEGIN(LOG_LVL_INFO);
@@ -263,9 +331,7 @@ int HttpHeaderBase::parseLine(const CircularBuffer &buffer)
 					
 					if (type != FieldMap::kInvalidFieldType)
 					{
-						mFields[mNumFields].setType(type);
-						mFields[mNumFields].setData(data.c_str());
-						mNumFields++;
+						appendField(type, data.data(), data.size());
 						LOG("Field %s, data %s", field.c_str(), data.c_str());
 					}
 					else
@@ -314,12 +380,50 @@ int HttpHeaderBase::parseLine(const CircularBuffer &buffer)
 }
 
 
+void HttpHeaderBase::handleField(const char *name, int nameLen,
+								 const char *value, int valueLen)
+{
+	TRACE_BEGIN(LOG_LVL_NOISE);
+	
+	if (nameLen == 0)
+	{
+		// A folded line, joined to the last field with a space
+		if (mLastFieldKept and valueLen > 0)
+		{
+			extendLastField(value, valueLen);
+			mHeaderStr.clear();
+		}
+		return;
+	}
+	
+	FieldMap::FieldType type = getFieldType(name, nameLen);
+	
+	mLastFieldKept = type != FieldMap::kInvalidFieldType;
+	
+	if (mLastFieldKept)
+	{
+		appendField(type, value, valueLen);
+		mHeaderStr.clear();
+	}
+	else
+	{
+		LOG("Dropped field %.*s", nameLen, name);
+	}
+}
+
+
 const char *HttpHeaderBase::getField(FieldMap::FieldType type) const
 {
-	for (int i = 0; i < mNumFields; i++)
+	return getField(type, 0);
+}
+
+
+const char *HttpHeaderBase::getField(FieldMap::FieldType type, int n) const
+{
+	for (unsigned i = 0; i < mFields.size(); i++)
 	{
-		if (mFields[i].mType == type)
-			return mFields[i].mData;
+		if (mFields[i].mType == type and n-- == 0)
+			return mArena + mFields[i].mOffset;
 	}
 	
 	return NULL;
@@ -358,20 +462,52 @@ ErrCode HttpHeaderBase::getFieldInt64(FieldMap::FieldType type,
 }
 
 
+bool HttpHeaderBase::hasFieldToken(FieldMap::FieldType type, 
+								   const char *token) const
+{
+	const char *value = getField(type);
+	int len = strlen(token);
+	
+	if (value == NULL)
+		return false;
+	
+	while (*value != '\0')
+	{
+		while (*value == ' ' or *value == '\t' or *value == ',')
+			value++;
+		
+		const char *end = value;
+		while (*end != '\0' and *end != ',' and *end != ' ' and *end != '\t')
+			end++;
+		
+		if (end - value == len and strncasecmp(value, token, len) == 0)
+			return true;
+		
+		value = end;
+	}
+	
+	return false;
+}
+
+
 ErrCode HttpHeaderBase::removeField(FieldMap::FieldType type)
 {
 	TRACE_BEGIN(LOG_LVL_NOISE);
 
-	for (int i = 0; i < mNumFields; i++)
+	for (unsigned i = 0; i < mFields.size(); i++)
 	{
 		if (mFields[i].mType == type)
 		{
-			for (int j = i; j < mNumFields - 1; j++)
-			{
-				mFields[j] = mFields[j + 1];
-			}
-			mFields[mNumFields - 1].mData = NULL;
-			mNumFields--;
+			mArenaFree += mFields[i].mLen + 1;
+			mFields.erase(i);
+			mHeaderStr.clear();
+			
+			// Don't let repeated adds and removes grow the arena forever
+			if (mFields.empty())
+				mArenaLen = mArenaFree = 0;
+			else if (mArenaFree > mArenaLen / 2)
+				compactArena();
+			
 			return JetHead::kNoError;
 		}
 	}
@@ -382,12 +518,7 @@ bool HttpHeaderBase::addField(FieldMap::FieldType type, const char *data)
 {
 	TRACE_BEGIN(LOG_LVL_NOISE);
 	
-	if (mNumFields >= kMaxFields)
-		return false;
-	
-	mFields[mNumFields].mType = type;
-	mFields[mNumFields].setData(data);
-	mNumFields++;
+	appendField(type, data, strlen(data));
 
 	// Make sure we re-build the header if it has already been built.
 	mHeaderStr.clear();
@@ -435,14 +566,25 @@ void HttpHeaderBase::buildHeader() const
 		return;
 	}
 	
-	for (int i = 0; i < mNumFields; i++)
+	// Work out the exact size first so the string grows at most once
+	int size = mHeaderStr.size() + 2;
+	
+	for (unsigned i = 0; i < mFields.size(); i++)
+	{
+		const char *name = getFieldTypeString(mFields[i].mType);
+		size += strlen(name) + mFields[i].mLen + 4;
+	}
+	
+	mHeaderStr.reserve(size);
+	
+	for (unsigned i = 0; i < mFields.size(); i++)
 	{
 		mHeaderStr += getFieldTypeString(mFields[i].mType);
-		mHeaderStr += ": ";
-		mHeaderStr += mFields[i].mData;
-		mHeaderStr += "\r\n";
+		mHeaderStr.append(": ", 2);
+		mHeaderStr.append(mArena + mFields[i].mOffset, mFields[i].mLen);
+		mHeaderStr.append("\r\n", 2);
 	}
-		mHeaderStr += "\r\n";	
+	mHeaderStr.append("\r\n", 2);
 }
 
 
@@ -525,21 +667,89 @@ int HttpHeaderBase::searchForLine(const CircularBuffer &buffer)
 
 
 //
-//	HttpHeaderBase::HeaderField functions
+//	HttpHeaderBase field storage
 //
 
 
-/**
- *	@brief Copy data specified into the HeaderField
- */
-void HttpHeaderBase::HeaderField::setData(const char *data)
+void HttpHeaderBase::appendField(FieldMap::FieldType type, const char *data,
+								 int len)
 {
-	if (mData)
+	reserveArena(len + 1);
+	
+	HeaderField field;
+	field.mType = type;
+	field.mOffset = mArenaLen;
+	field.mLen = len;
+	
+	memcpy(mArena + mArenaLen, data, len);
+	mArena[mArenaLen + len] = '\0';
+	mArenaLen += len + 1;
+	
+	mFields.push_back(field);
+}
+
+
+void HttpHeaderBase::extendLastField(const char *data, int len)
+{
+	reserveArena(mFields[mFields.size() - 1].mLen + len + 2);
+	
+	HeaderField &field = mFields[mFields.size() - 1];
+	
+	// The last field added is normally still at the end of the arena, if
+	//  something was removed since it may not be so move it there first.
+	if (field.mOffset + field.mLen + 1 != mArenaLen)
 	{
-		delete[] mData;		
+		memcpy(mArena + mArenaLen, mArena + field.mOffset, field.mLen + 1);
+		mArenaFree += field.mLen + 1;
+		field.mOffset = mArenaLen;
+		mArenaLen += field.mLen + 1;
 	}
-	mData = jh_new char[strlen(data) + 1];
-	strcpy(mData, data);
+	
+	char *end = mArena + field.mOffset + field.mLen;
+	*end++ = ' ';
+	memcpy(end, data, len);
+	end[len] = '\0';
+	
+	field.mLen += len + 1;
+	mArenaLen += len + 1;
 }
 
 
+void HttpHeaderBase::reserveArena(int len)
+{
+	if (mArenaLen + len <= mArenaSize)
+		return;
+	
+	int size = mArenaSize > 0 ? mArenaSize : kDefaultArenaSize;
+	while (size < mArenaLen + len)
+		size *= 2;
+	
+	char *arena = jh_new char[size];
+	if (mArenaLen > 0)
+		memcpy(arena, mArena, mArenaLen);
+	
+	delete[] mArena;
+	mArena = arena;
+	mArenaSize = size;
+}
+
+
+void HttpHeaderBase::compactArena()
+{
+	char *arena = jh_new char[mArenaSize];
+	int len = 0;
+	
+	for (unsigned i = 0; i < mFields.size(); i++)
+	{
+		HeaderField &field = mFields[i];
+		
+		memcpy(arena + len, mArena + field.mOffset, field.mLen + 1);
+		field.mOffset = len;
+		len += field.mLen + 1;
+	}
+	
+	delete[] mArena;
+	mArena = arena;
+	mArenaLen = len;
+	mArenaFree = 0;
+}
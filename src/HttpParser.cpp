@@ -0,0 +1,580 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "HttpParser.h"
+
+#include "logging.h"
+
+#include <string.h>
+#include <strings.h>
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+using namespace JetHead;
+
+namespace
+{
+	bool isSpace( char c )
+	{
+		return c == ' ' or c == '\t';
+	}
+	
+	//! Does the slice name match str, ignoring case?
+	bool matches( const char *name, int len, const char *str )
+	{
+		return (int)strlen( str ) == len and strncasecmp( name, str, len ) == 0;
+	}
+	
+	//! Is token one of the comma separated tokens in value?
+	bool hasToken( const char *value, int len, const char *token )
+	{
+		const char *end = value + len;
+		
+		while ( value < end )
+		{
+			while ( value < end and ( isSpace( *value ) or *value == ',' ) )
+				value++;
+			
+			const char *start = value;
+			while ( value < end and *value != ',' and not isSpace( *value ) )
+				value++;
+			
+			if ( matches( start, value - start, token ) )
+				return true;
+		}
+		
+		return false;
+	}
+	
+	//! Parse a decimal number from the whole slice, -1 if it isn't one
+	int64_t parseDecimal( const char *str, int len )
+	{
+		int64_t value = 0;
+		
+		if ( len == 0 )
+			return -1;
+		
+		for ( int i = 0; i < len; i++ )
+		{
+			if ( str[ i ] < '0' or str[ i ] > '9' or 
+				 value > ( INT64_MAX - 9 ) / 10 )
+				return -1;
+			
+			value = value * 10 + str[ i ] - '0';
+		}
+		
+		return value;
+	}
+}
+
+HttpParser::HttpParser( Type type, HttpParserListener *listener )
+	: mType( type ), mListener( listener ), mForwarder( listener ), 
+	  mDecoder( &mForwarder )
+{
+	mDecoder.setTrailerListener( listener );
+	reset();
+}
+
+void HttpParser::reset( bool head )
+{
+	mState = kFirstLine;
+	mHead = head;
+	mStarted = false;
+	mMajor = 1;
+	mMinor = 1;
+	mCode = 0;
+	mInterim = false;
+	mKeepAlive = false;
+	mChunked = false;
+	mEncoded = false;
+	mContentLength = -1;
+	mRemaining = 0;
+	mLineLen = 0;
+}
+
+int HttpParser::parse( const char *data, int len )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	const char *p = data;
+	const char *end = data + len;
+	
+	if ( len > 0 and mState != kDone )
+		mStarted = true;
+	
+	while ( p < end )
+	{
+		switch ( mState )
+		{
+		case kBody:
+		{
+			int size = end - p;
+			
+			if ( size > mRemaining )
+				size = mRemaining;
+			
+			mListener->handleBody( p, size );
+			p += size;
+			bodyUsed( size );
+			break;
+		}
+		
+		case kChunkSize:
+		case kChunkData:
+		case kChunkEnd:
+		case kTrailer:
+		{
+			int used = mDecoder.decode( p, end - p );
+			
+			if ( used < 0 )
+			{
+				mState = kError;
+				return -1;
+			}
+			
+			p += used;
+			chunkUsed();
+			break;
+		}
+		
+		case kToClose:
+			mListener->handleBody( p, end - p );
+			p = end;
+			break;
+			
+		case kDone:
+			return p - data;
+			
+		case kError:
+			return -1;
+			
+		default:
+		{
+			const char *nl = (const char*)memchr( p, '\n', end - p );
+			
+			if ( nl == NULL )
+			{
+				// Keep the start of the line until the rest arrives
+				if ( mLineLen + ( end - p ) > kMaxLineSize )
+				{
+					LOG_NOTICE( "Line longer than %d bytes", kMaxLineSize );
+					mState = kError;
+					return -1;
+				}
+				
+				memcpy( mLine + mLineLen, p, end - p );
+				mLineLen += end - p;
+				return len;
+			}
+			
+			const char *line = p;
+			int line_len = nl - p;
+			p = nl + 1;
+			
+			if ( mLineLen > 0 )
+			{
+				if ( mLineLen + line_len > kMaxLineSize )
+				{
+					LOG_NOTICE( "Line longer than %d bytes", kMaxLineSize );
+					mState = kError;
+					return -1;
+				}
+				
+				memcpy( mLine + mLineLen, line, line_len );
+				line = mLine;
+				line_len += mLineLen;
+				mLineLen = 0;
+			}
+			
+			if ( line_len > kMaxLineSize )
+			{
+				LOG_NOTICE( "Line longer than %d bytes", kMaxLineSize );
+				mState = kError;
+				return -1;
+			}
+			
+			// Lines should end with CRLF but a bare LF is accepted
+			if ( line_len > 0 and line[ line_len - 1 ] == '\r' )
+				line_len--;
+			
+			if ( parseLine( line, line_len ) != 0 )
+			{
+				mState = kError;
+				return -1;
+			}
+			break;
+		}
+		}
+	}
+	
+	return mState == kError ? -1 : p - data;
+}
+
+int HttpParser::parse( CircularBuffer &buf )
+{
+	int total = 0;
+	
+	while ( buf.getLength() > 0 and mState != kDone )
+	{
+		int size;
+		const char *data = (const char*)buf.getBytes( 0, size );
+		
+		if ( data == NULL or size <= 0 )
+			break;
+		
+		int used = parse( data, size );
+		
+		if ( used < 0 )
+			return -1;
+		
+		buf.read( NULL, used );
+		total += used;
+	}
+	
+	return total;
+}
+
+int HttpParser::finish()
+{
+	if ( mState == kToClose )
+		endMessage();
+	
+	return mState == kDone ? 0 : -1;
+}
+
+void HttpParser::skip( int64_t len )
+{
+	if ( mState == kChunkData and len <= mRemaining )
+	{
+		mStarted = true;
+		mDecoder.skip( len );
+		chunkUsed();
+	}
+	else if ( mState == kBody and len <= mRemaining )
+	{
+		mStarted = true;
+		bodyUsed( len );
+	}
+	else
+	{
+		LOG_ERR( "Can't skip %lld bytes in state %d", (long long)len, mState );
+	}
+}
+
+void HttpParser::bodyUsed( int64_t len )
+{
+	mRemaining -= len;
+	
+	if ( mRemaining == 0 )
+		endMessage();
+}
+
+void HttpParser::chunkUsed()
+{
+	mRemaining = mDecoder.getRemaining();
+	
+	switch ( mDecoder.getState() )
+	{
+	case ChunkedDecoder::kSize:		mState = kChunkSize; break;
+	case ChunkedDecoder::kData:		mState = kChunkData; break;
+	case ChunkedDecoder::kDataEnd:	mState = kChunkEnd; break;
+	case ChunkedDecoder::kTrailer:	mState = kTrailer; break;
+	case ChunkedDecoder::kDone:		endMessage(); break;
+	case ChunkedDecoder::kError:	mState = kError; break;
+	}
+}
+
+int HttpParser::parseLine( const char *line, int len )
+{
+	switch ( mState )
+	{
+	case kFirstLine:
+		// Be forgiving of blank lines before the first line
+		if ( len == 0 )
+			return 0;
+		
+		if ( parseFirstLine( line, len ) != 0 )
+			return -1;
+		
+		mState = kField;
+		return 0;
+		
+	case kField:
+		if ( len == 0 )
+			return startBody();
+		
+		return parseField( line, len );
+		
+	default:
+		LOG_ERR( "Line in state %d", mState );
+		return -1;
+	}
+}
+
+int HttpParser::parseFirstLine( const char *line, int len )
+{
+	const char *end = line + len;
+	
+	if ( mType == kResponse )
+	{
+		// HTTP/x.y code reason
+		const char *sp = (const char*)memchr( line, ' ', len );
+		
+		if ( sp == NULL or parseVersion( line, sp - line ) != 0 )
+		{
+			LOG_NOTICE( "Bad status line \"%.*s\"", len, line );
+			return -1;
+		}
+		
+		while ( sp < end and *sp == ' ' )
+			sp++;
+		
+		const char *code = sp;
+		while ( sp < end and *sp != ' ' )
+			sp++;
+		
+		mCode = parseDecimal( code, sp - code );
+		
+		if ( sp - code != 3 or mCode < 100 )
+		{
+			LOG_NOTICE( "Bad status line \"%.*s\"", len, line );
+			return -1;
+		}
+		
+		while ( sp < end and *sp == ' ' )
+			sp++;
+		
+		// 100 Continue and the like only say the real response is coming,
+		//  the listener never hears of them.  101 is the last response on
+		//  the connection.
+		mInterim = mCode / 100 == 1 and mCode != 101;
+		
+		if ( not mInterim )
+			mListener->handleStatusLine( mMajor, mMinor, mCode, sp, end - sp );
+	}
+	else
+	{
+		// method uri HTTP/x.y
+		const char *method_end = (const char*)memchr( line, ' ', len );
+		const char *uri_end = NULL;
+		
+		if ( method_end != NULL )
+		{
+			for ( uri_end = end; uri_end > method_end + 1; uri_end-- )
+			{
+				if ( uri_end[ -1 ] == ' ' )
+					break;
+			}
+		}
+		
+		if ( method_end == NULL or method_end == line or 
+			 uri_end <= method_end + 1 or
+			 parseVersion( uri_end, end - uri_end ) != 0 )
+		{
+			LOG_NOTICE( "Bad request line \"%.*s\"", len, line );
+			return -1;
+		}
+		
+		const char *uri = method_end + 1;
+		uri_end--;
+		
+		mListener->handleRequestLine( line, method_end - line, uri, 
+									  uri_end - uri, mMajor, mMinor );
+	}
+	
+	// HTTP/1.1 keeps the connection unless told otherwise, 1.0 the other 
+	//  way around
+	mKeepAlive = mMajor > 1 or ( mMajor == 1 and mMinor >= 1 );
+	return 0;
+}
+
+int HttpParser::parseVersion( const char *str, int len )
+{
+	if ( len != 8 or strncmp( str, "HTTP/", 5 ) != 0 or 
+		 str[ 5 ] < '0' or str[ 5 ] > '9' or str[ 6 ] != '.' or
+		 str[ 7 ] < '0' or str[ 7 ] > '9' )
+		return -1;
+	
+	mMajor = str[ 5 ] - '0';
+	mMinor = str[ 7 ] - '0';
+	return 0;
+}
+
+int HttpParser::splitField( const char *line, int len, 
+							const char *&name, int &nameLen,
+							const char *&value, int &valueLen )
+{
+	const char *end = line + len;
+	
+	name = line;
+	nameLen = 0;
+	
+	if ( len > 0 and isSpace( *line ) )
+	{
+		// A continuation of the last field
+		value = line;
+	}
+	else
+	{
+		const char *colon = (const char*)memchr( line, ':', len );
+		
+		if ( colon == NULL or colon == line )
+		{
+			LOG_NOTICE( "Bad field line \"%.*s\"", len, line );
+			return -1;
+		}
+		
+		nameLen = colon - line;
+		while ( nameLen > 0 and isSpace( name[ nameLen - 1 ] ) )
+			nameLen--;
+		
+		value = colon + 1;
+	}
+	
+	while ( value < end and isSpace( *value ) )
+		value++;
+	while ( end > value and isSpace( end[ -1 ] ) )
+		end--;
+	
+	valueLen = end - value;
+	return 0;
+}
+
+int HttpParser::parseField( const char *line, int len )
+{
+	const char *name;
+	const char *value;
+	int name_len;
+	int value_len;
+	
+	if ( splitField( line, len, name, name_len, value, value_len ) != 0 )
+		return -1;
+	
+	if ( mInterim )
+		return 0;
+	
+	mListener->handleField( name, name_len, value, value_len );
+	return checkField( name, name_len, value, value_len );
+}
+
+int HttpParser::checkField( const char *name, int nameLen,
+							const char *value, int valueLen )
+{
+	if ( matches( name, nameLen, "Content-Length" ) )
+	{
+		int64_t length = parseDecimal( value, valueLen );
+		
+		// More than one is only allowed if they agree
+		if ( length < 0 or 
+			 ( mContentLength >= 0 and length != mContentLength ) )
+		{
+			LOG_NOTICE( "Bad Content-Length \"%.*s\"", valueLen, value );
+			return -1;
+		}
+		
+		mContentLength = length;
+	}
+	else if ( matches( name, nameLen, "Transfer-Encoding" ) )
+	{
+		if ( not matches( value, valueLen, "identity" ) )
+			mEncoded = true;
+		
+		if ( hasToken( value, valueLen, "chunked" ) )
+			mChunked = true;
+	}
+	else if ( matches( name, nameLen, "Connection" ) )
+	{
+		if ( hasToken( value, valueLen, "close" ) )
+			mKeepAlive = false;
+		else if ( hasToken( value, valueLen, "keep-alive" ) )
+			mKeepAlive = true;
+	}
+	
+	return 0;
+}
+
+int HttpParser::startBody()
+{
+	if ( mInterim )
+	{
+		// Start over on the real response
+		reset( mHead );
+		mStarted = true;
+		return 0;
+	}
+	
+	mListener->handleHeaderEnd();
+	
+	if ( mType == kResponse and 
+		 ( mHead or mCode == 101 or mCode == 204 or mCode == 304 ) )
+	{
+		// Never a body, whatever the header says
+		endMessage();
+	}
+	else if ( mChunked )
+	{
+		mState = kChunkSize;
+		mRemaining = 0;
+		mDecoder.reset();
+	}
+	else if ( mEncoded )
+	{
+		// Can't tell where a request would end
+		if ( mType == kRequest )
+		{
+			LOG_NOTICE( "Request body has unknown transfer coding" );
+			return -1;
+		}
+		
+		mState = kToClose;
+		mKeepAlive = false;
+	}
+	else if ( mContentLength > 0 )
+	{
+		mState = kBody;
+		mRemaining = mContentLength;
+	}
+	else if ( mContentLength == 0 or mType == kRequest )
+	{
+		endMessage();
+	}
+	else
+	{
+		mState = kToClose;
+		mKeepAlive = false;
+	}
+	
+	return 0;
+}
+
+void HttpParser::endMessage()
+{
+	mState = kDone;
+	mListener->handleMessageEnd();
+}
@@ -181,6 +181,30 @@ int HttpRequest::buildFirstLine() const
 	return mHeaderStr.size();
 }
 
+void HttpRequest::handleRequestLine( const char *method, int methodLen,
+									 const char *uri, int uriLen,
+									 int major, int minor )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	char name[ MAX_METHOD_SIZE ];
+	
+	if ( methodLen < (int)sizeof( name ) )
+	{
+		memcpy( name, method, methodLen );
+		name[ methodLen ] = '\0';
+		parseMethod( name );
+	}
+	else
+	{
+		mMethod = kMethodUnknown;
+	}
+	
+	mUri.setString( uri, uriLen );
+	mMajor = major;
+	mMinor = minor;
+}
+
 void HttpRequest::parseMethod( const char *method )
 {
 	TRACE_BEGIN( LOG_LVL_INFO );
@@ -87,7 +87,7 @@ ResponseCodeData gResponseCodeList[] = {
 	{ 505, "HTTP Version Not Supported" },
 };
 
-HttpResponse::HttpResponse() : mResponseCode( 200 )
+HttpResponse::HttpResponse() : mResponseCode( 200 ), mMajor( 1 ), mMinor( 1 )
 {
 }
 
@@ -111,6 +111,14 @@ const char *HttpResponse::getResponseString() const
 	return getResponseString( mResponseCode );
 }
 
+void HttpResponse::handleStatusLine( int major, int minor, int code,
+									 const char *reason, int reasonLen )
+{
+	mMajor = major;
+	mMinor = minor;
+	mResponseCode = code;
+}
+
 int HttpResponse::parseFirstLine( const CircularBuffer &buf )
 {
 	TRACE_BEGIN( LOG_LVL_INFO );
@@ -119,6 +127,7 @@ int HttpResponse::parseFirstLine( const CircularBuffer &buf )
 	char c = 0;
 
 	std::string statusCodeStr;
+	std::string protocol;
 
 	enum { ParseProtocol,
 		   SeekStatusCode,
@@ -151,9 +160,13 @@ int HttpResponse::parseFirstLine( const CircularBuffer &buf )
 		case ParseProtocol:
 			if (c != ' ')
 			{
-				// append c to protocol string, unimplemented for now
+				protocol += c;
 				break;
 			}
+			if (sscanf(protocol.c_str(), "HTTP/%d.%d", &mMajor, &mMinor) != 2)
+			{
+				LOG_NOTICE("unexpected protocol %s", protocol.c_str());
+			}
 			state = SeekStatusCode;
 			// found a space, so fall through to the next state to
 			// handle the space
@@ -246,6 +259,14 @@ int HttpResponse::parseFirstLine( const CircularBuffer &buf )
 	return -1;
 }
 
+bool HttpResponse::isKeepAlive() const
+{
+	if ( mMajor > 1 or ( mMajor == 1 and mMinor >= 1 ) )
+		return not hasFieldToken( HttpFieldMap::kFieldConnection, "close" );
+	
+	return hasFieldToken( HttpFieldMap::kFieldConnection, "keep-alive" );
+}
+
 int HttpResponse::buildFirstLine() const
 {
 	char statusCodeBuf[kStatusCodeSize + 1];
@@ -0,0 +1,849 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "HttpServer.h"
+#include "EventAgent.h"
+
+#include "jh_memory.h"
+#include "logging.h"
+
+#include <string.h>
+#include <stdio.h>
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+using namespace JetHead;
+
+//! Size of the buffer requests are read into
+static const int kReadBufferSize = 16 * 1024;
+
+/**
+ * The server's state for one connection, only used on the thread of the 
+ *  worker that owns the connection.
+ */
+struct HttpExchange::Connection : public HttpParserListener
+{
+	Connection( HttpServer *server, TcpConnection *tcp )
+		: mServer( server ), mTcp( tcp ), 
+		  mParser( HttpParser::kRequest, this ), mBuffer( kReadBufferSize ),
+		  mParsing( NULL ), mDepth( 0 ), mClosing( false ), 
+		  mWritable( false ), mReadPaused( false )
+	{
+	}
+	
+	~Connection()
+	{
+		delete mParsing;
+	}
+	
+	//! Read what is waiting and parse it
+	void readData();
+	
+	//! Parse requests from mBuffer while we are allowed more
+	void parseRequests();
+	
+	//! Write finished pieces of responses, in order
+	void writeResponses();
+	
+	//! Write as much of piece as will go, returning true if it all went
+	bool writePiece( Piece *piece );
+	
+	//! Stop using the TcpConnection, it is about to be deleted
+	void detach();
+	
+	//! Called around anything that might lead to us being detached
+	void enter() { mDepth++; }
+	void leave()
+	{
+		if ( --mDepth == 0 and mTcp == NULL )
+			delete this;
+	}
+	
+	// HttpParserListener
+	void handleRequestLine( const char *method, int methodLen,
+							const char *uri, int uriLen, int major, int minor );
+	void handleField( const char *name, int nameLen,
+					  const char *value, int valueLen );
+	void handleBody( const char *data, int len );
+	void handleMessageEnd();
+	
+	HttpServer				*mServer;
+	TcpConnection			*mTcp;
+	HttpParser				mParser;
+	CircularBuffer			mBuffer;
+	
+	//! The request being parsed
+	HttpExchange			*mParsing;
+	
+	//! Requests waiting for their responses to be written, oldest first
+	JetHead::list<HttpExchange*>	mExchanges;
+	
+	int						mDepth;
+	
+	//! No more requests will be read, close after the last response
+	bool					mClosing;
+	
+	//! Set while handleWritable is writing
+	bool					mWritable;
+	
+	bool					mReadPaused;
+};
+
+HttpExchange::Piece::~Piece()
+{
+	delete mFile;
+}
+
+HttpExchange::HttpExchange( HttpServer *server, Connection *conn )
+	: mServer( server ), mSelector( conn->mTcp->getSelector() ), 
+	  mPosted( 0 ), mHandlerDone( false ), mConn( conn ), mFinished( false ),
+	  mMajor( 1 ), mMinor( 1 ), mHead( false ), mKeepAlive( true ), 
+	  mTooLarge( false ), mStarted( false ), mChunked( false ), 
+	  mWriter( this ), mEncoder( &mWriter ), mEnding( false ), mCoder( NULL )
+{
+}
+
+HttpExchange::~HttpExchange()
+{
+	delete mCoder;
+	
+	while ( not mPieces.empty() )
+	{
+		delete mPieces.front();
+		mPieces.pop_front();
+	}
+}
+
+const char *HttpExchange::prepareHeader( int64_t len )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	bool old = mMajor == 1 and mMinor == 0;
+	
+	mStarted = true;
+	
+	if ( mResponse.hasFieldToken( HttpFieldMap::kFieldConnection, "close" ) )
+		mKeepAlive = false;
+	
+	mResponse.removeField( HttpFieldMap::kFieldConnection );
+	
+	if ( len >= 0 )
+	{
+		if ( not mResponse.isBodyless( false ) )
+			mResponse.addFieldDecimal64( HttpFieldMap::kFieldContentLength, 
+										 len );
+	}
+	else if ( not old )
+	{
+		mResponse.addField( HttpFieldMap::kFieldTransferEncoding, "chunked" );
+		mChunked = true;
+	}
+	else
+	{
+		// The end of the body is the end of the connection
+		mKeepAlive = false;
+	}
+	
+	if ( not mKeepAlive and not old )
+		mResponse.addField( HttpFieldMap::kFieldConnection, "close" );
+	else if ( mKeepAlive and old )
+		mResponse.addField( HttpFieldMap::kFieldConnection, "keep-alive" );
+	
+	return mResponse.getHeader();
+}
+
+ContentCoding::Coding HttpExchange::chooseCoding( int64_t len )
+{
+	if ( not mServer->mCompress or mResponse.isBodyless( false ) or
+		 mResponse.getResponseCode() == 206 or
+		 ( len >= 0 and len < HttpServer::kMinCompressSize ) or
+		 mResponse.getField( HttpFieldMap::kFieldContentEncoding ) != NULL )
+		return ContentCoding::kIdentity;
+	
+	return ContentCoding::choose( 
+		mRequest.getField( HttpFieldMap::kFieldAcceptEncoding ) );
+}
+
+void HttpExchange::addCodingFields( ContentCoding::Coding coding )
+{
+	mResponse.addField( HttpFieldMap::kFieldContentEncoding, 
+						ContentCoding::getName( coding ) );
+	
+	if ( mResponse.getField( HttpFieldMap::kFieldVary ) == NULL )
+		mResponse.addField( HttpFieldMap::kFieldVary, "Accept-Encoding" );
+}
+
+void HttpExchange::send( const void *body, int len )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	if ( mStarted )
+	{
+		LOG_WARN( "Response already sent" );
+		return;
+	}
+	
+	ContentCoding::Coding coding = chooseCoding( len );
+	JHSTD::string coded;
+	
+	if ( coding != ContentCoding::kIdentity )
+	{
+		AppendBodyHandler out( coded );
+		ContentEncoder encoder( &out, coding );
+		
+		encoder.handleData( (const char*)body, len );
+		encoder.finish();
+		
+		// Not worth it if it doesn't get smaller
+		if ( not encoder.hasFailed() and (int)coded.size() < len )
+		{
+			addCodingFields( coding );
+			body = coded.data();
+			len = coded.size();
+		}
+	}
+	
+	Piece *piece = jh_new Piece( this );
+	piece->mData = prepareHeader( len );
+	
+	if ( not mHead and len > 0 )
+		piece->mData.append( (const char*)body, len );
+	
+	piece->mLast = true;
+	post( piece );
+}
+
+void HttpExchange::sendFile( File *file, int64_t offset, int64_t len )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	if ( mStarted )
+	{
+		LOG_WARN( "Response already sent" );
+		delete file;
+		return;
+	}
+	
+	// Whatever we say the length is has to come, or the client will wait
+	int64_t size = file->getLength();
+	if ( offset > size )
+		offset = size;
+	if ( len > size - offset )
+		len = size - offset;
+	
+	const char *header = prepareHeader( len );
+	
+	// For HEAD the header is the last piece, and once it is posted the 
+	//  connection's thread may delete this exchange
+	if ( mHead )
+	{
+		delete file;
+		post( header, strlen( header ), true );
+		return;
+	}
+	
+	post( header, strlen( header ), false );
+	
+	Piece *piece = jh_new Piece( this );
+	piece->mFile = file;
+	piece->mOffset = offset;
+	piece->mLen = len;
+	piece->mLast = true;
+	post( piece );
+}
+
+void HttpExchange::startChunked()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	if ( mStarted )
+	{
+		LOG_WARN( "Response already sent" );
+		return;
+	}
+	
+	ContentCoding::Coding coding = chooseCoding( -1 );
+	
+	if ( coding != ContentCoding::kIdentity )
+		addCodingFields( coding );
+	
+	const char *header = prepareHeader( -1 );
+	post( header, strlen( header ), false );
+	
+	if ( coding != ContentCoding::kIdentity and not mHead )
+	{
+		mCoder = jh_new ContentEncoder( 
+			mChunked ? (BodyHandler*)&mEncoder : &mWriter, coding );
+	}
+}
+
+void HttpExchange::sendChunk( const void *data, int len )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	if ( len <= 0 or mHead )
+		return;
+	
+	if ( mCoder != NULL )
+	{
+		mCoder->handleData( (const char*)data, len );
+		mCoder->flush();
+		return;
+	}
+	
+	if ( not mChunked )
+	{
+		post( (const char*)data, len, false );
+		return;
+	}
+	
+	mEncoder.handleData( (const char*)data, len );
+}
+
+void HttpExchange::addTrailer( const char *name, const char *value )
+{
+	if ( mChunked and not mHead )
+		mEncoder.addTrailer( name, value );
+}
+
+void HttpExchange::finish()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	if ( mCoder != NULL )
+		mCoder->finish();
+	
+	if ( mChunked and not mHead )
+	{
+		mEnding = true;
+		
+		// The connection's thread may write the last piece and delete this
+		//  exchange before finish returns, it must be the last thing to 
+		//  touch it
+		mEncoder.finish();
+	}
+	else
+	{
+		post( "", 0, true );
+	}
+}
+
+void HttpExchange::PieceWriter::handleData( const char *buf, int len )
+{
+	mExchange->post( buf, len, mExchange->mEnding );
+}
+
+void HttpExchange::PieceWriter::handleDatav( const struct iovec *iov, 
+											 int count )
+{
+	Piece *piece = jh_new Piece( mExchange );
+	int len = 0;
+	
+	for ( int i = 0; i < count; i++ )
+		len += iov[ i ].iov_len;
+	
+	piece->mData.reserve( len );
+	for ( int i = 0; i < count; i++ )
+		piece->mData.append( (const char*)iov[ i ].iov_base, 
+							 iov[ i ].iov_len );
+	
+	piece->mLast = mExchange->mEnding;
+	mExchange->post( piece );
+}
+
+void HttpExchange::post( const char *data, int len, bool last )
+{
+	Piece *piece = jh_new Piece( this );
+	piece->mData.assign( data, len );
+	piece->mLast = last;
+	post( piece );
+}
+
+void HttpExchange::post( Piece *piece )
+{
+	bool orphaned = false;
+	bool done = false;
+	
+	{
+		AutoLock l( mServer->mLock );
+		
+		if ( piece->mLast )
+			mHandlerDone = true;
+		
+		if ( mSelector != NULL )
+		{
+			mPosted++;
+			AsyncEventAgent1<HttpServer, Piece*> *agent = 
+				jh_new AsyncEventAgent1<HttpServer, Piece*>( 
+					mServer, &HttpServer::output, piece );
+			agent->send( mSelector );
+		}
+		else
+		{
+			orphaned = true;
+			done = mHandlerDone and mPosted == 0;
+		}
+	}
+	
+	// The connection has gone, so there's no one to send to
+	if ( orphaned )
+	{
+		delete piece;
+		if ( done )
+			delete this;
+	}
+}
+
+void HttpExchange::Connection::readData()
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	char buf[ kReadBufferSize ];
+	
+	int space = mBuffer.getFreeSpace();
+	if ( space <= 0 )
+	{
+		parseRequests();
+		return;
+	}
+	
+	int res = mTcp->read( buf, space < (int)sizeof( buf ) ? space : sizeof( buf ) );
+	
+	// The connection is closed for us once this callback returns
+	if ( res <= 0 )
+		return;
+	
+	mBuffer.write( (const uint8_t*)buf, res );
+	parseRequests();
+}
+
+void HttpExchange::Connection::parseRequests()
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	while ( not mClosing and mBuffer.getLength() > 0 and 
+			(int)mExchanges.size() < mServer->mMaxPipelined )
+	{
+		if ( mParser.isDone() )
+			mParser.reset();
+		
+		if ( mParser.parse( mBuffer ) < 0 )
+		{
+			LOG_NOTICE( "Bad request" );
+			
+			if ( mParsing == NULL )
+				mParsing = jh_new HttpExchange( mServer, this );
+			
+			HttpExchange *exchange = mParsing;
+			mParsing = NULL;
+			exchange->mKeepAlive = false;
+			mExchanges.push_back( exchange );
+			mClosing = true;
+			mServer->sendError( exchange, 400 );
+			break;
+		}
+		
+		if ( not mParser.isDone() )
+			break;
+	}
+	
+	// Don't let the client queue up more than we'll take
+	bool paused = mClosing or 
+		(int)mExchanges.size() >= mServer->mMaxPipelined or
+		mBuffer.getFreeSpace() == 0;
+	
+	if ( paused != mReadPaused )
+	{
+		mReadPaused = paused;
+		mTcp->setReadPaused( paused );
+	}
+}
+
+void HttpExchange::Connection::handleRequestLine( const char *method, 
+	int methodLen, const char *uri, int uriLen, int major, int minor )
+{
+	mParsing = jh_new HttpExchange( mServer, this );
+	mParsing->mRequest.handleRequestLine( method, methodLen, uri, uriLen, 
+										  major, minor );
+	mParsing->mMajor = major;
+	mParsing->mMinor = minor;
+	mParsing->mHead = 
+		mParsing->mRequest.getMethod() == HttpRequest::kMethodHead;
+}
+
+void HttpExchange::Connection::handleField( const char *name, int nameLen,
+											const char *value, int valueLen )
+{
+	mParsing->mRequest.handleField( name, nameLen, value, valueLen );
+}
+
+void HttpExchange::Connection::handleBody( const char *data, int len )
+{
+	HttpExchange *exchange = mParsing;
+	
+	if ( (int)exchange->mBody.size() + len > mServer->mMaxBodySize )
+		exchange->mTooLarge = true;
+	
+	if ( not exchange->mTooLarge )
+		exchange->mBody.append( data, len );
+}
+
+void HttpExchange::Connection::handleMessageEnd()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	HttpExchange *exchange = mParsing;
+	mParsing = NULL;
+	
+	exchange->mKeepAlive = mParser.isKeepAlive();
+	mExchanges.push_back( exchange );
+	
+	if ( not exchange->mKeepAlive )
+		mClosing = true;
+	
+	if ( exchange->mTooLarge )
+	{
+		// Don't read anything more from a client that sends too much
+		exchange->mKeepAlive = false;
+		mClosing = true;
+		mServer->sendError( exchange, 413 );
+		return;
+	}
+	
+	mServer->dispatch( exchange );
+}
+
+void HttpExchange::Connection::writeResponses()
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	while ( not mExchanges.empty() )
+	{
+		HttpExchange *exchange = mExchanges.front();
+		
+		while ( not exchange->mPieces.empty() )
+		{
+			Piece *piece = exchange->mPieces.front();
+			
+			if ( not writePiece( piece ) )
+				return;
+			
+			exchange->mPieces.pop_front();
+			delete piece;
+		}
+		
+		if ( not exchange->mFinished )
+			return;
+		
+		mExchanges.pop_front();
+		
+		bool keepAlive = exchange->mKeepAlive;
+		delete exchange;
+		
+		if ( not keepAlive )
+		{
+			mClosing = true;
+			break;
+		}
+	}
+	
+	if ( mClosing )
+	{
+		if ( mExchanges.empty() )
+			mTcp->close();
+	}
+	else
+	{
+		parseRequests();
+	}
+}
+
+bool HttpExchange::Connection::writePiece( Piece *piece )
+{
+	if ( piece->mFile == NULL )
+	{
+		int len = piece->mData.size() - piece->mSent;
+		int res = mTcp->write( piece->mData.data() + piece->mSent, len );
+		
+		if ( res < 0 )
+			return false;
+		
+		piece->mSent += res;
+		return res == len;
+	}
+	
+	int64_t res = mTcp->sendFile( *piece->mFile, 
+								  piece->mOffset + piece->mSent, 
+								  piece->mLen - piece->mSent );
+	
+	if ( res < 0 )
+		return false;
+	
+	// Told the socket had room, but nothing came from the file
+	if ( res == 0 and mWritable and mTcp->getPendingWrite() == 0 )
+	{
+		LOG_NOTICE( "File ended before %lld bytes were sent", 
+					(long long)piece->mLen );
+		mTcp->abort();
+		return false;
+	}
+	
+	piece->mSent += res;
+	return piece->mSent == piece->mLen;
+}
+
+void HttpExchange::Connection::detach()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	delete mParsing;
+	mParsing = NULL;
+	
+	while ( not mExchanges.empty() )
+	{
+		HttpExchange *exchange = mExchanges.front();
+		mExchanges.pop_front();
+		bool done;
+		
+		{
+			AutoLock l( mServer->mLock );
+			exchange->mSelector = NULL;
+			exchange->mConn = NULL;
+			done = exchange->mHandlerDone and exchange->mPosted == 0;
+		}
+		
+		// Otherwise the last to touch it deletes it, see post and output
+		if ( done )
+			delete exchange;
+	}
+	
+	mTcp = NULL;
+}
+
+HttpServer::HttpServer( int numHandlerThreads, int numWorkers, 
+						const char *name )
+	: mTcpServer( this, numWorkers, 1, name ), mNextThread( 0 ),
+	  mMaxBodySize( kDefaultMaxBodySize ), 
+	  mMaxPipelined( kDefaultMaxPipelined ), mCompress( false )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	if ( numHandlerThreads < 1 )
+		numHandlerThreads = 1;
+	
+	JHSTD::string threadName;
+	for ( int i = 0; i < numHandlerThreads; i++ )
+	{
+		JetHead::stl_sprintf( threadName, "%s-handler-%d", name, i );
+		mHandlerThreads.push_back( jh_new EventThread( threadName.c_str() ) );
+	}
+}
+
+HttpServer::~HttpServer()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	stop();
+	
+	for ( unsigned i = 0; i < mHandlerThreads.size(); i++ )
+	{
+		mHandlerThreads[ i ]->removeAgentsByReceiver( this );
+		delete mHandlerThreads[ i ];
+	}
+}
+
+void HttpServer::addHandler( const char *prefix, HttpRequestHandler *handler )
+{
+	Route route;
+	route.mPrefix = prefix;
+	
+	// "/foo/" and "/foo" mean the same
+	if ( route.mPrefix.size() > 1 and 
+		 route.mPrefix[ route.mPrefix.size() - 1 ] == '/' )
+		route.mPrefix.erase( route.mPrefix.size() - 1 );
+	
+	route.mHandler = handler;
+	mRoutes.push_back( route );
+}
+
+int HttpServer::start( const Socket::Address &addr )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	return mTcpServer.start( addr );
+}
+
+void HttpServer::stop( uint32_t drainMs )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	mTcpServer.stop( drainMs );
+}
+
+bool HttpServer::handleConnection( TcpConnection *tcp )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	// Pipelined responses are small separate writes, don't let them wait
+	//  on the client's delayed ack
+	tcp->setNoDelay( true );
+	tcp->setPrivateData( (jh_ptr_int_t)jh_new Connection( this, tcp ) );
+	return true;
+}
+
+void HttpServer::handleData( TcpConnection *tcp )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	Connection *conn = (Connection*)tcp->getPrivateData();
+	
+	conn->enter();
+	conn->readData();
+	conn->leave();
+}
+
+void HttpServer::handleWritable( TcpConnection *tcp )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	Connection *conn = (Connection*)tcp->getPrivateData();
+	
+	conn->enter();
+	conn->mWritable = true;
+	conn->writeResponses();
+	
+	if ( conn->mTcp != NULL )
+		conn->mWritable = false;
+	
+	conn->leave();
+}
+
+void HttpServer::handleClose( TcpConnection *tcp )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	Connection *conn = (Connection*)tcp->getPrivateData();
+	
+	conn->enter();
+	conn->detach();
+	conn->leave();
+}
+
+void HttpServer::handleDrain( TcpConnection *tcp )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	Connection *conn = (Connection*)tcp->getPrivateData();
+	
+	// Answer what has been asked already, but nothing more
+	conn->enter();
+	conn->mClosing = true;
+	
+	if ( conn->mExchanges.empty() )
+		tcp->close();
+	else
+		tcp->setReadPaused( true );
+	
+	conn->leave();
+}
+
+void HttpServer::dispatch( HttpExchange *exchange )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	const JHSTD::string &path = exchange->mRequest.getURI().getPath();
+	HttpRequestHandler *handler = NULL;
+	unsigned longest = 0;
+	
+	for ( unsigned i = 0; i < mRoutes.size(); i++ )
+	{
+		const JHSTD::string &prefix = mRoutes[ i ].mPrefix;
+		unsigned len = prefix.size();
+		
+		if ( len < longest or strncmp( path.c_str(), prefix.c_str(), len ) != 0 )
+			continue;
+		
+		// Whole path segments only, "/" is everything
+		if ( path.size() == len or path[ len ] == '/' or prefix == "/" )
+		{
+			handler = mRoutes[ i ].mHandler;
+			longest = len;
+		}
+	}
+	
+	if ( handler == NULL )
+	{
+		LOG_INFO( "No handler for %s", path.c_str() );
+		sendError( exchange, 404 );
+		return;
+	}
+	
+	uint32_t thread = __sync_fetch_and_add( &mNextThread, 1 ) % 
+		mHandlerThreads.size();
+	
+	AsyncEventAgent2<HttpServer, HttpExchange*, HttpRequestHandler*> *agent =
+		jh_new AsyncEventAgent2<HttpServer, HttpExchange*, HttpRequestHandler*>(
+			this, &HttpServer::runHandler, exchange, handler );
+	agent->send( mHandlerThreads[ thread ] );
+}
+
+void HttpServer::runHandler( HttpExchange *exchange, 
+							 HttpRequestHandler *handler )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	handler->handleRequest( exchange );
+}
+
+void HttpServer::sendError( HttpExchange *exchange, int code )
+{
+	exchange->mResponse.setResponseCode( code );
+	exchange->send();
+}
+
+void HttpServer::output( Piece *piece )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	HttpExchange *exchange = piece->mExchange;
+	bool orphaned;
+	bool done;
+	
+	{
+		AutoLock l( mLock );
+		exchange->mPosted--;
+		orphaned = exchange->mSelector == NULL;
+		done = exchange->mHandlerDone and exchange->mPosted == 0;
+	}
+	
+	if ( orphaned )
+	{
+		delete piece;
+		if ( done )
+			delete exchange;
+		return;
+	}
+	
+	if ( piece->mLast )
+		exchange->mFinished = true;
+	
+	exchange->mPieces.push_back( piece );
+	
+	Connection *conn = exchange->mConn;
+	conn->enter();
+	conn->writeResponses();
+	conn->leave();
+}
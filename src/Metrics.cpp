@@ -0,0 +1,488 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "Metrics.h"
+#include "jh_memory.h"
+#include "logging.h"
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+__thread int Metric::sShard = -1;
+volatile int Metric::sNextShard = 0;
+
+MetricsRegistry *MetricsRegistry::mSingleton = NULL;
+
+Metric::Metric( Type type, const char *name, const char *labels )
+	: mType( type ), mName( name ), mLabels( labels == NULL ? "" : labels )
+{
+}
+
+int Metric::assignShard()
+{
+	return __sync_fetch_and_add( &sNextShard, 1 ) % kNumShards;
+}
+
+void Metric::onRefCountZero() const
+{
+	MetricsRegistry::getInstance()->removeMetric( this );
+	delete this;
+}
+
+Counter::Counter( const char *name, const char *labels )
+	: Metric( kCounter, name, labels )
+{
+	memset( (void*)mShards, 0, sizeof( mShards ) );
+}
+
+int64_t Counter::getValue() const
+{
+	int64_t value = 0;
+	
+	for ( int i = 0; i < kNumShards; i++ )
+		value += mShards[ i ].mValue;
+
+	return value;
+}
+
+Gauge::Gauge( const char *name, const char *labels )
+	: Metric( kGauge, name, labels ), mValue( 0 )
+{
+}
+
+Histogram::Histogram( const char *name, const char *labels )
+	: Metric( kHistogram, name, labels )
+{
+	memset( (void*)mShards, 0, sizeof( mShards ) );
+}
+
+void Histogram::getSnapshot( Snapshot &snap ) const
+{
+	snap = Snapshot();
+	
+	for ( int i = 0; i < kNumShards; i++ )
+	{
+		const Shard &s = mShards[ i ];
+
+		for ( int j = 0; j < kNumBuckets; j++ )
+			snap.mBuckets[ j ] += s.mBuckets[ j ];
+
+		snap.mCount += s.mCount;
+		snap.mSum += s.mSum;
+	}
+}
+
+uint64_t Histogram::getBucketLimit( int i )
+{
+	if ( i <= 0 )
+		return 0;
+
+	if ( i >= kNumBuckets - 1 )
+		return UINT64_MAX;
+
+	return ( 1ULL << i ) - 1;
+}
+
+Histogram::Snapshot::Snapshot() : mCount( 0 ), mSum( 0 )
+{
+	memset( mBuckets, 0, sizeof( mBuckets ) );
+}
+
+uint64_t Histogram::Snapshot::getMean() const
+{
+	if ( mCount == 0 )
+		return 0;
+
+	return mSum / mCount;
+}
+
+uint64_t Histogram::Snapshot::getPercentile( double percentile ) const
+{
+	if ( mCount == 0 )
+		return 0;
+	
+	// The rank of the value we are looking for, rounded up so that the 100th
+	//  percentile is the last value.
+	uint64_t rank = (uint64_t)( ( percentile / 100.0 ) * mCount + 0.999999 );
+	if ( rank == 0 )
+		rank = 1;
+	
+	uint64_t seen = 0;
+	
+	for ( int i = 0; i < kNumBuckets; i++ )
+	{
+		seen += mBuckets[ i ];
+		if ( seen >= rank )
+			return getBucketLimit( i );
+	}
+	
+	return getBucketLimit( kNumBuckets - 1 );
+}
+
+MetricsRegistry *MetricsRegistry::getInstance()
+{
+	// Metrics are looked up from constructors that may run on any thread, so
+	//  creation of the singleton must be protected.
+	if ( mSingleton == NULL )
+	{
+		Mutex::EnterCriticalSection();
+		if ( mSingleton == NULL )
+			mSingleton = jh_new MetricsRegistry;
+		Mutex::ExitCriticalSection();
+	}
+	
+	return mSingleton;
+}
+
+void MetricsRegistry::destroyRegistry()
+{
+	if ( mSingleton != NULL )
+	{
+		delete mSingleton;
+		mSingleton = NULL;
+	}
+}
+
+MetricsRegistry::MetricsRegistry()
+	: mLock( "MetricsRegistry" )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+}
+
+MetricsRegistry::~MetricsRegistry()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	// Anyone still holding a metric is holding a reference, so we can't free
+	//  it.  Just complain about it like TimerManager does for timers.
+	for ( JetHead::list<Metric*>::iterator i = mMetrics.begin();
+		  i != mMetrics.end(); ++i )
+	{
+		LOG_WARN( "Possibly leaked metric %s{%s}", (*i)->getName(), 
+				  (*i)->getLabels() );
+	}
+}
+
+SmartPtr<Metric> MetricsRegistry::findMetric( const char *name, const char *labels )
+{
+	if ( labels == NULL )
+		labels = "";
+	
+	for ( JetHead::list<Metric*>::iterator i = mMetrics.begin();
+		  i != mMetrics.end(); ++i )
+	{
+		Metric *m = *i;
+
+		if ( strcmp( m->getName(), name ) != 0 or
+			 strcmp( m->getLabels(), labels ) != 0 )
+		{
+			continue;
+		}
+		
+		// The count drops to zero without mLock, so checking it and then 
+		//  taking a reference could bring back a metric that is already on
+		//  its way to removeMetric and delete.  Only take one while someone
+		//  else still holds one.
+		if ( not m->TryAddRef() )
+			continue;
+		
+		SmartPtr<Metric> result = m;
+		m->Release();
+		return result;
+	}
+	
+	return NULL;
+}
+
+void MetricsRegistry::addMetric( Metric *metric )
+{
+	for ( JetHead::list<Metric*>::iterator i = mMetrics.begin();
+		  i != mMetrics.end(); ++i )
+	{
+		if ( strcmp( metric->getName(), (*i)->getName() ) < 0 )
+		{
+			i.insertBefore( metric );
+			return;
+		}
+	}
+
+	mMetrics.push_back( metric );
+}
+
+void MetricsRegistry::removeMetric( const Metric *metric )
+{
+	AutoLock l( mLock );
+	
+	for ( JetHead::list<Metric*>::iterator i = mMetrics.begin();
+		  i != mMetrics.end(); ++i )
+	{
+		if ( *i == metric )
+		{
+			i.erase();
+			return;
+		}
+	}
+}
+
+SmartPtr<Counter> MetricsRegistry::getCounter( const char *name, const char *labels )
+{
+	// Declared ahead of the lock so that if ours ends up the last reference
+	//  it is dropped after mLock is released, removeMetric takes it.
+	SmartPtr<Metric> m;
+	AutoLock l( mLock );
+
+	m = findMetric( name, labels );
+	
+	if ( m == NULL )
+	{
+		m = jh_new Counter( name, labels );
+		addMetric( m );
+	}
+	else if ( m->getType() != Metric::kCounter )
+	{
+		LOG_WARN( "metric %s is not a counter", name );
+		return NULL;
+	}
+
+	// A new metric holds our reference before addMetric makes it visible, 
+	//  so it is never found with a zero count.
+	return static_cast<Counter*>( static_cast<Metric*>( m ) );
+}
+
+SmartPtr<Gauge> MetricsRegistry::getGauge( const char *name, const char *labels )
+{
+	// Declared ahead of the lock so that if ours ends up the last reference
+	//  it is dropped after mLock is released, removeMetric takes it.
+	SmartPtr<Metric> m;
+	AutoLock l( mLock );
+
+	m = findMetric( name, labels );
+	
+	if ( m == NULL )
+	{
+		m = jh_new Gauge( name, labels );
+		addMetric( m );
+	}
+	else if ( m->getType() != Metric::kGauge )
+	{
+		LOG_WARN( "metric %s is not a gauge", name );
+		return NULL;
+	}
+
+	return static_cast<Gauge*>( static_cast<Metric*>( m ) );
+}
+
+SmartPtr<Histogram> MetricsRegistry::getHistogram( const char *name, const char *labels )
+{
+	// Declared ahead of the lock so that if ours ends up the last reference
+	//  it is dropped after mLock is released, removeMetric takes it.
+	SmartPtr<Metric> m;
+	AutoLock l( mLock );
+
+	m = findMetric( name, labels );
+	
+	if ( m == NULL )
+	{
+		m = jh_new Histogram( name, labels );
+		addMetric( m );
+	}
+	else if ( m->getType() != Metric::kHistogram )
+	{
+		LOG_WARN( "metric %s is not a histogram", name );
+		return NULL;
+	}
+
+	return static_cast<Histogram*>( static_cast<Metric*>( m ) );
+}
+
+int MetricsRegistry::getNumMetrics()
+{
+	AutoLock l( mLock );
+	return mMetrics.size();
+}
+
+static void addHeapSample( JetHead::vector<MetricsRegistry::Sample> &samples,
+						   const char *name, int64_t value )
+{
+	MetricsRegistry::Sample s;
+	s.mName = name;
+	s.mType = Metric::kGauge;
+	s.mValue = value;
+	samples.push_back( s );
+}
+
+void MetricsRegistry::snapshot( JetHead::vector<Sample> &samples )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	samples.clear();
+	
+	// Heap stats come first so they don't break up the sorted order of the
+	//  registered metrics.  They are read when asked for rather than 
+	//  published, since the heap can't call back into us while allocating.
+	if ( GCHeap::defaultHeap != NULL )
+	{
+		GCHeap::Stats stats;
+		GCHeap::defaultHeap->getStats( stats );
+		addHeapSample( samples, "jh_gcheap_current_bytes", stats.mCurrentSize );
+		addHeapSample( samples, "jh_gcheap_max_bytes", stats.mMaxSize );
+		addHeapSample( samples, "jh_gcheap_current_allocations", 
+					   stats.mNumCurrentAllocations );
+		addHeapSample( samples, "jh_gcheap_total_allocations", 
+					   stats.mNumTotalAllocations );
+	}
+	
+	AutoLock l( mLock );
+	
+	for ( JetHead::list<Metric*>::iterator i = mMetrics.begin();
+		  i != mMetrics.end(); ++i )
+	{
+		Metric *m = *i;
+		Sample s;
+
+		s.mName = m->getName();
+		s.mLabels = m->getLabels();
+		s.mType = m->getType();
+		s.mValue = 0;
+		
+		switch ( m->getType() )
+		{
+			case Metric::kCounter:
+				s.mValue = static_cast<Counter*>( m )->getValue();
+				break;
+			case Metric::kGauge:
+				s.mValue = static_cast<Gauge*>( m )->getValue();
+				break;
+			case Metric::kHistogram:
+				static_cast<Histogram*>( m )->getSnapshot( s.mHistogram );
+				break;
+		}
+		
+		samples.push_back( s );
+	}
+}
+
+static const char *gTypeNames[] = {
+	"counter",
+	"gauge",
+	"histogram",
+};
+
+// Append "name{labels}" or "name{labels,extra}" to out.
+static void appendSeries( JHSTD::string &out, const JHSTD::string &name, 
+						  const char *suffix, const JHSTD::string &labels, 
+						  const char *extra = NULL )
+{
+	out += name;
+	out += suffix;
+
+	if ( labels.length() != 0 or extra != NULL )
+	{
+		out += "{";
+		out += labels;
+		if ( extra != NULL )
+		{
+			if ( labels.length() != 0 )
+				out += ",";
+			out += extra;
+		}
+		out += "}";
+	}
+}
+
+void MetricsRegistry::writeText( JHSTD::string &out )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	JetHead::vector<Sample> samples;
+	char buf[ 64 ];
+
+	snapshot( samples );
+	
+	out.clear();
+	
+	for ( unsigned i = 0; i < samples.size(); i++ )
+	{
+		const Sample &s = samples[ i ];
+
+		// Only one TYPE line per name, the samples are sorted so all series
+		//  for a name are next to each other.
+		if ( i == 0 or samples[ i - 1 ].mName != s.mName )
+		{
+			out += "# TYPE ";
+			out += s.mName;
+			out += " ";
+			out += gTypeNames[ s.mType ];
+			out += "\n";
+		}
+		
+		if ( s.mType != Metric::kHistogram )
+		{
+			appendSeries( out, s.mName, "", s.mLabels );
+			snprintf( buf, sizeof( buf ), " %lld\n", (long long)s.mValue );
+			out += buf;
+			continue;
+		}
+
+		uint64_t cumulative = 0;
+		
+		for ( int j = 0; j < Histogram::kNumBuckets; j++ )
+		{
+			cumulative += s.mHistogram.mBuckets[ j ];
+
+			// Skip empty buckets past the data to keep the output short, but
+			//  always write +Inf.
+			if ( j != Histogram::kNumBuckets - 1 and 
+				 cumulative == s.mHistogram.mCount and
+				 s.mHistogram.mBuckets[ j ] == 0 )
+			{
+				continue;
+			}
+			
+			if ( j == Histogram::kNumBuckets - 1 )
+				snprintf( buf, sizeof( buf ), "le=\"+Inf\"" );
+			else
+				snprintf( buf, sizeof( buf ), "le=\"%llu\"", 
+						  (unsigned long long)Histogram::getBucketLimit( j ) );
+
+			appendSeries( out, s.mName, "_bucket", s.mLabels, buf );
+			snprintf( buf, sizeof( buf ), " %llu\n", (unsigned long long)cumulative );
+			out += buf;
+		}
+
+		appendSeries( out, s.mName, "_sum", s.mLabels );
+		snprintf( buf, sizeof( buf ), " %llu\n", 
+				  (unsigned long long)s.mHistogram.mSum );
+		out += buf;
+
+		appendSeries( out, s.mName, "_count", s.mLabels );
+		snprintf( buf, sizeof( buf ), " %llu\n", 
+				  (unsigned long long)s.mHistogram.mCount );
+		out += buf;
+	}
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "MetricsServer.h"
+#include "Metrics.h"
+#include "jh_memory.h"
+#include "logging.h"
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+using namespace JetHead;
+
+//! How long a scraper gets to take the text before we give up on it
+static const int kWriteTimeoutMs = 1000;
+
+MetricsServer::MetricsServer() : mSocket( NULL ), mSelector( "MetricsServer" )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+}
+
+MetricsServer::~MetricsServer()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	stop();
+}
+
+int MetricsServer::start( int port )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	if ( mSocket != NULL )
+	{
+		LOG_WARN( "already started on port %d", getPort() );
+		return -1;
+	}
+	
+	mSocket = jh_new ServerSocket;
+	
+	Socket::Address addr( "127.0.0.1", port );
+	
+	if ( mSocket->bind( addr ) != 0 or mSocket->listen( 5 ) != 0 )
+	{
+		delete mSocket;
+		mSocket = NULL;
+		return -1;
+	}
+	
+	mSocket->setSelector( this, &mSelector );
+	
+	LOG_NOTICE( "serving metrics on port %d", getPort() );
+	
+	return 0;
+}
+
+void MetricsServer::stop()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	if ( mSocket != NULL )
+	{
+		mSocket->setSelector( NULL, NULL );
+		delete mSocket;
+		mSocket = NULL;
+	}
+}
+
+int MetricsServer::getPort()
+{
+	if ( mSocket == NULL )
+		return 0;
+	
+	Socket::Address addr;
+	mSocket->getLocalAddress( addr );
+	return addr.getPort();
+}
+
+bool MetricsServer::handleAccept( ServerSocket *server, Socket *socket )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	JHSTD::string text;
+	
+	MetricsRegistry::getInstance()->writeText( text );
+	
+	// We write on the selector's only thread, so a client that stops 
+	//  reading must not hold it.  With a timeout write keeps going until 
+	//  everything is sent or the time is up.
+	socket->setWriteTimeoutMs( kWriteTimeoutMs );
+	
+	if ( socket->write( text.c_str(), text.length() ) != (int)text.length() )
+		LOG_WARN_PERROR( "failed to write metrics" );
+	
+	// We took ownership by returning true, so clean up here.
+	socket->close();
+	delete socket;
+	return true;
+}
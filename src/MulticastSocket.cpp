@@ -27,6 +27,8 @@
 
 #include "MulticastSocket.h"
 #include "netinet/in.h"
+#include <net/if.h>
+#include <ifaddrs.h>
 #include "logging.h"
 
 SET_LOG_CAT( LOG_CAT_ALL );
@@ -36,7 +38,8 @@ using namespace JetHead;
 
 MulticastSocket::MulticastSocket()
 	: ServerSocket(false),
-	  mInGroup(false)
+	  mInGroup(false),
+	  mIfIndex(0)
 {
 
 }
@@ -46,6 +49,43 @@ MulticastSocket::~MulticastSocket()
 {
 }
 
+unsigned MulticastSocket::getInterfaceIndex(const Socket::Address& addr)
+{
+	struct ifaddrs *ifs = NULL;
+	unsigned index = 0;
+	
+	if (getifaddrs(&ifs) != 0)
+		return 0;
+	
+	for (struct ifaddrs *i = ifs; i != NULL and index == 0; i = i->ifa_next)
+	{
+		if (i->ifa_addr == NULL or i->ifa_addr->sa_family != addr.getFamily())
+			continue;
+		
+		const void *a = NULL, *b = NULL;
+		size_t len;
+		
+		if (addr.isIPv6())
+		{
+			a = &((const struct sockaddr_in6*)i->ifa_addr)->sin6_addr;
+			b = &((const struct sockaddr_in6*)&addr.mAddr)->sin6_addr;
+			len = sizeof(struct in6_addr);
+		}
+		else
+		{
+			a = &((const struct sockaddr_in*)i->ifa_addr)->sin_addr;
+			b = &((const struct sockaddr_in*)&addr.mAddr)->sin_addr;
+			len = sizeof(struct in_addr);
+		}
+		
+		if (memcmp(a, b, len) == 0)
+			index = if_nametoindex(i->ifa_name);
+	}
+	
+	freeifaddrs(ifs);
+	return index;
+}
+
 /**
  * @brief Join the group (call this after bind)
  *
@@ -53,26 +93,85 @@ MulticastSocket::~MulticastSocket()
  */
 int MulticastSocket::joinGroup(const Socket::Address& addr)
 {
-	return joinGroup(addr, Socket::Address());
+	return joinGroup(addr, Socket::Address(0, addr.getFamily()), 0);
 }
 
 int MulticastSocket::joinGroup(const Socket::Address& addr,
 							   const Socket::Address& ifAddr)
 {
-	struct ip_mreq mreq;
-	mreq.imr_multiaddr.s_addr = addr.mAddr.sin_addr.s_addr;
-	mreq.imr_interface.s_addr = ifAddr.mAddr.sin_addr.s_addr;
+	unsigned index = 0;
+	
+	// IPv6 wants an index, 0 (any) is what the wildcard address means
+	if (addr.isIPv6() and ifAddr.isIPv6())
+	{
+		const struct in6_addr *in6 = 
+			&((const struct sockaddr_in6*)&ifAddr.mAddr)->sin6_addr;
+		if (not IN6_IS_ADDR_UNSPECIFIED(in6))
+			index = getInterfaceIndex(ifAddr);
+	}
+	
+	return joinGroup(addr, ifAddr, index);
+}
 
-	int ret = setsockopt(getFd(),
+int MulticastSocket::joinGroup(const Socket::Address& addr, const char* ifName)
+{
+	if (addr.isIPv6())
+	{
+		unsigned index = if_nametoindex(ifName);
+		if (index == 0)
+		{
+			LOG_ERR_PERROR("No interface %s", ifName);
+			return -1;
+		}
+		return joinGroup(addr, Socket::Address(0, AF_INET6), index);
+	}
+	
+	Socket::Address ifAddr;
+	int ret = getInterfaceAddress(ifName, ifAddr);
+	
+	if (ret)
+		return ret;
+	
+	return joinGroup(addr, ifAddr, 0);
+}
+
+int MulticastSocket::joinGroup(const Socket::Address& addr,
+							   const Socket::Address& ifAddr, unsigned ifIndex)
+{
+	int ret;
+	
+	if (addr.isIPv6())
+	{
+		struct ipv6_mreq mreq;
+		mreq.ipv6mr_multiaddr = ((const struct sockaddr_in6*)&addr.mAddr)->sin6_addr;
+		mreq.ipv6mr_interface = ifIndex;
+		
+		ret = setsockopt(getFd(),
+						 IPPROTO_IPV6,
+						 IPV6_JOIN_GROUP,
+						 &mreq,
+						 sizeof(struct ipv6_mreq));
+	}
+	else
+	{
+		struct ip_mreq mreq;
+		mreq.imr_multiaddr = ((const struct sockaddr_in*)&addr.mAddr)->sin_addr;
+		mreq.imr_interface = ((const struct sockaddr_in*)&ifAddr.mAddr)->sin_addr;
+		
+		ret = setsockopt(getFd(),
 						 IPPROTO_IP,
 						 IP_ADD_MEMBERSHIP,
 						 &mreq,
 						 sizeof(struct ip_mreq));
+	}
+	
 	if (ret)
 	{
 		LOG_ERR_PERROR("Multicast join failed");
 	} else {
 		mInGroup = true;
+		mAddr = addr;
+		mIfIndex = ifIndex;
 	}
 	return ret;
 }
@@ -84,11 +183,25 @@ int MulticastSocket::joinGroup(const Socket::Address& addr,
  */
 int MulticastSocket::setTTL(uint8_t ttl)
 {
-	int ret = setsockopt(getFd(),
+	int ret;
+	
+	if (getFamily() == AF_INET6)
+	{
+		int hops = ttl;
+		ret = setsockopt(getFd(),
+						 IPPROTO_IPV6,
+						 IPV6_MULTICAST_HOPS,
+						 &hops,
+						 sizeof(hops));
+	}
+	else
+	{
+		ret = setsockopt(getFd(),
 						 IPPROTO_IP,
 						 IP_MULTICAST_TTL,
 						 &ttl,
 						 sizeof(uint8_t));
+	}
 	if (ret)
 	{
 		LOG_ERR_PERROR("Set Multicast TTL failed");
@@ -103,13 +216,27 @@ int MulticastSocket::setTTL(uint8_t ttl)
  */
 int MulticastSocket::setLoopback(bool enable)
 {
-	uint8_t val = 0;
-	if (enable) val = 1;
-	int ret = setsockopt(getFd(),
+	int ret;
+	
+	if (getFamily() == AF_INET6)
+	{
+		unsigned val = enable ? 1 : 0;
+		ret = setsockopt(getFd(),
+						 IPPROTO_IPV6,
+						 IPV6_MULTICAST_LOOP,
+						 &val,
+						 sizeof(val));
+	}
+	else
+	{
+		uint8_t val = 0;
+		if (enable) val = 1;
+		ret = setsockopt(getFd(),
 						 IPPROTO_IP,
 						 IP_MULTICAST_LOOP,
 						 &val,
 						 sizeof(val));
+	}
 	if (ret)
 	{
 		LOG_ERR_PERROR("Set multicast loopback");
@@ -126,11 +253,25 @@ int MulticastSocket::setLoopback(bool enable)
  */
 int MulticastSocket::setInterface(const Socket::Address& addr)
 {
-	int ret = setsockopt(getFd(),
+	int ret;
+	
+	if (getFamily() == AF_INET6)
+	{
+		unsigned index = getInterfaceIndex(addr);
+		ret = setsockopt(getFd(),
+						 IPPROTO_IPV6,
+						 IPV6_MULTICAST_IF,
+						 &index,
+						 sizeof(index));
+	}
+	else
+	{
+		ret = setsockopt(getFd(),
 						 IPPROTO_IP,
 						 IP_MULTICAST_IF,
-						 &addr.mAddr.sin_addr,
+						 &((const struct sockaddr_in*)&addr.mAddr)->sin_addr,
 						 sizeof(struct in_addr));
+	}
 	if (ret)
 	{
 		LOG_ERR_PERROR("Set Multicast interface failed");
@@ -140,6 +281,21 @@ int MulticastSocket::setInterface(const Socket::Address& addr)
 
 int MulticastSocket::setInterface(const char* ifName)
 {
+	if (getFamily() == AF_INET6)
+	{
+		unsigned index = if_nametoindex(ifName);
+		int ret = setsockopt(getFd(),
+							 IPPROTO_IPV6,
+							 IPV6_MULTICAST_IF,
+							 &index,
+							 sizeof(index));
+		if (ret)
+		{
+			LOG_ERR_PERROR("Set Multicast interface failed");
+		}
+		return ret;
+	}
+	
 	Socket::Address addr;
 
 	int ret = getInterfaceAddress(ifName, addr);
@@ -149,7 +305,6 @@ int MulticastSocket::setInterface(const char* ifName)
 	
 	return setInterface(addr);
 }
-
 int MulticastSocket::setBroadcast(bool enable)
 {
 	int option = enable ? 1 : 0;
@@ -172,15 +327,32 @@ int MulticastSocket::setBroadcast(bool enable)
  */
 int MulticastSocket::leaveGroup()
 {
-	struct ip_mreq mreq;
-	mreq.imr_multiaddr.s_addr = mAddr.mAddr.sin_addr.s_addr;
-	mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+	int ret;
+	
+	if (mAddr.isIPv6())
+	{
+		struct ipv6_mreq mreq;
+		mreq.ipv6mr_multiaddr = ((const struct sockaddr_in6*)&mAddr.mAddr)->sin6_addr;
+		mreq.ipv6mr_interface = mIfIndex;
+		
+		ret = setsockopt(getFd(),
+						 IPPROTO_IPV6,
+						 IPV6_LEAVE_GROUP,
+						 &mreq,
+						 sizeof(struct ipv6_mreq));
+	}
+	else
+	{
+		struct ip_mreq mreq;
+		mreq.imr_multiaddr = ((const struct sockaddr_in*)&mAddr.mAddr)->sin_addr;
+		mreq.imr_interface.s_addr = htonl(INADDR_ANY);
 
-	int ret = setsockopt(getFd(),
+		ret = setsockopt(getFd(),
 						 IPPROTO_IP,
 						 IP_DROP_MEMBERSHIP,
 						 &mreq,
 						 sizeof(struct ip_mreq));
+	}
 	if (ret)
 	{
 		// This seems to ALWAYS trigger, and the extraneous warning is
@@ -50,6 +50,7 @@ Regex::~Regex()
 #define PARSE_ERROR( str ) \
 { \
 	mErrorData.mErrorString = str; \
+	mErrorData.mErrorPos = i; \
 	LOG_NOTICE( "Parse error at char %d, %s", i, str ); \
 	return JetHead::kInvalidRequest; \
 }
@@ -113,6 +114,13 @@ JetHead::ErrCode	Regex::prepare( const JHSTD::string &regex )
 	int range_state;
 	int in_group = 0;
 	
+	// Start over if this was prepared before
+	delete mRoot.mChild;
+	mRoot.mChild = NULL;
+	mState = Regex::STATE_INIT;
+	mMatch.mMatched = false;
+	mMatch.mGroups.clear();
+	
 	for ( int i = 0; i < rlen; i++ )
 	{
 		switch ( regex[ i ] ) 
@@ -209,6 +217,8 @@ JetHead::ErrCode	Regex::prepare( const JHSTD::string &regex )
 				if ( state == IN_CLASS )
 					PARSE_ERROR( "Non-excaped * in charater class" )
 				new_element = cur_node->getLastChild();
+				if ( new_element == NULL )
+					PARSE_ERROR( "Nothing to repeat" )
 				new_element->mRepeatMin = 0;
 				new_element->mRepeatMax = -1;
 				assert( new_element->mType == TYPE_CLASS ||new_element->mType == TYPE_OR || new_element->mType == TYPE_TERMINAL );
@@ -218,6 +228,8 @@ JetHead::ErrCode	Regex::prepare( const JHSTD::string &regex )
 				if ( state == IN_CLASS )
 					PARSE_ERROR( "Non-excaped + in charater class" )
 				new_element = cur_node->getLastChild();
+				if ( new_element == NULL )
+					PARSE_ERROR( "Nothing to repeat" )
 				new_element->mRepeatMin = 1;
 				new_element->mRepeatMax = -1;
 				assert( new_element->mType == TYPE_CLASS ||new_element->mType == TYPE_OR || new_element->mType == TYPE_TERMINAL );
@@ -227,6 +239,8 @@ JetHead::ErrCode	Regex::prepare( const JHSTD::string &regex )
 				if ( state == IN_CLASS )
 					PARSE_ERROR( "Non-excaped ? in charater class" )
 				new_element = cur_node->getLastChild();
+				if ( new_element == NULL )
+					PARSE_ERROR( "Nothing to repeat" )
 				new_element->mRepeatMin = 0;
 				new_element->mRepeatMax = 1;
 				assert( new_element->mType == TYPE_CLASS ||new_element->mType == TYPE_OR || new_element->mType == TYPE_TERMINAL );
@@ -237,11 +251,13 @@ JetHead::ErrCode	Regex::prepare( const JHSTD::string &regex )
 					PARSE_ERROR( "Non-excaped { in charater class" )
 				i += 1;
 				new_element = cur_node->getLastChild();
+				if ( new_element == NULL )
+					PARSE_ERROR( "Nothing to repeat" )
 				new_element->mRepeatMin = 0;
 				new_element->mRepeatMax = 0;
 				assert( new_element->mType == TYPE_CLASS ||new_element->mType == TYPE_OR || new_element->mType == TYPE_TERMINAL );
 				range_state = IN_RANGE_MIN;
-				while( regex[ i ] != '}' )
+				while( i < rlen && regex[ i ] != '}' )
 				{
 					switch( regex[ i ] )
 					{
@@ -274,6 +290,9 @@ JetHead::ErrCode	Regex::prepare( const JHSTD::string &regex )
 					
 					i += 1;
 				}
+				
+				if ( i >= rlen )
+					PARSE_ERROR( "Unterminated repetition range" )
 
 				if ( range_state == IN_RANGE_MIN )
 					new_element->mRepeatMax = new_element->mRepeatMin;				
@@ -370,14 +389,16 @@ JetHead::ErrCode	Regex::prepare( const JHSTD::string &regex )
 				break;
 		}
 	}
-			
+	
+	compile();
+	
 	mState = Regex::STATE_PREPARED;
 	return JetHead::kNoError;
 }
 
 JetHead::ErrCode	Regex::dumpTree( std::string &dump )
 {
-	if ( mState != Regex::STATE_PARSED && mState != Regex::STATE_PREPARED )
+	if ( mState != Regex::STATE_PREPARED )
 		return JetHead::kNotInitialized;
 
 	Element *cur_node = &mRoot;
@@ -480,212 +501,201 @@ void	Regex::dumpElement( Element *cur_node, std::string &dump )
 	dump.append( strm.str() );
 }
 
-bool	Regex::parse( const JHSTD::string &string )
-{	
-	if ( mState != Regex::STATE_PARSED && mState != Regex::STATE_PREPARED )
-		return JetHead::kNotInitialized;
+
+/**
+ * Compile the tree into a program for a Thompson NFA.  Repetitions are 
+ *  unrolled, {2,4} becomes two copies of the element followed by two 
+ *  optional ones, and each group is bracketed by OP_OPEN and OP_CLOSE.  
+ *  OP_SPLIT always lists the greedy or earlier choice first.
+ */
+void	Regex::compile()
+{
+	mProgram.clear();
 	
-	Element *cur_node = &mRoot;
-	ParseData data( string );
+	compileSequence( &mRoot );
+	mProgram.emit( RegexProgram::OP_MATCH );
 	
-	bool res = processSubTree( cur_node, &data );
-
-	if ( res )
-		mState = Regex::STATE_PARSED;
+	mProgram.finish();
+}
 
-	return res;
+void	Regex::compileSequence( Element *sequence )
+{
+	for ( Element *e = sequence->mChild; e != NULL; e = e->mNext )
+		compileRepeat( e );
 }
 
-bool	Regex::processSubTree( Element *cur_node, ParseData *data )
+void	Regex::compileRepeat( Element *element )
 {
-	Element *top_node = cur_node;
+	int min = element->mRepeatMin;
+	int max = element->mRepeatMax;
 	
-	while( cur_node != NULL )
+	// {n,} leaves the max at 0
+	if ( max != -1 && max < min )
+		max = -1;
+	
+	for ( int i = 0; i < min; i++ )
+		compileAtom( element );
+	
+	if ( max == -1 )
+	{
+		int split = mProgram.emit( RegexProgram::OP_SPLIT, 
+								   mProgram.size() + 1 );
+		compileAtom( element );
+		mProgram.emit( RegexProgram::OP_JUMP, split );
+		mProgram.setSecondTarget( split, mProgram.size() );
+	}
+	else if ( max > min )
 	{
-		if ( processElement( cur_node, data ) == false )
-			return false;
+		JetHead::vector<int> splits;
 		
-		if ( cur_node->mType != TYPE_CLASS && cur_node->mType != TYPE_OR && cur_node->mChild != NULL )
-		{
-			cur_node = cur_node->mChild;
-		}
-		else if ( cur_node->mNext != NULL )
-		{
-			cur_node = cur_node->mNext;
-		}
-		else 
+		for ( int i = min; i < max; i++ )
 		{
-			bool done = false;
-			while ( !done )
-			{
-				if ( top_node == cur_node->mParent )
-				{
-					done = true;
-					cur_node = NULL;
-				}
-				else
-				{
-					cur_node = cur_node->mParent;
-					if ( cur_node->mNext != NULL )
-					{
-						cur_node = cur_node->mNext;
-						done = true;
-					}
-				}
-			}
+			splits.push_back( mProgram.emit( RegexProgram::OP_SPLIT, 
+											 mProgram.size() + 1 ) );
+			compileAtom( element );
 		}
+		
+		for ( unsigned i = 0; i < splits.size(); i++ )
+			mProgram.setSecondTarget( splits[ i ], mProgram.size() );
 	}
-	
-	return true;
 }
 
-
-#define CUR_CHAR	data->string[ data->cur_pos ]
-
-bool	Regex::processTerminal( Element *cur_node, ParseData *data )
+void	Regex::compileAtom( Element *element )
 {
-	if ( cur_node->mType == TYPE_TERMINAL )
-	{
-		if ( CUR_CHAR >= cur_node->mTermStartChar && CUR_CHAR <= cur_node->mTermEndChar )
-			return true;
-	}
-	else if ( cur_node->mType == TYPE_CLASS )
+	RegexProgram::ByteSet set;
+	
+	switch ( element->mType )
 	{
-		bool invert = cur_node->mClassInvert;
-		bool match = invert;
-		Element *child_node = cur_node->mChild;
-		
-		while ( child_node != NULL )
-		{
-			if ( !invert )
+		case TYPE_TERMINAL:
+			// Ranges compare as char, as the tree always has
+			for ( int c = element->mTermStartChar; c <= element->mTermEndChar; c++ )
+				set.add( (uint8_t)c );
+			mProgram.emit( RegexProgram::OP_BYTE, mProgram.addSet( set ) );
+			break;
+			
+		case TYPE_CLASS:
+			for ( Element *e = element->mChild; e != NULL; e = e->mNext )
 			{
-				if ( CUR_CHAR >= child_node->mTermStartChar && CUR_CHAR <= child_node->mTermEndChar )
-					return true;
+				for ( int c = e->mTermStartChar; c <= e->mTermEndChar; c++ )
+					set.add( (uint8_t)c );
 			}
-			else
+			
+			if ( element->mClassInvert )
+				set.invert();
+			
+			mProgram.emit( RegexProgram::OP_BYTE, mProgram.addSet( set ) );
+			break;
+			
+		case TYPE_OR:
+		{
+			JetHead::vector<int> jumps;
+			
+			mProgram.emit( RegexProgram::OP_OPEN );
+			
+			for ( Element *alt = element->mChild; alt != NULL; alt = alt->mNext )
 			{
-				if ( CUR_CHAR >= child_node->mTermStartChar && CUR_CHAR <= child_node->mTermEndChar )
-					return false;
+				int split = -1;
+				
+				if ( alt->mNext != NULL )
+					split = mProgram.emit( RegexProgram::OP_SPLIT, 
+										   mProgram.size() + 1 );
+				
+				compileSequence( alt );
+				
+				if ( alt->mNext != NULL )
+				{
+					jumps.push_back( mProgram.emit( RegexProgram::OP_JUMP ) );
+					mProgram.setSecondTarget( split, mProgram.size() );
+				}
 			}
 			
-			child_node = child_node->mNext;
+			for ( unsigned i = 0; i < jumps.size(); i++ )
+				mProgram.setTarget( jumps[ i ], mProgram.size() );
+			
+			mProgram.emit( RegexProgram::OP_CLOSE );
+			break;
 		}
-		
-		if ( match )
-			return true;
-		else
-			return false;
+			
+		case TYPE_SEQUENCE:
+			compileSequence( element );
+			break;
+			
+		default:
+			LOG_ERR_FATAL( "Bad element Type" );
+			break;
 	}
-
-	return false;
 }
 
-void	Regex::backtrackGroups( ParseData *data )
+bool	Regex::parse( const JHSTD::string &string )
 {
-	for ( int i = 0; i < (int)mGroups.size(); i++ )
-	{
-		if ( mGroups[ i ].end_pos > data->cur_pos )
-		{
-			std::string &s = mGroups[ i ].string;
-			s.erase( s.length() - ( mGroups[ i ].end_pos - data->cur_pos ) );
-			mGroups[ i ].end_pos = data->cur_pos;
-		}
-	}
+	return parse( string, mMatch );
 }
 
-bool	Regex::processElement( Element *cur_node, ParseData *data )
+bool	Regex::parse( const JHSTD::string &string, RegexMatch &match ) const
 {	
-	if ( cur_node->mType == TYPE_OR )
-	{
-		cur_node->mGroupNum = mGroups.size();
-		mGroups.resize( mGroups.size() + 1 );
-		mGroups[ cur_node->mGroupNum ].start_pos = data->cur_pos;
-
-		LOG_INFO( "Group %d open at %d", cur_node->mGroupNum, data->cur_pos );
+	match.mMatched = false;
+	match.mGroups.clear();
+	
+	if ( mState != Regex::STATE_PREPARED )
+		return false;
+	
+	// The DFA ignores groups, so it can turn away most strings that don't
+	//  match before the slower Pike VM works out where the groups are
+	bool res = mProgram.match( match.mCache, string.data(), string.size() );
+	
+	if ( res && mProgram.hasGroups() )
+		res = mProgram.capture( match.mCache, string.data(), string.size(), 
+								match.mSpans );
 
-		Element *child_node = cur_node->mChild;
+	if ( res )
+	{
+		match.mGroups.resize( match.mSpans.size() );
 		
-		while ( child_node != NULL )
+		for ( unsigned i = 0; i < match.mSpans.size(); i++ )
 		{
-			if ( processSubTree( child_node, data ) )
-			{
-				int len = data->cur_pos - mGroups[ cur_node->mGroupNum ].start_pos;
-
-				mGroups[ cur_node->mGroupNum ].end_pos = data->cur_pos;
-				mGroups[ cur_node->mGroupNum ].string.assign( data->string, 
-					mGroups[ cur_node->mGroupNum ].start_pos, len );
-		
-				LOG_INFO( "Group %d closing, with size of %d and value of %s", cur_node->mGroupNum, len, mGroups[ cur_node->mGroupNum ].string.c_str() );
-				LOG_INFO( "Group %d start %d, end %d", cur_node->mGroupNum, mGroups[ cur_node->mGroupNum ].start_pos, mGroups[ cur_node->mGroupNum ].end_pos );
-				return true;
-			}
-			child_node = child_node->mNext;
+			RegexMatch::GroupData &group = match.mGroups[ i ];
+			group.start_pos = match.mSpans[ i ].mStart;
+			group.end_pos = match.mSpans[ i ].mEnd;
+			group.string.assign( string, group.start_pos, 
+								 group.end_pos - group.start_pos );
+			
+			LOG_INFO( "Group %d start %d, end %d, value %s", i, 
+					  group.start_pos, group.end_pos, group.string.c_str() );
 		}
 		
-		return false;
+		match.mMatched = true;
 	}
-	if ( cur_node->mType == TYPE_SEQUENCE )
-	{
-		return true;
-	}
-	else if ( cur_node->mType == TYPE_TERMINAL || cur_node->mType == TYPE_CLASS )
-	{
-		assert( cur_node->mParent->mType == TYPE_SEQUENCE );
-		
-		bool backtrack = false;
-		bool res;
-		int start_pos = data->cur_pos;
-		
-		do {
-			data->match_count = 0;
-			res = processTerminal( cur_node, data );
-		
-			while ( ( cur_node->mRepeatMax == -1 || data->match_count < cur_node->mRepeatMax ) && res == true )
-			{
-				data->cur_pos += 1;
-				data->match_count += 1;
-				res = processTerminal( cur_node, data );
-			}
-		
-			backtrack = false;
-			
-			if ( res == false )
-			{
-				if ( data->match_count >= cur_node->mRepeatMin )
-					return true;
-				else if ( start_pos > data->backtrack_pos )
-				{
-					LOG_NOTICE( "backtrack %d %d", data->cur_pos, data->backtrack_pos );
-					start_pos -= 1;
-					data->cur_pos = start_pos;
-					backtrack = true;
-					backtrackGroups( data );
-				}
-			}
-		} while ( backtrack );
 
-		if ( res && data->match_count >= cur_node->mRepeatMin )
-		{
-			data->cur_pos += 1;
-			data->match_count += 1;
-			data->backtrack_pos = data->cur_pos - ( data->match_count - cur_node->mRepeatMin );
-			return true;
-		}
-	}
-	
-	return false;
+	return res;
 }
 
 const JHSTD::string &Regex::getData( int i )
+{
+	return mMatch.getData( i );
+}
+
+int Regex::getNumGroups()
+{
+	return mMatch.getNumGroups();
+}
+
+const JHSTD::string &RegexMatch::getData( int i ) const
 {
 	static JHSTD::string null_string( "" );
 
-	if ( mState != Regex::STATE_PARSED )
+	if ( not mMatched )
 		return null_string;
 
-	if ( i >= (int)mGroups.size() )
+	if ( i < 0 || i >= (int)mGroups.size() )
 		return null_string;
 
 	return mGroups[ i ].string;
 }
 
+int RegexMatch::getNumGroups() const
+{
+	if ( not mMatched )
+		return 0;
+	
+	return mGroups.size();
+}
@@ -0,0 +1,742 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "RegexProgram.h"
+#include "logging.h"
+
+#include <stdlib.h>
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+static int compareInts( const void *a, const void *b )
+{
+	return *(const int*)a - *(const int*)b;
+}
+
+uint32_t RegexProgram::sNextSerial = 0;
+
+RegexProgram::RegexProgram() : mStart( 0 ), mHasGroups( false ), 
+	mPrefilter( false ), mFirstByte( -1 ), mNumClasses( 0 ), mSerial( 0 )
+{
+	memset( mByteClass, 0, sizeof( mByteClass ) );
+}
+
+void RegexProgram::clear()
+{
+	mProgram.clear();
+	mSets.clear();
+	mStart = 0;
+	mHasGroups = false;
+	mPrefilter = false;
+	mFirstByte = -1;
+	mSerial = 0;
+}
+
+int RegexProgram::emit( OpCode op, int x, int y )
+{
+	Inst inst;
+	inst.mOp = op;
+	inst.mX = x;
+	inst.mY = y;
+	inst.mPattern = 0;
+	mProgram.push_back( inst );
+	
+	if ( op == OP_OPEN )
+		mHasGroups = true;
+	
+	return mProgram.size() - 1;
+}
+
+int RegexProgram::addSet( const ByteSet &set )
+{
+	for ( unsigned i = 0; i < mSets.size(); i++ )
+	{
+		if ( memcmp( mSets[ i ].mBits, set.mBits, sizeof( set.mBits ) ) == 0 )
+			return i;
+	}
+	
+	mSets.push_back( set );
+	return mSets.size() - 1;
+}
+
+int RegexProgram::append( const RegexProgram &other, int pattern )
+{
+	int base = mProgram.size();
+	JetHead::vector<int> sets;
+	
+	for ( unsigned i = 0; i < other.mSets.size(); i++ )
+		sets.push_back( addSet( other.mSets[ i ] ) );
+	
+	for ( unsigned i = 0; i < other.mProgram.size(); i++ )
+	{
+		Inst inst = other.mProgram[ i ];
+		
+		switch ( inst.mOp )
+		{
+			case OP_BYTE:
+				inst.mX = sets[ inst.mX ];
+				break;
+			case OP_SPLIT:
+				inst.mX += base;
+				inst.mY += base;
+				break;
+			case OP_JUMP:
+				inst.mX += base;
+				break;
+			case OP_MATCH:
+				inst.mX = pattern;
+				break;
+			default:
+				break;
+		}
+		
+		inst.mPattern = pattern;
+		mProgram.push_back( inst );
+	}
+	
+	mHasGroups = mHasGroups || other.mHasGroups;
+	return base;
+}
+
+void RegexProgram::finish( bool search )
+{
+	mStart = 0;
+	mPrefilter = false;
+	mFirstByte = -1;
+	
+	// Searching goes round a loop that starts the program again at every 
+	//  byte, which belongs to no pattern
+	if ( search )
+	{
+		ByteSet any;
+		any.invert();
+		
+		mStart = emit( OP_SPLIT, 0, mProgram.size() + 1 );
+		emit( OP_BYTE, addSet( any ) );
+		emit( OP_JUMP, mStart );
+		
+		for ( unsigned i = mStart; i < mProgram.size(); i++ )
+			mProgram[ i ].mPattern = -1;
+	}
+	
+	computeByteClasses();
+	mSerial = __sync_add_and_fetch( &sNextSerial, 1 );
+	
+	if ( mSerial == 0 )
+		mSerial = __sync_add_and_fetch( &sNextSerial, 1 );
+	
+	if ( search && mStart > 0 )
+	{
+		// Which bytes could start a match?  Anything can if a pattern 
+		//  matches nothing at all.
+		Cache cache;
+		prepareCache( cache );
+		cache.nextGeneration();
+		cache.mDfaWork.clear();
+		addClosure( cache, 0 );
+		
+		mPrefilter = true;
+		ByteSet first;
+		
+		for ( unsigned i = 0; i < cache.mDfaWork.size(); i++ )
+		{
+			const Inst &inst = mProgram[ cache.mDfaWork[ i ] ];
+			
+			if ( inst.mOp == OP_MATCH )
+			{
+				mPrefilter = false;
+				break;
+			}
+			
+			for ( int j = 0; j < 8; j++ )
+				first.mBits[ j ] |= mSets[ inst.mX ].mBits[ j ];
+		}
+		
+		int count = 0;
+		
+		for ( int c = 0; c < 256; c++ )
+		{
+			if ( first.has( c ) )
+			{
+				mFirstByte = c;
+				count++;
+			}
+		}
+		
+		if ( count != 1 )
+			mFirstByte = -1;
+		
+		if ( count == 256 )
+			mPrefilter = false;
+		
+		mFirstBytes = first;
+	}
+	
+	LOG_INFO( "Program has %d instructions, %d sets, %d byte classes", 
+			  mProgram.size(), mSets.size(), mNumClasses );
+}
+
+/**
+ * Bytes that no set tells apart share a DFA transition.  A new class starts
+ *  wherever any set changes its mind, so there are usually only a handful.
+ */
+void RegexProgram::computeByteClasses()
+{
+	int cls = 0;
+	mByteClass[ 0 ] = 0;
+	
+	for ( int c = 1; c < 256; c++ )
+	{
+		for ( unsigned i = 0; i < mSets.size(); i++ )
+		{
+			if ( mSets[ i ].has( c ) != mSets[ i ].has( c - 1 ) )
+			{
+				cls++;
+				break;
+			}
+		}
+		
+		mByteClass[ c ] = cls;
+	}
+	
+	mNumClasses = cls + 1;
+}
+
+//! Start over if cache was last used with some other program
+void RegexProgram::prepareCache( Cache &cache ) const
+{
+	if ( cache.mSerial == mSerial )
+		return;
+	
+	cache.mSerial = mSerial;
+	cache.mThreads[ 0 ].clear();
+	cache.mThreads[ 1 ].clear();
+	cache.mCaptures.clear();
+	cache.mFreeCapture = -1;
+	
+	cache.mVisited.resize( mProgram.size() );
+	for ( unsigned i = 0; i < cache.mVisited.size(); i++ )
+		cache.mVisited[ i ] = 0;
+	cache.mGeneration = 0;
+	
+	clearDfa( cache );
+}
+
+//! Start a new set of visited marks
+void RegexProgram::Cache::nextGeneration()
+{
+	// Generations only have to differ from the last few, start over long
+	//  before they could wrap
+	if ( mGeneration > 0x3fffffff )
+	{
+		for ( unsigned i = 0; i < mVisited.size(); i++ )
+			mVisited[ i ] = 0;
+		mGeneration = 0;
+	}
+	
+	mGeneration++;
+}
+
+/**
+ * Run every thread in lock step over the string, a byte at a time.  Threads
+ *  are kept in priority order and only the first to reach an instruction
+ *  gets it, so the result is the one a backtracker would have found first.
+ */
+bool RegexProgram::capture( Cache &cache, const char *str, int len, 
+							JetHead::vector<Span> &groups ) const
+{
+	const uint8_t *s = (const uint8_t*)str;
+	JetHead::vector<Thread> *cur = &cache.mThreads[ 0 ];
+	JetHead::vector<Thread> *next = &cache.mThreads[ 1 ];
+	int match = -1;
+	bool found = false;
+	
+	groups.clear();
+	
+	// Not finished yet, or nothing to run
+	if ( mSerial == 0 || mProgram.empty() )
+		return false;
+	
+	prepareCache( cache );
+	cache.mCaptures.clear();
+	cache.mFreeCapture = -1;
+	cur->clear();
+	next->clear();
+	
+	cache.nextGeneration();
+	addThread( cache, *cur, mStart, -1, 0 );
+	
+	for ( int pos = 0; not cur->empty(); pos++ )
+	{
+		cache.nextGeneration();
+		
+		for ( unsigned i = 0; i < cur->size(); i++ )
+		{
+			const Thread &thread = (*cur)[ i ];
+			const Inst &inst = mProgram[ thread.mPc ];
+			
+			if ( inst.mOp == OP_MATCH )
+			{
+				// Threads after this one could only give a worse match
+				if ( found )
+					releaseCapture( cache, match );
+				
+				match = thread.mCapture;
+				found = true;
+				
+				for ( unsigned j = i + 1; j < cur->size(); j++ )
+					releaseCapture( cache, (*cur)[ j ].mCapture );
+				break;
+			}
+			
+			if ( pos < len && mSets[ inst.mX ].has( s[ pos ] ) )
+				addThread( cache, *next, thread.mPc + 1, thread.mCapture, pos + 1 );
+			else
+				releaseCapture( cache, thread.mCapture );
+		}
+		
+		JetHead::vector<Thread> *tmp = cur;
+		cur = next;
+		next = tmp;
+		next->clear();
+	}
+	
+	if ( not found )
+		return false;
+	
+	// Replay the group events of the matching thread, in order
+	JetHead::vector<int> events;
+	JetHead::vector<int> open;
+	
+	for ( int c = match; c >= 0; c = cache.mCaptures[ c ].mPrev )
+		events.push_back( c );
+	
+	for ( int i = events.size() - 1; i >= 0; i-- )
+	{
+		const CaptureNode &node = cache.mCaptures[ events[ i ] ];
+		
+		if ( node.mOpen )
+		{
+			Span span;
+			span.mStart = node.mPos;
+			span.mEnd = node.mPos;
+			open.push_back( groups.size() );
+			groups.push_back( span );
+		}
+		else
+		{
+			groups[ open[ open.size() - 1 ] ].mEnd = node.mPos;
+			open.resize( open.size() - 1 );
+		}
+	}
+	
+	releaseCapture( cache, match );
+	return true;
+}
+
+/**
+ * Add the thread at pc to list, following jumps, splits and group events 
+ *  until it gets to instructions that consume a byte.  Takes over the 
+ *  reference to capture.
+ */
+void RegexProgram::addThread( Cache &cache, JetHead::vector<Thread> &list, 
+							  int pc, int capture, int pos ) const
+{
+	Thread thread;
+	thread.mPc = pc;
+	thread.mCapture = capture;
+	
+	cache.mStack.clear();
+	cache.mStack.push_back( thread );
+	
+	while ( not cache.mStack.empty() )
+	{
+		thread = cache.mStack[ cache.mStack.size() - 1 ];
+		cache.mStack.resize( cache.mStack.size() - 1 );
+		
+		// Someone with higher priority got here first
+		if ( cache.mVisited[ thread.mPc ] == cache.mGeneration )
+		{
+			releaseCapture( cache, thread.mCapture );
+			continue;
+		}
+		
+		cache.mVisited[ thread.mPc ] = cache.mGeneration;
+		const Inst &inst = mProgram[ thread.mPc ];
+		
+		switch ( inst.mOp )
+		{
+			case OP_JUMP:
+				thread.mPc = inst.mX;
+				cache.mStack.push_back( thread );
+				break;
+				
+			case OP_SPLIT:
+				if ( thread.mCapture >= 0 )
+					cache.mCaptures[ thread.mCapture ].mRefs++;
+				
+				// Pushed last so it is followed first
+				thread.mPc = inst.mY;
+				cache.mStack.push_back( thread );
+				thread.mPc = inst.mX;
+				cache.mStack.push_back( thread );
+				break;
+				
+			case OP_OPEN:
+			case OP_CLOSE:
+				thread.mCapture = newCapture( cache, thread.mCapture, pos, 
+											  inst.mOp == OP_OPEN );
+				thread.mPc += 1;
+				cache.mStack.push_back( thread );
+				break;
+				
+			default:
+				list.push_back( thread );
+				break;
+		}
+	}
+}
+
+//! Takes over the reference to prev, the new node has one reference
+int RegexProgram::newCapture( Cache &cache, int prev, int pos, bool open ) const
+{
+	int capture = cache.mFreeCapture;
+	
+	if ( capture >= 0 )
+		cache.mFreeCapture = cache.mCaptures[ capture ].mPrev;
+	else
+	{
+		capture = cache.mCaptures.size();
+		cache.mCaptures.resize( capture + 1 );
+	}
+	
+	CaptureNode &node = cache.mCaptures[ capture ];
+	node.mPrev = prev;
+	node.mPos = pos;
+	node.mRefs = 1;
+	node.mOpen = open;
+	
+	return capture;
+}
+
+void RegexProgram::releaseCapture( Cache &cache, int capture ) const
+{
+	while ( capture >= 0 && --cache.mCaptures[ capture ].mRefs == 0 )
+	{
+		int prev = cache.mCaptures[ capture ].mPrev;
+		cache.mCaptures[ capture ].mPrev = cache.mFreeCapture;
+		cache.mFreeCapture = capture;
+		capture = prev;
+	}
+}
+
+/**
+ * Walk the string through the DFA, working out transitions the first time
+ *  they are taken.  It stops early once every pattern has either matched 
+ *  or can't.
+ */
+bool RegexProgram::match( Cache &cache, const char *str, int len, 
+						  JetHead::vector<int> *patterns ) const
+{
+	const uint8_t *s = (const uint8_t*)str;
+	bool found = false;
+	
+	// Not finished yet, or nothing to run
+	if ( mSerial == 0 || mProgram.empty() )
+		return false;
+	
+	prepareCache( cache );
+	
+	if ( cache.mDfaStart < 0 )
+	{
+		bool flushed;
+		
+		cache.nextGeneration();
+		cache.mDfaWork.clear();
+		addClosure( cache, mStart );
+		cache.mDfaStart = dfaState( cache, flushed );
+	}
+	
+	int state = cache.mDfaStart;
+	
+	for ( int pos = 0; ; pos++ )
+	{
+		const DfaState &dfa = cache.mDfaStates[ state ];
+		
+		if ( dfa.mMatches > 0 )
+		{
+			found = true;
+			
+			if ( patterns == NULL )
+				return true;
+			
+			for ( int i = 0; i < dfa.mMatches; i++ )
+			{
+				int pattern = -1 - cache.mDfaInsts[ dfa.mFirst + i ];
+				unsigned j = 0;
+				
+				// A search can find a pattern more than once
+				while ( j < patterns->size() && (*patterns)[ j ] != pattern )
+					j++;
+				
+				if ( j == patterns->size() )
+					patterns->push_back( pattern );
+			}
+		}
+		
+		if ( dfa.mCount == dfa.mMatches || pos == len )
+			return found;
+		
+		// Nothing is under way at the start of a search, skip to somewhere
+		//  a match could start
+		if ( mPrefilter && state == cache.mDfaStart )
+		{
+			if ( mFirstByte >= 0 )
+			{
+				const void *p = memchr( s + pos, mFirstByte, len - pos );
+				pos = p != NULL ? (const uint8_t*)p - s : len;
+			}
+			else
+			{
+				while ( pos < len && not mFirstBytes.has( s[ pos ] ) )
+					pos++;
+			}
+			
+			if ( pos == len )
+				return found;
+		}
+		
+		int next = cache.mDfaNext[ state * mNumClasses + mByteClass[ s[ pos ] ] ];
+		
+		if ( next < 0 )
+			next = dfaStep( cache, state, s[ pos ] );
+		
+		state = next;
+	}
+}
+
+int RegexProgram::dfaStep( Cache &cache, int state, uint8_t c ) const
+{
+	int first = cache.mDfaStates[ state ].mFirst + cache.mDfaStates[ state ].mMatches;
+	int last = cache.mDfaStates[ state ].mFirst + cache.mDfaStates[ state ].mCount;
+	
+	cache.nextGeneration();
+	cache.mDfaWork.clear();
+	
+	for ( int i = first; i < last; i++ )
+	{
+		const Inst &inst = mProgram[ cache.mDfaInsts[ i ] ];
+		
+		if ( inst.mOp == OP_BYTE && mSets[ inst.mX ].has( c ) )
+			addClosure( cache, cache.mDfaInsts[ i ] + 1 );
+	}
+	
+	bool flushed;
+	int next = dfaState( cache, flushed );
+	
+	// If the cache was thrown away state is gone, don't remember the way
+	if ( not flushed )
+		cache.mDfaNext[ state * mNumClasses + mByteClass[ c ] ] = next;
+	
+	return next;
+}
+
+//! Add the instructions reachable from pc that consume a byte to cache.mDfaWork
+void RegexProgram::addClosure( Cache &cache, int pc ) const
+{
+	Thread thread;
+	thread.mPc = pc;
+	thread.mCapture = -1;
+	
+	cache.mStack.clear();
+	cache.mStack.push_back( thread );
+	
+	while ( not cache.mStack.empty() )
+	{
+		thread = cache.mStack[ cache.mStack.size() - 1 ];
+		cache.mStack.resize( cache.mStack.size() - 1 );
+		
+		if ( cache.mVisited[ thread.mPc ] == cache.mGeneration )
+			continue;
+		
+		cache.mVisited[ thread.mPc ] = cache.mGeneration;
+		const Inst &inst = mProgram[ thread.mPc ];
+		
+		switch ( inst.mOp )
+		{
+			case OP_JUMP:
+				thread.mPc = inst.mX;
+				cache.mStack.push_back( thread );
+				break;
+				
+			case OP_SPLIT:
+				thread.mPc = inst.mY;
+				cache.mStack.push_back( thread );
+				thread.mPc = inst.mX;
+				cache.mStack.push_back( thread );
+				break;
+				
+			case OP_OPEN:
+			case OP_CLOSE:
+				thread.mPc += 1;
+				cache.mStack.push_back( thread );
+				break;
+				
+			default:
+				cache.mDfaWork.push_back( thread.mPc );
+				break;
+		}
+	}
+}
+
+/**
+ * Find the state for the instructions in cache.mDfaWork, adding it if it is new.
+ *  flushed is set if the cache was full and had to be thrown away first.
+ */
+int RegexProgram::dfaState( Cache &cache, bool &flushed ) const
+{
+	flushed = false;
+	
+	// Patterns that matched are done, keep only that they did
+	int matches = 0;
+	
+	for ( unsigned i = 0; i < cache.mDfaWork.size(); i++ )
+	{
+		if ( mProgram[ cache.mDfaWork[ i ] ].mOp == OP_MATCH )
+			matches++;
+	}
+	
+	if ( matches > 0 )
+	{
+		cache.mDfaMatched.clear();
+		
+		for ( unsigned i = 0; i < cache.mDfaWork.size(); i++ )
+		{
+			const Inst &inst = mProgram[ cache.mDfaWork[ i ] ];
+			
+			if ( inst.mOp == OP_MATCH )
+				cache.mDfaMatched.push_back( inst.mX );
+		}
+		
+		unsigned keep = 0;
+		
+		for ( unsigned i = 0; i < cache.mDfaWork.size(); i++ )
+		{
+			int pattern = mProgram[ cache.mDfaWork[ i ] ].mPattern;
+			unsigned j = 0;
+			
+			while ( j < cache.mDfaMatched.size() && cache.mDfaMatched[ j ] != pattern )
+				j++;
+			
+			if ( j == cache.mDfaMatched.size() )
+				cache.mDfaWork[ keep++ ] = cache.mDfaWork[ i ];
+		}
+		
+		cache.mDfaWork.resize( keep );
+		
+		for ( unsigned i = 0; i < cache.mDfaMatched.size(); i++ )
+			cache.mDfaWork.push_back( -1 - cache.mDfaMatched[ i ] );
+	}
+	
+	// Sorted so the same set is always the same state, insertion sort is
+	//  quicker for the usual handful
+	int count = cache.mDfaWork.size();
+	uint32_t hash = 2166136261U;
+	
+	if ( count > 16 )
+		qsort( &cache.mDfaWork[ 0 ], count, sizeof( int ), compareInts );
+	else
+	{
+		for ( int i = 1; i < count; i++ )
+		{
+			int pc = cache.mDfaWork[ i ];
+			int j = i;
+			
+			for ( ; j > 0 && cache.mDfaWork[ j - 1 ] > pc; j-- )
+				cache.mDfaWork[ j ] = cache.mDfaWork[ j - 1 ];
+			
+			cache.mDfaWork[ j ] = pc;
+		}
+	}
+	
+	for ( int i = 0; i < count; i++ )
+		hash = ( hash ^ cache.mDfaWork[ i ] ) * 16777619U;
+	
+	for ( int s = cache.mDfaHash[ hash % kDfaHashSize ]; s >= 0; 
+		  s = cache.mDfaStates[ s ].mHashNext )
+	{
+		const DfaState &dfa = cache.mDfaStates[ s ];
+		
+		if ( dfa.mHash == hash && dfa.mCount == count && 
+			 ( count == 0 || memcmp( &cache.mDfaInsts[ dfa.mFirst ], &cache.mDfaWork[ 0 ], 
+									 count * sizeof( int ) ) == 0 ) )
+			return s;
+	}
+	
+	int memory = cache.mDfaStates.size() * sizeof( DfaState ) + 
+		( cache.mDfaInsts.size() + cache.mDfaNext.size() ) * sizeof( int );
+	
+	if ( memory >= kMaxDfaMemory )
+	{
+		LOG_INFO( "DFA cache full, starting over" );
+		clearDfa( cache );
+		flushed = true;
+	}
+	
+	DfaState dfa;
+	dfa.mFirst = cache.mDfaInsts.size();
+	dfa.mCount = count;
+	dfa.mMatches = matches;
+	dfa.mHash = hash;
+	dfa.mHashNext = cache.mDfaHash[ hash % kDfaHashSize ];
+	
+	for ( int i = 0; i < count; i++ )
+		cache.mDfaInsts.push_back( cache.mDfaWork[ i ] );
+	
+	int state = cache.mDfaStates.size();
+	cache.mDfaStates.push_back( dfa );
+	cache.mDfaHash[ hash % kDfaHashSize ] = state;
+	
+	for ( int i = 0; i < mNumClasses; i++ )
+		cache.mDfaNext.push_back( -1 );
+	
+	return state;
+}
+
+void RegexProgram::clearDfa( Cache &cache ) const
+{
+	cache.mDfaStates.clear();
+	cache.mDfaInsts.clear();
+	cache.mDfaNext.clear();
+	cache.mDfaHash.resize( kDfaHashSize );
+	
+	for ( int i = 0; i < kDfaHashSize; i++ )
+		cache.mDfaHash[ i ] = -1;
+	
+	cache.mDfaStart = -1;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "RegexSet.h"
+#include "jh_memory.h"
+#include "logging.h"
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+RegexSet::RegexSet()
+{
+}
+
+RegexSet::~RegexSet()
+{
+	for ( unsigned i = 0; i < mPatterns.size(); i++ )
+		delete mPatterns[ i ];
+}
+
+int RegexSet::add( const JHSTD::string &regex )
+{
+	Regex *re = jh_new Regex;
+	
+	if ( re->prepare( regex ) != JetHead::kNoError )
+	{
+		mErrorData = re->getPrepareError();
+		delete re;
+		return -1;
+	}
+	
+	mPatterns.push_back( re );
+	compile( mAnchored, false );
+	compile( mSearch, true );
+	
+	return mPatterns.size() - 1;
+}
+
+bool RegexSet::match( const JHSTD::string &string, 
+					  JetHead::vector<int> &matches, 
+					  RegexProgram::Cache &cache ) const
+{
+	return run( mAnchored, cache, string, matches );
+}
+
+bool RegexSet::search( const JHSTD::string &string, 
+					   JetHead::vector<int> &matches,
+					   RegexProgram::Cache &cache ) const
+{
+	return run( mSearch, cache, string, matches );
+}
+
+/**
+ * The program starts with a chain of splits that fans out to every RE, 
+ *  which follow one after the other.  The DFA then runs them all side by 
+ *  side.
+ */
+void RegexSet::compile( RegexProgram &program, bool search )
+{
+	int num = mPatterns.size();
+	
+	program.clear();
+	
+	for ( int i = 0; i < num - 1; i++ )
+		program.emit( RegexProgram::OP_SPLIT, 0, i + 1 );
+	
+	for ( int i = 0; i < num; i++ )
+	{
+		int start = program.append( mPatterns[ i ]->mProgram, i );
+		
+		if ( i < num - 1 )
+			program.setTarget( i, start );
+		else if ( i > 0 )
+			program.setSecondTarget( i - 1, start );
+	}
+	
+	program.finish( search );
+	
+	LOG_INFO( "Compiled %d REs to %d instructions", num, program.size() );
+}
+
+bool RegexSet::run( const RegexProgram &program, RegexProgram::Cache &cache,
+					const JHSTD::string &string, 
+					JetHead::vector<int> &matches ) const
+{
+	matches.clear();
+	
+	if ( mPatterns.empty() )
+		return false;
+	
+	program.match( cache, string.data(), string.size(), &matches );
+	
+	// The DFA finds them in the order they end, report them in index order
+	for ( unsigned i = 1; i < matches.size(); i++ )
+	{
+		int index = matches[ i ];
+		unsigned j = i;
+		
+		for ( ; j > 0 && matches[ j - 1 ] > index; j-- )
+			matches[ j ] = matches[ j - 1 ];
+		
+		matches[ j ] = index;
+	}
+	
+	return not matches.empty();
+}
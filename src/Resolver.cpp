@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include "Resolver.h"
+#include "EventAgent.h"
+#include "TimeUtils.h"
+
+#include "jh_memory.h"
+#include "logging.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+using namespace JetHead;
+
+Resolver *Resolver::mSingleton = NULL;
+
+Resolver *Resolver::getInstance()
+{
+	// Creating a Resolver takes references on metrics, which needs the 
+	//  critical section, so race to install one instead of locking.
+	if ( mSingleton == NULL )
+	{
+		Resolver *resolver = jh_new Resolver;
+		if ( not __sync_bool_compare_and_swap( &mSingleton, NULL, resolver ) )
+			delete resolver;
+	}
+	
+	return mSingleton;
+}
+
+Resolver::Resolver( const char *name )
+	: mName( name ), mLock( name ), mNextWorker( 0 ), 
+	mCacheTtl( kDefaultCacheTtl ), mNegativeTtl( kDefaultNegativeTtl ),
+	mLookup( getaddrinfoLookup )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	MetricsRegistry *registry = MetricsRegistry::getInstance();
+	mLookups = registry->getCounter( "jh_resolver_lookups_total" );
+	mCacheHits = registry->getCounter( "jh_resolver_cache_hits_total" );
+}
+
+Resolver::~Resolver()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	// Joins the workers, anything they hadn't got to is dropped
+	for ( unsigned i = 0; i < mWorkers.size(); i++ )
+		delete mWorkers[ i ];
+	
+	if ( not mRequests.empty() )
+		LOG_WARN( "Destroyed with lookups outstanding" );
+	
+	while ( not mRequests.empty() )
+	{
+		delete mRequests.front();
+		mRequests.pop_front();
+	}
+}
+
+int Resolver::getaddrinfoLookup( const char *name, 
+								 JetHead::vector<Socket::Address> &addrs )
+{
+	struct addrinfo hints;
+	struct addrinfo *res = NULL;
+	
+	memset( &hints, 0, sizeof( hints ) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	
+	int err = getaddrinfo( name, NULL, &hints, &res );
+	
+	if ( err != 0 )
+		return err;
+	
+	for ( struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next )
+	{
+		if ( ai->ai_family != AF_INET and ai->ai_family != AF_INET6 )
+			continue;
+		
+		Socket::Address addr( ai->ai_addr, ai->ai_addrlen );
+		bool dup = false;
+		
+		for ( unsigned i = 0; i < addrs.size() and not dup; i++ )
+			dup = addrs[ i ] == addr;
+		
+		if ( not dup )
+			addrs.push_back( addr );
+	}
+	
+	freeaddrinfo( res );
+	
+	return addrs.empty() ? EAI_NONAME : 0;
+}
+
+int Resolver::resolve( const char *name, JetHead::vector<Socket::Address> &addrs )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	int error;
+	LookupFunc lookup;
+	
+	addrs.clear();
+	
+	{
+		AutoLock lock( mLock );
+		
+		if ( findCached( name, error, addrs ) )
+			return error;
+		
+		lookup = mLookup;
+	}
+	
+	mLookups->increment();
+	error = lookup( name, addrs );
+	
+	AutoLock lock( mLock );
+	addCached( name, error, addrs );
+	
+	return error;
+}
+
+void Resolver::resolveAsync( const char *name, ResolverListener *listener,
+							 IEventDispatcher *dispatcher )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	AutoLock lock( mLock );
+	
+	Request *req = jh_new Request;
+	req->mName = name;
+	req->mListener = listener;
+	req->mDispatcher = dispatcher;
+	req->mError = 0;
+	req->mDone = false;
+	req->mCancelled = false;
+	
+	int error;
+	JetHead::vector<Socket::Address> addrs;
+	bool inFlight = false;
+	
+	for ( JetHead::list<Request*>::iterator i = mRequests.begin(); 
+		  i != mRequests.end() and not inFlight; ++i )
+	{
+		inFlight = not (*i)->mDone and (*i)->mName == req->mName;
+	}
+	
+	mRequests.push_back( req );
+	
+	if ( findCached( name, error, addrs ) )
+	{
+		complete( req, error, addrs );
+	}
+	else if ( not inFlight )
+	{
+		// Plenty of users only ever call resolve, so don't start threads
+		//  until they are needed
+		if ( mWorkers.empty() )
+		{
+			for ( int i = 0; i < kNumWorkers; i++ )
+				mWorkers.push_back( jh_new EventThread( mName ) );
+		}
+		
+		// doLookup takes care of every request waiting on the name
+		AsyncEventAgent1<Resolver, JHSTD::string*> *agent = 
+			jh_new AsyncEventAgent1<Resolver, JHSTD::string*>( 
+				this, &Resolver::doLookup, jh_new JHSTD::string( name ) );
+		agent->send( mWorkers[ mNextWorker ] );
+		mNextWorker = ( mNextWorker + 1 ) % mWorkers.size();
+	}
+}
+
+void Resolver::cancel( ResolverListener *listener )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	AutoLock lock( mLock );
+	
+	for ( JetHead::list<Request*>::iterator i = mRequests.begin(); 
+		  i != mRequests.end(); ++i )
+	{
+		if ( (*i)->mListener == listener )
+			(*i)->mCancelled = true;
+	}
+}
+
+void Resolver::setCacheTtl( uint32_t positiveMs, uint32_t negativeMs )
+{
+	AutoLock lock( mLock );
+	mCacheTtl = positiveMs;
+	mNegativeTtl = negativeMs;
+}
+
+void Resolver::flushCache()
+{
+	AutoLock lock( mLock );
+	mCache.clear();
+}
+
+void Resolver::setLookupFunction( LookupFunc func )
+{
+	AutoLock lock( mLock );
+	mLookup = func != NULL ? func : getaddrinfoLookup;
+}
+
+bool Resolver::findCached( const char *name, int &error, 
+						   JetHead::vector<Socket::Address> &addrs )
+{
+	uint64_t now = TimeUtils::getMonotonicMicros();
+	
+	for ( unsigned i = 0; i < mCache.size(); i++ )
+	{
+		if ( mCache[ i ].mName != name )
+			continue;
+		
+		if ( mCache[ i ].mExpires <= now )
+		{
+			mCache.erase( i );
+			return false;
+		}
+		
+		mCacheHits->increment();
+		error = mCache[ i ].mError;
+		addrs = mCache[ i ].mAddrs;
+		return true;
+	}
+	
+	return false;
+}
+
+void Resolver::addCached( const char *name, int error, 
+						  const JetHead::vector<Socket::Address> &addrs )
+{
+	uint32_t ttl = error == 0 ? mCacheTtl : mNegativeTtl;
+	
+	if ( ttl == 0 )
+		return;
+	
+	uint64_t now = TimeUtils::getMonotonicMicros();
+	unsigned slot = mCache.size();
+	
+	// Replace an old answer for the same name, or failing that something
+	//  that has expired, or failing that whatever expires soonest.
+	for ( unsigned i = 0; i < mCache.size(); i++ )
+	{
+		if ( mCache[ i ].mName == name )
+		{
+			slot = i;
+			break;
+		}
+		
+		if ( mCache[ i ].mExpires <= now )
+			slot = i;
+		else if ( mCache.size() >= (unsigned)kMaxCacheEntries and 
+				  ( slot == mCache.size() or 
+					mCache[ i ].mExpires < mCache[ slot ].mExpires ) )
+			slot = i;
+	}
+	
+	if ( slot == mCache.size() )
+		mCache.resize( slot + 1 );
+	
+	CacheEntry &entry = mCache[ slot ];
+	entry.mName = name;
+	entry.mError = error;
+	entry.mAddrs = addrs;
+	entry.mExpires = now + (uint64_t)ttl * 1000;
+}
+
+void Resolver::doLookup( JHSTD::string *name )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	JetHead::vector<Socket::Address> addrs;
+	LookupFunc lookup;
+	
+	{
+		AutoLock lock( mLock );
+		lookup = mLookup;
+	}
+	
+	// The slow part, done without holding anything
+	mLookups->increment();
+	int error = lookup( name->c_str(), addrs );
+	
+	if ( error != 0 )
+		LOG_INFO( "Failed to resolve %s: %s", name->c_str(), gai_strerror( error ) );
+	
+	AutoLock lock( mLock );
+	
+	addCached( name->c_str(), error, addrs );
+	
+	for ( JetHead::list<Request*>::iterator i = mRequests.begin(); 
+		  i != mRequests.end(); ++i )
+	{
+		if ( not (*i)->mDone and (*i)->mName == *name )
+			complete( *i, error, addrs );
+	}
+	
+	delete name;
+}
+
+void Resolver::complete( Request *req, int error, 
+						 const JetHead::vector<Socket::Address> &addrs )
+{
+	req->mError = error;
+	req->mAddrs = addrs;
+	req->mDone = true;
+	
+	AsyncEventAgent1<Resolver, Request*> *agent = 
+		jh_new AsyncEventAgent1<Resolver, Request*>( 
+			this, &Resolver::deliver, req );
+	agent->send( req->mDispatcher );
+}
+
+void Resolver::deliver( Request *req )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	bool cancelled;
+	
+	{
+		AutoLock lock( mLock );
+		
+		for ( JetHead::list<Request*>::iterator i = mRequests.begin(); 
+			  i != mRequests.end(); ++i )
+		{
+			if ( *i == req )
+			{
+				i.erase();
+				break;
+			}
+		}
+		
+		cancelled = req->mCancelled;
+	}
+	
+	if ( not cancelled )
+		req->mListener->handleResolved( req->mName.c_str(), req->mError, 
+										req->mAddrs );
+	
+	delete req;
+}
@@ -28,21 +28,29 @@
 #include "jh_types.h"
 
 #include "Selector.h"
+#include "TimeUtils.h"
+#include "TraceRecorder.h"
 
 #include "logging.h"
 #include "jh_memory.h"
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <string.h>
+
+#ifdef JH_SELECTOR_USE_EPOLL
+#include <sys/epoll.h>
+#endif
 
 SET_LOG_CAT( LOG_CAT_ALL );
 SET_LOG_LEVEL( LOG_LVL_NOTICE );
 
 Selector::Selector( const char *name ) : mLock( true ), 
 	mThread( name == NULL ? "Selector" : name, this, &Selector::threadMain ),
-	mUpdateFds( false )
+	mUpdateFds( false ), mPolledFds( 0 )
 {
 	TRACE_BEGIN( LOG_LVL_INFO );
+	mGeneration = 0;
 	int res = pipe( mPipe );
 	
 	LOG( "pipe reader %d writer %d", mPipe[ PIPE_READER ], mPipe[ PIPE_WRITER ] );
@@ -50,6 +58,32 @@ Selector::Selector( const char *name ) : mLock( true ),
 	if ( res != 0 )
 		LOG_ERR_FATAL( "failed to create pipe" );	
 
+#ifdef JH_SELECTOR_USE_EPOLL
+	mEpollFd = epoll_create( kMaxEventsPerPoll );
+	
+	if ( mEpollFd < 0 )
+		LOG_ERR_FATAL( "failed to create epoll fd" );
+	
+	fcntl( mEpollFd, F_SETFD, FD_CLOEXEC );
+	
+	struct epoll_event ev;
+	memset( &ev, 0, sizeof( ev ) );
+	ev.events = EPOLLIN;
+	ev.data.fd = mPipe[ PIPE_READER ];
+	
+	if ( epoll_ctl( mEpollFd, EPOLL_CTL_ADD, mPipe[ PIPE_READER ], &ev ) != 0 )
+		LOG_ERR_FATAL( "failed to add pipe to epoll fd" );
+#endif
+
+	JHSTD::string labels;
+	JetHead::stl_sprintf( labels, "selector=\"%s\"", mThread.GetName() );
+	MetricsRegistry *metrics = MetricsRegistry::getInstance();
+	mFdsGauge = metrics->getGauge( "jh_selector_fds", labels.c_str() );
+	mWakeups = metrics->getCounter( "jh_selector_wakeups_total", labels.c_str() );
+	mCallbackTime = metrics->getHistogram( "jh_selector_callback_time_us", 
+										   labels.c_str() );
+	setMetricsName( mThread.GetName() );
+
 	mRunning = true;
 	mThread.Start();
 	mShutdown = false;
@@ -61,10 +95,26 @@ Selector::~Selector()
 
 	shutdown();
 	
+	mFdsGauge->add( -mPolledFds );
+	
+	for ( unsigned fd = 0; fd < mFds.size(); fd++ )
+	{
+		ListenerNode *node = mFds[ fd ];
+		while ( node != NULL )
+		{
+			ListenerNode *next = node->mNext;
+			delete node;
+			node = next;
+		}
+	}
+	
 	LOG( "Closing pipes" );
 	// close the pipes fd's.
 	close( mPipe[ PIPE_WRITER ] );
 	close( mPipe[ PIPE_READER ] );
+#ifdef JH_SELECTOR_USE_EPOLL
+	close( mEpollFd );
+#endif
 
 	if ( mThread == *Thread::GetCurrent() )
 		LOG_ERR_FATAL( "A selector MUST NOT be deleted by its own thread!" );
@@ -101,19 +151,35 @@ void Selector::addListener( int fd, short events, SelectorListener *listener, jh
 {
 	TRACE_BEGIN( LOG_LVL_INFO );
 
+	if ( fd < 0 )
+	{
+		LOG_ERR( "can't listen on fd %d", fd );
+		return;
+	}
+	
 	ListenerNode *node = jh_new ListenerNode();
 	
 	node->mFd = fd;
 	node->mEvents = events;
 	node->mListener = listener;
 	node->mPrivateData = private_data;
+	node->mNext = NULL;
 	
 	AutoLock l( mLock );
 	
-	mList.push_back( node );	
+	if ( (unsigned)fd >= mFds.size() )
+		mFds.resize( fd + 1 );
+	
+	// Add to the end so listeners are called in the order they were added
+	ListenerNode **last = &mFds[ fd ];
+	while ( *last != NULL )
+		last = &(*last)->mNext;
+	*last = node;
+	
+	fdChanged( fd );
 	updateListeners();	
 	
-	LOG( "added fd %d events %x, list size %d", fd, events, mList.size() );
+	LOG( "added fd %d events %x", fd, events );
 }
 
 void Selector::removeListener( int fd, SelectorListener *listener )
@@ -121,43 +187,60 @@ void Selector::removeListener( int fd, SelectorListener *listener )
 	TRACE_BEGIN( LOG_LVL_INFO );
 
 	AutoLock l( mLock );
-	ListenerNode n( fd, NULL );
-	bool update = false;
 	
-	JetHead::list<ListenerNode*>::iterator i = mList.begin(); 
-	while (i != mList.end())
+	ListenerNode *node = getListeners( fd );
+	
+	if ( node == NULL )
+		return;
+	
+	// Everything on this fd goes, the fd is probably about to be closed.
+	mFds[ fd ] = NULL;
+	while ( node != NULL )
 	{
-		if (*(*i) == n)
-		{
-			update = true;
-			delete *i;
-			i = i.erase();
-		} 
-		else 
+		ListenerNode *next = node->mNext;
+		delete node;
+		node = next;
+	}
+	
+	mGeneration++;
+	fdChanged( fd );
+	updateListeners();		
+}
+
+void Selector::setListenerEvents( int fd, SelectorListener *listener, short events )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+
+	AutoLock l( mLock );
+	bool changed = false;
+	
+	for ( ListenerNode *node = getListeners( fd ); node != NULL; 
+		  node = node->mNext )
+	{
+		if ( node->mListener == listener and node->mEvents != events )
 		{
-			++i;
+			node->mEvents = events;
+			changed = true;
 		}
 	}
-		
-	if ( update )
+	
+	if ( changed )
 	{
-		updateListeners();		
+		fdChanged( fd );
+		updateListeners();
 	}
 }
-	
-Selector::ListenerNode *Selector::findListener( int fd, SelectorListener *listener )
+
+void Selector::fdChanged( int fd )
 {
-	ListenerNode n( fd, listener );
-	for (JetHead::list<ListenerNode*>::iterator i = mList.begin(); 
-		 i != mList.end(); ++i)
+	if ( (unsigned)fd >= mPolledEvents.size() )
+		mPolledEvents.resize( fd + 1 );
+	
+	if ( ( mPolledEvents[ fd ] & kChanged ) == 0 )
 	{
-		if (*(*i) == n)
-		{
-			return *i;
-		}
+		mPolledEvents[ fd ] |= kChanged;
+		mChangedFds.push_back( fd );
 	}
-		
-	return NULL;
 }
 
 void Selector::updateListeners()
@@ -184,82 +267,52 @@ void Selector::threadMain()
 {
 	TRACE_BEGIN( LOG_LVL_INFO );
 	bool gotEvent = false;
-	struct pollfd	fds[ kMaxPollFds ];
-	int				numFds = 0;
+	struct pollfd	fds[ kMaxEventsPerPoll ];
 	
-	fillPollFds( fds, numFds );
+	updatePollSet();
 	
 	// Event will be sent by EventThread on exit
 	while( mRunning )
 	{
-		LOG( "%p on %d files", this, numFds );
-		for ( int i = 1; i < numFds; i++ )
-		{
-			LOG( "%p fd %d", this, fds[ i ].fd );
-		}
-		
-		// set errno to zero
-		// this is being set to better monitor the behavior of poll on
-		// the 7401 until poll gets fixed
-		errno = 0;
-		int res = 0;
-		
-		// test here to ensure that errno cannot be modified before it is tested.
-		if ( ( res = poll( fds, numFds, -1 ) ) < 0 )
-		{
-			// for whatever reason, there are times when poll returns -1,
-			// but doesn't set errno
-			if (errno == 0)
-				LOG_NOTICE( "Poll returned %d, but didn't set errno", res);
-			else if (errno == EINTR)
-				LOG_NOISE( "Poll was interrupted" );
-			else
-				LOG_ERR_PERROR( "Poll returned %d", res );
-		}
+		int res = waitForEvents( fds, kMaxEventsPerPoll );
 		
 		LOG( "%p woke up %d", this, res );
+		mWakeups->increment();
+		uint64_t wakeTime = TimeUtils::getMonotonicMicros();
 		
-		if ( res > 0 )
+		for ( int i = 0; i < res; i++ )
 		{
-			LOG( "got %d from poll", res );
-			
-			for ( int i = 0; i < numFds; i++ )
+			if ( fds[ i ].fd == mPipe[ PIPE_READER ] )
 			{
-				if ( fds[ i ].fd == mPipe[ PIPE_READER ] )
+				LOG( "got %x on pipe %d", fds[ i ].revents, fds[ i ].fd );
+				if ( fds[ i ].revents & POLLIN )
 				{
-					LOG( "got %x on pipe %d", fds[ 0 ].revents, fds[ i ].fd );
-					if ( fds[ i ].revents & POLLIN )
-					{
-						char buf[10];
-						read( mPipe[ PIPE_READER ], &buf, 4 );
-						
-						// We need to handle events after we handle file
-						// descriptor polls because one of the events
-						// that we handle modifies the current list of
-						// file descriptors for poll and we need to handle
-						// any that occured before updating them.
-						gotEvent = true;
-					}			
-					else if ( fds[ i ].revents & ( POLLHUP | POLLNVAL ) )
-					{
-						LOG_ERR_FATAL( "POLLHUP recieved on pipe" );
-					}
-				}
-				else
+					char buf[10];
+					read( mPipe[ PIPE_READER ], &buf, 4 );
+					
+					// We need to handle events after we handle file
+					// descriptor polls because one of the events
+					// that we handle modifies the current list of
+					// file descriptors for poll and we need to handle
+					// any that occured before updating them.
+					gotEvent = true;
+				}			
+				else if ( fds[ i ].revents & ( POLLHUP | POLLNVAL ) )
 				{
-					LOG_NOISE( "got %x on fd %d", fds[ i ].revents, fds[ i ].fd );
-					if ( fds[ i ].revents != 0 )
-					{
-						// if callListeners removes a listener we need to update 
-						//  Fds.  However only set if callListeners returns true
-						//  This should not be cleared since one of the listeners
-						//  could have called removeListener and that call might 
-						//  have set mUpdateFds
-						if ( callListeners( fds[ i ].fd, fds[ i ].revents ) )
-							mUpdateFds = true;
-					}
+					LOG_ERR_FATAL( "POLLHUP recieved on pipe" );
 				}
 			}
+			else
+			{
+				LOG_NOISE( "got %x on fd %d", fds[ i ].revents, fds[ i ].fd );
+				// if callListeners removes a listener we need to update 
+				//  Fds.  However only set if callListeners returns true
+				//  This should not be cleared since one of the listeners
+				//  could have called removeListener and that call might 
+				//  have set mUpdateFds
+				if ( callListeners( fds[ i ].fd, fds[ i ].revents, wakeTime ) )
+					mUpdateFds = true;
+			}
 		}
 
 		// Now that file descriptors have been handled we can deal with
@@ -292,7 +345,7 @@ void Selector::threadMain()
 		
 		if ( mUpdateFds )
 		{
-			fillPollFds( fds, numFds );
+			updatePollSet();
 			mUpdateFds = false;
 		}
 		
@@ -302,117 +355,268 @@ void Selector::threadMain()
 	LOG_NOTICE( "Thread exiting" );
 }
 
-void Selector::fillPollFds( struct pollfd *fds, int &numFds )
+int Selector::waitForEvents( struct pollfd *fds, int maxFds )
 {
-	AutoLock m( mLock );
-	TRACE_BEGIN( LOG_LVL_INFO );
-
-	fds[ 0 ].fd = mPipe[ PIPE_READER ];
-	fds[ 0 ].events = POLLIN;
+	// set errno to zero
+	// this is being set to better monitor the behavior of poll on
+	// the 7401 until poll gets fixed
+	errno = 0;
+	int res = 0;
+	
+#ifdef JH_SELECTOR_USE_EPOLL
+	struct epoll_event events[ kMaxEventsPerPoll ];
+	
+	if ( maxFds > kMaxEventsPerPoll )
+		maxFds = kMaxEventsPerPoll;
+	
+	// Don't sleep if there are fds that are always ready
+	res = epoll_wait( mEpollFd, events, maxFds, mReadyFds.empty() ? -1 : 0 );
+	
+	for ( int i = 0; i < res; i++ )
+	{
+		// The poll and epoll event bits are the same on linux
+		fds[ i ].fd = events[ i ].data.fd;
+		fds[ i ].events = 0;
+		fds[ i ].revents = events[ i ].events;
+	}
+	
+	for ( unsigned i = 0; res >= 0 and res < maxFds and i < mReadyFds.size(); i++ )
+	{
+		if ( mReadyFds[ i ].revents != 0 )
+			fds[ res++ ] = mReadyFds[ i ];
+	}
+#else
+	res = poll( &mPollFds[ 0 ], mPollFds.size(), -1 );
+	
+	if ( res > 0 )
+	{
+		int found = 0;
+		for ( unsigned i = 0; i < mPollFds.size() and found < maxFds; i++ )
+		{
+			// Anything past maxFds is still ready next time around
+			if ( mPollFds[ i ].revents != 0 )
+				fds[ found++ ] = mPollFds[ i ];
+		}
+		res = found;
+	}
+#endif
 
-	int j, i = 1;
+	if ( res < 0 )
+	{
+		// for whatever reason, there are times when poll returns -1,
+		// but doesn't set errno
+		if (errno == 0)
+			LOG_NOTICE( "Poll returned %d, but didn't set errno", res);
+		else if (errno == EINTR)
+			LOG_NOISE( "Poll was interrupted" );
+		else
+			LOG_ERR_PERROR( "Poll returned %d", res );
+	}
+	
+	return res;
+}
 
-	for (JetHead::list<ListenerNode*>::iterator listener = mList.begin(); 
-		 listener != mList.end(); ++listener)
+void Selector::updatePollSet()
+{
+	AutoLock m( mLock );
+	TRACE_BEGIN( LOG_LVL_INFO );
+	int numPolled = mPolledFds;
+	
+	for ( unsigned i = 0; i < mChangedFds.size(); i++ )
 	{
-		// If we already have this fd in our list, skip it
-		for ( j = 1; j < i; j++ )
+		int fd = mChangedFds[ i ];
+		int events = 0;
+		bool wanted = false;
+		
+		// Poll for everything any listener on the fd wants
+		for ( ListenerNode *node = getListeners( fd ); node != NULL; 
+			  node = node->mNext )
 		{
-			if ( fds[ j ].fd == (*listener)->mFd )
-			{
-				fds[ j ].events &= (*listener)->mEvents;
-				break;
-			}
+			events |= node->mEvents;
+			wanted = true;
 		}
 		
-		if ( j == i )
+		int polled = mPolledEvents[ fd ];
+		mPolledEvents[ fd ] = wanted ? ( events | kPolled ) : 0;
+		
+		if ( wanted and ( polled & kPolled ) == 0 )
+			numPolled++;
+		else if ( not wanted and ( polled & kPolled ) != 0 )
+			numPolled--;
+		
+#ifdef JH_SELECTOR_USE_EPOLL
+		struct epoll_event ev;
+		memset( &ev, 0, sizeof( ev ) );
+		ev.events = events;
+		ev.data.fd = fd;
+		errno = 0;
+		
+		if ( polled & kAlwaysReady )
 		{
-			fds[ i ].fd = (*listener)->mFd;
-			fds[ i ].events = (*listener)->mEvents;
-			i++;
-
-			if ( i == kMaxPollFds )
+			for ( unsigned j = 0; j < mReadyFds.size(); j++ )
 			{
-				numFds = kMaxPollFds;
-				return;
+				if ( mReadyFds[ j ].fd == fd )
+				{
+					mReadyFds.erase( j );
+					break;
+				}
 			}
 		}
+		
+		if ( not wanted )
+		{
+			// Fails if the fd has already been closed, which is fine.
+			if ( polled & kPolled )
+				epoll_ctl( mEpollFd, EPOLL_CTL_DEL, fd, &ev );
+		}
+		else if ( polled & kPolled )
+		{
+			// The fd may have been closed and reopened since we added it, 
+			//  which silently drops it from the epoll set.
+			if ( epoll_ctl( mEpollFd, EPOLL_CTL_MOD, fd, &ev ) != 0 and
+				 ( errno != ENOENT or
+				   epoll_ctl( mEpollFd, EPOLL_CTL_ADD, fd, &ev ) != 0 ) )
+				LOG_ERR_PERROR( "failed to modify fd %d", fd );
+		}
+		else
+		{
+			if ( epoll_ctl( mEpollFd, EPOLL_CTL_ADD, fd, &ev ) != 0 and
+				 ( errno != EEXIST or
+				   epoll_ctl( mEpollFd, EPOLL_CTL_MOD, fd, &ev ) != 0 ) and
+				 errno != EPERM )
+				LOG_ERR_PERROR( "failed to add fd %d", fd );
+		}
+		
+		// epoll won't take regular files, poll says they are always ready 
+		//  so we do too.
+		if ( wanted and errno == EPERM )
+		{
+			struct pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = events;
+			pfd.revents = events & ( POLLIN | POLLOUT );
+			mReadyFds.push_back( pfd );
+			mPolledEvents[ fd ] |= kAlwaysReady;
+		}
+#endif
 	}
 	
-	numFds = i;
-	
-	for ( i = 0; i < numFds; i++ )
+#ifndef JH_SELECTOR_USE_EPOLL
+	if ( mChangedFds.size() > 0 or mPollFds.size() == 0 )
 	{
-		LOG_NOISE( "file entry %d: fd %d events %x", i, fds[ i ].fd, fds[ i ].events );
+		mPollFds.clear();
+		mPollFds.resize( 1 );
+		mPollFds[ 0 ].fd = mPipe[ PIPE_READER ];
+		mPollFds[ 0 ].events = POLLIN;
+		
+		for ( unsigned fd = 0; fd < mPolledEvents.size(); fd++ )
+		{
+			if ( mPolledEvents[ fd ] & kPolled )
+			{
+				struct pollfd pfd;
+				pfd.fd = fd;
+				pfd.events = mPolledEvents[ fd ] & ~kPolled;
+				pfd.revents = 0;
+				mPollFds.push_back( pfd );
+			}
+		}
 	}
+#endif
+
+	LOG( "poll on %d fds, %d changed", numPolled, mChangedFds.size() );
+	mChangedFds.clear();
 	
-	LOG( "poll on %d fds, size %d", numFds, mList.size() );
+	// Selectors can share a name, and therefore a gauge, so only apply our
+	//  change to it.
+	mFdsGauge->add( numPolled - mPolledFds );
+	mPolledFds = numPolled;
 }
-
 						
-bool Selector::callListeners( int fd, uint32_t events )
+bool Selector::callListeners( int fd, uint32_t events, uint64_t wakeTime )
 {
 	AutoLock l( mLock );
 	TRACE_BEGIN( LOG_LVL_INFO );
-	ListenerNode n( fd, NULL );
 	bool result = false;
 	
-	JetHead::list<ListenerNode*>::iterator listener = mList.begin();
-	while (listener != mList.end())
+	ListenerNode *node = getListeners( fd );
+	while ( node != NULL )
 	{
-		if (*(*listener) == n)
-		{
-			LOG( "got event %x %p", events, *listener );
+		LOG( "got event %x %p", events, node );
+		
+		// We want to remove the listener from the list if 
+		//  revents includes POLLHUP or POLLNVAL.  But we also
+		//  need for the listener to know about these event(s).
+		// A "good" listener could take care of this by 
+		//  removing himself from the selector.  The lock has 
+		//  been made recursive so this is possible without dead
+		//  locking.  But a "bad" listener may ignore these 
+		//  event entirly.  
+		// So in the spirit of "doing the right thing".  We need
+		//  to deal with both cases.  However once we 
+		//  call the listener's callback, the listener itself
+		//  might be destroyed.  But if POLLHUP or POLLNVAL
+		//  was recieved and the listener has not been destroyed
+		//  we must do it.
 		
-			// We want to remove the listener from the list if 
-			//  revents includes POLLHUP or POLLNVAL.  But we also
-			//  need for the listener to know about these event(s).
-			// A "good" listener could take care of this by 
-			//  removing himself from the selector.  The lock has 
-			//  been made recursive so this is possible without dead
-			//  locking.  But a "bad" listener may ignore these 
-			//  event entirly.  
-			// So in the spirit of "doing the right thing".  We need
-			//  to deal with both cases.  However once we 
-			//  call the listener's callback, the listener itself
-			//  might be destroyed.  But if POLLHUP or POLLNVAL
-			//  was recieved and the listener has not been destroyed
-			//  we must do it.
+		// listener might be destroyed if POLLHUP or POLLNVAL
+		//  events are recieved.  So we will get any data we 
+		//  need from it now. 
+		SelectorListener *interface = node->mListener;
+		jh_ptr_int_t pd = node->mPrivateData;
+		ListenerNode *next = node->mNext;
+		
+		if ( events & ( POLLHUP | POLLNVAL ) )
+		{	
+			if ( events & POLLHUP )
+				LOG_INFO( "POLLHUP recieved on fd = %d (%p)", fd, node );
+			
+			if ( events & POLLNVAL )
+				LOG_WARN( "POLLNVAL recieved on fd = %d (%p)", fd, node );
+
+			ListenerNode **prev = &mFds[ fd ];
+			while ( *prev != node )
+				prev = &(*prev)->mNext;
+			*prev = next;
+			delete node;
 			
-			// listener might be destroyed if POLLHUP or POLLNVAL
-			//  events are recieved.  So we will get any data we 
-			//  need from it now. 
-			SelectorListener *interface = (*listener)->mListener;
-			jh_ptr_int_t pd = (*listener)->mPrivateData;
+			mGeneration++;
+			fdChanged( fd );
+			result = true;
+		}
 		
-			if ( events & ( POLLHUP | POLLNVAL ) )
-			{	
-				if ( events & POLLHUP )
-					LOG_INFO( "POLLHUP recieved on fd = %d (%p)", fd, *listener );
-				
-				if ( events & POLLNVAL )
-					LOG_WARN( "POLLNVAL recieved on fd = %d (%p)", fd, *listener );
-								
-				delete *listener;
-				listener = listener.erase();
-
-				result = true;
-			}
-			else
+		if ( interface != NULL )
+		{
+			LOG_NOISE( "eventsCallback %p %d %d", interface, events, fd );
+			uint32_t generation = mGeneration;
+			uint64_t start = TimeUtils::getMonotonicMicros();
 			{
-				// Gets incremented by the "erase" in the other branch
-				++listener;
+				TraceSpan span( "SelectorListener::processFileEvents", fd );
+				interface->processFileEvents( fd, events, pd );
 			}
 			
-			if ( interface != NULL )
+			StallReport report;
+			report.mEventId = Event::kInvalidEventId;
+			report.mTarget = interface;
+			report.mMethod = NULL;
+			report.mFd = fd;
+			report.mQueueWait = start - wakeTime;
+			report.mRunTime = TimeUtils::getMonotonicMicros() - start;
+			mCallbackTime->observe( report.mRunTime );
+			checkStall( report );
+			LOG_NOISE( "eventsCallback done" );
+			
+			// The callback removed listeners, make sure next wasn't one of 
+			//  them before we touch it.
+			if ( generation != mGeneration )
 			{
-				LOG_NOISE( "eventsCallback %p %d %d", interface, events, fd );
-				interface->processFileEvents( fd, events, pd );
-				LOG_NOISE( "eventsCallback done" );
+				ListenerNode *n = getListeners( fd );
+				while ( n != NULL and n != next )
+					n = n->mNext;
+				next = n;
 			}
-		} else {
-			++listener;
 		}
+		
+		node = next;
 	}
 	
 	return result;
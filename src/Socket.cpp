@@ -35,9 +35,18 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <sys/uio.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #include "Socket.h"
+#include "Resolver.h"
 #include "File.h"
+#include "Metrics.h"
+#include "EventAgent.h"
+#include "TimeUtils.h"
 #include "jh_memory.h"
 #include "logging.h"
 
@@ -50,16 +59,141 @@ using namespace JetHead;
 #define MSG_NOSIGNAL	0
 #endif
 
+/**
+ * The writeAsync queue.  Data is kept in a list of chunks, small writes are
+ *  copied onto the end of the last chunk so a burst of them goes out in a 
+ *  few iovecs, big writes get a chunk of their own.
+ */
+struct Socket::WriteQueue
+{
+	struct Chunk
+	{
+		uint8_t	*mData;
+		int		mSize;
+		int		mStart;
+		int		mEnd;
+	};
+	
+	//! Size of the chunks that small writes are coalesced into
+	static const int kChunkSize = 16 * 1024;
+	
+	//! Most chunks we will try to send at once
+	static const int kMaxIovecs = 64;
+	
+	WriteQueue() : mLength( 0 ) {}
+	~WriteQueue() { clear(); }
+	
+	void append( const uint8_t *data, int len )
+	{
+		mLength += len;
+		
+		if ( not mChunks.empty() )
+		{
+			Chunk &last = mChunks.back();
+			int n = last.mSize - last.mEnd;
+			if ( n > len )
+				n = len;
+			memcpy( last.mData + last.mEnd, data, n );
+			last.mEnd += n;
+			data += n;
+			len -= n;
+		}
+		
+		if ( len > 0 )
+		{
+			Chunk c;
+			c.mSize = len > kChunkSize ? len : kChunkSize;
+			c.mData = jh_new uint8_t[ c.mSize ];
+			c.mStart = 0;
+			c.mEnd = len;
+			memcpy( c.mData, data, len );
+			mChunks.push_back( c );
+		}
+	}
+	
+	//! Drop len bytes that have been sent
+	void consume( int len )
+	{
+		mLength -= len;
+		
+		while ( len > 0 )
+		{
+			Chunk &c = mChunks.front();
+			int n = c.mEnd - c.mStart;
+			if ( n > len )
+				n = len;
+			c.mStart += n;
+			len -= n;
+			
+			if ( c.mStart == c.mEnd )
+			{
+				delete [] c.mData;
+				mChunks.pop_front();
+			}
+		}
+	}
+	
+	//! Point iov at up to max chunks, returns the number filled in
+	int fillIovecs( struct iovec *iov, int max )
+	{
+		int n = 0;
+		for ( JetHead::list<Chunk>::iterator i = mChunks.begin(); 
+			  i != mChunks.end() and n < max; ++i, ++n )
+		{
+			iov[ n ].iov_base = (*i).mData + (*i).mStart;
+			iov[ n ].iov_len = (*i).mEnd - (*i).mStart;
+		}
+		return n;
+	}
+	
+	void clear()
+	{
+		while ( not mChunks.empty() )
+		{
+			delete [] mChunks.front().mData;
+			mChunks.pop_front();
+		}
+		mLength = 0;
+	}
+	
+	JetHead::list<Chunk>	mChunks;
+	
+	//! Total bytes queued, the list doesn't know its size cheaply
+	int						mLength;
+};
+
+// Process wide byte counters, created on first use.
+static Counter *getBytesReadCounter()
+{
+	static SmartPtr<Counter> counter = 
+		MetricsRegistry::getInstance()->getCounter( "jh_socket_bytes_read_total" );
+	return counter;
+}
+
+static Counter *getBytesWrittenCounter()
+{
+	static SmartPtr<Counter> counter = 
+		MetricsRegistry::getInstance()->getCounter( "jh_socket_bytes_written_total" );
+	return counter;
+}
+
 Socket::Socket( bool sock_stream )
 	:	mConnectedAsync( false ),
 		mListener( NULL ),
 		mFd( -1 ),
 		mSelector( NULL ),
 		mConnected( false ), mPrivateData( 0 ), mSockStream( sock_stream ),
-		mParent(this), mReadTimeout( 0 )
+		mFamily( AF_INET ),
+		mNonBlocking( false ), mParent(this), mReadTimeout( 0 ), mWriteTimeout( 0 ),
+		mBytesRead( 0 ), mBytesWritten( 0 ), mWriteQueue( NULL ),
+		mLowWatermark( kDefaultLowWatermark ), 
+		mHighWatermark( kDefaultHighWatermark ), mWriteBlocked( false ),
+		mReceiveBatch( NULL )
 {
 	TRACE_BEGIN( LOG_LVL_INFO );
 	
+	mSplicePipe[ 0 ] = mSplicePipe[ 1 ] = -1;
+	
 	if ( sock_stream )
 		mFd = socket( AF_INET, SOCK_STREAM, 0 );
 	else
@@ -82,9 +216,22 @@ Socket::Socket( int fd ) :
 	mFd( fd ),  
 	mSelector( NULL ), 
 	mConnected( false ), mPrivateData( 0 ), mSockStream( true ),
-	mParent(this), mReadTimeout( 0 )
+	mFamily( AF_INET ),
+	mNonBlocking( false ), mParent(this), mReadTimeout( 0 ), mWriteTimeout( 0 ),
+	mBytesRead( 0 ), mBytesWritten( 0 ), mWriteQueue( NULL ),
+	mLowWatermark( kDefaultLowWatermark ), 
+	mHighWatermark( kDefaultHighWatermark ), mWriteBlocked( false ),
+	mReceiveBatch( NULL )
 {
 	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	mSplicePipe[ 0 ] = mSplicePipe[ 1 ] = -1;
+	
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof( addr );
+	
+	if ( getsockname( mFd, (struct sockaddr*)&addr, &len ) == 0 )
+		mFamily = addr.ss_family;
 }
 
 Socket::~Socket()
@@ -92,6 +239,7 @@ Socket::~Socket()
 	TRACE_BEGIN( LOG_LVL_INFO );
 	shutdown();
 	close();
+	delete mReceiveBatch;
 }
 	
 int Socket::connect( const Socket::Address &addr )
@@ -99,6 +247,10 @@ int Socket::connect( const Socket::Address &addr )
 	TRACE_BEGIN( LOG_LVL_INFO );
 	int len;
 	const struct sockaddr *saddr = addr.getAddr( len );
+	
+	if ( setFamily( addr.getFamily() ) != 0 )
+		return -1;
+	
 	int res = ::connect( mFd, saddr, len );
 
 	LOG( "connect to %s on port %d", addr.getName(), addr.getPort() );
@@ -110,6 +262,21 @@ int Socket::connect( const Socket::Address &addr )
 }
 
 int Socket::connect( const Socket::Address &addr, int timeout )
+{
+	// A timeout of 0 has always meant not waiting at all, where connectMs
+	//  waits as long as it takes
+	if ( timeout <= 0 )
+		return connectBy( addr, TimeUtils::getMonotonicMicros() );
+	
+	return connectBy( addr, getDeadline( timeout * 1000 ) );
+}
+
+int Socket::connectMs( const Socket::Address &addr, int msecs )
+{
+	return connectBy( addr, getDeadline( msecs ) );
+}
+
+int Socket::connectBy( const Socket::Address &addr, uint64_t deadline )
 {
 	TRACE_BEGIN( LOG_LVL_INFO );
 	socklen_t len = 0;
@@ -117,11 +284,9 @@ int Socket::connect( const Socket::Address &addr, int timeout )
 	int res = 0;
 	int saveflags, ret, back_err;
 	const struct sockaddr *saddr = addr.getAddr( len_addr );
-	fd_set fd_w;
-	struct timeval t;
 
-	t.tv_sec = timeout;
-	t.tv_usec = 0;
+	if ( setFamily( addr.getFamily() ) != 0 )
+		return -1;
 
 	saveflags=fcntl(mFd,F_GETFL,0);
 
@@ -146,41 +311,35 @@ int Socket::connect( const Socket::Address &addr, int timeout )
 	/* return unless the connection was successful or the connect is
 	still in progress. */
 	if(res<0 && back_err!=EINPROGRESS) {
+		errno = back_err;
 		return -1;
 	}
 
-	FD_ZERO(&fd_w);
-	FD_SET(mFd,&fd_w);
-
-	res=select(FD_SETSIZE,NULL,&fd_w,NULL,&t);
-
-	if(res < 0) {
-		return -1;
-	}
-
-	/* 0 means it timeout out & no fds changed */
-	if( res == 0 ) {
-		return -1;
-	}
-
-	/* Get the return code from the connect */
-	len=sizeof(ret);
-	res=getsockopt(mFd,SOL_SOCKET,SO_ERROR,&ret,&len);
-	if(res<0) {
-		return -1;
-	}
+	if ( res < 0 )
+	{
+		/* 0 means it timed out, errno is already ETIMEDOUT */
+		if ( waitForEvents( POLLOUT, deadline ) <= 0 )
+			return -1;
+
+		/* Get the return code from the connect */
+		len=sizeof(ret);
+		res=getsockopt(mFd,SOL_SOCKET,SO_ERROR,&ret,&len);
+		if(res<0) {
+			return -1;
+		}
 
-	/* ret=0 means success, otherwise it contains the errno */
-	if(ret) {
-		return -1;
+		/* ret=0 means success, otherwise it contains the errno */
+		if(ret) {
+			errno = ret;
+			return -1;
+		}
 	}
 
 	LOG_NOTICE( "connect to %s on port %d", addr.getName(), addr.getPort() );
 
-	if ( res == 0 )
-		setConnected( true );
+	setConnected( true );
 
-	return res;
+	return 0;
 }
 
 int Socket::connectAsync( const Socket::Address &addr )
@@ -191,6 +350,9 @@ int Socket::connectAsync( const Socket::Address &addr )
 	int saveflags, back_err;
 	const struct sockaddr *saddr = addr.getAddr( len_addr );
 
+	if ( setFamily( addr.getFamily() ) != 0 )
+		return -1;
+
 	saveflags=fcntl(mFd,F_GETFL,0);
 
 	if( saveflags < 0 ) {
@@ -230,6 +392,267 @@ int Socket::connectAsync( const Socket::Address &addr )
 }
 
 
+void Socket::copySocketOptions( int from, int to )
+{
+	static const struct { int level; int name; } kOptions[] = {
+		{ SOL_SOCKET, SO_REUSEADDR },
+#ifdef SO_REUSEPORT
+		{ SOL_SOCKET, SO_REUSEPORT },
+#endif
+		{ SOL_SOCKET, SO_KEEPALIVE },
+		{ SOL_SOCKET, SO_BROADCAST },
+		{ SOL_SOCKET, SO_TIMESTAMP },
+		{ IPPROTO_TCP, TCP_NODELAY },
+	};
+	
+	for ( unsigned i = 0; i < sizeof( kOptions ) / sizeof( kOptions[ 0 ] ); i++ )
+	{
+		int val = 0;
+		socklen_t len = sizeof( val );
+		
+		if ( getsockopt( from, kOptions[ i ].level, kOptions[ i ].name, 
+						 &val, &len ) == 0 and val != 0 )
+			setsockopt( to, kOptions[ i ].level, kOptions[ i ].name, &val, len );
+	}
+	
+	struct linger l;
+	socklen_t len = sizeof( l );
+	if ( getsockopt( from, SOL_SOCKET, SO_LINGER, &l, &len ) == 0 and l.l_onoff )
+		setsockopt( to, SOL_SOCKET, SO_LINGER, &l, len );
+}
+
+void Socket::adoptFd( int fd, int family )
+{
+	copySocketOptions( mFd, fd );
+	
+	int flags = fcntl( mFd, F_GETFL, 0 );
+	if ( flags >= 0 )
+		fcntl( fd, F_SETFL, flags );
+	
+	// dup2 keeps our fd number, so anything that has been told it (like a
+	//  selector) is still right.
+	dup2( fd, mFd );
+	::close( fd );
+	mFamily = family;
+}
+
+int Socket::setFamily( int family )
+{
+	if ( family == mFamily )
+		return 0;
+	
+	// Too late to swap the socket out from under anyone.  A selector only
+	//  watches us once we are connected.
+	if ( mConnected )
+	{
+		errno = EAFNOSUPPORT;
+		return -1;
+	}
+	
+	int fd = socket( family, mSockStream ? SOCK_STREAM : SOCK_DGRAM, 0 );
+	
+	if ( fd < 0 )
+		return -1;
+	
+	adoptFd( fd, family );
+	
+	return 0;
+}
+
+int Socket::connect( const char *host, int port, int msecs )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	JetHead::vector<Socket::Address> found;
+	
+	int err = Resolver::getInstance()->resolve( host, found );
+	
+	if ( err != 0 )
+	{
+		LOG_INFO( "Failed to resolve %s: %s", host, gai_strerror( err ) );
+		errno = EHOSTUNREACH;
+		return -1;
+	}
+	
+	// Alternate families so a dead one only costs one attempt delay
+	JetHead::vector<Socket::Address> addrs;
+	int first = found[ 0 ].getFamily();
+	unsigned same = 0, other = 0;
+	
+	while ( addrs.size() < found.size() )
+	{
+		while ( same < found.size() and found[ same ].getFamily() != first )
+			same++;
+		if ( same < found.size() )
+			addrs.push_back( found[ same++ ] );
+		
+		while ( other < found.size() and found[ other ].getFamily() == first )
+			other++;
+		if ( other < found.size() )
+			addrs.push_back( found[ other++ ] );
+	}
+	
+	for ( unsigned i = 0; i < addrs.size(); i++ )
+		addrs[ i ].setPort( port );
+	
+	return connectMs( addrs, msecs );
+}
+
+int Socket::connectMs( const JetHead::vector<Socket::Address> &addrs, int msecs )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	if ( addrs.size() == 0 )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	
+	// Only TCP has anything to race
+	if ( addrs.size() == 1 or not mSockStream )
+		return connectMs( addrs[ 0 ], msecs );
+	
+	if ( mConnected or mSelector != NULL )
+	{
+		errno = EISCONN;
+		return -1;
+	}
+	
+	JetHead::vector<struct pollfd> attempts;
+	JetHead::vector<int> families;
+	uint64_t deadline = getDeadline( msecs );
+	uint64_t nextStart = 0;
+	unsigned next = 0;
+	int winner = -1;
+	int winnerFamily = AF_INET;
+	int lastError = ECONNREFUSED;
+	bool timedOut = false;
+	
+	while ( winner < 0 )
+	{
+		uint64_t now = TimeUtils::getMonotonicMicros();
+		
+		// Start the next attempt if it is time or nothing else is going
+		if ( next < addrs.size() and ( now >= nextStart or attempts.empty() ) )
+		{
+			const Socket::Address &addr = addrs[ next++ ];
+			int len;
+			const struct sockaddr *saddr = addr.getAddr( len );
+			int fd = socket( addr.getFamily(), SOCK_STREAM, 0 );
+			
+			nextStart = now + kConnectAttemptDelay * 1000;
+			
+			if ( fd < 0 )
+			{
+				lastError = errno;
+				continue;
+			}
+			
+			fcntl( fd, F_SETFL, fcntl( fd, F_GETFL, 0 ) | O_NONBLOCK );
+			
+			LOG_INFO( "Trying %s port %d", addr.getName(), addr.getPort() );
+			
+			if ( ::connect( fd, saddr, len ) == 0 )
+			{
+				winner = fd;
+				winnerFamily = addr.getFamily();
+				break;
+			}
+			
+			if ( errno != EINPROGRESS )
+			{
+				lastError = errno;
+				::close( fd );
+				continue;
+			}
+			
+			struct pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = POLLOUT;
+			pfd.revents = 0;
+			attempts.push_back( pfd );
+			families.push_back( addr.getFamily() );
+		}
+		
+		if ( attempts.empty() )
+		{
+			// Nothing in progress and nothing left to try
+			errno = lastError;
+			return -1;
+		}
+		
+		if ( deadline != 0 and now >= deadline )
+		{
+			timedOut = true;
+			break;
+		}
+		
+		// Wake up for the deadline or to start the next attempt
+		int timeout = -1;
+		uint64_t wake = next < addrs.size() ? nextStart : 0;
+		if ( deadline != 0 and ( wake == 0 or deadline < wake ) )
+			wake = deadline;
+		if ( wake != 0 )
+			timeout = wake > now ? (int)( ( wake - now + 999 ) / 1000 ) : 0;
+		
+		int res = poll( &attempts[ 0 ], attempts.size(), timeout );
+		
+		if ( res < 0 and errno != EINTR )
+		{
+			lastError = errno;
+			break;
+		}
+		
+		for ( unsigned i = 0; res > 0 and i < attempts.size() and winner < 0; )
+		{
+			if ( attempts[ i ].revents == 0 )
+			{
+				i++;
+				continue;
+			}
+			
+			int err = 0;
+			socklen_t len = sizeof( err );
+			getsockopt( attempts[ i ].fd, SOL_SOCKET, SO_ERROR, &err, &len );
+			
+			if ( err == 0 )
+			{
+				winner = attempts[ i ].fd;
+				winnerFamily = families[ i ];
+				attempts.erase( i );
+				families.erase( i );
+				break;
+			}
+			
+			// This one failed, so don't keep the next waiting
+			lastError = err;
+			::close( attempts[ i ].fd );
+			attempts.erase( i );
+			families.erase( i );
+			nextStart = 0;
+		}
+	}
+	
+	for ( unsigned i = 0; i < attempts.size(); i++ )
+		::close( attempts[ i ].fd );
+	
+	if ( winner < 0 )
+	{
+		errno = timedOut ? ETIMEDOUT : lastError;
+		return -1;
+	}
+	
+	// adoptFd puts our own flags back, which turns non-blocking off again 
+	//  unless we were already non-blocking
+	adoptFd( winner, winnerFamily );
+	setConnected( true );
+	
+	Socket::Address addr;
+	getRemoteAddress( addr );
+	LOG_NOTICE( "connect to %s on port %d", addr.getName(), addr.getPort() );
+	
+	return 0;
+}
+
 int Socket::shutdown()
 {
 	if ( mFd != -1 )
@@ -249,96 +672,661 @@ void Socket::setSelector( SocketListener *listener, Selector *selector )
 		mSelector = selector;
 		if ( mSelector != NULL and mListener != NULL )
 		{
-			mSelector->addListener( mFd, POLLIN, this );
+			mSelector->addListener( mFd, 
+				getPendingWrite() > 0 ? POLLIN | POLLOUT : POLLIN, this );
 		}
 	}
 	else
 		mSelector = selector;		
 }
 
+uint64_t Socket::getDeadline( int msecs )
+{
+	if ( msecs <= 0 )
+		return 0;
+	
+	return TimeUtils::getMonotonicMicros() + (uint64_t)msecs * 1000;
+}
+
+int Socket::waitForEvents( short events, uint64_t deadline )
+{
+	struct pollfd pfd;
+	
+	pfd.fd = mFd;
+	pfd.events = events;
+	
+	while ( true )
+	{
+		int timeout = -1;
+		
+		if ( deadline != 0 )
+		{
+			uint64_t now = TimeUtils::getMonotonicMicros();
+			
+			if ( now >= deadline )
+			{
+				errno = ETIMEDOUT;
+				return 0;
+			}
+			
+			// Round up so we never wake up a hair early and spin
+			timeout = (int)( ( deadline - now + 999 ) / 1000 );
+		}
+		
+		pfd.revents = 0;
+		int res = poll( &pfd, 1, timeout );
+		
+		if ( res > 0 )
+			return 1;
+		
+		// On EINTR or an early wake up go around and work out how much
+		//  time is left rather than starting the whole wait again.
+		if ( res < 0 && errno != EINTR )
+			return -1;
+	}
+}
+
 int Socket::read( void *buffer, int len )
 {
 	TRACE_BEGIN(LOG_LVL_NOISE);
 	
-	if (mReadTimeout)
+	if ( mReadTimeout < 0 ) 
+	{
+		return -1; // invalid timeout
+	}
+	
+	if (not mSockStream)
 	{
-		int retCode = 0;
-		fd_set readSet;
-		struct timeval timeout;
-		int numBytes = 0;
+		return recvfrom(buffer, len, mLastDatagramSender);
+	}
+	
+	if ( mReadTimeout != 0 and 
+		 waitForEvents( POLLIN, getDeadline( mReadTimeout ) ) <= 0 )
+	{
+		return -1;
+	}
+	
+	return countRead( ::read(mFd, buffer, len) );
+} 
 
-		if( mReadTimeout < 0 ) 
+int Socket::write( const void *buffer, int len )
+{
+	if ( mWriteTimeout <= 0 )
+	{
+		// Passing in the MSG_NOSIGNAL flag to tell the OS not to send us
+		// SIGPIPE when the socket is closed during this call.  At some
+		// point we might make this a member variable that can be tweaked
+		// by the user, but that's interface clutter that we don't need
+		// yet.
+		return countWritten( ::send(mFd, buffer, len, MSG_NOSIGNAL) );
+	}
+	
+	// With a timeout never block in send, wait for room with poll and then 
+	//  send what fits until it is all gone or we run out of time.
+	const uint8_t *data = (const uint8_t*)buffer;
+	uint64_t deadline = getDeadline( mWriteTimeout );
+	int sent = 0;
+	
+	while ( sent < len )
+	{
+		int res = ::send( mFd, data + sent, len - sent, 
+						  MSG_NOSIGNAL | MSG_DONTWAIT );
+		
+		if ( res > 0 )
 		{
-			return -1; // invalid timeout
+			sent += countWritten( res );
+			continue;
 		}
+		
+		if ( res < 0 and errno == EINTR )
+			continue;
+		
+		if ( res < 0 and errno != EAGAIN and errno != EWOULDBLOCK )
+			return sent > 0 ? sent : -1;
+		
+		if ( waitForEvents( POLLOUT, deadline ) <= 0 )
+			return sent > 0 ? sent : -1;
+	}
+	
+	return sent;
+}
 
-		FD_ZERO( &readSet );
-		FD_SET( ( unsigned )mFd, &readSet );
+int Socket::setNonBlocking( bool nonBlocking )
+{
+	int flags = fcntl( mFd, F_GETFL, 0 );
+	
+	if ( flags == -1 )
+		return -1;
+	
+	if ( nonBlocking )
+		flags |= O_NONBLOCK;
+	else
+		flags &= ~O_NONBLOCK;
+	
+	if ( fcntl( mFd, F_SETFL, flags ) == -1 )
+	{
+		LOG_WARN_PERROR( "Failed to set non-blocking on fd %d", mFd );
+		return -1;
+	}
+	
+	mNonBlocking = nonBlocking;
+	return 0;
+}
+
+int Socket::writev( const struct iovec *iov, int count )
+{
+	if ( mWriteTimeout <= 0 )
+		return sendmsg( iov, count, NULL, MSG_NOSIGNAL );
+	
+	if ( count > kMaxWritevBuffers )
+		return IReaderWriter::writev( iov, count );
+	
+	// As write, but a copy of the buffers is stepped through as they go
+	struct iovec left[ kMaxWritevBuffers ];
+	struct iovec *next = left;
+	uint64_t deadline = getDeadline( mWriteTimeout );
+	int sent = 0;
+	
+	memcpy( left, iov, count * sizeof( struct iovec ) );
+	
+	while ( count > 0 )
+	{
+		if ( next->iov_len == 0 )
+		{
+			next++;
+			count--;
+			continue;
+		}
+		
+		int res = sendmsg( next, count, NULL, MSG_NOSIGNAL | MSG_DONTWAIT );
+		
+		if ( res > 0 )
+		{
+			sent += res;
+			
+			while ( count > 0 and res >= (int)next->iov_len )
+			{
+				res -= next->iov_len;
+				next++;
+				count--;
+			}
+			
+			if ( res > 0 )
+			{
+				next->iov_base = (uint8_t*)next->iov_base + res;
+				next->iov_len -= res;
+			}
+			continue;
+		}
+		
+		if ( res < 0 and errno == EINTR )
+			continue;
+		
+		if ( res < 0 and errno != EAGAIN and errno != EWOULDBLOCK )
+			return sent > 0 ? sent : -1;
+		
+		if ( waitForEvents( POLLOUT, deadline ) <= 0 )
+			return sent > 0 ? sent : -1;
+	}
+	
+	return sent;
+}
 
-		timeout.tv_sec = mReadTimeout;
-		timeout.tv_usec = 0;
+int Socket::writeAsync( const void *buffer, int len )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	if ( not mSockStream or not mConnected or mSelector == NULL or 
+		 mListener == NULL )
+	{
+		LOG_WARN( "writeAsync needs a connected TCP socket with a selector and listener" );
+		return -1;
+	}
+	
+	// The queue belongs to the selector's thread
+	if ( not mSelector->isThreadCurrent() )
+	{
+		SyncRetEventAgent2<Socket, int, const void*, int> *agent = 
+			jh_new SyncRetEventAgent2<Socket, int, const void*, int>( 
+				this, &Socket::writeAsync, buffer, len );
+		return agent->send( mSelector );
+	}
+	
+	int res = writeQueued( buffer, len );
+	
+	if ( res > 0 and getPendingWrite() > 0 )
+		updateWriteEvents();
+	
+	return res;
+}
 
-		while( true ) {
-			if( mReadTimeout == 0 ) 
+int Socket::writeQueued( const void *buffer, int len, int limit )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	if ( len <= 0 )
+		return 0;
+	
+	const uint8_t *data = (const uint8_t*)buffer;
+	int sent = 0;
+	
+	// Nothing ahead of us, so try to skip the queue.  Can't send until an
+	//  async connect has finished though.
+	if ( getPendingWrite() == 0 and not mConnectedAsync )
+	{
+		sent = countWritten( ::send( mFd, data, len, 
+									 MSG_NOSIGNAL | MSG_DONTWAIT ) );
+		
+		if ( sent < 0 )
+		{
+			if ( errno != EAGAIN and errno != EWOULDBLOCK and errno != EINTR )
+				return -1;
+			sent = 0;
+		}
+		
+		if ( sent == len )
+			return len;
+	}
+	
+	int queued = len - sent;
+	
+	if ( limit > 0 and getPendingWrite() + queued > limit )
+	{
+		queued = limit - getPendingWrite();
+		if ( queued < 0 )
+			queued = 0;
+		mWriteBlocked = true;
+	}
+	
+	if ( queued > 0 )
+	{
+		if ( mWriteQueue == NULL )
+			mWriteQueue = jh_new WriteQueue();
+		
+		mWriteQueue->append( data + sent, queued );
+	}
+	
+	if ( getPendingWrite() >= mHighWatermark )
+		mWriteBlocked = true;
+	
+	return sent + queued;
+}
+
+int Socket::getPendingWrite() const
+{
+	return mWriteQueue != NULL ? mWriteQueue->mLength : 0;
+}
+
+void Socket::setWriteWatermarks( int low, int high )
+{
+	mLowWatermark = low;
+	mHighWatermark = high < low ? low : high;
+}
+
+bool Socket::checkWriteDrained()
+{
+	if ( not mWriteBlocked or getPendingWrite() > mLowWatermark )
+		return false;
+	
+	mWriteBlocked = false;
+	return true;
+}
+
+int Socket::flushWriteQueue()
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	struct iovec iov[ WriteQueue::kMaxIovecs ];
+	
+	while ( getPendingWrite() > 0 )
+	{
+		struct msghdr msg;
+		memset( &msg, 0, sizeof( msg ) );
+		msg.msg_iov = iov;
+		msg.msg_iovlen = mWriteQueue->fillIovecs( iov, WriteQueue::kMaxIovecs );
+		
+		// sendmsg rather than writev so we can ask for no SIGPIPE and no 
+		//  blocking even if the socket is in blocking mode.
+		int res = countWritten( ::sendmsg( mFd, &msg, 
+										   MSG_NOSIGNAL | MSG_DONTWAIT ) );
+		
+		if ( res < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			
+			if ( errno == EAGAIN or errno == EWOULDBLOCK )
+				break;
+			
+			return -1;
+		}
+		
+		mWriteQueue->consume( res );
+	}
+	
+	return 0;
+}
+
+void Socket::updateWriteEvents()
+{
+	// An async connect is still waiting for its POLLOUT
+	if ( mSelector == NULL or mListener == NULL or not mConnected or 
+		 mConnectedAsync )
+		return;
+	
+	short events = POLLIN;
+	
+	if ( getPendingWrite() > 0 )
+		events |= POLLOUT;
+	
+	mSelector->setListenerEvents( mFd, this, events );
+}
+
+int Socket::countRead( int res )
+{
+	if ( res > 0 )
+	{
+		mBytesRead += res;
+		getBytesReadCounter()->increment( res );
+	}
+	return res;
+}
+
+int Socket::countWritten( int res )
+{
+	if ( res > 0 )
+	{
+		mBytesWritten += res;
+		getBytesWrittenCounter()->increment( res );
+	}
+	return res;
+}
+
+//! Most we move through a pipe or buffer at once in sendFile and spliceTo
+static const int kFileChunkSize = 64 * 1024;
+
+int Socket::waitIfBlocking( short events, uint64_t deadline )
+{
+	// A non-blocking caller wants whatever we managed straight away
+	if ( mNonBlocking )
+		return 0;
+	
+	return waitForEvents( events, deadline );
+}
+
+int64_t Socket::sendFile( File &file, jh_off64_t offset, int64_t len )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	uint64_t deadline = getDeadline( mWriteTimeout );
+	int64_t sent = 0;
+	int flags = fcntl( mFd, F_GETFL, 0 );
+	bool failed = false;
+	bool fallback = false;
+	
+	// Never block inside sendfile, we wait with poll so that the write 
+	//  timeout works
+	fcntl( mFd, F_SETFL, flags | O_NONBLOCK );
+	
+	while ( sent < len )
+	{
+#ifdef __linux__
+		off64_t off = offset + sent;
+		size_t count = len - sent > 0x7ffff000 ? 0x7ffff000 : len - sent;
+		ssize_t res = sendfile64( mFd, file.mFd, &off, count );
+#else
+		ssize_t res = -1;
+		errno = ENOSYS;
+#endif
+		
+		if ( res > 0 )
+		{
+			sent += countWritten( res );
+			continue;
+		}
+		
+		// Ran off the end of the file
+		if ( res == 0 )
+			break;
+		
+		if ( errno == EINTR )
+			continue;
+		
+		if ( errno == EAGAIN or errno == EWOULDBLOCK )
+		{
+			if ( waitIfBlocking( POLLOUT, deadline ) <= 0 )
+				break;
+			continue;
+		}
+		
+		// Not every kind of file can be sent this way
+		if ( errno == EINVAL or errno == ENOSYS or errno == EOVERFLOW )
+			fallback = true;
+		else
+			failed = true;
+		break;
+	}
+	
+	if ( fallback )
+	{
+		int64_t res = copyToSocket( file.mFd, offset + sent, len - sent, 
+									deadline );
+		if ( res > 0 )
+			sent += res;
+		else if ( res < 0 )
+			failed = true;
+	}
+	
+	fcntl( mFd, F_SETFL, flags );
+	
+	return sent > 0 or not failed ? sent : -1;
+}
+
+int64_t Socket::copyToSocket( int fd, jh_off64_t offset, int64_t len, 
+							  uint64_t deadline )
+{
+	uint8_t *buf = jh_new uint8_t[ kFileChunkSize ];
+	int64_t sent = 0;
+	bool failed = false;
+	
+	while ( sent < len and not failed )
+	{
+		int n = len - sent > kFileChunkSize ? kFileChunkSize : len - sent;
+		n = pread( fd, buf, n, offset + sent );
+		
+		if ( n < 0 and errno == EINTR )
+			continue;
+		
+		if ( n <= 0 )
+		{
+			failed = n < 0;
+			break;
+		}
+		
+		for ( int done = 0; done < n; )
+		{
+			int res = ::send( mFd, buf + done, n - done, MSG_NOSIGNAL );
+			
+			if ( res > 0 )
 			{
-				retCode = select( FD_SETSIZE, &readSet, NULL, NULL, NULL );
-			} 
-			else 
+				done += countWritten( res );
+				sent += res;
+			}
+			else if ( res < 0 and errno == EINTR )
+				continue;
+			else if ( res < 0 and ( errno == EAGAIN or errno == EWOULDBLOCK ) 
+					  and waitIfBlocking( POLLOUT, deadline ) > 0 )
+				continue;
+			else
 			{
-				retCode = select( FD_SETSIZE, &readSet, NULL, NULL, &timeout );
+				// Anything read but not sent is simply not counted
+				failed = true;
+				break;
 			}
+		}
+	}
+	
+	delete [] buf;
+	
+	return sent > 0 or not failed ? sent : -1;
+}
 
-			if( retCode == 0 ) 
+int64_t Socket::spliceTo( File &file, int64_t len )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	uint64_t deadline = getDeadline( mReadTimeout );
+	int64_t received = 0;
+	int flags = fcntl( mFd, F_GETFL, 0 );
+	bool failed = false;
+	bool fallback = false;
+	
+	fcntl( mFd, F_SETFL, flags | O_NONBLOCK );
+	
+#ifdef __linux__
+	if ( mSplicePipe[ 0 ] == -1 and ::pipe( mSplicePipe ) != 0 )
+		fallback = true;
+	
+	while ( received < len and not fallback )
+	{
+		int n = len - received > kFileChunkSize ? kFileChunkSize : len - received;
+		ssize_t res = splice( mFd, NULL, mSplicePipe[ 1 ], NULL, n, 
+							  SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+		
+		// End of stream
+		if ( res == 0 )
+			break;
+		
+		if ( res < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			
+			if ( errno == EAGAIN or errno == EWOULDBLOCK )
 			{
-				return -1; // timed out
+				if ( waitIfBlocking( POLLIN, deadline ) <= 0 )
+					break;
+				continue;
 			}
-			if( retCode == -1 ) 
+			
+			// Some files (and some kernels) can't take a splice
+			if ( received == 0 and ( errno == EINVAL or errno == ENOSYS ) )
+				fallback = true;
+			else
+				failed = true;
+			break;
+		}
+		
+		// Everything that went into the pipe has to come out of it before
+		//  we go round again
+		while ( res > 0 )
+		{
+			ssize_t out = splice( mSplicePipe[ 0 ], NULL, file.mFd, NULL, res, 
+								  SPLICE_F_MOVE );
+			
+			if ( out < 0 and errno == EINTR )
+				continue;
+			
+			if ( out <= 0 )
 			{
-				if( errno == EINTR )
-					continue;
+				LOG_WARN_PERROR( "Failed to splice to file" );
 				
-				return -1; // error
-			} 
-			else 
-			{
-				break; // continue with read 
+				// Don't leave stale data in the pipe for next time
+				::close( mSplicePipe[ 0 ] );
+				::close( mSplicePipe[ 1 ] );
+				mSplicePipe[ 0 ] = mSplicePipe[ 1 ] = -1;
+				failed = true;
+				break;
 			}
+			
+			received += countRead( out );
+			res -= out;
 		}
+		
+		if ( failed )
+			break;
+	}
+#else
+	fallback = true;
+#endif
+	
+	if ( fallback )
+	{
+		int64_t res = copyFromSocket( file.mFd, len - received, deadline );
+		if ( res > 0 )
+			received += res;
+		else if ( res < 0 )
+			failed = true;
+	}
+	
+	fcntl( mFd, F_SETFL, flags );
+	
+	return received > 0 or not failed ? received : -1;
+}
 
-		// read data
-		numBytes = recv( mFd, buffer, len, MSG_NOSIGNAL );
-
-		if( numBytes < 0 ) 
+int64_t Socket::copyFromSocket( int fd, int64_t len, uint64_t deadline )
+{
+	uint8_t *buf = jh_new uint8_t[ kFileChunkSize ];
+	int64_t received = 0;
+	bool failed = false;
+	
+	while ( received < len and not failed )
+	{
+		int n = len - received > kFileChunkSize ? kFileChunkSize : len - received;
+		n = ::recv( mFd, buf, n, 0 );
+		
+		if ( n == 0 )
+			break;
+		
+		if ( n < 0 )
 		{
-			return -1; // socket error;
+			if ( errno == EINTR )
+				continue;
+			if ( ( errno == EAGAIN or errno == EWOULDBLOCK ) and 
+				 waitIfBlocking( POLLIN, deadline ) > 0 )
+				continue;
+			failed = errno != EAGAIN and errno != EWOULDBLOCK;
+			break;
 		}
-
-		return numBytes;
-	}
-	else
-	{
-		if (not mSockStream)
+		
+		countRead( n );
+		
+		for ( int done = 0; done < n; )
 		{
-			return recvfrom(buffer, len, mLastDatagramSender);
-		} else {
-			return ::read(mFd, buffer, len);
+			int res = ::write( fd, buf + done, n - done );
+			
+			if ( res < 0 and errno == EINTR )
+				continue;
+			
+			if ( res <= 0 )
+			{
+				failed = true;
+				break;
+			}
+			
+			done += res;
+			received += res;
 		}
 	}
-} 
-
-int Socket::write( const void *buffer, int len )
-{
-	// Passing in the MSG_NOSIGNAL flag to tell the OS not to send us
-	// SIGPIPE when the socket is closed during this call.  At some
-	// point we might make this a member variable that can be tweaked
-	// by the user, but that's interface clutter that we don't need
-	// yet.
-	return ::send(mFd, buffer, len, MSG_NOSIGNAL);
+	
+	delete [] buf;
+	
+	return received > 0 or not failed ? received : -1;
 }
 
 JetHead::ErrCode Socket::close()
 {
 	int res = 0;
+	
+	// Anything still queued can't be sent now
+	delete mWriteQueue;
+	mWriteQueue = NULL;
+	mWriteBlocked = false;
+	
+	if ( mSplicePipe[ 0 ] != -1 )
+	{
+		::close( mSplicePipe[ 0 ] );
+		::close( mSplicePipe[ 1 ] );
+		mSplicePipe[ 0 ] = mSplicePipe[ 1 ] = -1;
+	}
+	
 	if ( mFd != -1 )
 	{
 		setConnected( false );
@@ -394,12 +1382,9 @@ void Socket::processFileEvents( int fd, short events, jh_ptr_int_t private_data
 			mConnectedAsync = false;
 
 			// If we have a selector (which I guess we do since we are
-			// here), then tweak the flags we are interested in.
-			if (mSelector != NULL)
-			{
-				mSelector->removeListener(mFd, this);
-				mSelector->addListener(mFd, POLLIN, this);
-			}		
+			// here), then tweak the flags we are interested in.  Keep 
+			// POLLOUT if writeAsync queued anything while we connected.
+			updateWriteEvents();
 
 			if (mListener == NULL)
 			{
@@ -407,13 +1392,15 @@ void Socket::processFileEvents( int fd, short events, jh_ptr_int_t private_data
 				return;
 			}
 
-			// Figure out whether the connect succeeded or failed (not
-			// strictly sure it can fail, the docs are a bit unclear).
+			// Figure out whether the connect succeeded or failed, a 
+			// refused or unreachable connect also shows up as writable
 			socklen_t len;
 			int ret = 0;
 			len = sizeof(ret);
 			int res = getsockopt(fd, SOL_SOCKET, SO_ERROR, &ret, &len);
-			if (res < 0) {
+			if (res < 0 or ret != 0) {
+				errno = res < 0 ? errno : ret;
+				
 				// Notify the listener and be done
 				mListener->handleConnected(this, false);
 				return;
@@ -422,10 +1409,50 @@ void Socket::processFileEvents( int fd, short events, jh_ptr_int_t private_data
 			// Notify the listener and be done
 			mListener->handleConnected(this, true);
 			return;
-		}		
+		}
+		
+		if (getPendingWrite() > 0)
+		{
+			if (flushWriteQueue() < 0)
+			{
+				LOG_INFO("Failed to flush write queue: %s", strerror(errno));
+				mWriteQueue->clear();
+				closeDetected = true;
+			}
+			
+			updateWriteEvents();
+			
+			if (not closeDetected and checkWriteDrained())
+			{
+				// Same as handleData below, once the listener has us we
+				// can't assume we still exist.
+				if (mListener != NULL)
+				{
+					mListener->handleWritable(this);
+					return;
+				}
+			}
+		}
 	}
 	
-	if (events & POLLIN)
+	// Read the whole burst in one go rather than a handleData per datagram.
+	//  A zero length datagram is still a datagram, not a close, so don't
+	//  go by getBytesAvailable here.
+	if ((events & POLLIN) and mReceiveBatch != NULL and not mSockStream)
+	{
+		int res = recvmmsg(*mReceiveBatch, MSG_DONTWAIT);
+		
+		if (res < 0 and errno != EAGAIN and errno != EWOULDBLOCK)
+			LOG_WARN_PERROR("Failed to receive datagrams");
+		
+		// As with handleData we can't touch ourselves after this
+		if (res > 0 and mListener != NULL)
+			mListener->handleDatagrams(this, *mReceiveBatch);
+		
+		return;
+	}
+	
+	if ((events & POLLIN) and not closeDetected)
 	{
 		int bytesAvail = getBytesAvailable();
 		if (bytesAvail == 0)
@@ -481,14 +1508,14 @@ void Socket::processFileEvents( int fd, short events, jh_ptr_int_t private_data
 
 int Socket::getRemoteAddress( Socket::Address &addr )
 {
-	struct sockaddr_in sock_addr;
+	struct sockaddr_storage sock_addr;
 	socklen_t sock_len = sizeof( sock_addr );
 	
 	int res = getpeername( mFd, (struct sockaddr*)&sock_addr, &sock_len );
 	
 	if ( res == 0 )
 	{
-		addr = Socket::Address( &sock_addr, sock_len );
+		addr = Socket::Address( (struct sockaddr*)&sock_addr, sock_len );
 	}
 	else
 	{
@@ -505,14 +1532,14 @@ int Socket::getRemoteAddress( Socket::Address &addr )
 
 int Socket::getLocalAddress( Socket::Address &addr )
 {
-	struct sockaddr_in sock_addr;
+	struct sockaddr_storage sock_addr;
 	socklen_t sock_len = sizeof( sock_addr );
 	
 	int res = getsockname( mFd, (struct sockaddr*)&sock_addr, &sock_len );
 	
 	if ( res == 0 )
 	{
-		addr = Socket::Address( &sock_addr, sock_len );
+		addr = Socket::Address( (struct sockaddr*)&sock_addr, sock_len );
 	}
 	else
 	{
@@ -536,16 +1563,28 @@ int Socket::getBytesAvailable()
 
 int Socket::recvfrom(void* buf, int len, Socket::Address& addr, int flags)
 {
-	return ::recvfrom(mFd, buf, len, flags, 
-					  (sockaddr*)&addr.mAddr, (socklen_t*)&addr.mLen);	
+	if ( mReadTimeout > 0 and ( flags & MSG_DONTWAIT ) == 0 and
+		 waitForEvents( POLLIN, getDeadline( mReadTimeout ) ) <= 0 )
+	{
+		return -1;
+	}
+	
+	addr.mLen = sizeof( addr.mAddr );
+	return countRead( ::recvfrom(mFd, buf, len, flags, 
+								 (sockaddr*)&addr.mAddr, 
+								 (socklen_t*)&addr.mLen) );
 }
 
 int Socket::sendto(const void* buf, int len, const Socket::Address& addr, 
 				   int flags)
 {
-	return ::sendto(mFd, buf, len, flags,
-					(const sockaddr*)&addr.mAddr, 
-					(socklen_t)addr.mLen);
+	// An unbound socket can still switch to the family of addr
+	if ( not mConnected and mSelector == NULL )
+		setFamily( addr.getFamily() );
+	
+	return countWritten( ::sendto(mFd, buf, len, flags,
+								  (const sockaddr*)&addr.mAddr, 
+								  (socklen_t)addr.mLen) );
 }
 
 int Socket::recvmsg(const JetHead::vector<iovec> &buffers,
@@ -560,22 +1599,282 @@ int Socket::recvmsg(const JetHead::vector<iovec> &buffers,
 	msg.msg_controllen = 0;
 	msg.msg_flags = 0;
 
-	return ::recvmsg(mFd, &msg, flags); 
+	return countRead( ::recvmsg(mFd, &msg, flags) ); 
 }
 
 int Socket::sendmsg(const JetHead::vector<iovec> &buffers,
 					const Socket::Address *addr, int flags)
+{
+	return sendmsg(&buffers[0], buffers.size(), addr, flags);
+}
+
+int Socket::sendmsg(const struct iovec *buffers, int count,
+					const Socket::Address *addr, int flags)
 {
 	msghdr msg;
 	msg.msg_name = (addr) ? (void *)&addr->mAddr : NULL;
 	msg.msg_namelen = (addr) ? addr->mLen : 0;
-	msg.msg_iov = const_cast<iovec *>(&buffers[0]);
-	msg.msg_iovlen = buffers.size();
+	msg.msg_iov = const_cast<iovec *>(buffers);
+	msg.msg_iovlen = count;
 	msg.msg_control = NULL;
 	msg.msg_controllen = 0;
 	msg.msg_flags = 0;
 
-	return ::sendmsg(mFd, &msg, flags);
+	return countWritten( ::sendmsg(mFd, &msg, flags) );
+}
+
+#ifdef __linux__
+typedef struct mmsghdr BatchHeader;
+#else
+struct BatchHeader
+{
+	struct msghdr	msg_hdr;
+	unsigned int	msg_len;
+};
+#endif
+
+struct DatagramBatch::Message
+{
+	//! Big enough for a SCM_TIMESTAMP
+	static const int kControlSize = CMSG_SPACE( sizeof( struct timeval ) );
+	
+	//! These are handed to the kernel as an array so can't live in Message
+	BatchHeader		*mHeaders;
+	struct iovec	*mIovecs;
+	Socket::Address	*mAddrs;
+	uint64_t		*mTimestamps;
+	uint8_t			*mControl;
+};
+
+DatagramBatch::DatagramBatch( int count, int maxSize ) 
+	: mCapacity( count > 0 ? count : 1 ), mMaxSize( maxSize ), mSize( 0 )
+{
+	mMessages = jh_new Message;
+	mMessages->mHeaders = jh_new BatchHeader[ mCapacity ];
+	mMessages->mIovecs = jh_new struct iovec[ mCapacity ];
+	mMessages->mAddrs = jh_new Socket::Address[ mCapacity ];
+	mMessages->mTimestamps = jh_new uint64_t[ mCapacity ];
+	mMessages->mControl = jh_new uint8_t[ mCapacity * Message::kControlSize ];
+	mData = jh_new uint8_t[ mCapacity * mMaxSize ];
+	
+	memset( mMessages->mHeaders, 0, mCapacity * sizeof( BatchHeader ) );
+	
+	for ( int i = 0; i < mCapacity; i++ )
+	{
+		mMessages->mIovecs[ i ].iov_base = mData + i * mMaxSize;
+		mMessages->mIovecs[ i ].iov_len = mMaxSize;
+		mMessages->mHeaders[ i ].msg_hdr.msg_iov = &mMessages->mIovecs[ i ];
+		mMessages->mHeaders[ i ].msg_hdr.msg_iovlen = 1;
+		mMessages->mTimestamps[ i ] = 0;
+	}
+}
+
+DatagramBatch::~DatagramBatch()
+{
+	delete [] mData;
+	delete [] mMessages->mControl;
+	delete [] mMessages->mTimestamps;
+	delete [] mMessages->mAddrs;
+	delete [] mMessages->mIovecs;
+	delete [] mMessages->mHeaders;
+	delete mMessages;
+}
+
+int DatagramBatch::add( const void *data, int len, const Socket::Address *addr )
+{
+	if ( mSize >= mCapacity or len > mMaxSize or len < 0 )
+		return -1;
+	
+	int i = mSize++;
+	struct msghdr &hdr = mMessages->mHeaders[ i ].msg_hdr;
+	
+	memcpy( mData + i * mMaxSize, data, len );
+	mMessages->mIovecs[ i ].iov_len = len;
+	mMessages->mHeaders[ i ].msg_len = len;
+	
+	if ( addr != NULL )
+	{
+		mMessages->mAddrs[ i ] = *addr;
+		hdr.msg_name = &mMessages->mAddrs[ i ].mAddr;
+		hdr.msg_namelen = addr->mLen;
+	}
+	else
+	{
+		hdr.msg_name = NULL;
+		hdr.msg_namelen = 0;
+	}
+	
+	hdr.msg_control = NULL;
+	hdr.msg_controllen = 0;
+	hdr.msg_flags = 0;
+	
+	return 0;
+}
+
+const uint8_t *DatagramBatch::getData( int i ) const
+{
+	return mData + i * mMaxSize;
+}
+
+int DatagramBatch::getLength( int i ) const
+{
+	return mMessages->mHeaders[ i ].msg_len;
+}
+
+const Socket::Address &DatagramBatch::getAddress( int i ) const
+{
+	return mMessages->mAddrs[ i ];
+}
+
+uint64_t DatagramBatch::getTimestamp( int i ) const
+{
+	return mMessages->mTimestamps[ i ];
+}
+
+bool DatagramBatch::isTruncated( int i ) const
+{
+	return ( mMessages->mHeaders[ i ].msg_hdr.msg_flags & MSG_TRUNC ) != 0;
+}
+
+int Socket::recvmmsg( DatagramBatch &batch, int flags )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	DatagramBatch::Message *msgs = batch.mMessages;
+	
+	batch.mSize = 0;
+	
+	if ( mReadTimeout < 0 ) 
+		return -1;
+	
+	if ( mReadTimeout > 0 and ( flags & MSG_DONTWAIT ) == 0 and
+		 waitForEvents( POLLIN, getDeadline( mReadTimeout ) ) <= 0 )
+	{
+		return -1;
+	}
+	
+	for ( int i = 0; i < batch.mCapacity; i++ )
+	{
+		struct msghdr &hdr = msgs->mHeaders[ i ].msg_hdr;
+		
+		msgs->mIovecs[ i ].iov_len = batch.mMaxSize;
+		hdr.msg_name = &msgs->mAddrs[ i ].mAddr;
+		hdr.msg_namelen = sizeof( msgs->mAddrs[ i ].mAddr );
+		hdr.msg_control = msgs->mControl + i * DatagramBatch::Message::kControlSize;
+		hdr.msg_controllen = DatagramBatch::Message::kControlSize;
+		hdr.msg_flags = 0;
+	}
+	
+#ifdef __linux__
+	// Block for the first one at most, take whatever else is already here
+	int res = ::recvmmsg( mFd, msgs->mHeaders, batch.mCapacity, 
+						  flags | MSG_WAITFORONE, NULL );
+#else
+	int res = 0;
+	while ( res < batch.mCapacity )
+	{
+		int len = ::recvmsg( mFd, &msgs->mHeaders[ res ].msg_hdr, 
+							 res == 0 ? flags : flags | MSG_DONTWAIT );
+		if ( len < 0 )
+			break;
+		msgs->mHeaders[ res++ ].msg_len = len;
+	}
+	if ( res == 0 )
+		res = -1;
+#endif
+	
+	if ( res <= 0 )
+		return res;
+	
+	struct timeval now;
+	TimeUtils::getCurTime( &now );
+	int total = 0;
+	
+	for ( int i = 0; i < res; i++ )
+	{
+		struct msghdr &hdr = msgs->mHeaders[ i ].msg_hdr;
+		struct timeval *tv = &now;
+		
+		msgs->mAddrs[ i ].mLen = hdr.msg_namelen;
+		total += msgs->mHeaders[ i ].msg_len;
+		
+		for ( struct cmsghdr *cmsg = CMSG_FIRSTHDR( &hdr ); cmsg != NULL; 
+			  cmsg = CMSG_NXTHDR( &hdr, cmsg ) )
+		{
+			if ( cmsg->cmsg_level == SOL_SOCKET and 
+				 cmsg->cmsg_type == SCM_TIMESTAMP )
+				tv = (struct timeval*)CMSG_DATA( cmsg );
+		}
+		
+		msgs->mTimestamps[ i ] = (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+	}
+	
+	countRead( total );
+	batch.mSize = res;
+	
+	return res;
+}
+
+int Socket::sendmmsg( const DatagramBatch &batch, int first, int flags )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	BatchHeader *hdrs = batch.mMessages->mHeaders;
+	
+	if ( first < 0 or first > batch.mSize )
+		return -1;
+	
+	if ( first == batch.mSize )
+		return 0;
+	
+	flags |= MSG_NOSIGNAL;
+	
+#ifdef __linux__
+	int res = ::sendmmsg( mFd, hdrs + first, batch.mSize - first, flags );
+#else
+	int res = 0;
+	while ( first + res < batch.mSize )
+	{
+		if ( ::sendmsg( mFd, &hdrs[ first + res ].msg_hdr, flags ) < 0 )
+			break;
+		res++;
+	}
+	if ( res == 0 )
+		res = -1;
+#endif
+	
+	if ( res > 0 )
+	{
+		int total = 0;
+		for ( int i = first; i < first + res; i++ )
+			total += batch.getLength( i );
+		countWritten( total );
+	}
+	
+	return res;
+}
+
+void Socket::setReceiveBatch( int count, int maxSize )
+{
+	// processFileEvents uses the batch on the selector's thread
+	if ( mSelector != NULL and not mSelector->isThreadCurrent() )
+	{
+		SyncEventAgent2<Socket, int, int> *agent = 
+			jh_new SyncEventAgent2<Socket, int, int>( 
+				this, &Socket::setReceiveBatch, count, maxSize );
+		agent->send( mSelector );
+		return;
+	}
+	
+	delete mReceiveBatch;
+	mReceiveBatch = NULL;
+	
+	if ( count > 0 )
+		mReceiveBatch = jh_new DatagramBatch( count, maxSize );
+}
+
+int Socket::setReceiveTimestamps( bool enable )
+{
+	int on = enable ? 1 : 0;
+	return setsockopt( mFd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof( on ) );
 }
 
 int Socket::getInterfaceAddress( const char *if_name, Socket::Address& addr )
@@ -607,7 +1906,7 @@ int Socket::getInterfaceAddress( const char *if_name, Socket::Address& addr )
 		return res;
 	}
 
-	addr.setSockaddr( (struct sockaddr_in*) &(ifr.ifr_addr), 
+	addr.setSockaddr( &ifr.ifr_addr, 
 					  sizeof(struct sockaddr_in) );
 	
 	LOG_INFO( "Lookup of %s got address %s", if_name, addr.getName() );
@@ -726,6 +2025,17 @@ bool Socket::setKeepAlive(int timeout)
 #endif
 }
 
+int Socket::setNoDelay( bool noDelay )
+{
+	int on = noDelay ? 1 : 0;
+	int res = setsockopt( mFd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+	
+	if ( res != 0 )
+		LOG_WARN_PERROR( "Failed to set TCP_NODELAY" );
+	
+	return res;
+}
+
 int Socket::checkSocketHealth(uint32_t thresholdSeconds)
 {
 #ifdef PLATFORM_DARWIN
@@ -776,31 +2086,59 @@ int Socket::checkSocketHealth(uint32_t thresholdSeconds)
 #endif
 }
 
+bool Socket::isIdleUsable()
+{
+	if ( not mConnected or mFd == -1 )
+		return false;
+	
+	struct pollfd pfd;
+	pfd.fd = mFd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	
+	// Nothing to read and no error means the peer is still there
+	if ( ::poll( &pfd, 1, 0 ) == 0 )
+		return true;
+	
+	// Either the peer hung up or it sent something unasked for, neither 
+	//  leaves a connection we can trust
+	LOG_INFO( "Idle socket %d not usable, events %x", mFd, pfd.revents );
+	return false;
+}
+
 void Socket::Address::setAddress( const char *name )
 {
+	uint16_t port = getPort();
+	
 	// Set address to default.
-	mAddr.sin_addr.s_addr = INADDR_ANY;
+	setAny( AF_INET, port );
 
 	if ( name != NULL )
 	{
-		// Returns non-zero if name is a valid dotted-quad
-		if (inet_aton(name, &mAddr.sin_addr))
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)&mAddr;
+		
+		// Numeric addresses don't need a lookup
+		if ( inet_pton( AF_INET, name, 
+						&((struct sockaddr_in*)&mAddr)->sin_addr ) == 1 )
 		{
 			return;
 		}
-
-		// protect calls to gethostbyname until we are certain that it
-		// is threadsafe
-		Mutex::EnterCriticalSection();
-
-		struct hostent *host = gethostbyname( name );
 		
-		if ( host != NULL && host->h_addrtype == AF_INET )
+		setAny( AF_INET6, port );
+		if ( inet_pton( AF_INET6, name, &sin6->sin6_addr ) == 1 )
 		{
-			mAddr.sin_addr.s_addr = *((uint32_t*)host->h_addr_list[ 0 ]);
+			return;
 		}
+		setAny( AF_INET, port );
+
+		// Cached, and safe to call from any thread without a global lock
+		JetHead::vector<Socket::Address> addrs;
 		
-		Mutex::ExitCriticalSection();
+		if ( Resolver::getInstance()->resolve( name, addrs ) == 0 )
+		{
+			*this = addrs[ 0 ];
+			setPort( port );
+		}
 	}
 }
 
@@ -826,6 +2164,13 @@ int ServerSocket::bind( const Socket::Address &addr )
 	TRACE_BEGIN( LOG_LVL_INFO );
 	int len;
 	const struct sockaddr *saddr = addr.getAddr( len );
+	
+	if ( setFamily( addr.getFamily() ) != 0 )
+	{
+		LOG_WARN_PERROR( "No socket for %s", addr.getName() );
+		return -1;
+	}
+	
 	int res = ::bind( getFd(), saddr, len );
 
 	// for UDP sockets set connected on bind, since listen will not be called.
@@ -843,6 +2188,24 @@ int ServerSocket::bind( const Socket::Address &addr )
 	return res;
 }
 
+int ServerSocket::bindDualStack( int port )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	if ( setFamily( AF_INET6 ) != 0 )
+	{
+		LOG_INFO( "No IPv6, binding IPv4 only" );
+		return bind( Socket::Address( port ) );
+	}
+	
+	// Linux defaults this to off but other systems (and sysctls) differ
+	int off = 0;
+	if ( setsockopt( getFd(), IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof( off ) ) != 0 )
+		LOG_WARN_PERROR( "Failed to clear IPV6_V6ONLY" );
+	
+	return bind( Socket::Address( port, AF_INET6 ) );
+}
+
 int ServerSocket::listen( int num )
 {
 	TRACE_BEGIN( LOG_LVL_INFO );
@@ -870,7 +2233,7 @@ Socket *ServerSocket::accept()
 		new_sock->setConnected( true );
 		new_sock->setParent(this);
 	}
-	else
+	else if ( not isNonBlocking() or ( errno != EAGAIN and errno != EWOULDBLOCK ) )
 	{
 		LOG_WARN_PERROR("Accept failed");
 	}
@@ -878,6 +2241,21 @@ Socket *ServerSocket::accept()
 	return new_sock;
 }
 
+int ServerSocket::setReusePort( bool reuse )
+{
+#ifdef SO_REUSEPORT
+	int on = reuse ? 1 : 0;
+	int res = setsockopt( getFd(), SOL_SOCKET, SO_REUSEPORT, &on, sizeof( on ) );
+	
+	if ( res != 0 )
+		LOG_WARN_PERROR( "Failed to set SO_REUSEPORT" );
+	
+	return res;
+#else
+	return reuse ? -1 : 0;
+#endif
+}
+
 void ServerSocket::processFileEvents( int fd, short events, jh_ptr_int_t private_data )
 {
 	TRACE_BEGIN( LOG_LVL_INFO );
@@ -885,13 +2263,21 @@ void ServerSocket::processFileEvents( int fd, short events, jh_ptr_int_t private
 	{
 		if ( isSockStream() )
 		{
-			bool accepted = false;
+			// When non-blocking take everything that is waiting (up to a 
+			//  limit so one busy socket can't starve the selector) rather 
+			//  than going back to poll for each one.
+			int maxAccepts = isNonBlocking() ? kMaxAcceptsPerEvent : 1;
 			
-			// Call accept to initialize the new socket
-			Socket *newSock = accept();
-			
-			if (newSock != NULL)
+			for ( int i = 0; i < maxAccepts; i++ )
 			{
+				bool accepted = false;
+				
+				// Call accept to initialize the new socket
+				Socket *newSock = accept();
+				
+				if (newSock == NULL)
+					break;
+				
 				// Check if the listener wishes to accept this connection
 				if (mListener != NULL)
 					accepted = mListener->handleAccept(this, newSock);
@@ -905,6 +2291,11 @@ void ServerSocket::processFileEvents( int fd, short events, jh_ptr_int_t private
 				}
 			}
 		}
+		else if ( mReceiveBatch != NULL )
+		{
+			// Bursts of datagrams are read the same as on a plain Socket
+			Socket::processFileEvents( fd, events, private_data );
+		}
 		else
 		{
 			if ( mListener != NULL )
@@ -0,0 +1,665 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "TcpServer.h"
+#include "EventAgent.h"
+#include "TimeUtils.h"
+
+#include "jh_memory.h"
+#include "logging.h"
+
+#include <unistd.h>
+#include <errno.h>
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+using namespace JetHead;
+
+/**
+ * A worker selector and the connections that live on it.  Everything in here
+ *  is only touched on the selector's thread.
+ */
+struct TcpConnection::Worker
+{
+	Worker( TcpServer *server, const char *name ) 
+		: mServer( server ), mSelector( name ), mHead( NULL ), mTail( NULL )
+	{
+	}
+	
+	//! Take over a socket accepted by an acceptor
+	void addConnection( Socket *socket );
+
+	//! Close connections that have been idle for too long
+	void sweepIdle();
+	
+	//! Ask the listener to finish up with every connection
+	void drain();
+
+	//! Close everything that is left
+	void abortAll();
+	
+	//! Add to the end of the list
+	void link( TcpConnection *conn )
+	{
+		conn->mPrev = mTail;
+		conn->mNext = NULL;
+		if ( mTail != NULL )
+			mTail->mNext = conn;
+		else
+			mHead = conn;
+		mTail = conn;
+	}
+	
+	void unlink( TcpConnection *conn )
+	{
+		if ( conn->mPrev != NULL )
+			conn->mPrev->mNext = conn->mNext;
+		else
+			mHead = conn->mNext;
+		
+		if ( conn->mNext != NULL )
+			conn->mNext->mPrev = conn->mPrev;
+		else
+			mTail = conn->mPrev;
+		
+		conn->mPrev = conn->mNext = NULL;
+	}
+	
+	TcpServer		*mServer;
+	Selector		mSelector;
+	
+	//! Our connections, least recently active first
+	TcpConnection	*mHead;
+	TcpConnection	*mTail;
+};
+
+void TcpServerListener::handleDrain( TcpConnection *conn )
+{
+	conn->close();
+}
+
+TcpConnection::TcpConnection( TcpServer *server, Worker *worker, 
+							  Socket *socket ) 
+	: mServer( server ), mWorker( worker ), mSocket( socket ),
+	  mEvents( POLLIN ), mCallbackDepth( 0 ),
+	  mWriteBlocked( false ), mWaitWritable( false ), mReadPaused( false ),
+	  mClosing( false ), mPeerClosed( false ),
+	  mDestroyPending( false ), mAccepted( false ), mPrivateData( 0 ),
+	  mLastActivity( TimeUtils::getMonotonicMicros() ), 
+	  mPrev( NULL ), mNext( NULL )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	mSocket->setNonBlocking( true );
+	mSocket->setWriteWatermarks( server->getLowWatermark(), 
+								 server->getHighWatermark() );
+	mWorker->link( this );
+}
+
+TcpConnection::~TcpConnection()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	delete mSocket;
+	mServer->connectionClosed();
+}
+
+Selector *TcpConnection::getSelector()
+{
+	return &mWorker->mSelector;
+}
+
+int TcpConnection::read( void *buffer, int len )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+
+	if ( mPeerClosed )
+		return -1;
+	
+	if ( len <= 0 )
+		return 0;
+	
+	int res = mSocket->read( buffer, len );
+	
+	if ( res > 0 )
+		return res;
+
+	if ( res < 0 and ( errno == EAGAIN or errno == EWOULDBLOCK or 
+					   errno == EINTR ) )
+		return 0;
+	
+	// 0 is end of file, the other side has shutdown (at least its side)
+	LOG_INFO( "read on fd %d returned %d", mSocket->getFd(), res );
+	mPeerClosed = true;
+	return -1;
+}
+
+int TcpConnection::write( const void *buffer, int len )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	if ( mClosing )
+		return -1;
+
+	if ( len <= 0 )
+		return 0;
+	
+	touch();
+	
+	int sent = mSocket->writeQueued( buffer, len, mServer->mWriteBufferSize );
+	
+	if ( sent < 0 )
+	{
+		LOG_INFO( "write on fd %d failed %d", mSocket->getFd(), errno );
+		abort();
+		return -1;
+	}
+	
+	if ( sent < len or getPendingWrite() > 0 )
+	{
+		if ( mSocket->isWriteBlocked() )
+			mWriteBlocked = true;
+		
+		updateEvents();
+	}
+	
+	return sent;
+}
+
+int64_t TcpConnection::sendFile( File &file, jh_off64_t offset, int64_t len )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	if ( mClosing )
+		return -1;
+
+	if ( len <= 0 )
+		return 0;
+	
+	touch();
+	
+	int64_t sent = 0;
+	
+	// Anything already queued has to go first
+	if ( getPendingWrite() == 0 )
+	{
+		sent = mSocket->sendFile( file, offset, len );
+		
+		if ( sent < 0 )
+		{
+			LOG_INFO( "sendFile on fd %d failed %d", mSocket->getFd(), errno );
+			abort();
+			return -1;
+		}
+	}
+	
+	if ( sent < len )
+	{
+		mWriteBlocked = true;
+		mWaitWritable = true;
+		updateEvents();
+	}
+	
+	return sent;
+}
+
+void TcpConnection::setReadPaused( bool paused )
+{
+	mReadPaused = paused;
+	updateEvents();
+}
+
+void TcpConnection::close()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+
+	if ( mClosing )
+		return;
+	
+	mClosing = true;
+	
+	if ( getPendingWrite() == 0 )
+		destroy();
+	else
+		updateEvents();
+}
+
+void TcpConnection::abort()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	mClosing = true;
+	destroy();
+}
+
+void TcpConnection::processFileEvents( int fd, short events, 
+									   jh_ptr_int_t private_data )
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	LOG( "fd %d events %x", fd, events );
+	
+	enterCallback();
+	
+	if ( events & POLLOUT )
+		flush();
+	
+	if ( ( events & POLLIN ) and not mClosing and not mWriteBlocked and
+		 not mReadPaused )
+	{
+		touch();
+		mServer->mListener->handleData( this );
+	}
+	
+	if ( events & ( POLLERR | POLLHUP | POLLNVAL ) )
+	{
+		// The selector has already dropped us, and there is no one left 
+		//  to flush to.
+		abort();
+	}
+	else if ( mPeerClosed )
+	{
+		close();
+	}
+	
+	leaveCallback();
+}
+
+void TcpConnection::flush()
+{
+	TRACE_BEGIN( LOG_LVL_NOISE );
+	
+	mWaitWritable = false;
+	
+	if ( mSocket->flushWriteQueue() < 0 )
+	{
+		LOG_INFO( "write on fd %d failed %d", mSocket->getFd(), errno );
+		abort();
+		return;
+	}
+	
+	if ( getPendingWrite() == 0 and mClosing )
+	{
+		destroy();
+		return;
+	}
+	
+	mSocket->checkWriteDrained();
+	
+	// We may also be blocked by a sendFile that stopped short, with 
+	//  nothing queued
+	if ( mWriteBlocked and not mSocket->isWriteBlocked() )
+	{
+		mWriteBlocked = false;
+		updateEvents();
+		
+		if ( not mClosing )
+			mServer->mListener->handleWritable( this );
+	}
+	else
+	{
+		updateEvents();
+	}
+}
+
+void TcpConnection::updateEvents()
+{
+	short events = 0;
+	
+	if ( not mClosing and not mWriteBlocked and not mReadPaused )
+		events |= POLLIN;
+	
+	if ( getPendingWrite() > 0 or mWaitWritable )
+		events |= POLLOUT;
+	
+	if ( events != mEvents )
+	{
+		mEvents = events;
+		mWorker->mSelector.setListenerEvents( mSocket->getFd(), this, events );
+	}
+}
+
+void TcpConnection::touch()
+{
+	if ( mServer->mIdleTimeout == 0 )
+		return;
+	
+	mLastActivity = TimeUtils::getMonotonicMicros();
+	
+	if ( mWorker->mTail != this )
+	{
+		mWorker->unlink( this );
+		mWorker->link( this );
+	}
+}
+
+void TcpConnection::leaveCallback()
+{
+	if ( --mCallbackDepth == 0 and mDestroyPending )
+		destroy();
+}
+
+void TcpConnection::destroy()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	if ( mCallbackDepth > 0 )
+	{
+		mDestroyPending = true;
+		return;
+	}
+	
+	mWorker->mSelector.removeListener( mSocket->getFd(), this );
+	mWorker->unlink( this );
+	
+	if ( mAccepted )
+	{
+		// Anything the listener does to us in here is moot
+		enterCallback();
+		mServer->mListener->handleClose( this );
+	}
+	
+	delete this;
+}
+
+void TcpConnection::Worker::addConnection( Socket *socket )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	if ( mServer->mStopping )
+	{
+		delete socket;
+		return;
+	}
+	
+	TcpConnection *conn = jh_new TcpConnection( mServer, this, socket );
+	
+	__sync_add_and_fetch( &mServer->mNumConnections, 1 );
+	mServer->mConnectionsGauge->add( 1 );
+	mServer->mAccepted->increment();
+	
+	mSelector.addListener( socket->getFd(), POLLIN, conn );
+	
+	conn->enterCallback();
+	conn->mAccepted = mServer->mListener->handleConnection( conn );
+	
+	if ( not conn->mAccepted )
+		conn->abort();
+	
+	conn->leaveCallback();
+}
+
+void TcpConnection::Worker::sweepIdle()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	uint64_t now = TimeUtils::getMonotonicMicros();
+	uint64_t timeout = (uint64_t)mServer->mIdleTimeout * 1000;
+	
+	// The list is kept in order of activity so we only look at the idle ones
+	while ( mHead != NULL and now - mHead->mLastActivity >= timeout )
+	{
+		LOG_INFO( "closing idle connection on fd %d", 
+				  mHead->mSocket->getFd() );
+		mHead->abort();
+	}
+}
+
+void TcpConnection::Worker::drain()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	JetHead::vector<TcpConnection*> conns;
+	
+	// Hold off deleting anything until we are done walking the list, the 
+	//  listener can close any connection from handleDrain.
+	for ( TcpConnection *conn = mHead; conn != NULL; conn = conn->mNext )
+	{
+		conn->enterCallback();
+		conns.push_back( conn );
+	}
+	
+	for ( unsigned i = 0; i < conns.size(); i++ )
+	{
+		if ( not conns[ i ]->mDestroyPending )
+			mServer->mListener->handleDrain( conns[ i ] );
+	}
+	
+	for ( unsigned i = 0; i < conns.size(); i++ )
+		conns[ i ]->leaveCallback();
+}
+
+void TcpConnection::Worker::abortAll()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+
+	while ( mHead != NULL )
+		mHead->abort();
+}
+
+TcpServer::TcpServer( TcpServerListener *listener, int numWorkers, 
+					  int numAcceptors, const char *name )
+	: mListener( listener ), mName( name ), 
+	  mNumAcceptors( numAcceptors < 1 ? 1 : numAcceptors ),
+	  mNextWorker( 0 ), mNumConnections( 0 ), mStopping( false ), mPort( 0 ),
+	  mIdleTimeout( 0 ), mWriteBufferSize( kDefaultWriteBufferSize ),
+	  mLowWatermark( -1 ), mHighWatermark( -1 )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	if ( numWorkers <= 0 )
+		numWorkers = sysconf( _SC_NPROCESSORS_ONLN );
+
+	if ( numWorkers <= 0 )
+		numWorkers = 1;
+	
+	mWorkers.resize( numWorkers );
+	
+	JHSTD::string labels;
+	JetHead::stl_sprintf( labels, "server=\"%s\"", name );
+	MetricsRegistry *metrics = MetricsRegistry::getInstance();
+	mConnectionsGauge = metrics->getGauge( "jh_tcpserver_connections", 
+										   labels.c_str() );
+	mAccepted = metrics->getCounter( "jh_tcpserver_accepted_total", 
+									 labels.c_str() );
+}
+
+TcpServer::~TcpServer()
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	stop();
+}
+
+void TcpServer::setWriteWatermarks( int low, int high )
+{
+	mLowWatermark = low;
+	mHighWatermark = high < low ? low : high;
+}
+
+int TcpServer::start( const Socket::Address &addr, int backlog )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	if ( mAcceptors.size() > 0 )
+	{
+		LOG_WARN( "%s already started", mName.c_str() );
+		return -1;
+	}
+	
+	mStopping = false;
+	
+	JHSTD::string name;
+	for ( unsigned i = 0; i < mWorkers.size(); i++ )
+	{
+		JetHead::stl_sprintf( name, "%s-%d", mName.c_str(), i );
+		mWorkers[ i ] = jh_new Worker( this, name.c_str() );
+
+		if ( mIdleTimeout != 0 )
+		{
+			uint32_t period = mIdleTimeout / 4;
+			if ( period < 100 )
+				period = 100;
+			
+			AsyncEventAgent0<Worker> *agent = jh_new AsyncEventAgent0<Worker>( 
+				mWorkers[ i ], &Worker::sweepIdle );
+			agent->sendPeriodically( &mWorkers[ i ]->mSelector, period );
+		}
+	}
+	
+	Socket::Address bindAddr = addr;
+	
+	for ( int i = 0; i < mNumAcceptors; i++ )
+	{
+		ServerSocket *sock = jh_new ServerSocket();
+		
+		if ( mNumAcceptors > 1 )
+			sock->setReusePort( true );
+		
+		sock->setNonBlocking( true );
+		
+		if ( sock->bind( bindAddr ) != 0 or sock->listen( backlog ) != 0 )
+		{
+			delete sock;
+			stop();
+			return -1;
+		}
+		
+		// If the OS picked the port the rest need to share it
+		if ( i == 0 )
+		{
+			Socket::Address local;
+			sock->getLocalAddress( local );
+			mPort = local.getPort();
+			bindAddr.setPort( mPort );
+		}
+		
+		JetHead::stl_sprintf( name, "%s-accept-%d", mName.c_str(), i );
+		Selector *selector = jh_new Selector( name.c_str() );
+		sock->setSelector( this, selector );
+		
+		mAcceptSelectors.push_back( selector );
+		mAcceptors.push_back( sock );
+	}
+	
+	LOG_INFO( "%s listening on port %d with %d workers", mName.c_str(), mPort,
+			  mWorkers.size() );
+	
+	return 0;
+}
+
+bool TcpServer::handleAccept( ServerSocket *server, Socket *socket )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+	
+	uint32_t next = __sync_fetch_and_add( &mNextWorker, 1 );
+	Worker *worker = mWorkers[ next % mWorkers.size() ];
+	
+	AsyncEventAgent1<Worker, Socket*> *agent = 
+		jh_new AsyncEventAgent1<Worker, Socket*>( worker, 
+												  &Worker::addConnection, 
+												  socket );
+	agent->send( &worker->mSelector );
+	
+	return true;
+}
+
+void TcpServer::stopAcceptors()
+{
+	for ( unsigned i = 0; i < mAcceptors.size(); i++ )
+	{
+		mAcceptors[ i ]->setSelector( NULL, NULL );
+		delete mAcceptors[ i ];
+	}
+	
+	for ( unsigned i = 0; i < mAcceptSelectors.size(); i++ )
+		delete mAcceptSelectors[ i ];
+	
+	mAcceptors.clear();
+	mAcceptSelectors.clear();
+}
+
+void TcpServer::stop( uint32_t drainMs )
+{
+	TRACE_BEGIN( LOG_LVL_INFO );
+
+	if ( mWorkers.size() == 0 or mWorkers[ 0 ] == NULL )
+		return;
+
+	// Stop new connections first, anything already handed to a worker is
+	//  ahead of the drain in its queue.
+	stopAcceptors();
+	mStopping = true;
+	
+	for ( unsigned i = 0; i < mWorkers.size(); i++ )
+	{
+		SyncEventAgent0<Worker> *agent = jh_new SyncEventAgent0<Worker>( 
+			mWorkers[ i ], &Worker::drain );
+		agent->send( &mWorkers[ i ]->mSelector );
+	}
+	
+	{
+		AutoLock l( mLock );
+		uint64_t deadline = TimeUtils::getMonotonicMicros() + 
+			(uint64_t)drainMs * 1000;
+		
+		while ( mNumConnections > 0 )
+		{
+			uint64_t now = TimeUtils::getMonotonicMicros();
+			
+			if ( now >= deadline )
+				break;
+			
+			mDrained.Wait( mLock, ( deadline - now ) / 1000 + 1 );
+		}
+	}
+	
+	if ( mNumConnections > 0 )
+		LOG_NOTICE( "%s aborting %d connections", mName.c_str(), 
+					mNumConnections );
+	
+	for ( unsigned i = 0; i < mWorkers.size(); i++ )
+	{
+		Worker *worker = mWorkers[ i ];
+		
+		SyncEventAgent0<Worker> *agent = jh_new SyncEventAgent0<Worker>( 
+			worker, &Worker::abortAll );
+		agent->send( &worker->mSelector );
+		
+		worker->mSelector.removeAgentsByReceiver( worker );
+		delete worker;
+		mWorkers[ i ] = NULL;
+	}
+	
+	mPort = 0;
+}
+
+void TcpServer::connectionClosed()
+{
+	mConnectionsGauge->add( -1 );
+	
+	if ( __sync_sub_and_fetch( &mNumConnections, 1 ) == 0 and mStopping )
+	{
+		AutoLock l( mLock );
+		mDrained.Broadcast();
+	}
+}
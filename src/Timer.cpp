@@ -57,6 +57,11 @@ Timer::Timer(int tickTimeMs, bool stoppable)
 	if (mMsPerTick < 0)
 		mMsPerTick = 100;
 	
+	JHSTD::string labels;
+	JetHead::stl_sprintf(labels, "tick_ms=\"%d\"", mMsPerTick);
+	mPending = MetricsRegistry::getInstance()->getGauge("jh_timer_pending",
+														 labels.c_str());
+	
 	// Start the timer thread running immediately
 	start();
 }
@@ -68,6 +73,9 @@ Timer::~Timer()
 	// Force stop of this timer
 	doStop();
 	
+	// Drop anything still pending so it is no longer counted
+	reset();
+	
 	// Remove the Timer from the TimerManager
 	TimerManager::getInstance()->removeTimer(this);
 	
@@ -133,7 +141,11 @@ void Timer::reset()
 	DebugAutoLock(mMutex);
 	
 	mTicks = 0;
-	mList.clear();
+	while (not mList.empty())
+	{
+		mList.pop_front();
+		mPending->add(-1);
+	}
 }
 
 void Timer::clockHandler()
@@ -203,11 +215,35 @@ void Timer::handleTick()
 		
 		// Remove the timer from the list now
 		mList.pop_front();
+		mPending->add(-1);
+
+		// Check to see if this is a periodic timer.   If it is then
+		// we need to re-calculate the tick value for the timer.  In
+		// addition we are going to calculate the # of ms that are
+		// lost by the tick calculation and accumulate them so that
+		// over time we line up properly whenever possible.  This is
+		// done before it fires so that a remove from inside the
+		// listener finds it.
+		if (timer.mRepeatMS != 0)
+		{
+			TimerNode next = timer;
+			unsigned newTicks = (next.mRepeatMS + mMsPerTick - 1 - 
+								 next.mRemainingMS) / mMsPerTick;
+			next.mTick += newTicks;
+			next.mRemainingMS = (next.mRepeatMS + next.mRemainingMS) % 
+				mMsPerTick;
+			addTimerNode(next);
+		}
 
 		// If the timer doesn't have an event then we call the listener
 		if ( timer.mEvent == NULL )
 		{
+			// Listeners may remove events, which can mean waiting on a
+			// thread that is itself waiting for our lock.  So don't
+			// hold it while they run.
+			mMutex.Unlock();
 			timer.mListener->onTimeout( timer.mPrivateData );
+			mMutex.Lock();
 		}
 		// Otherwise send the event
 		else
@@ -216,26 +252,8 @@ void Timer::handleTick()
 			timer.mDispatcher->sendEvent( timer.mEvent );
 		}
 		
-		// Check to see if this is a periodic timer.   If it is then
-		// we need to re-calculate the tick value for the timer.  In
-		// addition we are going to calculate the # of ms that are
-		// lost by the tick calculation and accumulate them so that
-		// over time we line up properly whenever possible.
-		if (timer.mRepeatMS != 0)
-		{
-			unsigned newTicks = (timer.mRepeatMS + mMsPerTick - 1 - 
-								 timer.mRemainingMS) / mMsPerTick;
-			timer.mTick += newTicks;
-			timer.mRemainingMS = (timer.mRepeatMS + timer.mRemainingMS) % 
-				mMsPerTick;
-			addTimerNode(timer);
-		}
-		// If this is a non-periodic then release our reference to
-		// the event if we have one
-		else
-		{
-			timer.mEvent = NULL;
-		}
+		// Release our reference to the event if we have one
+		timer.mEvent = NULL;
 	}
 }
 
@@ -374,6 +392,7 @@ void Timer::removeTimedEvent( Event::Id eventId,
 				 || eventId == Event::kInvalidEventId )
 			{
 				i = i.erase();
+				mPending->add(-1);
 				continue;
 			}
 		}
@@ -400,6 +419,7 @@ void Timer::removeTimedEvent( Event *ev )
 		if ( (Event*)timer.mEvent == ev )
 		{
 			node = node.erase();
+			mPending->add(-1);
 			continue;
 		}
 		++node;
@@ -420,13 +440,16 @@ void Timer::removeAgentsByReceiver( void* receiver,
 		// Get the TimerNode
 		timer = *i;
 
-		if ( timer.mEvent->getEventId() == Event::kAgentEventId and
+		// Listener timers have no event
+		if ( timer.mEvent != NULL and
+			 timer.mEvent->getEventId() == Event::kAgentEventId and
 			 timer.mDispatcher == dispatcher )
 		{
 			EventAgent* agent = static_cast<EventAgent*>( (Event*)timer.mEvent );
 			if (agent->getDeliveryTarget() == receiver)
 			{
 				i = i.erase();
+				mPending->add(-1);
 				continue;
 			}
 		}
@@ -440,6 +463,8 @@ void Timer::addTimerNode( const TimerNode& newTimer )
 
 	int32_t diff;
 	bool inserted = false;
+	
+	mPending->add(1);
 
 	// Add new timer node to the list (sorted)	
 	for (JetHead::list<TimerNode>::iterator i = mList.begin();
@@ -64,6 +64,9 @@ TimerManager::TimerManager()
 		LOG_ERR_FATAL("Illegal creation of TimerManager, use getInstance()");
 	
 	mDefaultTimer = jh_new Timer(kMsPerTick, false);
+	
+	// Register it so removeTimedEvent and friends reach it
+	addTimer(mDefaultTimer);
 };
 
 TimerManager::~TimerManager()
@@ -107,6 +110,7 @@ Timer* TimerManager::getTimer(int tickTimeMs)
 	// We didn't find a timer with the specified tick time so
 	// we need to create a new one and give it to the user.
 	Timer* newTimer = jh_new Timer(tickTimeMs);
+	addTimer(newTimer);
 	
 	return newTimer;
 }
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "TraceRecorder.h"
+#include "Thread.h"
+#include "jh_memory.h"
+#include "logging.h"
+
+#include <sys/syscall.h>
+#include <string.h>
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+// Nothing in here may use TRACE_BEGIN, when built with JH_TRACE_EVENTS it
+//  would record into the TraceRecorder.
+
+volatile bool TraceRecorder::sEnabled = false;
+volatile uint32_t TraceRecorder::sNextFlowId = 0;
+int TraceRecorder::sRecordsPerThread = TraceRecorder::kDefaultRecordsPerThread;
+uint64_t TraceRecorder::sStartTime = 0;
+TraceRecorder::ThreadBuffer * volatile TraceRecorder::sBuffers = NULL;
+__thread TraceRecorder::ThreadBuffer *TraceRecorder::sBuffer = NULL;
+__thread bool TraceRecorder::sCreating = false;
+
+void TraceRecorder::start( int recordsPerThread )
+{
+	if ( recordsPerThread > 0 )
+		sRecordsPerThread = recordsPerThread;
+	
+	sStartTime = TimeUtils::getMonotonicMicros();
+	__sync_synchronize();
+	sEnabled = true;
+}
+
+void TraceRecorder::stop()
+{
+	sEnabled = false;
+	__sync_synchronize();
+}
+
+void TraceRecorder::span( const char *name, uint64_t begin, int64_t arg )
+{
+	record( 'X', name, begin, TimeUtils::getMonotonicMicros() - begin, arg );
+}
+
+void TraceRecorder::flowStart( const char *name, uint32_t id )
+{
+	record( 's', name, TimeUtils::getMonotonicMicros(), 0, id );
+}
+
+void TraceRecorder::flowEnd( const char *name, uint32_t id )
+{
+	record( 'f', name, TimeUtils::getMonotonicMicros(), 0, id );
+}
+
+void TraceRecorder::record( char phase, const char *name, uint64_t time,
+							uint64_t duration, int64_t arg )
+{
+	if ( not sEnabled )
+		return;
+	
+	ThreadBuffer *buf = sBuffer;
+	
+	if ( buf == NULL )
+	{
+		// Creating the buffer can end up recording (allocators and Thread
+		//  both trace) so drop anything recorded while we are doing it.
+		if ( sCreating )
+			return;
+		
+		sCreating = true;
+		buf = sBuffer = createBuffer();
+		sCreating = false;
+	}
+	
+	Record &r = buf->mRecords[ buf->mNext % buf->mSize ];
+	r.mTime = time;
+	r.mDuration = duration;
+	r.mName = name;
+	r.mArg = arg;
+	r.mPhase = phase;
+	
+	// Make sure the record is complete before a reader can see it
+	__sync_synchronize();
+	buf->mNext = buf->mNext + 1;
+}
+
+TraceRecorder::ThreadBuffer *TraceRecorder::createBuffer()
+{
+	ThreadBuffer *buf = jh_new ThreadBuffer;
+	
+	buf->mSize = sRecordsPerThread;
+	buf->mRecords = jh_new Record[ buf->mSize ];
+	buf->mNext = 0;
+	buf->mTid = syscall( SYS_gettid );
+	strncpy( buf->mName, GetThreadName(), sizeof( buf->mName ) );
+	buf->mName[ sizeof( buf->mName ) - 1 ] = '\0';
+	
+	// Push on the list of all buffers
+	do {
+		buf->mNextBuffer = sBuffers;
+	} while ( not __sync_bool_compare_and_swap( &sBuffers, buf->mNextBuffer, 
+												buf ) );
+	
+	return buf;
+}
+
+static void writeJsonString( FILE *out, const char *str )
+{
+	fputc( '"', out );
+	
+	for ( ; *str != '\0'; str++ )
+	{
+		if ( *str == '"' or *str == '\\' )
+			fprintf( out, "\\%c", *str );
+		else if ( (unsigned char)*str < 0x20 )
+			fprintf( out, "\\u%04x", *str );
+		else
+			fputc( *str, out );
+	}
+	
+	fputc( '"', out );
+}
+
+int TraceRecorder::writeJson( FILE *out )
+{
+	int pid = getpid();
+	uint64_t startTime = sStartTime;
+	bool first = true;
+	
+	fprintf( out, "{\"traceEvents\":[" );
+	
+	for ( ThreadBuffer *buf = sBuffers; buf != NULL; buf = buf->mNextBuffer )
+	{
+		uint64_t end = buf->mNext;
+		uint64_t begin = end > buf->mSize ? end - buf->mSize : 0;
+		
+		__sync_synchronize();
+
+		if ( begin == end )
+			continue;
+
+		fprintf( out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+				 "\"tid\":%d,\"args\":{\"name\":", first ? "" : ",", pid, 
+				 buf->mTid );
+		writeJsonString( out, buf->mName );
+		fprintf( out, "}}" );
+		first = false;
+		
+		for ( uint64_t i = begin; i != end; i++ )
+		{
+			const Record &r = buf->mRecords[ i % buf->mSize ];
+			
+			if ( r.mTime < startTime )
+				continue;
+			
+			fprintf( out, ",\n{\"name\":" );
+			writeJsonString( out, r.mName );
+			fprintf( out, ",\"ph\":\"%c\",\"ts\":%llu,\"pid\":%d,\"tid\":%d",
+					 r.mPhase, (unsigned long long)( r.mTime - startTime ),
+					 pid, buf->mTid );
+			
+			if ( r.mPhase == 'X' )
+			{
+				fprintf( out, ",\"cat\":\"span\",\"dur\":%llu", 
+						 (unsigned long long)r.mDuration );
+				if ( r.mArg != kNoArg )
+					fprintf( out, ",\"args\":{\"arg\":%lld}", 
+							 (long long)r.mArg );
+			}
+			else
+			{
+				// Flow ends bind to the slice they are in rather than the
+				//  next slice to start.
+				fprintf( out, ",\"cat\":\"flow\",\"id\":%lld%s", 
+						 (long long)r.mArg, 
+						 r.mPhase == 'f' ? ",\"bp\":\"e\"" : "" );
+			}
+			
+			fprintf( out, "}" );
+		}
+	}
+	
+	fprintf( out, "\n],\"displayTimeUnit\":\"ms\"}\n" );
+	
+	return ferror( out ) ? -1 : 0;
+}
+
+int TraceRecorder::writeJson( const char *filename )
+{
+	FILE *out = fopen( filename, "w" );
+	
+	if ( out == NULL )
+	{
+		LOG_WARN_PERROR( "failed to open %s", filename );
+		return -1;
+	}
+	
+	int res = writeJson( out );
+	
+	if ( fclose( out ) != 0 )
+		res = -1;
+	
+	return res;
+}
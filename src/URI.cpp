@@ -42,17 +42,30 @@ using JHSTD::string;
 
 string gNullString;
 
+static void assign( string &str, const URIView::Part &part )
+{
+	str.assign( part.mData, part.mLength );
+}
+
 URI::URI()
 :	mRelative(false),
 	mModified(false),
-	mModifiedQuery(false)
+	mModifiedQuery(false),
+	mParsedQuery(true),
+	mHostLength(0),
+	mPort(-1),
+	mSchemePort(-1)
 {
 }
 
 URI::URI( const char *uri )
 :	mRelative(false),
 	mModified(false),
-	mModifiedQuery(false)
+	mModifiedQuery(false),
+	mParsedQuery(true),
+	mHostLength(0),
+	mPort(-1),
+	mSchemePort(-1)
 {
 	mFullString = uri;
 	parseString();
@@ -61,7 +74,11 @@ URI::URI( const char *uri )
 URI::URI( const string &uri )
 :	mRelative(false),
 	mModified(false),
-	mModifiedQuery(false)
+	mModifiedQuery(false),
+	mParsedQuery(true),
+	mHostLength(0),
+	mPort(-1),
+	mSchemePort(-1)
 {
 	mFullString = uri;
 	parseString();
@@ -70,7 +87,11 @@ URI::URI( const string &uri )
 URI::URI( const URI &other )
 :	mRelative(false),
 	mModified(false),
-	mModifiedQuery(false)
+	mModifiedQuery(false),
+	mParsedQuery(true),
+	mHostLength(0),
+	mPort(-1),
+	mSchemePort(-1)
 {
 	copyValues(other);
 }
@@ -119,6 +140,7 @@ void URI::copyValues(const URI &other)
 	// Source was just flushed, so we are starting with no modifications
 	mModified = false;
 	mModifiedQuery = false;
+	mParsedQuery = other.mParsedQuery;
 	
 	mFullString = other.mFullString;
 	mQueryString = other.mQueryString;
@@ -127,6 +149,9 @@ void URI::copyValues(const URI &other)
 	mPath = other.mPath;
 	mFragment = other.mFragment;
 	mQueryParams = other.mQueryParams;
+	mHostLength = other.mHostLength;
+	mPort = other.mPort;
+	mSchemePort = other.mSchemePort;
 }
 
 void URI::clear()
@@ -141,6 +166,10 @@ void URI::clear()
 	mPath.clear();
 	mFragment.clear();
 	mQueryParams.clear();
+	mParsedQuery = true;
+	mHostLength = 0;
+	mPort = -1;
+	mSchemePort = -1;
 }
 
 const string &URI::getScheme() const
@@ -152,6 +181,7 @@ void URI::setScheme( const string &scheme )
 {
 	mModified = true;
 	mScheme = scheme;
+	mSchemePort = -1;
 }
 
 const string &URI::getAuthority() const
@@ -163,17 +193,28 @@ void URI::setAuthority( const string &authority )
 {
 	mModified = true;
 	mAuthority = authority;
+	splitAuthority();
+}
+
+void URI::splitAuthority()
+{
+	mHostLength = URIView::splitAuthority( mAuthority.data(), 
+										   mAuthority.size(), mPort );
 }
 
 string URI::getHost() const
 {
-	string::size_type offset = mAuthority.find( ":" );
-	
-	return mAuthority.substr( 0, offset );
+	return mAuthority.substr( 0, mHostLength );
 }
 
 int getSchemePort( const string &str )
 {
+	// Skip the services database for the usual ones
+	if ( str == "http" )
+		return 80;
+	if ( str == "https" )
+		return 443;
+	
 	struct servent *ent = getservbyname( str.c_str(), "tcp" );
 	
 	if ( ent != NULL )
@@ -184,17 +225,13 @@ int getSchemePort( const string &str )
 
 int URI::getPort() const
 {
-	string::size_type offset = mAuthority.find( ":" );
+	if ( mPort >= 0 )
+		return mPort;
 	
-	if ( offset == string::npos )
-		return getSchemePort( getScheme() );
-	else
-	{
-		int port_num = 0;
-		string port = mAuthority.substr( offset + 1 );
-		port_num = strtol( port.c_str(), NULL, 10 );
-		return port_num;
-	}
+	if ( mSchemePort < 0 )
+		mSchemePort = getSchemePort( mScheme );
+	
+	return mSchemePort;
 }
 
 const string &URI::getPath() const
@@ -238,11 +275,16 @@ const string &URI::getQuery() const
 void URI::setQuery( const string &query )
 {
 	mQueryString = query;
-	parseQuery();
+	mQueryParams.clear();
+	mParsedQuery = false;
+	mModifiedQuery = false;
+	mModified = true;
 }
 
 void URI::appendQueryParam( const string &key, const string &value )
 {
+	parseQuery();
+	
 	QueryParam parms(key, value);
 	mQueryParams.push_back( parms );
 	mModifiedQuery = true;
@@ -256,8 +298,9 @@ void URI::removeQueryParam( const string &key )
 	if ( i != -1 )
 	{
 		mQueryParams.erase( i );
+		mModifiedQuery = true;
+		mModified = true;
 	}
-	mModifiedQuery = true;
 }
 
 const string &URI::getQueryParam( const string &key ) const
@@ -276,6 +319,8 @@ const string &URI::getQueryParam( const string &key ) const
 
 int URI::findParam( const string &key ) const
 {
+	parseQuery();
+	
 	for( unsigned i = 0; i < mQueryParams.size(); i++)
 	{
 		if ( mQueryParams[i].mKey == key )
@@ -307,81 +352,38 @@ bool URI::setString( string &uri )
 	return parseString();
 }
 
+bool URI::setString( const char *uri, int len )
+{
+	clear();
+	mFullString.assign( uri, len );
+	return parseString();
+}
+
 bool URI::parseString()
 {
+	URIView view( mFullString.data(), mFullString.size() );
+	
 	mModified = false;
-	mRelative = false;
+	mRelative = view.isRelative();
 	
-	string::size_type start = 0;
-	string::size_type off = mFullString.find( ":" );
+	assign( mScheme, view.getScheme() );
+	assign( mAuthority, view.getAuthority() );
+	assign( mPath, view.getPath() );
+	assign( mQueryString, view.getQuery() );
+	assign( mFragment, view.getFragment() );
 	
-	if ( off != string::npos )
-	{
-		mScheme = mFullString.substr( 0, off );
-		LOG_NOISE( "scheme is %s", mScheme.c_str() );
-		off++;
-		start = off;
-	}
+	LOG_NOISE( "scheme %s auth %s path %s query %s fragment %s", 
+			   mScheme.c_str(), mAuthority.c_str(), mPath.c_str(), 
+			   mQueryString.c_str(), mFragment.c_str() );
 	
-	bool hasAuth = false;
-
-	// if the next chars are // or if they are not a / and we have a scheme
-	//  then parse auth, otherwise if no / is found and we don't have a schem 
-	//  this is a relative URI. 
-	if ( mFullString.find( "//", start ) == start ) 
-	{
-		hasAuth = true;
-		start += 2;
-	}
-	else if ( mFullString.find( "/", start ) != start )
-	{
-		if ( mScheme.empty() )
-		{
-			mRelative = true;
-			hasAuth = false;
-		}
-		else
-		{
-			hasAuth = true;
-		}
-	}		
+	// The query parameters wait until someone asks for one
+	mQueryParams.clear();
+	mParsedQuery = mQueryString.empty();
+	mModifiedQuery = false;
 	
-	if ( hasAuth )
-	{
-		off = mFullString.find( "/", start );
-
-		mAuthority = mFullString.substr( start, off - start );
-		LOG_NOISE( "auth is %s", mAuthority.c_str() );
-
-		start = off;
-	}
-		
-	if ( start < mFullString.size() )
-	{
-		off = mFullString.find( "?", start );
-		
-		mPath = mFullString.substr( start, off - start );
-		
-		LOG_NOISE( "path is %s", mPath.c_str() );
-		
-		if ( off != string::npos )
-		{
-			start = off + 1;
-			off = mFullString.find( "#", start );
-			
-			mQueryString = mFullString.substr( start, off - start );
-			LOG_NOISE( "query is %s", mQueryString.c_str() );
-			
-			if ( parseQuery() == false )
-				return false;
-			
-			if ( off != string::npos )
-			{				
-				mFragment = mFullString.substr( off + 1 );
-				LOG_NOISE( "fragment is %s", mFragment.c_str() );
-			}
-		}
-	}
+	mHostLength = view.getHost().mLength;
+	mPort = view.getPort();
+	mSchemePort = -1;
 
 	return true;
 }
@@ -428,47 +430,23 @@ void URI::buildString() const
 	mModified = false;
 }
 
-bool URI::parseQuery()
+void URI::parseQuery() const
 {
-	mModifiedQuery = false;
-	QueryParam parms;
-
-	if ( mQueryString.empty() )
-	{
-		mQueryParams.clear();
-		return true;
-	}
+	if ( mParsedQuery )
+		return;
 	
-	string::size_type start = 0;	
-	string::size_type off = 0;
+	mParsedQuery = true;
+	mQueryParams.clear();
 	
-	while ( off != string::npos )
-	{
-		off = mQueryString.find( "=", start );
-
-		if ( off == string::npos )
-			return false;
-
-		parms.mKey = mQueryString.substr( start, off - start );
-
-		start = off + 1;
-		off = mQueryString.find( "&", start );
+	int pos = 0;
+	URIView::Param param;
 	
-		if ( off == string::npos )
-		{
-			parms.mParam = mQueryString.substr( start );
-		}
-		else
-		{
-			parms.mParam = mQueryString.substr( start, off - start );
-			start = off + 1;
-			off = mQueryString.find( "=", start );
-		}
-		
-		mQueryParams.push_back( parms );
+	while ( URIView::nextParam( mQueryString.data(), mQueryString.size(), 
+								pos, param ) )
+	{
+		mQueryParams.push_back( QueryParam( param.mKey.str(), 
+											param.mValue.str() ) );
 	}
-	
-	return true;
 }
 
 void URI::buildQuery() const
@@ -494,8 +472,10 @@ void URI::buildQuery() const
 
 string URI::getPathAndQuery() const
 {
-	if (mQueryString.empty()) return mPath;
-	string ret = mPath + "?" + mQueryString;
+	const string &query = getQuery();
+	
+	if (query.empty()) return mPath;
+	string ret = mPath + "?" + query;
 	return ret;
 }
 
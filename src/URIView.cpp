@@ -0,0 +1,334 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "URIView.h"
+
+#include <string.h>
+#include <ctype.h>
+
+//! Value of the hex digit c or -1
+static int hexValue( char c )
+{
+	if ( c >= '0' and c <= '9' )
+		return c - '0';
+	if ( c >= 'a' and c <= 'f' )
+		return c - 'a' + 10;
+	if ( c >= 'A' and c <= 'F' )
+		return c - 'A' + 10;
+	return -1;
+}
+
+bool URIView::Part::equals( const char *str ) const
+{
+	return strncmp( mData, str, mLength ) == 0 and str[ mLength ] == '\0';
+}
+
+bool URIView::Part::equals( const char *str, int len ) const
+{
+	return len == mLength and memcmp( mData, str, len ) == 0;
+}
+
+bool URIView::Part::isEncoded() const
+{
+	for ( int i = 0; i < mLength; i++ )
+	{
+		if ( mData[ i ] == '%' or mData[ i ] == '+' )
+			return true;
+	}
+	
+	return false;
+}
+
+int URIView::Part::decode( char *buf, int size, bool form ) const
+{
+	int len = 0;
+	
+	for ( int i = 0; i < mLength; i++ )
+	{
+		char c = mData[ i ];
+		
+		if ( c == '%' )
+		{
+			if ( i + 2 >= mLength )
+				return -1;
+			
+			int high = hexValue( mData[ i + 1 ] );
+			int low = hexValue( mData[ i + 2 ] );
+			
+			if ( high < 0 or low < 0 )
+				return -1;
+			
+			c = (char)( high * 16 + low );
+			i += 2;
+		}
+		else if ( c == '+' and form )
+		{
+			c = ' ';
+		}
+		
+		if ( len >= size )
+			return -1;
+		
+		buf[ len++ ] = c;
+	}
+	
+	return len;
+}
+
+bool URIView::Part::decode( JHSTD::string &out, bool form ) const
+{
+	out.clear();
+	
+	if ( mLength == 0 )
+		return true;
+	
+	out.resize( mLength );
+	int len = decode( &out[ 0 ], mLength, form );
+	
+	if ( len < 0 )
+	{
+		out.clear();
+		return false;
+	}
+	
+	out.resize( len );
+	return true;
+}
+
+URIView::URIView()
+{
+	clear();
+}
+
+URIView::URIView( const char *uri, int len )
+{
+	parse( uri, len );
+}
+
+void URIView::clear()
+{
+	mUri = NULL;
+	mLength = 0;
+	mScheme.set( -1, 0 );
+	mAuthority.set( -1, 0 );
+	mHost.set( -1, 0 );
+	mPath.set( -1, 0 );
+	mQuery.set( -1, 0 );
+	mFragment.set( -1, 0 );
+	mPort = -1;
+	mRelative = false;
+}
+
+void URIView::parse( const char *uri, int len )
+{
+	clear();
+	
+	if ( uri == NULL )
+		return;
+	
+	if ( len < 0 )
+		len = strlen( uri );
+	
+	mUri = uri;
+	mLength = len;
+	
+	int pos = 0;
+	
+	// A scheme is a letter followed by letters, digits, '+', '-' or '.' and 
+	//  then a ':', anything else is the start of a path
+	if ( len > 0 and isalpha( (unsigned char)uri[ 0 ] ) )
+	{
+		int i = 1;
+		
+		while ( i < len and ( isalnum( (unsigned char)uri[ i ] ) or 
+							  uri[ i ] == '+' or uri[ i ] == '-' or 
+							  uri[ i ] == '.' ) )
+			i++;
+		
+		if ( i < len and uri[ i ] == ':' )
+		{
+			mScheme.set( 0, i );
+			pos = i + 1;
+		}
+	}
+	
+	// "//" always starts an authority.  Without it a scheme followed by 
+	//  anything but a '/' is taken to be an authority too (i.e. mailto:), 
+	//  while no scheme and no '/' is a relative URI.
+	bool hasAuth = false;
+	
+	if ( pos + 1 < len and uri[ pos ] == '/' and uri[ pos + 1 ] == '/' )
+	{
+		hasAuth = true;
+		pos += 2;
+	}
+	else if ( pos >= len or uri[ pos ] != '/' )
+	{
+		if ( mScheme.mOffset < 0 )
+			mRelative = true;
+		else
+			hasAuth = true;
+	}
+	
+	if ( hasAuth )
+	{
+		int start = pos;
+		
+		while ( pos < len and uri[ pos ] != '/' and uri[ pos ] != '?' and 
+				uri[ pos ] != '#' )
+			pos++;
+		
+		mAuthority.set( start, pos - start );
+		mHost.set( start, splitAuthority( uri + start, pos - start, mPort ) );
+	}
+	
+	int start = pos;
+	
+	while ( pos < len and uri[ pos ] != '?' and uri[ pos ] != '#' )
+		pos++;
+	
+	mPath.set( start, pos - start );
+	
+	if ( pos < len and uri[ pos ] == '?' )
+	{
+		start = ++pos;
+		
+		while ( pos < len and uri[ pos ] != '#' )
+			pos++;
+		
+		mQuery.set( start, pos - start );
+	}
+	
+	if ( pos < len )
+	{
+		pos++;
+		mFragment.set( pos, len - pos );
+	}
+}
+
+int URIView::splitAuthority( const char *authority, int len, int &port )
+{
+	int i = 0;
+	
+	// The colons in an IPv6 address are in brackets
+	if ( len > 0 and authority[ 0 ] == '[' )
+	{
+		while ( i < len and authority[ i ] != ']' )
+			i++;
+	}
+	
+	while ( i < len and authority[ i ] != ':' )
+		i++;
+	
+	int host = i;
+	
+	if ( i == len )
+	{
+		port = -1;
+		return host;
+	}
+	
+	port = 0;
+	
+	for ( i++; i < len and isdigit( (unsigned char)authority[ i ] ); i++ )
+	{
+		port = port * 10 + ( authority[ i ] - '0' );
+		
+		if ( port > 65535 )
+		{
+			port = 0;
+			break;
+		}
+	}
+	
+	return host;
+}
+
+bool URIView::nextParam( int &pos, Param &param ) const
+{
+	if ( mQuery.mOffset < 0 )
+		return false;
+	
+	return nextParam( mUri + mQuery.mOffset, mQuery.mLength, pos, param );
+}
+
+bool URIView::nextParam( const char *query, int len, int &pos, 
+						 Param &param )
+{
+	while ( pos < len )
+	{
+		int start = pos;
+		int equals = -1;
+		
+		while ( pos < len and query[ pos ] != '&' )
+		{
+			if ( query[ pos ] == '=' and equals < 0 )
+				equals = pos;
+			pos++;
+		}
+		
+		int end = pos;
+		
+		if ( pos < len )
+			pos++;
+		
+		if ( end == start )
+			continue;
+		
+		if ( equals < 0 )
+		{
+			param.mKey = Part( query + start, end - start );
+			param.mValue = Part( query + end, 0 );
+		}
+		else
+		{
+			param.mKey = Part( query + start, equals - start );
+			param.mValue = Part( query + equals + 1, end - equals - 1 );
+		}
+		
+		return true;
+	}
+	
+	return false;
+}
+
+bool URIView::findParam( const char *key, Part &value ) const
+{
+	int pos = 0;
+	Param param;
+	
+	while ( nextParam( pos, param ) )
+	{
+		if ( param.mKey.equals( key ) )
+		{
+			value = param.mValue;
+			return true;
+		}
+	}
+	
+	return false;
+}
@@ -12,6 +12,19 @@ ifneq ($(JH_GCHEAP), no)
 CFLAGS_PROG_$(DIR) += -DGCHEAP_ENABLED
 endif
 
+#Record a TraceRecorder span for every TRACE_BEGIN
+ifeq ($(JH_TRACE_EVENTS), yes)
+CFLAGS_PROG_$(DIR) += -DJH_TRACE_EVENTS
+endif
+
+#gzip and deflate content-coding, unless JH_ZLIB is no
+ifneq ($(JH_ZLIB), no)
+CFLAGS_PROG_$(DIR) += -DJH_ZLIB
+LDFLAGS_libjhcommon += -lz
+LDFLAGS_libjhcommonmd += -lz
+LDFLAGS_libjhcommongb += -lz
+endif
+
 ifeq ($(PLATFORM),Darwin)
 CFLAGS_PROG_$(DIR) += -DPLATFORM_DARWIN
 endif
@@ -19,10 +32,13 @@ endif
 $(DIR)_JH_COMMON_SRCS = CircularBuffer.cpp Thread.cpp \
 	EventQueue.cpp Selector.cpp Socket.cpp File.cpp \
 	EventThread.cpp EventDispatcher.cpp Timer.cpp jh_memory.cpp \
-	AppArgs.cpp URI.cpp JetHead.cpp FdReaderWriter.cpp \
-	HttpHeaderBase.cpp HttpHeader.cpp HttpRequest.cpp HttpResponse.cpp \
-	HttpAgent.cpp logging.cpp MulticastSocket.cpp \
-	Allocator.cpp Condition.cpp Mutex.cpp Regex.cpp Path.cpp
+	AppArgs.cpp URI.cpp URIView.cpp JetHead.cpp FdReaderWriter.cpp \
+	FieldMap.cpp HttpHeaderBase.cpp HttpHeader.cpp HttpRequest.cpp HttpResponse.cpp HttpParser.cpp HttpChunked.cpp \
+	HttpContentCoding.cpp \
+	HttpAgent.cpp BodyHandler.cpp HttpConnectionPool.cpp AsyncHttpAgent.cpp HttpServer.cpp logging.cpp \
+	MulticastSocket.cpp \
+	Allocator.cpp Condition.cpp Mutex.cpp Regex.cpp RegexProgram.cpp RegexSet.cpp Path.cpp \
+	Metrics.cpp MetricsServer.cpp TraceRecorder.cpp TcpServer.cpp Resolver.cpp
 
 SRCS_libjhcommon := $($(DIR)_JH_COMMON_SRCS)
 
@@ -126,6 +126,16 @@ void GCHeap::free( ObjInfo *info )
 	::free( info );
 }
 
+void GCHeap::getStats( Stats &stats )
+{
+	Mutex::EnterCriticalSection();
+	stats.mCurrentSize = mCurrentSize;
+	stats.mMaxSize = mMaxSize;
+	stats.mNumTotalAllocations = mNumTotalAllocations;
+	stats.mNumCurrentAllocations = mNumCurrentAllocations;
+	Mutex::ExitCriticalSection();
+}
+
 GCHeap::ObjInfo *GCHeap::find( void *ptr )
 {
 	Mutex::EnterCriticalSection();
@@ -0,0 +1,564 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include "HttpAgent.h"
+#include "AsyncHttpAgent.h"
+#include "EventThread.h"
+#include "TcpServer.h"
+#include "jh_memory.h"
+#include "logging.h"
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_INFO );
+
+#include "TestCase.h"
+
+using namespace JetHead;
+
+//! Collects the body, reading from the socket itself when asked to
+class StringBodyHandler : public BodyHandler
+{
+public:
+	void handleData( const char *buf, int len )
+	{
+		mBody.append( buf, len );
+	}
+	
+	int handleSocket( Socket &sock, int len )
+	{
+		char buf[ 4096 ];
+		int res = sock.read( buf, len < (int)sizeof( buf ) ? 
+							 len : (int)sizeof( buf ) );
+		if ( res > 0 )
+			mBody.append( buf, res );
+		return res;
+	}
+	
+	JHSTD::string mBody;
+};
+
+class HttpAgentTest : public TestCase, public TcpServerListener, 
+					 public AsyncHttpListener
+{
+public:
+	HttpAgentTest( int test_id ) : TestCase( "HttpAgentTest" ), mTest( test_id ),
+		mServer( this ), mOpened( 0 ), mLock( "HttpAgentTest" )
+	{
+		char name[ 32 ];
+		sprintf( name, "HttpAgentTest%d", test_id );
+		SetTestName( name );
+	}
+
+	virtual ~HttpAgentTest() {}
+	
+private:
+	struct Connection
+	{
+		JHSTD::string	mRequest;
+		int				mServed;
+		int				mHeld;
+	};
+	
+	struct Result
+	{
+		int				mId;
+		ErrCode			mErr;
+		int				mCode;
+		JHSTD::string	mBody;
+	};
+	
+	static const int kBigSize = 1024 * 1024;
+	
+	int mTest;
+	TcpServer mServer;
+	volatile int mOpened;
+	
+	Mutex mLock;
+	Condition mCond;
+	JetHead::vector<Result> mResults;
+	
+	void Run()
+	{
+		if ( mServer.start( Socket::Address( "127.0.0.1", 0 ) ) != 0 )
+			TestFailed( "Failed to start server" );
+		
+		switch( mTest )
+		{
+			case 0:
+				framingTest();
+				break;
+			case 1:
+				poolTest();
+				break;
+			case 2:
+				retryTest();
+				break;
+			case 3:
+				asyncTest();
+				break;
+			case 4:
+				pipelineTest();
+				break;
+		}
+
+		mServer.stop();
+		TestPassed();
+	}
+
+	bool handleConnection( TcpConnection *conn )
+	{
+		__sync_add_and_fetch( &mOpened, 1 );
+		
+		Connection *state = jh_new Connection;
+		state->mServed = 0;
+		state->mHeld = 0;
+		conn->setPrivateData( (jh_ptr_int_t)state );
+		return true;
+	}
+	
+	void handleClose( TcpConnection *conn )
+	{
+		delete (Connection*)conn->getPrivateData();
+	}
+	
+	// Answers each request with a response chosen by its path
+	void handleData( TcpConnection *conn )
+	{
+		Connection *state = (Connection*)conn->getPrivateData();
+		char buf[ 1024 ];
+		int res;
+		
+		while ( ( res = conn->read( buf, sizeof( buf ) ) ) > 0 )
+			state->mRequest.append( buf, res );
+		
+		JHSTD::string::size_type end;
+		while ( ( end = state->mRequest.find( "\r\n\r\n" ) ) != 
+				JHSTD::string::npos )
+		{
+			JHSTD::string line = state->mRequest.substr( 0, 
+											state->mRequest.find( "\r\n" ) );
+			state->mRequest.erase( 0, end + 4 );
+			
+			bool head = line.compare( 0, 5, "HEAD " ) == 0;
+			JHSTD::string path = line.substr( line.find( ' ' ) + 1 );
+			path.erase( path.find( ' ' ) );
+			
+			if ( path == "/once" and state->mServed > 0 )
+			{
+				// Pretend we timed the connection out just as it was reused
+				conn->abort();
+				return;
+			}
+			state->mServed++;
+			
+			if ( path == "/slow" )
+				continue;
+			
+			// Not answered until a /release comes in behind it, which only
+			//  happens if the client pipelines
+			if ( path == "/hold" )
+			{
+				state->mHeld++;
+				continue;
+			}
+			
+			for ( ; state->mHeld > 0; state->mHeld-- )
+				reply( conn, "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\n",
+					   "held" );
+			
+			if ( path == "/length" or path == "/once" )
+				reply( conn, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n",
+					   head ? "" : "hello" );
+			else if ( path == "/chunked" )
+				reply( conn, "HTTP/1.1 200 OK\r\n"
+					   "Transfer-Encoding: chunked\r\n\r\n",
+					   "5;name=value\r\nhello\r\n6\r\n world\r\n0\r\n"
+					   "X-Checksum: 1234\r\n\r\n" );
+			// Only asked for with HEAD, so there is never a body to compress
+			else if ( path == "/gzip" )
+				reply( conn, "HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\n"
+					   "Content-Length: 25\r\n\r\n", "" );
+			else if ( path == "/nocontent" )
+				reply( conn, "HTTP/1.1 204 No Content\r\n\r\n", "" );
+			else if ( path == "/old" )
+				reply( conn, "HTTP/1.0 200 OK\r\nContent-Length: 5\r\n\r\n",
+					   "hello" );
+			else if ( path == "/close" )
+				reply( conn, "HTTP/1.1 200 OK\r\nConnection: close\r\n"
+					   "Content-Length: 5\r\n\r\n", "hello" );
+			else if ( path == "/eof" )
+			{
+				reply( conn, "HTTP/1.1 200 OK\r\n\r\n", "hello" );
+				conn->close();
+				return;
+			}
+			else if ( path == "/hangup" )
+			{
+				reply( conn, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n",
+					   "hello" );
+				conn->close();
+				return;
+			}
+			else if ( path == "/big" )
+			{
+				char header[ 128 ];
+				sprintf( header, "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n",
+						 kBigSize );
+				conn->write( header, strlen( header ) );
+				
+				JHSTD::string body( kBigSize, 'b' );
+				conn->write( body.data(), body.size() );
+			}
+			else
+				reply( conn, "HTTP/1.1 404 Not Found\r\n"
+					   "Content-Length: 0\r\n\r\n", "" );
+		}
+	}
+	
+	void reply( TcpConnection *conn, const char *header, const char *body )
+	{
+		conn->write( header, strlen( header ) );
+		conn->write( body, strlen( body ) );
+	}
+	
+	//! GET path, checking the body and the number of connections opened
+	void fetch( HttpAgent &agent, const char *path, const char *body,
+				int opened, HttpRequest::MethodType method = 
+				HttpRequest::kMethodGet, ErrCode expected = kNoError )
+	{
+		char uri[ 64 ];
+		sprintf( uri, "http://127.0.0.1:%d%s", mServer.getPort(), path );
+		
+		HttpRequest req( URI( uri ), method );
+		HttpResponse res;
+		StringBodyHandler handler;
+		
+		int err = agent.get( req, res, &handler );
+		if ( err != expected )
+			TestFailed( "%s failed: %s", path, 
+						getErrorString( (ErrCode)err ) );
+		
+		if ( handler.mBody != body )
+			TestFailed( "%s gave \"%s\"", path, handler.mBody.c_str() );
+		
+		if ( mOpened != opened )
+			TestFailed( "%s left %d connections opened, not %d", path, 
+						mOpened, opened );
+	}
+	
+	// Every way a response can end, the connection is only reused when the
+	//  end was marked and the server didn't ask to close
+	void framingTest()
+	{
+		HttpConnectionPool pool;
+		HttpAgent agent;
+		agent.setConnectionPool( &pool );
+		
+		fetch( agent, "/length", "hello", 1 );
+		fetch( agent, "/chunked", "hello world", 1 );
+		fetch( agent, "/length", "", 1, HttpRequest::kMethodHead );
+		
+		// Decoding a response that never had a body isn't cut short
+		HttpAgent decoding;
+		decoding.setConnectionPool( &pool );
+		decoding.setAcceptEncoding( true );
+		fetch( decoding, "/gzip", "", 1, HttpRequest::kMethodHead );
+		// Anything but 200 or 206 counts as not found
+		fetch( agent, "/nocontent", "", 1, HttpRequest::kMethodGet, 
+			   kNotFound );
+		fetch( agent, "/length", "hello", 1 );
+		
+		fetch( agent, "/old", "hello", 1 );
+		fetch( agent, "/length", "hello", 2 );
+		fetch( agent, "/close", "hello", 2 );
+		fetch( agent, "/length", "hello", 3 );
+		fetch( agent, "/eof", "hello", 3 );
+		fetch( agent, "/length", "hello", 4 );
+		
+		// Too big for the agent's buffer, so most goes through handleSocket
+		HttpAgent other;
+		other.setConnectionPool( &pool );
+		fetch( other, "/big", JHSTD::string( kBigSize, 'b' ).c_str(), 4 );
+		fetch( agent, "/length", "hello", 4 );
+		
+		if ( pool.getIdleCount( "127.0.0.1", mServer.getPort() ) != 1 )
+			TestFailed( "Connection not back in the pool" );
+		
+		// Without a pool every request gets its own connection
+		agent.setConnectionPool( NULL );
+		fetch( agent, "/length", "hello", 5 );
+		fetch( agent, "/length", "hello", 6 );
+	}
+	
+	void poolTest()
+	{
+		HttpConnectionPool pool( 1, 100 );
+		HttpAgent agent;
+		agent.setConnectionPool( &pool );
+		int port = mServer.getPort();
+		
+		// Idle too long
+		fetch( agent, "/length", "hello", 1 );
+		usleep( 200000 );
+		fetch( agent, "/length", "hello", 2 );
+		
+		// Closed by the server while idle
+		pool.setIdleTimeout( HttpConnectionPool::kDefaultIdleTimeout );
+		fetch( agent, "/hangup", "hello", 2 );
+		usleep( 50000 );
+		fetch( agent, "/length", "hello", 3 );
+		
+		// Only one per host, the second has to wait for the first
+		bool reused;
+		Socket *first = pool.acquire( "127.0.0.1", port, 1000, reused );
+		if ( first == NULL or not reused )
+			TestFailed( "Didn't get the idle connection" );
+		
+		uint64_t start = TimeUtils::getMonotonicMicros();
+		if ( pool.acquire( "127.0.0.1", port, 100, reused ) != NULL or 
+			 errno != ETIMEDOUT )
+			TestFailed( "Got a second connection" );
+		
+		if ( TimeUtils::getMonotonicMicros() - start < 90000 )
+			TestFailed( "Didn't wait for a connection" );
+		
+		pool.release( first, true );
+		Socket *second = pool.acquire( "127.0.0.1", port, 1000, reused );
+		if ( second != first )
+			TestFailed( "Didn't get the released connection" );
+		pool.release( second, false );
+		
+		if ( pool.getIdleCount( "127.0.0.1", port ) != 0 )
+			TestFailed( "Kept a connection that wasn't reusable" );
+		
+		if ( pool.acquire( "127.0.0.1", 1, 1000, reused ) != NULL )
+			TestFailed( "Connected to a closed port" );
+	}
+	
+	// A pooled connection that fails before anything comes back is tried 
+	//  again on a new one, unless the request can't safely be repeated
+	void retryTest()
+	{
+		HttpConnectionPool pool;
+		HttpAgent agent;
+		agent.setConnectionPool( &pool );
+		
+		fetch( agent, "/length", "hello", 1 );
+		fetch( agent, "/once", "hello", 2 );
+		
+		char uri[ 64 ];
+		sprintf( uri, "http://127.0.0.1:%d/once", mServer.getPort() );
+		HttpRequest req( URI( uri ), HttpRequest::kMethodPost );
+		HttpResponse res;
+		
+		if ( agent.sendAndGet( req, res, "data" ) != kReadFailed or 
+			 mOpened != 2 )
+			TestFailed( "POST was repeated" );
+	}
+	
+	void handleResponse( int id, ErrCode err, HttpResponse &res, 
+						 const JHSTD::string &body )
+	{
+		Result result;
+		result.mId = id;
+		result.mErr = err;
+		result.mCode = res.getResponseCode();
+		result.mBody = body;
+		
+		AutoLock lock( mLock );
+		mResults.push_back( result );
+		mCond.Broadcast();
+	}
+	
+	//! Start an async request for path
+	int start( AsyncHttpAgent &agent, IEventDispatcher *dispatcher, 
+			   const char *path, uint32_t timeoutMs = 5000, int port = 0,
+			   HttpRequest::MethodType method = HttpRequest::kMethodGet )
+	{
+		char uri[ 64 ];
+		sprintf( uri, "http://127.0.0.1:%d%s", 
+				 port != 0 ? port : mServer.getPort(), path );
+		
+		HttpRequest req( URI( uri ), method );
+		return agent.send( req, this, dispatcher, "", NULL, timeoutMs );
+	}
+	
+	//! Wait for the response to id
+	Result wait( int id )
+	{
+		AutoLock lock( mLock );
+		
+		while ( true )
+		{
+			for ( unsigned i = 0; i < mResults.size(); i++ )
+			{
+				if ( mResults[ i ].mId == id )
+				{
+					Result result = mResults[ i ];
+					mResults.erase( i );
+					return result;
+				}
+			}
+			
+			if ( not mCond.Wait( mLock, 10000 ) )
+				TestFailed( "No response to %d", id );
+		}
+	}
+	
+	void check( int id, const char *body, ErrCode err = kNoError, 
+				int code = 200 )
+	{
+		Result result = wait( id );
+		
+		if ( result.mErr != err )
+			TestFailed( "Request %d failed: %s", id, 
+						getErrorString( result.mErr ) );
+		
+		if ( result.mCode != code or result.mBody != body )
+			TestFailed( "Request %d gave %d \"%s\"", id, result.mCode, 
+						result.mBody.c_str() );
+	}
+	
+	// Many requests at once on one selector, sharing a couple of connections
+	void asyncTest()
+	{
+		EventThread dispatcher( "HttpAgentTestEvents" );
+		Selector selector( "HttpAgentTestSelector" );
+		AsyncHttpAgent agent( &selector );
+		agent.setMaxPerHost( 2 );
+		
+		const int kNumRequests = 50;
+		int ids[ kNumRequests ];
+		
+		for ( int i = 0; i < kNumRequests; i++ )
+			ids[ i ] = start( agent, &dispatcher, 
+							  i % 2 == 0 ? "/length" : "/chunked" );
+		
+		for ( int i = 0; i < kNumRequests; i++ )
+			check( ids[ i ], i % 2 == 0 ? "hello" : "hello world" );
+		
+		if ( mOpened != 2 )
+			TestFailed( "Opened %d connections", mOpened );
+		
+		check( start( agent, &dispatcher, "/length", 5000, 0, 
+					  HttpRequest::kMethodHead ), "" );
+		check( start( agent, &dispatcher, "/nocontent" ), "", kNoError, 204 );
+		check( start( agent, &dispatcher, "/missing" ), "", kNoError, 404 );
+		check( start( agent, &dispatcher, "/big" ), 
+			   JHSTD::string( kBigSize, 'b' ).c_str() );
+		
+		// Both kept connections get dropped by the server, the request is
+		//  repeated until it gets a new one
+		int opened = mOpened;
+		check( start( agent, &dispatcher, "/once" ), "hello" );
+		if ( mOpened == opened )
+			TestFailed( "Didn't open a new connection" );
+
+		check( start( agent, &dispatcher, "/eof" ), "hello" );
+		check( start( agent, &dispatcher, "/old" ), "hello" );
+		
+		check( start( agent, &dispatcher, "/slow", 200 ), "", kTimedOut, -1 );
+		check( start( agent, &dispatcher, "/length", 5000, 1 ), "", 
+			   kConnectionFailed, -1 );
+		
+		// Nothing is delivered once cancelled
+		int id = start( agent, &dispatcher, "/slow", 200 );
+		agent.cancel( id );
+		usleep( 400000 );
+		
+		AutoLock lock( mLock );
+		if ( not mResults.empty() )
+			TestFailed( "Got a response to a cancelled request" );
+	}
+	
+	// Requests written behind each other on one connection
+	void pipelineTest()
+	{
+		EventThread dispatcher( "HttpAgentTestEvents" );
+		Selector selector( "HttpAgentTestSelector" );
+		AsyncHttpAgent agent( &selector );
+		agent.setMaxPerHost( 1 );
+		agent.setPipelineDepth( 8 );
+		
+		// Nothing is pipelined until the connection is known to keep alive
+		check( start( agent, &dispatcher, "/length" ), "hello" );
+		
+		int hold = start( agent, &dispatcher, "/hold" );
+		int chunked = start( agent, &dispatcher, "/chunked" );
+		int length = start( agent, &dispatcher, "/length" );
+		
+		check( hold, "held" );
+		check( chunked, "hello world" );
+		check( length, "hello" );
+		
+		if ( mOpened != 1 )
+			TestFailed( "Opened %d connections", mOpened );
+		
+		// The server hangs up after the first, the rest are sent again
+		hold = start( agent, &dispatcher, "/hold" );
+		int hangup = start( agent, &dispatcher, "/hangup" );
+		int ids[ 5 ];
+		for ( int i = 0; i < 5; i++ )
+			ids[ i ] = start( agent, &dispatcher, "/chunked" );
+		
+		check( hold, "held" );
+		check( hangup, "hello" );
+		for ( int i = 0; i < 5; i++ )
+			check( ids[ i ], "hello world" );
+		
+		if ( mOpened != 2 )
+			TestFailed( "Opened %d connections", mOpened );
+		
+		// Nothing goes behind a POST, and it isn't sent behind others
+		hold = start( agent, &dispatcher, "/hold", 500 );
+		int post = start( agent, &dispatcher, "/release", 500, 0, 
+						  HttpRequest::kMethodPost );
+		check( hold, "", kTimedOut, -1 );
+		check( post, "", kTimedOut, -1 );
+	}
+};
+
+static const int gNumTests = 5;
+
+int main( int argc, char*argv[] )
+{
+	TestRunner runner( argv[ 0 ] );
+	
+	TestCase *test_set[ gNumTests ];
+
+	for ( int i = 0; i < gNumTests; i++ )
+		test_set[ i ] = jh_new HttpAgentTest( i );
+	
+	runner.RunAll( test_set, gNumTests );
+
+	return 0;
+}
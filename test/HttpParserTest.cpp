@@ -0,0 +1,906 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "HttpParser.h"
+#include "HttpRequest.h"
+#include "HttpResponse.h"
+#include "CircularBuffer.h"
+#include "HttpChunked.h"
+#include "HttpContentCoding.h"
+
+#include "logging.h"
+#include "jh_memory.h"
+#include "jh_string.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_INFO );
+
+#include "TestCase.h"
+
+using namespace JetHead;
+
+//! Writes everything it's told into a string, so results are easy to compare
+class Recorder : public HttpParserListener
+{
+public:
+	Recorder() : mInBody( false ) {}
+	
+	void handleRequestLine( const char *method, int methodLen,
+							const char *uri, int uriLen, int major, int minor )
+	{
+		add( "R:%.*s %.*s %d.%d", methodLen, method, uriLen, uri, major, minor );
+	}
+	
+	void handleStatusLine( int major, int minor, int code,
+						   const char *reason, int reasonLen )
+	{
+		add( "S:%d.%d %d %.*s", major, minor, code, reasonLen, reason );
+	}
+	
+	void handleField( const char *name, int nameLen,
+					  const char *value, int valueLen )
+	{
+		add( "F:%.*s=%.*s", nameLen, name, valueLen, value );
+	}
+	
+	void handleHeaderEnd()
+	{
+		add( "E" );
+	}
+	
+	void handleBody( const char *data, int len )
+	{
+		// Bodies come in however many pieces the input did, so join them
+		if ( not mInBody )
+			mLog += "|B:";
+		mInBody = true;
+		mLog.append( data, len );
+	}
+	
+	void handleTrailer( const char *name, int nameLen,
+						const char *value, int valueLen )
+	{
+		add( "T:%.*s=%.*s", nameLen, name, valueLen, value );
+	}
+	
+	void handleMessageEnd()
+	{
+		add( "M" );
+	}
+	
+	JHSTD::string mLog;
+	
+private:
+	void add( const char *fmt, ... ) __attribute__ ((__format__ (__printf__, 2, 3)))
+	{
+		char buf[ 256 ];
+		va_list params;
+		
+		va_start( params, fmt );
+		vsnprintf( buf, sizeof( buf ), fmt, params );
+		va_end( params );
+		
+		mLog += "|";
+		mLog += buf;
+		mInBody = false;
+	}
+	
+	bool mInBody;
+};
+
+//! Collects a body in a string
+class StringBody : public BodyHandler
+{
+public:
+	void handleData( const char *buf, int len ) { mData.append( buf, len ); }
+	int handleSocket( Socket &sock, int len ) { return -1; }
+	
+	JHSTD::string mData;
+};
+
+struct Message
+{
+	HttpParser::Type	type;
+	bool				head;
+	const char			*data;
+	const char			*expected;
+};
+
+static const Message gMessages[] = {
+	{ HttpParser::kResponse, false,
+	  "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nX-Thing:  a b  \r\n\r\nhello",
+	  "|S:1.1 200 OK|F:Content-Length=5|F:X-Thing=a b|E|B:hello|M" },
+	{ HttpParser::kResponse, false,
+	  "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+	  "5;name=value\r\nhello\r\n6\r\n world\r\n0\r\nX-Sum: 12\r\n\r\n",
+	  "|S:1.1 200 OK|F:Transfer-Encoding=chunked|E|B:hello world"
+	  "|T:X-Sum=12|M" },
+	{ HttpParser::kResponse, true,
+	  "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n",
+	  "|S:1.1 200 OK|F:Content-Length=5|E|M" },
+	{ HttpParser::kResponse, false,
+	  "\r\nHTTP/1.0 304 Not Modified\nContent-Length: 5\n\n",
+	  "|S:1.0 304 Not Modified|F:Content-Length=5|E|M" },
+	{ HttpParser::kResponse, false,
+	  "HTTP/1.1 100 Continue\r\nX-Early: 1\r\n\r\n"
+	  "HTTP/1.1 102 Processing\r\n\r\n"
+	  "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok",
+	  "|S:1.1 200 OK|F:Content-Length=2|E|B:ok|M" },
+	{ HttpParser::kResponse, false,
+	  "HTTP/1.1 101 Switching Protocols\r\nUpgrade: x\r\n\r\n",
+	  "|S:1.1 101 Switching Protocols|F:Upgrade=x|E|M" },
+	{ HttpParser::kResponse, false,
+	  "HTTP/1.1 200 OK\r\nX-Long: a\r\n  b\r\n\tc\r\n\r\n",
+	  "|S:1.1 200 OK|F:X-Long=a|F:=b|F:=c|E" },
+	{ HttpParser::kRequest, false,
+	  "GET /a/b?c=d HTTP/1.1\r\nHost: h\r\n\r\n",
+	  "|R:GET /a/b?c=d 1.1|F:Host=h|E|M" },
+	{ HttpParser::kRequest, false,
+	  "POST / HTTP/1.1\r\nContent-Length: 4\r\n\r\ndata",
+	  "|R:POST / 1.1|F:Content-Length=4|E|B:data|M" },
+	{ HttpParser::kRequest, false,
+	  "PUT /x HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+	  "A\r\n0123456789\r\n0\r\n\r\n",
+	  "|R:PUT /x 1.1|F:Transfer-Encoding=chunked|E|B:0123456789|M" },
+};
+
+static const int gNumMessages = sizeof( gMessages ) / sizeof( gMessages[ 0 ] );
+
+static const char *gRtspFields[] = { "CSeq", "Session", "Host" };
+
+//! A map with a table, like the RTSP map would have
+class TableFieldMap : public FieldMap
+{
+public:
+	TableFieldMap() : mTable( gRtspFields, 3, kRtspFieldMapStart ) {}
+	
+	FieldType getFieldType( const char *field ) const 
+	{ 
+		return mTable.find( field, strlen( field ) ); 
+	}
+	
+	const char *getFieldTypeString( FieldType type ) const 
+	{ 
+		type -= kRtspFieldMapStart;
+		return ( type >= 0 and type < 3 ) ? gRtspFields[ type ] : NULL;
+	}
+	
+	const FieldTable *getFieldTable() const { return &mTable; }
+	
+private:
+	FieldTable mTable;
+};
+
+//! A map without a table, that has to be searched with getFieldType
+class PlainFieldMap : public FieldMap
+{
+public:
+	FieldType getFieldType( const char *field ) const 
+	{ 
+		return strcasecmp( field, "Timeout" ) == 0 ? kGenaFieldMapStart :
+			kInvalidFieldType;
+	}
+	
+	const char *getFieldTypeString( FieldType type ) const 
+	{ 
+		return type == kGenaFieldMapStart ? "Timeout" : NULL;
+	}
+};
+
+//! A response that knows some extra fields
+class LayeredResponse : public HttpResponse
+{
+public:
+	LayeredResponse( FieldMap *map1, FieldMap *map2 = NULL )
+	{
+		addFieldMap( map1 );
+		addFieldMap( map2 );
+	}
+};
+
+class HttpParserTest : public TestCase
+{
+public:
+	HttpParserTest( int test_id ) : TestCase( "HttpParserTest" ), 
+		mTest( test_id )
+	{
+		char name[ 32 ];
+		sprintf( name, "HttpParserTest%d", test_id );
+		SetTestName( name );
+	}
+
+	virtual ~HttpParserTest() {}
+	
+private:
+	int mTest;
+	
+	void Run()
+	{
+		switch( mTest )
+		{
+			case 0:
+				splitTest();
+				break;
+			case 1:
+				pipelineTest();
+				break;
+			case 2:
+				errorTest();
+				break;
+			case 3:
+				headerTest();
+				break;
+			case 4:
+				fieldMapTest();
+				break;
+			case 5:
+				storageTest();
+				break;
+			case 6:
+				chunkedTest();
+				break;
+			case 7:
+				codingTest();
+				break;
+		}
+
+		TestPassed();
+	}
+	
+	//! Parse msg in pieces of at most step bytes, or random sizes if 0
+	JHSTD::string parse( const Message &msg, int step )
+	{
+		Recorder recorder;
+		HttpParser parser( msg.type, &recorder );
+		int len = strlen( msg.data );
+		int pos = 0;
+		
+		parser.reset( msg.head );
+		
+		while ( pos < len )
+		{
+			int size = step > 0 ? step : rand() % 16 + 1;
+			
+			if ( size > len - pos )
+				size = len - pos;
+			
+			int used = parser.parse( msg.data + pos, size );
+			
+			if ( used != size )
+				TestFailed( "Used %d of %d bytes at %d of \"%s\"", used, size, 
+							pos, msg.data );
+			pos += size;
+		}
+		
+		return recorder.mLog;
+	}
+	
+	// The same messages whole, a byte at a time and in random pieces
+	void splitTest()
+	{
+		for ( int i = 0; i < gNumMessages; i++ )
+		{
+			for ( int step = -20; step <= 100; step++ )
+			{
+				JHSTD::string log = parse( gMessages[ i ], 
+										   step < 0 ? 0 : step == 0 ? 
+										   strlen( gMessages[ i ].data ) : 
+										   step );
+				
+				if ( log != gMessages[ i ].expected )
+					TestFailed( "Message %d in steps of %d gave \"%s\"", i, 
+								step, log.c_str() );
+			}
+		}
+		
+		// A body that runs until the connection closes
+		Recorder recorder;
+		HttpParser parser( HttpParser::kResponse, &recorder );
+		const char *msg = "HTTP/1.0 200 OK\r\n\r\nabc";
+		
+		if ( parser.parse( msg, strlen( msg ) ) != (int)strlen( msg ) or
+			 parser.isDone() or parser.finish() != 0 or 
+			 parser.isKeepAlive() or 
+			 recorder.mLog != "|S:1.0 200 OK|E|B:abc|M" )
+			TestFailed( "Body to close gave \"%s\"", recorder.mLog.c_str() );
+	}
+	
+	// Parsing stops at the end of each message, leaving the next one
+	void pipelineTest()
+	{
+		Recorder recorder;
+		HttpParser parser( HttpParser::kResponse, &recorder );
+		CircularBuffer buf( 256 );
+		const char *msgs = 
+			"HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nabc"
+			"HTTP/1.1 204 No Content\r\n\r\n"
+			"HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 1\r\n\r\nd";
+		
+		// Make the data wrap around the end of the buffer
+		JHSTD::string filler( 200, ' ' );
+		buf.write( (const uint8_t*)filler.data(), filler.size() );
+		buf.read( NULL, filler.size() );
+		buf.write( (const uint8_t*)msgs, strlen( msgs ) );
+		
+		const char *expected[] = {
+			"|S:1.1 200 OK|F:Content-Length=3|E|B:abc|M",
+			"|S:1.1 204 No Content|E|M",
+			"|S:1.1 200 OK|F:Connection=close|F:Content-Length=1|E|B:d|M"
+		};
+		
+		for ( int i = 0; i < 3; i++ )
+		{
+			recorder.mLog.clear();
+			parser.reset();
+			
+			if ( parser.parse( buf ) <= 0 or not parser.isDone() or 
+				 recorder.mLog != expected[ i ] )
+				TestFailed( "Response %d gave \"%s\"", i, 
+							recorder.mLog.c_str() );
+			
+			if ( parser.isKeepAlive() != ( i < 2 ) )
+				TestFailed( "Response %d keep alive wrong", i );
+		}
+		
+		if ( buf.getLength() != 0 )
+			TestFailed( "%d bytes left over", buf.getLength() );
+		
+		// The caller can take body bytes itself
+		recorder.mLog.clear();
+		parser.reset();
+		const char *header = "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n";
+		parser.parse( header, strlen( header ) );
+		
+		if ( parser.getState() != HttpParser::kBody or 
+			 parser.getRemaining() != 10 )
+			TestFailed( "Not in the body" );
+		
+		parser.skip( 7 );
+		parser.parse( "abc", 3 );
+		
+		if ( not parser.isDone() or 
+			 recorder.mLog != "|S:1.1 200 OK|F:Content-Length=10|E|B:abc|M" )
+			TestFailed( "Skip gave \"%s\"", recorder.mLog.c_str() );
+	}
+	
+	void errorTest()
+	{
+		const Message bad[] = {
+			{ HttpParser::kResponse, false, "HTTP/1.1 2000 OK\r\n", NULL },
+			{ HttpParser::kResponse, false, "HTTX/1.1 200 OK\r\n", NULL },
+			{ HttpParser::kResponse, false, 
+			  "HTTP/1.1 200 OK\r\nNo colon\r\n", NULL },
+			{ HttpParser::kResponse, false, 
+			  "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n"
+			  "Content-Length: 6\r\n", NULL },
+			{ HttpParser::kResponse, false, 
+			  "HTTP/1.1 200 OK\r\nContent-Length: -5\r\n", NULL },
+			{ HttpParser::kResponse, false, 
+			  "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nx\r\n", 
+			  NULL },
+			{ HttpParser::kResponse, false, 
+			  "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+			  "1\r\naX\r\n", NULL },
+			{ HttpParser::kRequest, false, "GET /\r\n", NULL },
+			{ HttpParser::kRequest, false, 
+			  "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n", NULL },
+		};
+		
+		for ( unsigned i = 0; i < sizeof( bad ) / sizeof( bad[ 0 ] ); i++ )
+		{
+			Recorder recorder;
+			HttpParser parser( bad[ i ].type, &recorder );
+			
+			if ( parser.parse( bad[ i ].data, strlen( bad[ i ].data ) ) != -1 or
+				 parser.getState() != HttpParser::kError )
+				TestFailed( "Message %d parsed", i );
+			
+			if ( parser.parse( "\r\n", 2 ) != -1 )
+				TestFailed( "Message %d parsed after an error", i );
+		}
+		
+		// Lines are limited whether or not they arrive in one piece
+		JHSTD::string line( "HTTP/1.1 200 OK\r\nX-Big: " );
+		line.append( HttpParser::kMaxLineSize, 'x' );
+		line += "\r\n";
+		
+		Recorder recorder;
+		HttpParser parser( HttpParser::kResponse, &recorder );
+		
+		if ( parser.parse( line.data(), line.size() ) != -1 )
+			TestFailed( "Long line parsed" );
+		
+		parser.reset();
+		
+		int i;
+		for ( i = 0; i < (int)line.size(); i += 100 )
+		{
+			int size = line.size() - i < 100 ? line.size() - i : 100;
+			if ( parser.parse( line.data() + i, size ) < 0 )
+				break;
+		}
+		
+		if ( i >= (int)line.size() )
+			TestFailed( "Long line parsed in pieces" );
+		
+		// Cut short
+		const char *msg = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nab";
+		parser.reset();
+		parser.parse( msg, strlen( msg ) );
+		if ( parser.finish() != -1 )
+			TestFailed( "Short body finished" );
+	}
+	
+	// Headers filled in straight from the parser
+	void headerTest()
+	{
+		HttpResponse res;
+		HttpParser parser( HttpParser::kResponse, &res );
+		const char *msg = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n"
+			"Connection: keep-alive\r\nX-Unknown: 1\r\n"
+			"Content-Type: text/\r\n plain\r\n\r\n";
+		
+		if ( parser.parse( msg, strlen( msg ) ) != (int)strlen( msg ) or 
+			 not parser.isDone() or not parser.isKeepAlive() )
+			TestFailed( "Failed to parse response" );
+		
+		int major, minor;
+		int64_t length;
+		res.getVersion( major, minor );
+		
+		if ( res.getResponseCode() != 404 or major != 1 or minor != 0 or
+			 res.getFieldInt64( HttpFieldMap::kFieldContentLength, 
+								length ) != kNoError or length != 0 or
+			 not res.isKeepAlive() )
+			TestFailed( "Response header wrong" );
+		
+		const char *type = res.getField( HttpFieldMap::kFieldContentType );
+		if ( type == NULL or strcmp( type, "text/ plain" ) != 0 )
+			TestFailed( "Folded field gave \"%s\"", type );
+		
+		HttpRequest req;
+		HttpParser req_parser( HttpParser::kRequest, &req );
+		msg = "DELETE /a?b=c HTTP/1.1\r\nHost: example.com\r\n\r\n";
+		
+		if ( req_parser.parse( msg, strlen( msg ) ) != (int)strlen( msg ) or 
+			 not req_parser.isDone() )
+			TestFailed( "Failed to parse request" );
+		
+		const char *host = req.getField( HttpFieldMap::kFieldHost );
+		if ( req.getMethod() != HttpRequest::kMethodDelete or 
+			 req.getURI().getPath() != "/a" or 
+			 req.getURI().getQuery() != "b=c" or
+			 host == NULL or strcmp( host, "example.com" ) != 0 )
+			TestFailed( "Request header wrong" );
+	}
+	
+	//! Parse msg into res, which should have kept num fields
+	void parseInto( HttpResponse &res, const char *msg, int num )
+	{
+		HttpParser parser( HttpParser::kResponse, &res );
+		
+		if ( parser.parse( msg, strlen( msg ) ) != (int)strlen( msg ) or 
+			 not parser.isDone() )
+			TestFailed( "Failed to parse response" );
+		
+		// Count the field lines, less the first line and the blank one
+		int kept = -2;
+		for ( const char *p = res.getHeader(); 
+			  ( p = strstr( p, "\r\n" ) ) != NULL; p += 2 )
+			kept++;
+		
+		if ( kept != num )
+			TestFailed( "Kept %d fields not %d", kept, num );
+	}
+	
+	// Field names looked up through the hash tables
+	void fieldMapTest()
+	{
+		// Every HTTP field, in any case
+		HttpFieldMap http;
+		FieldMap &map = http;
+		const FieldTable *table = map.getFieldTable();
+		
+		if ( table == NULL or not table->isPerfect() )
+			TestFailed( "HTTP field table not perfect" );
+		
+		for ( int type = HttpFieldMap::kFieldAccept; 
+			  type < HttpFieldMap::kNumFields; type++ )
+		{
+			const char *name = map.getFieldTypeString( type );
+			
+			if ( name == NULL )
+				continue;
+			
+			JHSTD::string upper( name ), lower( name );
+			for ( unsigned i = 0; i < upper.size(); i++ )
+			{
+				upper[ i ] = toupper( upper[ i ] );
+				lower[ i ] = tolower( lower[ i ] );
+			}
+			
+			if ( map.getFieldType( name ) != type or 
+				 map.getFieldType( upper.c_str() ) != type or
+				 table->find( lower.data(), lower.size() ) != type )
+				TestFailed( "%s not found", name );
+			
+			// A slice of a longer name shouldn't match, nor a longer name
+			upper += "x";
+			if ( table->find( upper.data(), upper.size() ) != -1 or
+				 table->find( name, strlen( name ) - 1 ) == type )
+				TestFailed( "%s matched wrong length", name );
+		}
+		
+		// Letters folded with punctuation by the hash must still differ
+		if ( map.getFieldType( "Content_Length" ) != -1 or
+			 map.getFieldType( "" ) != -1 or map.getFieldType( "Hos" ) != -1 )
+			TestFailed( "Unknown field found" );
+		
+		// Maps layered on HTTP, the earlier map wins for Host
+		const char *msg = "HTTP/1.1 200 OK\r\nHOST: a\r\ncseq: 2\r\n"
+			"Session: 3\r\nTimeout: 4\r\nContent-Length: 0\r\n\r\n";
+		LayeredResponse rtsp( jh_new TableFieldMap );
+		parseInto( rtsp, msg, 4 );
+		
+		const char *cseq = rtsp.getField( FieldMap::kRtspFieldMapStart );
+		if ( cseq == NULL or strcmp( cseq, "2" ) != 0 or 
+			 rtsp.getField( HttpFieldMap::kFieldHost ) == NULL or
+			 rtsp.getField( FieldMap::kRtspFieldMapStart + 2 ) != NULL )
+			TestFailed( "Layered table lookup wrong" );
+		
+		// A second header with the same maps shares the merged table
+		LayeredResponse rtsp2( jh_new TableFieldMap );
+		parseInto( rtsp2, msg, 4 );
+		
+		// A map without a table falls back to asking each map
+		LayeredResponse gena( jh_new TableFieldMap, jh_new PlainFieldMap );
+		parseInto( gena, msg, 5 );
+		
+		const char *timeout = gena.getField( FieldMap::kGenaFieldMapStart );
+		if ( timeout == NULL or strcmp( timeout, "4" ) != 0 or 
+			 gena.getField( FieldMap::kRtspFieldMapStart + 1 ) == NULL )
+			TestFailed( "Fallback lookup wrong" );
+	}
+	
+	// Lots of fields, repeated fields and removing them
+	void storageTest()
+	{
+		JHSTD::string msg( "HTTP/1.1 200 OK\r\n" );
+		char line[ 64 ];
+		
+		for ( int i = 0; i < 200; i++ )
+		{
+			sprintf( line, "Set-Cookie: c%d=%d\r\n", i, i );
+			msg += line;
+		}
+		msg += "Content-Type: text/html\r\nContent-Length: 0\r\n\r\n";
+		
+		HttpResponse res;
+		parseInto( res, msg.c_str(), 202 );
+		
+		for ( int i = 0; i < 200; i++ )
+		{
+			const char *cookie = res.getField( HttpFieldMap::kFieldSetCookie, 
+											   i );
+			sprintf( line, "c%d=%d", i, i );
+			
+			if ( cookie == NULL or strcmp( cookie, line ) != 0 )
+				TestFailed( "Cookie %d is %s", i, cookie );
+		}
+		
+		if ( res.getField( HttpFieldMap::kFieldSetCookie, 200 ) != NULL )
+			TestFailed( "Too many cookies" );
+		
+		// Removing goes in order, and leaves the rest alone
+		for ( int i = 0; i < 150; i++ )
+		{
+			if ( res.removeField( HttpFieldMap::kFieldSetCookie ) != kNoError )
+				TestFailed( "Failed to remove cookie %d", i );
+		}
+		
+		const char *cookie = res.getField( HttpFieldMap::kFieldSetCookie );
+		const char *type = res.getField( HttpFieldMap::kFieldContentType );
+		if ( cookie == NULL or strcmp( cookie, "c150=150" ) != 0 or 
+			 type == NULL or strcmp( type, "text/html" ) != 0 )
+			TestFailed( "Wrong fields left after removing" );
+		
+		// Adding after a remove, and folding onto a field that has moved
+		if ( res.removeField( HttpFieldMap::kFieldContentLength ) != 
+			 kNoError or res.removeField( HttpFieldMap::kFieldAge ) != 
+			 kNotFound )
+			TestFailed( "Remove wrong" );
+		
+		res.handleField( "Content-Length", 14, "12", 2 );
+		res.removeField( HttpFieldMap::kFieldContentType );
+		res.handleField( "", 0, "34", 2 );
+		res.addField( HttpFieldMap::kFieldContentType, "text/plain" );
+		
+		const char *length = res.getField( HttpFieldMap::kFieldContentLength );
+		type = res.getField( HttpFieldMap::kFieldContentType );
+		if ( length == NULL or strcmp( length, "12 34" ) != 0 or 
+			 type == NULL or strcmp( type, "text/plain" ) != 0 )
+			TestFailed( "Fields wrong after adding" );
+		
+		const char *header = res.getHeader();
+		if ( strstr( header, "Set-Cookie: c199=199\r\n" 
+					 "Content-Length: 12 34\r\nContent-Type: text/plain\r\n"
+					 "\r\n" ) == NULL or strstr( header, "c149=" ) != NULL )
+			TestFailed( "Header built wrong:\n%s", header );
+	}
+	
+	// The chunked encoder and decoder on their own and chained together
+	void chunkedTest()
+	{
+		char line[ ChunkedEncoder::kMaxSizeLine ];
+		int len = ChunkedEncoder::formatSize( line, 0x1a2b );
+		if ( JHSTD::string( line, len ) != "1a2b\r\n" )
+			TestFailed( "Size line wrong" );
+		
+		StringBody out;
+		ChunkedEncoder encoder( &out, 4 );
+		
+		struct iovec iov[ 2 ];
+		iov[ 0 ].iov_base = const_cast<char*>( "ab" );
+		iov[ 0 ].iov_len = 2;
+		iov[ 1 ].iov_base = const_cast<char*>( "c" );
+		iov[ 1 ].iov_len = 1;
+		
+		encoder.handleData( "hello world", 11 );
+		encoder.handleData( "", 0 );
+		encoder.handleDatav( iov, 2 );
+		encoder.addTrailer( "X-Sum", "12" );
+		encoder.finish();
+		
+		const char *expected = "4\r\nhell\r\n4\r\no wo\r\n3\r\nrld\r\n"
+			"3\r\nabc\r\n0\r\nX-Sum: 12\r\n\r\n";
+		if ( out.mData != expected or not encoder.isFinished() )
+			TestFailed( "Encoded \"%s\"", out.mData.c_str() );
+		
+		// Decode it in every size of piece, with the next message after it
+		JHSTD::string encoded = out.mData + "HTTP/1.1";
+		
+		for ( int step = 1; step <= (int)encoded.size(); step++ )
+		{
+			StringBody body;
+			Recorder trailers;
+			ChunkedDecoder decoder( &body );
+			int pos = 0;
+			
+			decoder.setTrailerListener( &trailers );
+			
+			while ( not decoder.isDone() and pos < (int)encoded.size() )
+			{
+				int size = encoded.size() - pos;
+				if ( size > step )
+					size = step;
+				
+				int used = decoder.decode( encoded.data() + pos, size );
+				if ( used < 0 )
+					TestFailed( "Decode failed at %d in steps of %d", pos, 
+								step );
+				pos += used;
+			}
+			
+			if ( body.mData != "hello worldabc" or pos != (int)out.mData.size()
+				 or trailers.mLog != "|T:X-Sum=12" )
+				TestFailed( "Decoded \"%s\" in steps of %d", 
+							body.mData.c_str(), step );
+		}
+		
+		// Chunks over the limit
+		ChunkedDecoder limited( NULL, 4 );
+		if ( limited.decode( "4\r\nabcd\r\n", 9 ) != 9 or
+			 limited.decode( "5\r\nabcde\r\n", 10 ) != -1 or
+			 limited.getState() != ChunkedDecoder::kError )
+			TestFailed( "Chunk size limit not enforced" );
+		
+		Recorder recorder;
+		HttpParser parser( HttpParser::kRequest, &recorder );
+		const char *msg = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+			"\r\n100000000\r\n";
+		
+		parser.setMaxChunkSize( 1024 * 1024 );
+		if ( parser.parse( msg, strlen( msg ) ) != -1 )
+			TestFailed( "Parser chunk size limit not enforced" );
+		
+		// Encoding straight into a decoder gets back what went in
+		JHSTD::string data;
+		for ( int i = 0; i < 200000; i++ )
+			data += (char)( 'a' + i % 26 );
+		
+		StringBody result;
+		ChunkedDecoder decoder( &result );
+		ChunkedEncoder chained( &decoder );
+		
+		chained.handleData( data.data(), 70000 );
+		chained.handleData( data.data() + 70000, data.size() - 70000 );
+		chained.finish();
+		
+		if ( not decoder.isDone() or result.mData != data )
+			TestFailed( "Chained encoder and decoder lost data" );
+	}
+	
+	//! Decode coded with coding in pieces of step bytes
+	JHSTD::string decode( ContentCoding::Coding coding, 
+						  const JHSTD::string &coded, int step )
+	{
+		JHSTD::string result;
+		AppendBodyHandler out( result );
+		ContentDecoder decoder( &out, coding );
+		
+		for ( unsigned pos = 0; pos < coded.size(); pos += step )
+		{
+			int size = coded.size() - pos;
+			if ( size > step )
+				size = step;
+			
+			if ( decoder.decode( coded.data() + pos, size ) != 0 )
+				TestFailed( "Decode failed at %d in steps of %d", pos, step );
+		}
+		
+		if ( decoder.finish() != 0 )
+			TestFailed( "Decoded body incomplete in steps of %d", step );
+		
+		return result;
+	}
+	
+	// Negotiation, and gzip and deflate through the encoder and decoder
+	void codingTest()
+	{
+		if ( ContentCoding::parse( " GZIP " ) != ContentCoding::kGzip or
+			 ContentCoding::parse( NULL ) != ContentCoding::kIdentity or
+			 ContentCoding::parse( "br" ) != ContentCoding::kUnknown )
+			TestFailed( "Content-Encoding parsed wrong" );
+		
+		if ( not ContentCoding::isSupported() )
+		{
+			if ( ContentCoding::choose( "gzip" ) != ContentCoding::kIdentity )
+				TestFailed( "Chose a coding without zlib" );
+			return;
+		}
+		
+		struct { const char *accept; ContentCoding::Coding coding; } 
+		choices[] = {
+			{ "gzip, deflate", ContentCoding::kGzip },
+			{ "deflate, gzip;q=0.5", ContentCoding::kDeflate },
+			{ "gzip;q=0, deflate;q=0.1", ContentCoding::kDeflate },
+			{ "br, identity", ContentCoding::kIdentity },
+			{ "*", ContentCoding::kGzip },
+			{ "*;q=0.5, gzip;Q=0", ContentCoding::kDeflate },
+			{ "", ContentCoding::kIdentity },
+		};
+		
+		for ( unsigned i = 0; i < sizeof( choices ) / sizeof( choices[ 0 ] );
+			  i++ )
+		{
+			if ( ContentCoding::choose( choices[ i ].accept ) != 
+				 choices[ i ].coding )
+				TestFailed( "Chose wrong for \"%s\"", choices[ i ].accept );
+		}
+		
+		JHSTD::string data;
+		char line[ 64 ];
+		for ( int i = 0; i < 5000; i++ )
+		{
+			sprintf( line, "{\"id\": %d, \"value\": %d},\n", i, rand() % 100 );
+			data += line;
+		}
+		
+		ContentCoding::Coding codings[] = { ContentCoding::kGzip, 
+											ContentCoding::kDeflate };
+		
+		for ( int c = 0; c < 2; c++ )
+		{
+			JHSTD::string coded;
+			AppendBodyHandler out( coded );
+			ContentEncoder encoder( &out, codings[ c ], 9, 4 );
+			
+			// In uneven pieces with a flush part way
+			encoder.handleData( data.data(), 1000 );
+			encoder.flush();
+			encoder.handleData( data.data() + 1000, data.size() - 1000 );
+			encoder.finish();
+			
+			if ( encoder.hasFailed() or coded.size() >= data.size() / 2 )
+				TestFailed( "Encoding %d gave %d bytes", c, 
+							(int)coded.size() );
+			
+			int steps[] = { 1, 7, 100, 4096, (int)coded.size() };
+			for ( int i = 0; i < 5; i++ )
+			{
+				if ( decode( codings[ c ], coded, steps[ i ] ) != data )
+					TestFailed( "Coding %d round trip failed", c );
+			}
+			
+			// Cut short, and too big
+			JHSTD::string result;
+			AppendBodyHandler body( result );
+			ContentDecoder decoder( &body, codings[ c ] );
+			
+			if ( decoder.decode( coded.data(), coded.size() - 4 ) != 0 or
+				 decoder.finish() == 0 )
+				TestFailed( "Short body not noticed" );
+			
+			decoder.reset( codings[ c ] );
+			decoder.setMaxSize( 1000 );
+			if ( decoder.decode( coded.data(), coded.size() ) != -1 or
+				 not decoder.hasFailed() )
+				TestFailed( "Size limit not enforced" );
+			
+			decoder.reset( codings[ c ] );
+			if ( decoder.decode( "not compressed", 14 ) != -1 )
+				TestFailed( "Bad data not noticed" );
+		}
+		
+		// Raw deflate, as some servers send, and two gzip members together
+		JHSTD::string raw;
+		{
+			AppendBodyHandler out( raw );
+			ContentEncoder encoder( &out, ContentCoding::kDeflate );
+			encoder.handleData( "hello", 5 );
+			encoder.finish();
+		}
+		
+		// Strip the 2 byte zlib header and 4 byte checksum
+		raw = raw.substr( 2, raw.size() - 6 );
+		if ( decode( ContentCoding::kDeflate, raw, 3 ) != "hello" )
+			TestFailed( "Raw deflate not decoded" );
+		
+		JHSTD::string members;
+		for ( int i = 0; i < 2; i++ )
+		{
+			AppendBodyHandler out( members );
+			ContentEncoder encoder( &out, ContentCoding::kGzip );
+			encoder.handleData( "hello", 5 );
+			encoder.finish();
+		}
+		
+		if ( decode( ContentCoding::kGzip, members, 5 ) != "hellohello" )
+			TestFailed( "Second gzip member not decoded" );
+	}
+};
+
+static const int gNumTests = 8;
+
+int main( int argc, char*argv[] )
+{
+	TestRunner runner( argv[ 0 ] );
+	
+	TestCase *test_set[ gNumTests ];
+
+	for ( int i = 0; i < gNumTests; i++ )
+		test_set[ i ] = jh_new HttpParserTest( i );
+	
+	runner.RunAll( test_set, gNumTests );
+
+	return 0;
+}
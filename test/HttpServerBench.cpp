@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * Load generator for HttpServer.  Runs a server on loopback and hammers it 
+ *  with keep-alive connections, each from its own thread, then reports the
+ *  requests per second and latency percentiles.
+ *
+ *  httpServerBench -connections 8 -seconds 5 -pipeline 1 -handlers 2
+ */
+
+#include "HttpServer.h"
+#include "HttpParser.h"
+#include "AppArgs.h"
+#include "Thread.h"
+#include "TimeUtils.h"
+#include "jh_memory.h"
+#include "jh_vector.h"
+#include "logging.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+using namespace JetHead;
+
+class HelloHandler : public HttpRequestHandler
+{
+public:
+	void handleRequest( HttpExchange *exchange )
+	{
+		exchange->send( "hello world\n", 12 );
+	}
+};
+
+class BenchArgs : public AppArgs
+{
+public:
+	enum { kConnections, kSeconds, kPipeline, kHandlers, kWorkers };
+	
+	BenchArgs() : mConnections( 8 ), mSeconds( 5 ), mPipeline( 1 ), 
+		mHandlers( 2 ), mWorkers( 1 )
+	{
+		AddOption( "connections", true, true, kConnections );
+		AddOption( "seconds", true, true, kSeconds );
+		AddOption( "pipeline", true, true, kPipeline );
+		AddOption( "handlers", true, true, kHandlers );
+		AddOption( "workers", true, true, kWorkers );
+	}
+	
+	bool handleParam( int key, const char *param ) { return false; }
+	
+	bool handleParam( int key, int param )
+	{
+		if ( param <= 0 )
+			return false;
+		
+		switch ( key )
+		{
+			case kConnections:	mConnections = param; break;
+			case kSeconds:		mSeconds = param; break;
+			case kPipeline:		mPipeline = param; break;
+			case kHandlers:		mHandlers = param; break;
+			case kWorkers:		mWorkers = param; break;
+			default:			return false;
+		}
+		
+		return true;
+	}
+	
+	void usage( const char *prog_name )
+	{
+		printf( "usage: %s [-connections n] [-seconds n] [-pipeline n] "
+				"[-handlers n] [-workers n]\n", prog_name );
+	}
+	
+	int mConnections;
+	int mSeconds;
+	int mPipeline;
+	int mHandlers;
+	int mWorkers;
+};
+
+//! One keep-alive connection, sending mPipeline requests at a time
+class BenchClient : public HttpParserListener
+{
+public:
+	BenchClient( int port, int pipeline, uint64_t endTime ) 
+		: mErrors( 0 ), mPort( port ), mPipeline( pipeline ), 
+		mEndTime( endTime ), mParser( HttpParser::kResponse, this ),
+		mThread( "BenchClient", this, &BenchClient::run ) {}
+	
+	void start() { mThread.Start(); }
+	void join() { mThread.Join(); }
+	
+	//! Microseconds from send to last byte of each response
+	JetHead::vector<uint32_t> mLatencies;
+	int mErrors;
+	
+private:
+	void run()
+	{
+		static const char request[] = 
+			"GET /hello HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+		
+		JHSTD::string batch;
+		for ( int i = 0; i < mPipeline; i++ )
+			batch.append( request, sizeof( request ) - 1 );
+		
+		mSock.setReadTimeout( 5 );
+		if ( mSock.connectMs( Socket::Address( "127.0.0.1", mPort ), 
+							  5000 ) != 0 )
+		{
+			mErrors++;
+			return;
+		}
+		
+		char buf[ 16 * 1024 ];
+		
+		while ( TimeUtils::getMonotonicMicros() < mEndTime )
+		{
+			uint64_t sent = TimeUtils::getMonotonicMicros();
+			
+			if ( mSock.writeAll( batch.data(), batch.size() ) != 
+				 (int)batch.size() )
+			{
+				mErrors++;
+				return;
+			}
+			
+			int done = 0;
+			mParser.reset();
+			
+			while ( done < mPipeline )
+			{
+				int len = mSock.read( buf, sizeof( buf ) );
+				
+				if ( len <= 0 )
+				{
+					mErrors++;
+					return;
+				}
+				
+				int used = 0;
+				while ( used < len )
+				{
+					int res = mParser.parse( buf + used, len - used );
+					
+					if ( res < 0 )
+					{
+						mErrors++;
+						return;
+					}
+					
+					used += res;
+					
+					if ( mParser.isDone() )
+					{
+						mLatencies.push_back( 
+							TimeUtils::getMonotonicMicros() - sent );
+						done++;
+						mParser.reset();
+					}
+					else if ( res == 0 )
+						break;
+				}
+			}
+		}
+	}
+	
+	int			mPort;
+	int			mPipeline;
+	uint64_t	mEndTime;
+	Socket		mSock;
+	HttpParser	mParser;
+	Runnable<BenchClient>	mThread;
+};
+
+static int compareLatency( const void *a, const void *b )
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+int main( int argc, const char *argv[] )
+{
+	BenchArgs args;
+	
+	if ( not args.Parse( argc, argv ) )
+		return 1;
+	
+	HelloHandler hello;
+	HttpServer server( args.mHandlers, args.mWorkers );
+	server.addHandler( "/hello", &hello );
+	server.setMaxPipelined( args.mPipeline );
+	
+	if ( server.start( Socket::Address( "127.0.0.1", 0 ) ) != 0 )
+	{
+		printf( "Failed to start server\n" );
+		return 1;
+	}
+	
+	uint64_t start = TimeUtils::getMonotonicMicros();
+	uint64_t end = start + args.mSeconds * 1000000ULL;
+	
+	JetHead::vector<BenchClient*> clients;
+	for ( int i = 0; i < args.mConnections; i++ )
+	{
+		clients.push_back( jh_new BenchClient( server.getPort(), 
+											   args.mPipeline, end ) );
+		clients[ i ]->start();
+	}
+	
+	JetHead::vector<uint32_t> latencies;
+	int errors = 0;
+	
+	for ( int i = 0; i < args.mConnections; i++ )
+	{
+		clients[ i ]->join();
+		
+		for ( unsigned j = 0; j < clients[ i ]->mLatencies.size(); j++ )
+			latencies.push_back( clients[ i ]->mLatencies[ j ] );
+		
+		errors += clients[ i ]->mErrors;
+		delete clients[ i ];
+	}
+	
+	double elapsed = ( TimeUtils::getMonotonicMicros() - start ) / 1e6;
+	
+	server.stop();
+	
+	int count = latencies.size();
+	printf( "%d connections, pipeline %d, %d handler threads, "
+			"%d workers\n", args.mConnections, args.mPipeline, 
+			args.mHandlers, args.mWorkers );
+	printf( "%d requests in %.2fs, %.0f req/s, %d errors\n", count, 
+			elapsed, count / elapsed, errors );
+	
+	if ( count == 0 )
+		return 1;
+	
+	qsort( &latencies[ 0 ], count, sizeof( uint32_t ), compareLatency );
+	
+	static const double percentiles[] = { 50, 90, 99, 99.9 };
+	printf( "latency (us):" );
+	for ( unsigned i = 0; i < sizeof( percentiles ) / sizeof( double ); i++ )
+	{
+		int idx = (int)( count * percentiles[ i ] / 100 );
+		if ( idx >= count )
+			idx = count - 1;
+		printf( " p%g %u", percentiles[ i ], latencies[ idx ] );
+	}
+	printf( " max %u\n", latencies[ count - 1 ] );
+	
+	return errors == 0 ? 0 : 1;
+}
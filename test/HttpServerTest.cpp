@@ -0,0 +1,753 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "HttpServer.h"
+#include "HttpParser.h"
+#include "HttpChunked.h"
+#include "HttpContentCoding.h"
+#include "HttpAgent.h"
+#include "AsyncHttpAgent.h"
+#include "EventThread.h"
+#include "Selector.h"
+#include "File.h"
+#include "jh_memory.h"
+#include "jh_string.h"
+#include "logging.h"
+
+#include <unistd.h>
+#include <string.h>
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_INFO );
+
+#include "TestCase.h"
+
+using namespace JetHead;
+
+static const char *gFileName = "httpserver.tmp";
+static const int gFileSize = 256 * 1024;
+
+//! Answers with the name it was given, the method, the path and the body
+class EchoHandler : public HttpRequestHandler
+{
+public:
+	EchoHandler( const char *name, int delayMs = 0 ) 
+		: mName( name ), mDelayMs( delayMs ) {}
+	
+	void handleRequest( HttpExchange *exchange )
+	{
+		if ( mDelayMs > 0 )
+			usleep( mDelayMs * 1000 );
+		
+		JHSTD::string body = mName + " " + 
+			exchange->getRequest().getURI().getPath() + " " +
+			exchange->getBody();
+		exchange->send( body );
+	}
+	
+private:
+	JHSTD::string	mName;
+	int				mDelayMs;
+};
+
+//! Sends a body of unknown length
+class ChunkHandler : public HttpRequestHandler
+{
+public:
+	void handleRequest( HttpExchange *exchange )
+	{
+		exchange->startChunked();
+		exchange->sendChunk( "hello ", 6 );
+		exchange->sendChunk( "", 0 );
+		exchange->sendChunk( "world", 5 );
+		exchange->addTrailer( "X-Words", "2" );
+		exchange->finish();
+	}
+};
+
+//! A body that compresses well
+static JHSTD::string bigBody()
+{
+	JHSTD::string body;
+	char line[ 64 ];
+	
+	for ( int i = 0; i < 1000; i++ )
+	{
+		sprintf( line, "<item id=\"%d\">value %d</item>\n", i, i * 7 );
+		body += line;
+	}
+	
+	return body;
+}
+
+//! Sends bigBody whole, or in three pieces under /big/chunked
+class BigHandler : public HttpRequestHandler
+{
+public:
+	void handleRequest( HttpExchange *exchange )
+	{
+		JHSTD::string body = bigBody();
+		
+		if ( exchange->getRequest().getURI().getPath() == "/big" )
+		{
+			exchange->send( body );
+			return;
+		}
+		
+		exchange->startChunked();
+		exchange->sendChunk( body.data(), 100 );
+		exchange->sendChunk( body.data() + 100, 10000 );
+		exchange->sendChunk( body.data() + 10100, body.size() - 10100 );
+		exchange->finish();
+	}
+};
+
+//! Sends the test file from 10 bytes in, asking for more than there is
+class FileHandler : public HttpRequestHandler
+{
+public:
+	FileHandler( int delayMs = 0 ) : mDelayMs( delayMs ) {}
+	
+	void handleRequest( HttpExchange *exchange )
+	{
+		if ( mDelayMs > 0 )
+			usleep( mDelayMs * 1000 );
+		
+		File *file = jh_new File;
+		
+		if ( file->open( gFileName, File::OF_READ ) != kNoError )
+		{
+			delete file;
+			exchange->getResponse().setResponseCode( 500 );
+			exchange->send();
+			return;
+		}
+		
+		exchange->sendFile( file, 10, gFileSize );
+	}
+	
+private:
+	int		mDelayMs;
+};
+
+//! Collects a body in a string
+class StringBody : public BodyHandler
+{
+public:
+	void handleData( const char *buf, int len ) { mData.append( buf, len ); }
+	
+	int handleSocket( Socket &sock, int len )
+	{
+		char buf[ 1024 ];
+		int res = sock.read( buf, len < 1024 ? len : 1024 );
+		if ( res > 0 )
+			mData.append( buf, res );
+		return res;
+	}
+	
+	JHSTD::string mData;
+};
+
+//! A blocking client, reading responses with an HttpParser
+class Client : public HttpParserListener
+{
+public:
+	Client() : mParser( HttpParser::kResponse, this ), mBuffer( 64 * 1024 ),
+		mResponse( NULL ), mBody( NULL ) {}
+	
+	bool connect( int port )
+	{
+		mSock.setReadTimeout( 5 );
+		return mSock.connectMs( Socket::Address( "127.0.0.1", port ), 
+								5000 ) == 0;
+	}
+	
+	bool send( const JHSTD::string &text )
+	{
+		return mSock.writeAll( text.data(), text.size() ) == 
+			(int)text.size();
+	}
+	
+	//! Read the next response, head if it answers a HEAD
+	bool read( HttpResponse &res, JHSTD::string &body, bool head = false )
+	{
+		mResponse = &res;
+		mBody = &body;
+		body.clear();
+		mParser.reset( head );
+		
+		while ( true )
+		{
+			if ( mParser.parse( mBuffer ) < 0 )
+				return false;
+			
+			if ( mParser.isDone() )
+				return true;
+			
+			uint8_t buf[ 4096 ];
+			int len = mSock.read( buf, sizeof( buf ) );
+			
+			if ( len <= 0 )
+				return len == 0 and mParser.finish() == 0;
+			
+			mBuffer.write( buf, len );
+		}
+	}
+	
+	//! Read the header of a response, a byte at a time so none of the body is
+	bool readHeader()
+	{
+		JHSTD::string header;
+		char c;
+		
+		while ( header.size() < 4 or 
+				header.compare( header.size() - 4, 4, "\r\n\r\n" ) != 0 )
+		{
+			if ( mSock.read( &c, 1 ) != 1 )
+				return false;
+			header += c;
+		}
+		
+		return true;
+	}
+	
+	Socket &getSocket() { return mSock; }
+	
+	//! Has the server closed the connection?
+	bool isClosed()
+	{
+		uint8_t c;
+		return mBuffer.getLength() == 0 and mSock.read( &c, 1 ) == 0;
+	}
+	
+	void handleStatusLine( int major, int minor, int code,
+						   const char *reason, int reasonLen )
+	{
+		mResponse->handleStatusLine( major, minor, code, reason, reasonLen );
+	}
+	
+	void handleField( const char *name, int nameLen,
+					  const char *value, int valueLen )
+	{
+		mResponse->handleField( name, nameLen, value, valueLen );
+	}
+	
+	void handleBody( const char *data, int len )
+	{
+		mBody->append( data, len );
+	}
+	
+	void handleTrailer( const char *name, int nameLen,
+						const char *value, int valueLen )
+	{
+		mTrailer.append( name, nameLen );
+		mTrailer += "=";
+		mTrailer.append( value, valueLen );
+	}
+	
+	JHSTD::string	mTrailer;
+	
+private:
+	Socket			mSock;
+	HttpParser		mParser;
+	CircularBuffer	mBuffer;
+	HttpResponse	*mResponse;
+	JHSTD::string	*mBody;
+};
+
+//! Waits for one AsyncHttpAgent response
+class AsyncResult : public AsyncHttpListener
+{
+public:
+	AsyncResult() : mDone( false ), mErr( kNoError ), mCoded( false ) {}
+	
+	bool wait()
+	{
+		AutoLock lock( mLock );
+		
+		while ( not mDone )
+		{
+			if ( not mCond.Wait( mLock, 10000 ) )
+				return false;
+		}
+		
+		return true;
+	}
+	
+	void handleResponse( int id, ErrCode err, HttpResponse &res, 
+						 const JHSTD::string &body )
+	{
+		AutoLock lock( mLock );
+		mErr = err;
+		mBody = body;
+		mCoded = res.getField( HttpFieldMap::kFieldContentEncoding ) != NULL;
+		mDone = true;
+		mCond.Broadcast();
+	}
+	
+	bool			mDone;
+	ErrCode			mErr;
+	bool			mCoded;
+	JHSTD::string	mBody;
+	
+private:
+	Mutex			mLock;
+	Condition		mCond;
+};
+
+class HttpServerTest : public TestCase
+{
+public:
+	HttpServerTest( int test_id ) : TestCase( "HttpServerTest" ), 
+		mTest( test_id ), mRoot( "root" ), mA( "a" ), mAB( "ab" ), 
+		mSlow( "slow", 200 ), mSlowFile( 200 ), mServer( 2 )
+	{
+		char name[ 32 ];
+		sprintf( name, "HttpServerTest%d", test_id );
+		SetTestName( name );
+	}
+
+	virtual ~HttpServerTest() {}
+	
+private:
+	int mTest;
+	
+	EchoHandler		mRoot;
+	EchoHandler		mA;
+	EchoHandler		mAB;
+	EchoHandler		mSlow;
+	ChunkHandler	mChunk;
+	FileHandler		mFile;
+	FileHandler		mSlowFile;
+	BigHandler		mBig;
+	HttpServer		mServer;
+	
+	void Run()
+	{
+		mServer.addHandler( "/a", &mA );
+		mServer.addHandler( "/a/b/", &mAB );
+		mServer.addHandler( "/slow", &mSlow );
+		mServer.addHandler( "/chunked", &mChunk );
+		mServer.addHandler( "/file", &mFile );
+		mServer.addHandler( "/slowfile", &mSlowFile );
+		mServer.addHandler( "/big", &mBig );
+		
+		switch( mTest )
+		{
+			case 0:
+				routeTest();
+				break;
+			case 1:
+				pipelineTest();
+				break;
+			case 2:
+				chunkedTest();
+				break;
+			case 3:
+				fileTest();
+				break;
+			case 4:
+				errorTest();
+				break;
+			case 5:
+				compressionTest();
+				break;
+		}
+
+		mServer.stop( 1000 );
+		TestPassed();
+	}
+	
+	void start( Client &client )
+	{
+		if ( mServer.start( Socket::Address( "127.0.0.1", 0 ) ) != 0 )
+			TestFailed( "Failed to start server" );
+		
+		if ( not client.connect( mServer.getPort() ) )
+			TestFailed( "Failed to connect" );
+	}
+	
+	//! Read a response that should be coded with coding and decode it
+	void expectCoded( Client &client, ContentCoding::Coding coding, 
+					  const JHSTD::string &expected )
+	{
+		HttpResponse res;
+		JHSTD::string body;
+		
+		if ( not client.read( res, body ) )
+			TestFailed( "Failed to read response" );
+		
+		if ( ContentCoding::parse( res.getField( 
+				 HttpFieldMap::kFieldContentEncoding ) ) != coding )
+			TestFailed( "Wrong Content-Encoding" );
+		
+		if ( coding != ContentCoding::kIdentity and 
+			 ( res.getField( HttpFieldMap::kFieldVary ) == NULL or
+			   body.size() >= expected.size() ) )
+			TestFailed( "Coded response wrong" );
+		
+		JHSTD::string decoded;
+		AppendBodyHandler out( decoded );
+		ContentDecoder decoder( &out, coding );
+		
+		if ( decoder.decode( body.data(), body.size() ) != 0 or
+			 decoder.finish() != 0 or decoded != expected )
+			TestFailed( "Decoded %d bytes, wanted %d", (int)decoded.size(),
+						(int)expected.size() );
+	}
+	
+	//! Read a response checking its code and body
+	void expect( Client &client, int code, const char *body, 
+				 bool head = false )
+	{
+		HttpResponse res;
+		JHSTD::string got;
+		
+		if ( not client.read( res, got, head ) )
+			TestFailed( "Failed to read response" );
+		
+		if ( res.getResponseCode() != code or got != body )
+			TestFailed( "Got %d \"%s\" wanted %d \"%s\"", 
+						res.getResponseCode(), got.c_str(), code, body );
+	}
+	
+	// Requests go to the handler with the longest matching prefix
+	void routeTest()
+	{
+		Client client;
+		start( client );
+		
+		client.send( "GET /a HTTP/1.1\r\n\r\n" );
+		expect( client, 200, "a /a " );
+		
+		client.send( "GET /a/b/c?d=e HTTP/1.1\r\n\r\n" );
+		expect( client, 200, "ab /a/b/c " );
+		
+		client.send( "GET /a/bc HTTP/1.1\r\n\r\n" );
+		expect( client, 200, "a /a/bc " );
+		
+		// Nothing handles /ab, until there is a handler for everything
+		client.send( "GET /ab HTTP/1.1\r\n\r\n" );
+		expect( client, 404, "" );
+		
+		mServer.stop();
+		mServer.addHandler( "/", &mRoot );
+		
+		Client client2;
+		start( client2 );
+		
+		client2.send( "GET /ab HTTP/1.1\r\n\r\n" );
+		expect( client2, 200, "root /ab " );
+	}
+	
+	// Pipelined requests are answered in order, however long each takes
+	void pipelineTest()
+	{
+		Client client;
+		start( client );
+		
+		client.send( "GET /slow HTTP/1.1\r\n\r\n"
+					 "POST /a/1 HTTP/1.1\r\nContent-Length: 4\r\n\r\nbody"
+					 "GET /a/b/2 HTTP/1.1\r\n\r\n"
+					 "POST /a/3 HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+					 "2\r\nab\r\n1\r\nc\r\n0\r\n\r\n" );
+		
+		expect( client, 200, "slow /slow " );
+		expect( client, 200, "a /a/1 body" );
+		expect( client, 200, "ab /a/b/2 " );
+		expect( client, 200, "a /a/3 abc" );
+		
+		// Asked to close after the next one, so it does
+		client.send( "GET /a/4 HTTP/1.1\r\nConnection: close\r\n\r\n"
+					 "GET /a/5 HTTP/1.1\r\n\r\n" );
+		
+		HttpResponse res;
+		JHSTD::string body;
+		if ( not client.read( res, body ) or body != "a /a/4 " or 
+			 res.isKeepAlive() )
+			TestFailed( "Close request answered wrong" );
+		
+		if ( not client.isClosed() )
+			TestFailed( "Connection not closed" );
+		
+		// More requests than the server reads ahead still all get answers
+		Client client2;
+		if ( not client2.connect( mServer.getPort() ) )
+			TestFailed( "Failed to connect" );
+		
+		JHSTD::string many;
+		for ( int i = 0; i < HttpServer::kDefaultMaxPipelined * 3; i++ )
+			many += "GET /a HTTP/1.1\r\n\r\n";
+		client2.send( many );
+		
+		for ( int i = 0; i < HttpServer::kDefaultMaxPipelined * 3; i++ )
+			expect( client2, 200, "a /a " );
+	}
+	
+	// Bodies of unknown length are chunked, or end with the connection
+	void chunkedTest()
+	{
+		Client client;
+		start( client );
+		
+		HttpResponse res;
+		JHSTD::string body;
+		
+		client.send( "GET /chunked HTTP/1.1\r\n\r\n" );
+		if ( not client.read( res, body ) or body != "hello world" or
+			 not res.hasFieldToken( HttpFieldMap::kFieldTransferEncoding, 
+									"chunked" ) )
+			TestFailed( "Chunked body wrong: %s", body.c_str() );
+		
+		if ( client.mTrailer != "X-Words=2" )
+			TestFailed( "Trailer wrong: %s", client.mTrailer.c_str() );
+		
+		// Decoding straight from the socket leaves the next response there
+		client.send( "GET /chunked HTTP/1.1\r\n\r\nGET /a HTTP/1.1\r\n\r\n" );
+		
+		if ( not client.readHeader() )
+			TestFailed( "Failed to read header" );
+		
+		StringBody decoded;
+		ChunkedDecoder decoder( &decoded );
+		while ( not decoder.isDone() )
+		{
+			if ( decoder.handleSocket( client.getSocket(), 4096 ) <= 0 )
+				TestFailed( "Failed to decode from socket" );
+		}
+		
+		if ( decoded.mData != "hello world" )
+			TestFailed( "Decoded %s from socket", decoded.mData.c_str() );
+		
+		expect( client, 200, "a /a " );
+		
+		client.send( "HEAD /chunked HTTP/1.1\r\n\r\n" );
+		expect( client, 200, "", true );
+		
+		// Still usable after the HEAD
+		client.send( "GET /a HTTP/1.1\r\n\r\n" );
+		expect( client, 200, "a /a " );
+		
+		Client old;
+		if ( not old.connect( mServer.getPort() ) )
+			TestFailed( "Failed to connect" );
+		
+		HttpResponse res2;
+		old.send( "GET /chunked HTTP/1.0\r\n\r\n" );
+		if ( not old.read( res2, body ) or body != "hello world" or
+			 res2.getField( HttpFieldMap::kFieldTransferEncoding ) != NULL )
+			TestFailed( "HTTP/1.0 body wrong: %s", body.c_str() );
+		
+		// A 1.0 client that asks to keep the connection gets to
+		Client old2;
+		if ( not old2.connect( mServer.getPort() ) )
+			TestFailed( "Failed to connect" );
+		
+		old2.send( "GET /a HTTP/1.0\r\nConnection: keep-alive\r\n\r\n"
+				   "GET /a/b HTTP/1.0\r\n\r\n" );
+		expect( old2, 200, "a /a " );
+		expect( old2, 200, "ab /a/b " );
+		
+		if ( not old2.isClosed() )
+			TestFailed( "HTTP/1.0 connection not closed" );
+	}
+	
+	// File bodies come straight from the file
+	void fileTest()
+	{
+		File file;
+		if ( file.open( gFileName, File::OF_RDWR | File::OF_CREATE | 
+						File::OF_TRUNC ) != kNoError )
+			TestFailed( "Failed to create %s", gFileName );
+		
+		JHSTD::string contents;
+		for ( int i = 0; i < gFileSize; i++ )
+			contents += (char)( 'a' + i % 26 );
+		file.write( contents.data(), contents.size() );
+		file.close();
+		
+		Client client;
+		start( client );
+		
+		HttpResponse res;
+		JHSTD::string body;
+		int64_t length;
+		
+		client.send( "GET /file HTTP/1.1\r\n\r\nGET /a HTTP/1.1\r\n\r\n" );
+		if ( not client.read( res, body ) or body != contents.substr( 10 ) )
+			TestFailed( "File body wrong, %d bytes", (int)body.size() );
+		
+		expect( client, 200, "a /a " );
+		
+		HttpResponse head;
+		client.send( "HEAD /file HTTP/1.1\r\n\r\nGET /a HTTP/1.1\r\n\r\n" );
+		if ( not client.read( head, body, true ) or not body.empty() or 
+			 head.getFieldInt64( HttpFieldMap::kFieldContentLength, 
+								 length ) != kNoError or 
+			 length != gFileSize - 10 )
+			TestFailed( "HEAD of file wrong" );
+		
+		expect( client, 200, "a /a " );
+		
+		// The selector is idle by the time this handler answers, so the 
+		//  header goes out while the handler thread is still in sendFile
+		HttpResponse slow;
+		client.send( "HEAD /slowfile HTTP/1.1\r\n\r\n" );
+		if ( not client.read( slow, body, true ) or not body.empty() or 
+			 slow.getFieldInt64( HttpFieldMap::kFieldContentLength, 
+								 length ) != kNoError or 
+			 length != gFileSize - 10 )
+			TestFailed( "Slow HEAD of file wrong" );
+		
+		unlink( gFileName );
+	}
+	
+	// Bodies are compressed for clients that ask, and HttpAgent asks
+	void compressionTest()
+	{
+		mServer.setCompression( true );
+		
+		Client client;
+		start( client );
+		
+		if ( not ContentCoding::isSupported() )
+		{
+			client.send( "GET /big HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n" );
+			expect( client, 200, bigBody().c_str() );
+			return;
+		}
+		
+		ContentCoding::Coding gzip = ContentCoding::kGzip;
+		ContentCoding::Coding deflate = ContentCoding::kDeflate;
+		ContentCoding::Coding identity = ContentCoding::kIdentity;
+		
+		client.send( "GET /big HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n"
+					 "GET /big HTTP/1.1\r\n\r\n"
+					 "GET /big/chunked HTTP/1.1\r\n"
+					 "Accept-Encoding: deflate\r\n\r\n"
+					 "GET /a HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n" );
+		
+		expectCoded( client, gzip, bigBody() );
+		expectCoded( client, identity, bigBody() );
+		expectCoded( client, deflate, bigBody() );
+		
+		// Too small to bother with
+		expectCoded( client, identity, "a /a " );
+		
+		// An HTTP/1.0 client gets it coded up to the close
+		Client old;
+		if ( not old.connect( mServer.getPort() ) )
+			TestFailed( "Failed to connect" );
+		
+		old.send( "GET /big/chunked HTTP/1.0\r\nAccept-Encoding: gzip\r\n\r\n" );
+		expectCoded( old, gzip, bigBody() );
+		
+		// HttpAgent decodes it for its BodyHandler
+		char url[ 64 ];
+		sprintf( url, "http://127.0.0.1:%d/big/chunked", mServer.getPort() );
+		
+		HttpAgent agent;
+		HttpResponse res;
+		JHSTD::string body;
+		AppendBodyHandler handler( body );
+		
+		agent.setConnectionPool( NULL );
+		agent.setAcceptEncoding( true );
+		
+		if ( agent.get( URI( url ), res, &handler ) != kNoError or 
+			 body != bigBody() or 
+			 res.getField( HttpFieldMap::kFieldContentEncoding ) == NULL )
+			TestFailed( "HttpAgent got %d bytes", (int)body.size() );
+		
+		// So does AsyncHttpAgent, for the body it collects
+		EventThread dispatcher( "HttpServerTestEvents" );
+		Selector selector( "HttpServerTestSelector" );
+		AsyncHttpAgent async( &selector );
+		AsyncResult result;
+		URI uri( url );
+		HttpRequest req( uri );
+		
+		async.setAcceptEncoding( true );
+		async.send( req, &result, &dispatcher );
+		
+		if ( not result.wait() )
+			TestFailed( "No response from AsyncHttpAgent" );
+		
+		if ( result.mErr != kNoError or result.mBody != bigBody() or 
+			 not result.mCoded )
+			TestFailed( "AsyncHttpAgent got %d bytes", 
+						(int)result.mBody.size() );
+	}
+	
+	// The server answers for itself when it can't handle a request
+	void errorTest()
+	{
+		mServer.setMaxBodySize( 10 );
+		
+		Client client;
+		start( client );
+		
+		client.send( "POST /a HTTP/1.1\r\nContent-Length: 10\r\n\r\n"
+					 "0123456789" );
+		expect( client, 200, "a /a 0123456789" );
+		
+		client.send( "POST /a HTTP/1.1\r\nContent-Length: 11\r\n\r\n"
+					 "0123456789A" );
+		expect( client, 413, "" );
+		
+		if ( not client.isClosed() )
+			TestFailed( "Connection not closed after 413" );
+		
+		Client client2;
+		if ( not client2.connect( mServer.getPort() ) )
+			TestFailed( "Failed to connect" );
+		
+		client2.send( "GET /a HTTP/1.1\r\n\r\nnot http\r\n\r\n" );
+		expect( client2, 200, "a /a " );
+		expect( client2, 400, "" );
+		
+		if ( not client2.isClosed() )
+			TestFailed( "Connection not closed after 400" );
+	}
+};
+
+static const int gNumTests = 6;
+
+int main( int argc, char*argv[] )
+{
+	TestRunner runner( argv[ 0 ] );
+	
+	TestCase *test_set[ gNumTests ];
+
+	for ( int i = 0; i < gNumTests; i++ )
+		test_set[ i ] = jh_new HttpServerTest( i );
+	
+	runner.RunAll( test_set, gNumTests );
+
+	return 0;
+}
@@ -0,0 +1,518 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <unistd.h>
+#include "Metrics.h"
+#include "MetricsServer.h"
+#include "EventThread.h"
+#include "Selector.h"
+#include "Socket.h"
+#include "jh_memory.h"
+#include "logging.h"
+
+using namespace JetHead;
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_INFO );
+
+#include "TestCase.h"
+
+struct HistogramTestData {
+	uint64_t	value;
+	int			expected_bucket;
+};
+
+HistogramTestData histogram_test_data[] = {
+	{ 0,			0 },
+	{ 1,			1 },
+	{ 2,			2 },
+	{ 3,			2 },
+	{ 4,			3 },
+	{ 1023,			10 },
+	{ 1024,			11 },
+	{ 1ULL << 40,	Histogram::kNumBuckets - 1 },
+};
+
+class MetricsTest : public TestCase, public StallListener, 
+	public SelectorListener
+{
+public:
+	MetricsTest( int test_id ) : TestCase( "MetricsTest" ), mTest( test_id )
+	{
+		char name[ 32 ];
+		sprintf( name, "MetricsTest%d", test_id );
+		SetTestName( name );
+	}
+
+	virtual ~MetricsTest() {}
+	
+private:
+	int mTest;
+	
+	void Run()
+	{
+		switch( mTest )
+		{
+			case 0:
+				counterTest();
+				break;
+			case 1:
+				gaugeTest();
+				break;
+			case 2:
+				histogramTest();
+				break;
+			case 3:
+				registryTest();
+				break;
+			case 4:
+				textTest();
+				break;
+			case 5:
+				dispatcherTest();
+				break;
+			case 6:
+				serverTest();
+				break;
+			case 7:
+				stallTest();
+				break;
+			case 8:
+				selectorStallTest();
+				break;
+			case 9:
+				churnTest();
+				break;
+		}
+
+		TestPassed();
+	}
+
+	// Bump a counter from a few threads and make sure no counts get lost 
+	//  across the shards.
+	void counterThread()
+	{
+		SmartPtr<Counter> c = 
+			MetricsRegistry::getInstance()->getCounter( "test_counter_total" );
+		for ( int i = 0; i < kIterations; i++ )
+			c->increment();
+	}
+	
+	static const int kIterations = 100000;
+	static const int kNumThreads = 4;
+	
+	void counterTest()
+	{
+		SmartPtr<Counter> c = 
+			MetricsRegistry::getInstance()->getCounter( "test_counter_total" );
+		
+		if ( c == NULL )
+			TestFailed( "Failed to create counter" );
+		
+		if ( c->getValue() != 0 )
+			TestFailed( "New counter not zero" );
+		
+		Runnable<MetricsTest> *threads[ kNumThreads ];
+		
+		for ( int i = 0; i < kNumThreads; i++ )
+		{
+			threads[ i ] = jh_new Runnable<MetricsTest>( "counter", this, 
+											&MetricsTest::counterThread );
+			threads[ i ]->Start();
+		}
+
+		for ( int i = 0; i < kNumThreads; i++ )
+		{
+			threads[ i ]->Join();
+			delete threads[ i ];
+		}
+		
+		if ( c->getValue() != kIterations * kNumThreads )
+			TestFailed( "Counter is %lld expected %d", 
+						(long long)c->getValue(), kIterations * kNumThreads );
+
+		c->increment( 10 );
+		
+		if ( c->getValue() != kIterations * kNumThreads + 10 )
+			TestFailed( "Counter increment by 10 failed" );
+	}
+	
+	void gaugeTest()
+	{
+		SmartPtr<Gauge> g = 
+			MetricsRegistry::getInstance()->getGauge( "test_gauge" );
+
+		if ( g == NULL )
+			TestFailed( "Failed to create gauge" );
+
+		g->set( 10 );
+		g->add( 5 );
+		g->add( -20 );
+		
+		if ( g->getValue() != -5 )
+			TestFailed( "Gauge is %lld expected -5", (long long)g->getValue() );
+		
+		g->set( 42 );
+		
+		if ( g->getValue() != 42 )
+			TestFailed( "Gauge set failed" );
+	}
+	
+	void histogramTest()
+	{
+		for ( int i = 0; i < JH_ARRAY_SIZE( histogram_test_data ); i++ )
+		{
+			int bucket = Histogram::getBucket( histogram_test_data[ i ].value );
+			if ( bucket != histogram_test_data[ i ].expected_bucket )
+				TestFailed( "value %llu in bucket %d expected %d", 
+							(unsigned long long)histogram_test_data[ i ].value,
+							bucket, histogram_test_data[ i ].expected_bucket );
+			
+			if ( histogram_test_data[ i ].value > 
+				 Histogram::getBucketLimit( bucket ) )
+				TestFailed( "value %llu above limit of bucket %d",
+							(unsigned long long)histogram_test_data[ i ].value,
+							bucket );
+		}
+		
+		SmartPtr<Histogram> h = 
+			MetricsRegistry::getInstance()->getHistogram( "test_histogram" );
+
+		Histogram::Snapshot snap;
+		h->getSnapshot( snap );
+		
+		if ( snap.mCount != 0 or snap.getPercentile( 50 ) != 0 )
+			TestFailed( "New histogram not empty" );
+		
+		// 90 small values and 10 large ones
+		for ( int i = 0; i < 90; i++ )
+			h->observe( 3 );
+		for ( int i = 0; i < 10; i++ )
+			h->observe( 1000 );
+
+		h->getSnapshot( snap );
+
+		if ( snap.mCount != 100 or snap.mSum != 90 * 3 + 10 * 1000 )
+			TestFailed( "count %llu sum %llu", (unsigned long long)snap.mCount,
+						(unsigned long long)snap.mSum );
+		
+		if ( snap.getPercentile( 50 ) != 3 )
+			TestFailed( "p50 is %llu", 
+						(unsigned long long)snap.getPercentile( 50 ) );
+		
+		if ( snap.getPercentile( 99 ) != 1023 )
+			TestFailed( "p99 is %llu", 
+						(unsigned long long)snap.getPercentile( 99 ) );
+		
+		if ( snap.getMean() != ( 90 * 3 + 10 * 1000 ) / 100 )
+			TestFailed( "mean is %llu", (unsigned long long)snap.getMean() );
+	}
+	
+	void registryTest()
+	{
+		MetricsRegistry *reg = MetricsRegistry::getInstance();
+		int start = reg->getNumMetrics();
+		
+		{
+			SmartPtr<Counter> c1 = reg->getCounter( "test_shared", "a=\"1\"" );
+			SmartPtr<Counter> c2 = reg->getCounter( "test_shared", "a=\"1\"" );
+			SmartPtr<Counter> c3 = reg->getCounter( "test_shared", "a=\"2\"" );
+			
+			if ( c1 != c2 )
+				TestFailed( "Same name and labels gave different counters" );
+			
+			if ( c1 == c3 )
+				TestFailed( "Different labels gave same counter" );
+			
+			if ( reg->getGauge( "test_shared", "a=\"1\"" ) != NULL )
+				TestFailed( "Got a gauge for a counter name" );
+			
+			if ( reg->getNumMetrics() != start + 2 )
+				TestFailed( "Expected 2 new metrics got %d", 
+							reg->getNumMetrics() - start );
+		}
+		
+		// Releasing the last reference removes them from the registry
+		if ( reg->getNumMetrics() != start )
+			TestFailed( "Metrics not removed when released" );
+	}
+	
+	// Get and drop the same counter from a few threads so that gets race
+	//  with the last reference going away.
+	void churnThread()
+	{
+		for ( int i = 0; i < kChurnIterations; i++ )
+		{
+			SmartPtr<Counter> c = 
+				MetricsRegistry::getInstance()->getCounter( "test_churn_total" );
+			c->increment();
+		}
+	}
+	
+	static const int kChurnIterations = 20000;
+	
+	void churnTest()
+	{
+		MetricsRegistry *reg = MetricsRegistry::getInstance();
+		int start = reg->getNumMetrics();
+		
+		Runnable<MetricsTest> *threads[ kNumThreads ];
+		
+		for ( int i = 0; i < kNumThreads; i++ )
+		{
+			threads[ i ] = jh_new Runnable<MetricsTest>( "churn", this, 
+											&MetricsTest::churnThread );
+			threads[ i ]->Start();
+		}
+
+		for ( int i = 0; i < kNumThreads; i++ )
+		{
+			threads[ i ]->Join();
+			delete threads[ i ];
+		}
+		
+		if ( reg->getNumMetrics() != start )
+			TestFailed( "Expected %d metrics got %d", start, 
+						reg->getNumMetrics() );
+	}
+	
+	void textTest()
+	{
+		SmartPtr<Counter> c = 
+			MetricsRegistry::getInstance()->getCounter( "test_text_total", 
+														"id=\"x\"" );
+		SmartPtr<Histogram> h = 
+			MetricsRegistry::getInstance()->getHistogram( "test_text_usecs" );
+		
+		c->increment( 7 );
+		h->observe( 5 );
+
+		JHSTD::string text;
+		MetricsRegistry::getInstance()->writeText( text );
+		
+		const char *expected[] = {
+			"# TYPE test_text_total counter\n",
+			"test_text_total{id=\"x\"} 7\n",
+			"# TYPE test_text_usecs histogram\n",
+			"test_text_usecs_bucket{le=\"7\"} 1\n",
+			"test_text_usecs_bucket{le=\"+Inf\"} 1\n",
+			"test_text_usecs_sum 5\n",
+			"test_text_usecs_count 1\n",
+		};
+		
+		for ( int i = 0; i < JH_ARRAY_SIZE( expected ); i++ )
+		{
+			if ( text.find( expected[ i ] ) == JHSTD::string::npos )
+				TestFailed( "Missing \"%s\" in:\n%s", expected[ i ], text.c_str() );
+		}
+	}
+	
+	void handleAgent() {}
+	
+	void dispatcherTest()
+	{
+		EventThread thread( "MetricsTestThread" );
+		
+		SmartPtr<Counter> c = MetricsRegistry::getInstance()->getCounter( 
+			"jh_eventdispatcher_events_total", 
+			"dispatcher=\"MetricsTestThread\"" );
+		SmartPtr<Gauge> g = MetricsRegistry::getInstance()->getGauge( 
+			"jh_eventqueue_depth", "queue=\"MetricsTestThread\"" );
+		
+		for ( int i = 0; i < 10; i++ )
+		{
+			SyncEventAgent0<MetricsTest> *agent = jh_new 
+				SyncEventAgent0<MetricsTest>( this, &MetricsTest::handleAgent );
+			agent->send( &thread );
+		}
+		
+		if ( c->getValue() != 10 )
+			TestFailed( "Dispatched %lld expected 10", (long long)c->getValue() );
+		
+		if ( g->getValue() != 0 )
+			TestFailed( "Queue depth %lld expected 0", (long long)g->getValue() );
+	}
+	
+	void serverTest()
+	{
+		MetricsServer server;
+		SmartPtr<Counter> c = 
+			MetricsRegistry::getInstance()->getCounter( "test_server_total" );
+		c->increment( 3 );
+		
+		if ( server.start( 0 ) != 0 )
+			TestFailed( "Failed to start server" );
+		
+		Socket sock;
+		Socket::Address addr( "127.0.0.1", server.getPort() );
+		
+		if ( sock.connect( addr ) != 0 )
+			TestFailed( "Failed to connect to port %d", server.getPort() );
+
+		char buf[ 4096 ];
+		int len = sock.readAll( buf, sizeof( buf ) - 1 );
+		
+		if ( len <= 0 )
+			TestFailed( "Failed to read metrics" );
+		
+		buf[ len ] = '\0';
+		
+		if ( strstr( buf, "test_server_total 3\n" ) == NULL )
+			TestFailed( "Counter not in scrape:\n%s", buf );
+	}
+
+	void handleStall( const StallReport &report )
+	{
+		mReport = report;
+		mNumStalls++;
+	}
+	
+	void handleSlowAgent()
+	{
+		usleep( 30000 );
+	}
+	
+	void stallTest()
+	{
+		EventThread thread( "StallTestThread" );
+		thread.setStallThreshold( 20 );
+		mNumStalls = 0;
+		EventDispatcher::setStallListener( this );
+		
+		AsyncEventAgent0<MetricsTest> *slow = jh_new 
+			AsyncEventAgent0<MetricsTest>( this, &MetricsTest::handleSlowAgent );
+		slow->send( &thread );
+		
+		// Queued behind the slow agent so it will wait at least as long as
+		//  the slow agent runs.
+		SyncEventAgent0<MetricsTest> *agent = jh_new 
+			SyncEventAgent0<MetricsTest>( this, &MetricsTest::handleAgent );
+		agent->send( &thread );
+		
+		// The dispatcher records the first sync agent after waking us up, so
+		//  send another to be sure it has been counted.
+		agent = jh_new SyncEventAgent0<MetricsTest>( this, 
+													 &MetricsTest::handleAgent );
+		agent->send( &thread );
+		
+		EventDispatcher::setStallListener( NULL );
+		
+		if ( mNumStalls != 1 )
+			TestFailed( "Got %d stalls expected 1", mNumStalls );
+		
+		if ( strcmp( mReport.mDispatcher, "StallTestThread" ) != 0 )
+			TestFailed( "Stall reported on %s", mReport.mDispatcher );
+		
+		if ( mReport.mEventId != Event::kAgentEventId or 
+			 mReport.mTarget != this or mReport.mMethod == NULL or 
+			 mReport.mFd != -1 )
+			TestFailed( "Stall did not identify the agent" );
+
+		if ( mReport.mRunTime < 20000 )
+			TestFailed( "Stall run time %llu", 
+						(unsigned long long)mReport.mRunTime );
+		
+		SmartPtr<Histogram> wait = MetricsRegistry::getInstance()->getHistogram( 
+			"jh_eventdispatcher_queue_wait_us", "dispatcher=\"StallTestThread\"" );
+		SmartPtr<Histogram> run = MetricsRegistry::getInstance()->getHistogram( 
+			"jh_eventdispatcher_run_time_us", "dispatcher=\"StallTestThread\"" );
+		
+		Histogram::Snapshot waitSnap, runSnap;
+		wait->getSnapshot( waitSnap );
+		run->getSnapshot( runSnap );
+		
+		if ( runSnap.mCount < 2 or runSnap.getPercentile( 100 ) < 20000 )
+			TestFailed( "Run time histogram count %llu max %llu", 
+						(unsigned long long)runSnap.mCount,
+						(unsigned long long)runSnap.getPercentile( 100 ) );
+
+		if ( waitSnap.mCount < 2 or waitSnap.getPercentile( 100 ) < 20000 )
+			TestFailed( "Queue wait histogram count %llu max %llu", 
+						(unsigned long long)waitSnap.mCount,
+						(unsigned long long)waitSnap.getPercentile( 100 ) );
+	}
+	
+	void processFileEvents( int fd, short events, jh_ptr_int_t private_data )
+	{
+		char c;
+		read( fd, &c, 1 );
+		usleep( 30000 );
+		mGotFileEvent = true;
+	}
+	
+	void selectorStallTest()
+	{
+		Selector selector( "StallTestSelector" );
+		selector.setStallThreshold( 20 );
+		mNumStalls = 0;
+		mGotFileEvent = false;
+		EventDispatcher::setStallListener( this );
+		
+		int fds[ 2 ];
+		if ( pipe( fds ) != 0 )
+			TestFailed( "Failed to create pipe" );
+		
+		selector.addListener( fds[ 0 ], POLLIN, this );
+		write( fds[ 1 ], "x", 1 );
+		
+		for ( int i = 0; i < 100 and not mGotFileEvent; i++ )
+			usleep( 10000 );
+		
+		selector.removeListener( fds[ 0 ], this );
+		EventDispatcher::setStallListener( NULL );
+		close( fds[ 0 ] );
+		close( fds[ 1 ] );
+		
+		if ( mNumStalls != 1 )
+			TestFailed( "Got %d stalls expected 1", mNumStalls );
+		
+		if ( mReport.mFd != fds[ 0 ] or mReport.mTarget != 
+			 static_cast<SelectorListener*>( this ) )
+			TestFailed( "Stall did not identify the listener" );
+	}
+
+	StallReport mReport;
+	volatile int mNumStalls;
+	volatile bool mGotFileEvent;
+};
+
+static const int gNumTests = 10;
+
+int main( int argc, char*argv[] )
+{
+	TestRunner runner( argv[ 0 ] );
+	
+	TestCase *test_set[ gNumTests ];
+
+	for ( int i = 0; i < gNumTests; i++ )
+		test_set[ i ] = jh_new MetricsTest( i );
+	
+	runner.RunAll( test_set, gNumTests );
+
+	return 0;
+}
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Benchmark for Regex on inputs that take a backtracking matcher 
+ *  exponential or polynomial time.  Each case is run on longer and longer
+ *  strings, the time per byte should stay about the same as they grow.
+ *  Then RegexSet searches a log for several REs at once.
+ *
+ *  regexBench -max 100000 -bytes 20000000
+ */
+
+#include "Regex.h"
+#include "RegexSet.h"
+#include "AppArgs.h"
+#include "TimeUtils.h"
+#include "logging.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_NOTICE );
+
+class BenchArgs : public AppArgs
+{
+public:
+	enum { kMax, kBytes };
+	
+	BenchArgs() : mMax( 100000 ), mBytes( 20000000 )
+	{
+		AddOption( "max", true, true, kMax );
+		AddOption( "bytes", true, true, kBytes );
+	}
+	
+	bool handleParam( int key, const char *param ) { return false; }
+	
+	bool handleParam( int key, int param )
+	{
+		if ( param <= 0 )
+			return false;
+		
+		switch ( key )
+		{
+			case kMax:		mMax = param; break;
+			case kBytes:	mBytes = param; break;
+			default:		return false;
+		}
+		
+		return true;
+	}
+	
+	void usage( const char *prog_name )
+	{
+		printf( "usage: %s [-max length] [-bytes per measurement]\n", 
+				prog_name );
+	}
+	
+	int mMax;
+	int mBytes;
+};
+
+enum Input {
+	kAs,			// aaaa...a
+	kAsThenB,		// aaaa...ab
+	kRandomAB,		// abbab...bc
+	kToken,			// a long HTTP token
+	kPath,			// /abc/abc/.../abc.html
+	kLog			// lines of a log with nothing wrong in it
+};
+
+struct BenchCase
+{
+	const char	*mName;
+	const char	*mRegex;
+	Input		mInput;
+	bool		mMatch;
+};
+
+static BenchCase gCases[] = {
+	{ "nested star", "(a*)*b", kAs, false },
+	{ "nested star, match", "(a*)*b", kAsThenB, true },
+	{ "overlapping alternation", "(a|aa)*c", kAs, false },
+	{ "optional prefix", "a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?"
+		"aaaaaaaaaaaaaaaaaaaac", kAs, false },
+	{ "many stars", "a*a*a*a*a*a*a*a*a*a*b", kAs, false },
+	{ "DFA states", "[ab]*a[ab]{9}c", kRandomAB, true },
+	{ "DFA cache thrash", "[ab]*a[ab]{14}c", kRandomAB, true },
+	{ "header token", "[!#$%&'\\*\\+\\.^_`|~0-9A-Za-z\\-]+:", kToken, true },
+	{ "path with groups", "/(\\w+/)*(\\w+)\\.html", kPath, true },
+};
+
+struct SetBenchCase
+{
+	const char	*mName;
+	const char	*mRegexes[ 8 ];
+	Input		mInput;
+	bool		mMatch;
+};
+
+static SetBenchCase gSetCases[] = {
+	{ "set, one first byte", { "#\\d+" }, kLog, false },
+	{ "set, 8 REs", { "ERROR", "FATAL", "timeout after \\d+ms", "panic:", 
+					  "Segmentation fault", "Out of memory", "WARN(ING)?", 
+					  "denied" }, kLog, false },
+	{ "set, 8 REs, match", { "ERROR", "FATAL", "timeout after \\d+ms", 
+							 "panic:", "Segmentation fault", "Out of memory",
+							 "WARN(ING)?", "served in \\d+ms" }, kLog, true },
+};
+
+static std::string makeInput( Input input, int len )
+{
+	std::string s;
+	uint32_t seed = 1;
+	
+	switch ( input )
+	{
+		case kAs:
+			s.assign( len, 'a' );
+			break;
+			
+		case kAsThenB:
+			s.assign( len - 1, 'a' );
+			s += 'b';
+			break;
+			
+		case kRandomAB:
+			for ( int i = 0; i < len - 1; i++ )
+			{
+				seed = seed * 1103515245 + 12345;
+				s += ( seed >> 16 ) & 1 ? 'a' : 'b';
+			}
+			
+			// Make sure it matches
+			if ( len > 16 )
+			{
+				s[ len - 11 ] = 'a';
+				s[ len - 16 ] = 'a';
+			}
+			s += 'c';
+			break;
+			
+		case kToken:
+			while ( (int)s.size() < len - 1 )
+				s += "X-Custom_Header.Name";
+			s.resize( len - 1 );
+			s += ':';
+			break;
+			
+		case kPath:
+			while ( (int)s.size() < len - 10 )
+				s += "/abc";
+			s += "/page.html";
+			break;
+			
+		case kLog:
+			while ( (int)s.size() < len )
+				s += "2024-05-01 12:00:00 INFO request served in 3ms\n";
+			s.resize( len );
+			break;
+	}
+	
+	return s;
+}
+
+static bool benchRegexes( BenchArgs &args )
+{
+	for ( unsigned c = 0; c < JH_ARRAY_SIZE( gCases ); c++ )
+	{
+		Regex regex;
+		
+		if ( regex.prepare( gCases[ c ].mRegex ) != JetHead::kNoError )
+		{
+			printf( "Failed to prepare %s\n", gCases[ c ].mRegex );
+			return false;
+		}
+		
+		for ( int len = 100; len <= args.mMax; len *= 10 )
+		{
+			std::string s = makeInput( gCases[ c ].mInput, len );
+			int parses = args.mBytes / s.size();
+			
+			if ( parses < 1 )
+				parses = 1;
+			
+			uint64_t start = TimeUtils::getMonotonicMicros();
+			
+			for ( int i = 0; i < parses; i++ )
+			{
+				if ( regex.parse( s ) != gCases[ c ].mMatch )
+				{
+					printf( "%s gave the wrong answer\n", gCases[ c ].mName );
+					return false;
+				}
+			}
+			
+			uint64_t micros = TimeUtils::getMonotonicMicros() - start;
+			
+			printf( "%-26s %10d %12d %10.2f\n", gCases[ c ].mName, 
+					(int)s.size(), parses, 
+					micros * 1000.0 / ( (double)parses * s.size() ) );
+		}
+	}
+	
+	return true;
+}
+
+static bool benchSets( BenchArgs &args )
+{
+	for ( unsigned c = 0; c < JH_ARRAY_SIZE( gSetCases ); c++ )
+	{
+		RegexSet set;
+		
+		for ( int i = 0; i < 8 and gSetCases[ c ].mRegexes[ i ] != NULL; i++ )
+		{
+			if ( set.add( gSetCases[ c ].mRegexes[ i ] ) < 0 )
+			{
+				printf( "Failed to prepare %s\n", gSetCases[ c ].mRegexes[ i ] );
+				return false;
+			}
+		}
+		
+		for ( int len = 100; len <= args.mMax; len *= 10 )
+		{
+			std::string s = makeInput( gSetCases[ c ].mInput, len );
+			JetHead::vector<int> matches;
+			int searches = args.mBytes / s.size();
+			
+			if ( searches < 1 )
+				searches = 1;
+			
+			uint64_t start = TimeUtils::getMonotonicMicros();
+			
+			for ( int i = 0; i < searches; i++ )
+			{
+				if ( set.search( s, matches ) != gSetCases[ c ].mMatch )
+				{
+					printf( "%s gave the wrong answer\n", gSetCases[ c ].mName );
+					return false;
+				}
+			}
+			
+			uint64_t micros = TimeUtils::getMonotonicMicros() - start;
+			
+			printf( "%-26s %10d %12d %10.2f\n", gSetCases[ c ].mName, 
+					(int)s.size(), searches, 
+					micros * 1000.0 / ( (double)searches * s.size() ) );
+		}
+	}
+	
+	return true;
+}
+
+int main( int argc, const char *argv[] )
+{
+	BenchArgs args;
+	
+	if ( not args.Parse( argc, argv ) )
+		return 1;
+	
+	printf( "%-26s %10s %12s %10s\n", "case", "length", "parses", "ns/byte" );
+	
+	if ( not benchRegexes( args ) or not benchSets( args ) )
+		return 1;
+	
+	return 0;
+}
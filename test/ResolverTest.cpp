@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <unistd.h>
+#include <netdb.h>
+#include "Resolver.h"
+#include "EventThread.h"
+#include "jh_memory.h"
+#include "logging.h"
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_INFO );
+
+#include "TestCase.h"
+
+using namespace JetHead;
+
+static volatile int gStubLookups = 0;
+static volatile int gStubDelay = 0;
+
+// Knows "good.test" as 10.0.0.1 and 10.0.0.2 and nothing else
+static int stubLookup( const char *name, JetHead::vector<Socket::Address> &addrs )
+{
+	__sync_add_and_fetch( &gStubLookups, 1 );
+	
+	if ( gStubDelay > 0 )
+		usleep( gStubDelay * 1000 );
+	
+	if ( strcmp( name, "good.test" ) != 0 and strcmp( name, "slow.test" ) != 0 )
+		return EAI_NONAME;
+	
+	addrs.push_back( Socket::Address( "10.0.0.1" ) );
+	addrs.push_back( Socket::Address( "10.0.0.2" ) );
+	return 0;
+}
+
+class ResolverTest : public TestCase, public ResolverListener
+{
+public:
+	ResolverTest( int test_id ) : TestCase( "ResolverTest" ), mTest( test_id ),
+		mNumResolved( 0 ), mLastError( -1 ), mNumAddrs( 0 )
+	{
+		char name[ 32 ];
+		sprintf( name, "ResolverTest%d", test_id );
+		SetTestName( name );
+	}
+
+	virtual ~ResolverTest() {}
+	
+private:
+	int mTest;
+	volatile int mNumResolved;
+	volatile int mLastError;
+	volatile int mNumAddrs;
+	
+	void Run()
+	{
+		gStubLookups = 0;
+		gStubDelay = 0;
+		
+		switch( mTest )
+		{
+			case 0:
+				hostsTest();
+				break;
+			case 1:
+				cacheTest();
+				break;
+			case 2:
+				asyncTest();
+				break;
+		}
+
+		TestPassed();
+	}
+	
+	void handleResolved( const char *name, int error, 
+						 const JetHead::vector<Socket::Address> &addrs )
+	{
+		mLastError = error;
+		mNumAddrs = addrs.size();
+		__sync_add_and_fetch( &mNumResolved, 1 );
+	}
+	
+	void waitResolved( int n )
+	{
+		for ( int i = 0; i < 500 and mNumResolved < n; i++ )
+			usleep( 10000 );
+		
+		if ( mNumResolved != n )
+			TestFailed( "Resolved %d times, wanted %d", mNumResolved, n );
+	}
+	
+	// The real getaddrinfo, localhost should be in /etc/hosts
+	void hostsTest()
+	{
+		Resolver resolver;
+		JetHead::vector<Socket::Address> addrs;
+		
+		if ( resolver.resolve( "localhost", addrs ) != 0 or addrs.size() == 0 )
+			TestFailed( "Failed to resolve localhost" );
+		
+		// Depending on /etc/hosts and gai.conf either family may come first
+		if ( strcmp( addrs[ 0 ].getName(), "127.0.0.1" ) != 0 and 
+			 strcmp( addrs[ 0 ].getName(), "::1" ) != 0 )
+			TestFailed( "localhost is %s", addrs[ 0 ].getName() );
+		
+		Socket::Address addr( "localhost", 80 );
+		if ( strcmp( addr.getName(), addrs[ 0 ].getName() ) != 0 or 
+			 addr.getPort() != 80 )
+			TestFailed( "Address( \"localhost\" ) is %s:%d", addr.getName(), 
+						addr.getPort() );
+		
+		if ( resolver.resolve( "no.such.host.invalid", addrs ) == 0 )
+			TestFailed( "Resolved an .invalid name" );
+	}
+	
+	// Answers and failures are both cached until their TTL runs out
+	void cacheTest()
+	{
+		Resolver resolver;
+		JetHead::vector<Socket::Address> addrs;
+		
+		resolver.setLookupFunction( stubLookup );
+		resolver.setCacheTtl( 200, 100 );
+		
+		for ( int i = 0; i < 3; i++ )
+		{
+			if ( resolver.resolve( "good.test", addrs ) != 0 or 
+				 addrs.size() != 2 )
+				TestFailed( "Failed to resolve good.test" );
+			
+			if ( resolver.resolve( "bad.test", addrs ) != EAI_NONAME or
+				 addrs.size() != 0 )
+				TestFailed( "Resolved bad.test" );
+		}
+		
+		if ( gStubLookups != 2 )
+			TestFailed( "%d lookups, wanted 2", gStubLookups );
+		
+		// The failure expires first
+		usleep( 150 * 1000 );
+		resolver.resolve( "good.test", addrs );
+		resolver.resolve( "bad.test", addrs );
+		
+		if ( gStubLookups != 3 )
+			TestFailed( "%d lookups, wanted 3", gStubLookups );
+		
+		usleep( 100 * 1000 );
+		resolver.resolve( "good.test", addrs );
+		
+		if ( gStubLookups != 4 )
+			TestFailed( "%d lookups, wanted 4", gStubLookups );
+		
+		resolver.flushCache();
+		resolver.resolve( "good.test", addrs );
+		
+		if ( gStubLookups != 5 )
+			TestFailed( "%d lookups, wanted 5", gStubLookups );
+	}
+	
+	// Lookups happen on the workers and don't hold up anything else
+	void asyncTest()
+	{
+		Resolver resolver;
+		EventThread dispatcher( "ResolverTest" );
+		JetHead::vector<Socket::Address> addrs;
+		
+		resolver.setLookupFunction( stubLookup );
+		gStubDelay = 300;
+		
+		// Three asks while the first is still going share one lookup
+		uint64_t start = TimeUtils::getMonotonicMicros();
+		for ( int i = 0; i < 3; i++ )
+			resolver.resolveAsync( "slow.test", this, &dispatcher );
+		
+		// None of these should wait for the slow lookup
+		Mutex::EnterCriticalSection();
+		Mutex::ExitCriticalSection();
+		
+		if ( mNumResolved != 0 or 
+			 TimeUtils::getMonotonicMicros() - start > 200 * 1000 )
+			TestFailed( "resolveAsync waited for the lookup" );
+		
+		waitResolved( 3 );
+		
+		if ( gStubLookups != 1 or mLastError != 0 or mNumAddrs != 2 )
+			TestFailed( "%d lookups, error %d, %d addrs", gStubLookups, 
+						mLastError, mNumAddrs );
+		
+		// Cached now, still comes back through the dispatcher
+		resolver.resolveAsync( "slow.test", this, &dispatcher );
+		waitResolved( 4 );
+		
+		if ( gStubLookups != 1 )
+			TestFailed( "Cached answer was looked up again" );
+		
+		// A failure, and a cancelled lookup that must never call back
+		resolver.resolveAsync( "bad.test", this, &dispatcher );
+		waitResolved( 5 );
+		
+		if ( mLastError != EAI_NONAME )
+			TestFailed( "Got error %d for bad.test", mLastError );
+		
+		resolver.resolveAsync( "other.test", this, &dispatcher );
+		resolver.cancel( this );
+		usleep( 500 * 1000 );
+		
+		if ( mNumResolved != 5 )
+			TestFailed( "Cancelled lookup called back" );
+	}
+};
+
+static const int gNumTests = 3;
+
+int main( int argc, char*argv[] )
+{
+	TestRunner runner( argv[ 0 ] );
+	
+	TestCase *test_set[ gNumTests ];
+
+	for ( int i = 0; i < gNumTests; i++ )
+		test_set[ i ] = jh_new ResolverTest( i );
+	
+	runner.RunAll( test_set, gNumTests );
+
+	return 0;
+}
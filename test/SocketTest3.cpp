@@ -0,0 +1,748 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include "Socket.h"
+#include "MulticastSocket.h"
+#include "TimeUtils.h"
+#include "File.h"
+#include "HttpResponse.h"
+#include "jh_memory.h"
+#include "logging.h"
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_INFO );
+
+#include "TestCase.h"
+
+using namespace JetHead;
+
+class SocketTest3 : public TestCase, public SocketListener
+{
+public:
+	SocketTest3( int test_id ) : TestCase( "SocketTest3" ), mTest( test_id ),
+		mSelector( "SocketTest3" ), mAccepted( NULL ), mWritable( 0 ),
+		mDatagrams( 0 ), mBadDatagrams( 0 )
+	{
+		char name[ 32 ];
+		sprintf( name, "SocketTest3-%d", test_id );
+		SetTestName( name );
+	}
+
+	virtual ~SocketTest3() {}
+	
+private:
+	int mTest;
+	Selector mSelector;
+	ServerSocket *mServer;
+	Socket * volatile mAccepted;
+	volatile int mWritable;
+	volatile int mDatagrams;
+	volatile int mBadDatagrams;
+	
+	void Run()
+	{
+		switch( mTest )
+		{
+			case 0:
+				backpressureTest();
+				break;
+			case 1:
+				coalesceTest();
+				break;
+			case 2:
+				timeoutTest();
+				break;
+			case 3:
+				batchTest();
+				break;
+			case 4:
+				ipv6Test();
+				break;
+			case 5:
+				sendFileTest();
+				break;
+			case 6:
+				writevTest();
+				break;
+		}
+
+		TestPassed();
+	}
+
+	bool handleAccept( ServerSocket *server, Socket *socket )
+	{
+		socket->setSelector( this, &mSelector );
+		mAccepted = socket;
+		return true;
+	}
+	
+	void handleData( Socket *socket )
+	{
+		char buf[ 256 ];
+		socket->read( buf, sizeof( buf ) );
+	}
+	
+	void handleWritable( Socket *socket )
+	{
+		mWritable++;
+	}
+	
+	// Datagram i holds i as an int, they arrive in order over loopback
+	void handleDatagrams( Socket *socket, DatagramBatch &batch )
+	{
+		for ( int i = 0; i < batch.size(); i++ )
+		{
+			int val = -1;
+			if ( batch.getLength( i ) == sizeof( val ) )
+				memcpy( &val, batch.getData( i ), sizeof( val ) );
+			
+			if ( val != mDatagrams )
+				mBadDatagrams++;
+			mDatagrams++;
+		}
+	}
+	
+	//! Set up a listening server and connect client to it
+	void connectPair( Socket &client )
+	{
+		mServer = jh_new ServerSocket();
+		
+		if ( mServer->bind( Socket::Address( "127.0.0.1", 0 ) ) != 0 or
+			 mServer->listen( 1 ) != 0 )
+			TestFailed( "Failed to listen" );
+		
+		mServer->setSelector( this, &mSelector );
+		
+		Socket::Address addr;
+		mServer->getLocalAddress( addr );
+		addr.setAddress( "127.0.0.1" );
+		
+		if ( client.connectMs( addr, 5000 ) != 0 )
+			TestFailed( "Failed to connect" );
+		
+		client.setReadTimeout( 5 );
+		
+		for ( int i = 0; i < 500 and mAccepted == NULL; i++ )
+			usleep( 10000 );
+		
+		if ( mAccepted == NULL )
+			TestFailed( "Never accepted" );
+	}
+	
+	void closePair()
+	{
+		mServer->setSelector( NULL, NULL );
+		delete mServer;
+		mAccepted->setSelector( NULL, NULL );
+		delete mAccepted;
+	}
+	
+	//! Read len bytes checking they count up from start
+	void readPattern( Socket &client, int len, uint8_t start )
+	{
+		uint8_t buf[ 4096 ];
+		int total = 0;
+		
+		while ( total < len )
+		{
+			int res = client.read( buf, sizeof( buf ) );
+			if ( res <= 0 )
+				TestFailed( "Read failed after %d of %d bytes", total, len );
+			
+			for ( int i = 0; i < res; i++ )
+			{
+				if ( buf[ i ] != (uint8_t)( start + total + i ) )
+					TestFailed( "Bad byte at %d", total + i );
+			}
+			total += res;
+		}
+	}
+	
+	// Write far more than the socket buffers hold to a client that isn't 
+	//  reading.  Nothing is lost, the queue reports it is blocked and the 
+	//  listener hears when it drains.
+	void backpressureTest()
+	{
+		Socket client;
+		connectPair( client );
+		
+		static const int kTotal = 16 * 1024 * 1024;
+		static const int kWriteSize = 64 * 1024;
+		uint8_t *buf = jh_new uint8_t[ kWriteSize ];
+		
+		mAccepted->setWriteWatermarks( 64 * 1024, 256 * 1024 );
+		
+		for ( int sent = 0; sent < kTotal; sent += kWriteSize )
+		{
+			for ( int i = 0; i < kWriteSize; i++ )
+				buf[ i ] = (uint8_t)( sent + i );
+			
+			if ( mAccepted->writeAsync( buf, kWriteSize ) != kWriteSize )
+				TestFailed( "writeAsync failed" );
+		}
+		
+		delete [] buf;
+		
+		if ( not mAccepted->isWriteBlocked() )
+			TestFailed( "Not blocked with %d pending", 
+						mAccepted->getPendingWrite() );
+		
+		readPattern( client, kTotal, 0 );
+		
+		for ( int i = 0; i < 500 and mWritable == 0; i++ )
+			usleep( 10000 );
+		
+		if ( mWritable != 1 )
+			TestFailed( "handleWritable called %d times", mWritable );
+		
+		if ( mAccepted->getPendingWrite() != 0 or mAccepted->isWriteBlocked() )
+			TestFailed( "%d bytes still pending", mAccepted->getPendingWrite() );
+		
+		closePair();
+	}
+	
+	// Lots of tiny writes, queued behind a full socket, come out in order.
+	void coalesceTest()
+	{
+		Socket client;
+		connectPair( client );
+		
+		static const int kTotal = 4 * 1024 * 1024;
+		uint8_t buf[ 7 ];
+		int sent = 0;
+		
+		// Fill the socket so that everything after queues
+		while ( sent < kTotal and mAccepted->getPendingWrite() == 0 )
+		{
+			for ( int i = 0; i < (int)sizeof( buf ); i++ )
+				buf[ i ] = (uint8_t)( sent + i );
+			mAccepted->writeAsync( buf, sizeof( buf ) );
+			sent += sizeof( buf );
+		}
+		
+		if ( sent >= kTotal )
+			TestFailed( "Never queued" );
+		
+		for ( int j = 0; j < 10000; j++ )
+		{
+			for ( int i = 0; i < (int)sizeof( buf ); i++ )
+				buf[ i ] = (uint8_t)( sent + i );
+			mAccepted->writeAsync( buf, sizeof( buf ) );
+			sent += sizeof( buf );
+		}
+		
+		readPattern( client, sent, 0 );
+		
+		if ( mAccepted->getPendingWrite() != 0 )
+			TestFailed( "%d bytes still pending", mAccepted->getPendingWrite() );
+		
+		closePair();
+	}
+	
+	//! Check a read on client times out after about msecs
+	void checkReadTimeout( Socket &client, int msecs )
+	{
+		char buf[ 16 ];
+		client.setReadTimeoutMs( msecs );
+		
+		uint64_t start = TimeUtils::getMonotonicMicros();
+		int res = client.read( buf, sizeof( buf ) );
+		uint64_t elapsed = ( TimeUtils::getMonotonicMicros() - start ) / 1000;
+		
+		if ( res != -1 or errno != ETIMEDOUT )
+			TestFailed( "Read returned %d (%s)", res, strerror( errno ) );
+		
+		if ( elapsed < (uint64_t)msecs or elapsed > (uint64_t)msecs + 1000 )
+			TestFailed( "Read took %d ms, wanted %d", (int)elapsed, msecs );
+	}
+	
+	// Read and write timeouts are in ms, work on fds past FD_SETSIZE and 
+	//  connect reports failures.
+	void timeoutTest()
+	{
+		// Use up the low fds so the client lands past what select can watch,
+		//  poll doesn't care.  If the fd limit is too low just test low fds.
+		JetHead::vector<int> fillers;
+		int fd;
+		while ( ( fd = open( "/dev/null", O_RDONLY ) ) >= 0 )
+		{
+			fillers.push_back( fd );
+			if ( fd > FD_SETSIZE )
+				break;
+		}
+		
+		Socket client;
+		connectPair( client );
+		
+		for ( int i = 0; i < (int)fillers.size(); i++ )
+			::close( fillers[ i ] );
+		
+		if ( fd < 0 )
+			LOG_NOTICE( "Not enough fds to test past FD_SETSIZE" );
+		
+		checkReadTimeout( client, 100 );
+		checkReadTimeout( client, 20 );
+		
+		char c = 'x';
+		mAccepted->write( &c, 1 );
+		client.setReadTimeoutMs( 1000 );
+		if ( client.read( &c, 1 ) != 1 or c != 'x' )
+			TestFailed( "Read failed" );
+		
+		// Nobody reads on the other end so a big write only gets partway
+		mAccepted->setSelector( NULL, NULL );
+		
+		static const int kBulkSize = 16 * 1024 * 1024;
+		uint8_t *buf = jh_new uint8_t[ kBulkSize ];
+		memset( buf, 0, kBulkSize );
+		client.setWriteTimeoutMs( 200 );
+		
+		uint64_t start = TimeUtils::getMonotonicMicros();
+		int res = client.write( buf, kBulkSize );
+		uint64_t elapsed = ( TimeUtils::getMonotonicMicros() - start ) / 1000;
+		delete [] buf;
+		
+		if ( res <= 0 or res >= kBulkSize )
+			TestFailed( "Write returned %d", res );
+		
+		if ( elapsed < 200 or elapsed > 1200 )
+			TestFailed( "Write took %d ms", (int)elapsed );
+		
+		// Nobody listening on the port we just freed
+		Socket::Address addr;
+		mServer->getLocalAddress( addr );
+		addr.setAddress( "127.0.0.1" );
+		closePair();
+		
+		Socket refused;
+		if ( refused.connectMs( addr, 1000 ) != -1 or errno == ETIMEDOUT )
+			TestFailed( "Connect to closed port returned wrong error" );
+		
+		// A timeout of 0 seconds doesn't wait for an answer that isn't coming
+		Socket unanswered;
+		start = TimeUtils::getMonotonicMicros();
+		
+		if ( unanswered.connect( Socket::Address( "10.255.255.1", 9 ), 0 ) != -1 )
+			TestFailed( "Connect with no wait succeeded" );
+		
+		elapsed = ( TimeUtils::getMonotonicMicros() - start ) / 1000;
+		if ( elapsed > 100 )
+			TestFailed( "Connect with no wait took %d ms", (int)elapsed );
+	}
+	
+	// Many datagrams per system call, both directly and from the selector
+	void batchTest()
+	{
+		ServerSocket receiver( false );
+		Socket sender( false );
+		
+		if ( receiver.bind( Socket::Address( "127.0.0.1", 0 ) ) != 0 )
+			TestFailed( "Failed to bind" );
+		
+		Socket::Address addr;
+		receiver.getLocalAddress( addr );
+		addr.setAddress( "127.0.0.1" );
+		receiver.setReceiveTimestamps( true );
+		
+		DatagramBatch out( 128, 64 );
+		DatagramBatch in( 32, 16 );
+		uint8_t big[ 64 ];
+		memset( big, 0, sizeof( big ) );
+		
+		// A zero length one, an ordinary one and one too big for in
+		out.add( big, 0, &addr );
+		out.add( big, 16, &addr );
+		out.add( big, sizeof( big ), &addr );
+		if ( out.add( big, sizeof( big ) + 1, &addr ) != -1 )
+			TestFailed( "Added an oversized datagram" );
+		
+		if ( sender.sendmmsg( out ) != 3 )
+			TestFailed( "sendmmsg failed: %s", strerror( errno ) );
+		
+		uint64_t now = TimeUtils::getMonotonicMicros();
+		struct timeval tv;
+		TimeUtils::getCurTime( &tv );
+		uint64_t wall = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+		
+		receiver.setReadTimeoutMs( 1000 );
+		if ( receiver.recvmmsg( in ) != 3 )
+			TestFailed( "Got %d datagrams", in.size() );
+		
+		if ( in.getLength( 0 ) != 0 or in.getLength( 1 ) != 16 or 
+			 in.isTruncated( 1 ) or not in.isTruncated( 2 ) )
+			TestFailed( "Wrong lengths" );
+		
+		Socket::Address from;
+		sender.getLocalAddress( from );
+		if ( in.getAddress( 1 ).getPort() != from.getPort() )
+			TestFailed( "Wrong sender" );
+		
+		if ( in.getTimestamp( 0 ) + 1000000 < wall or 
+			 in.getTimestamp( 0 ) > wall + 1000000 )
+			TestFailed( "Bad timestamp" );
+		
+		// Nothing left, so this waits out the timeout
+		receiver.setReadTimeoutMs( 50 );
+		if ( receiver.recvmmsg( in ) != -1 or errno != ETIMEDOUT or 
+			 TimeUtils::getMonotonicMicros() - now < 50000 )
+			TestFailed( "recvmmsg didn't time out" );
+		
+		// Now let the selector drain them in bursts
+		static const int kTotal = 1000;
+		receiver.setReceiveBatch( 32 );
+		receiver.setSelector( this, &mSelector );
+		
+		for ( int sent = 0; sent < kTotal; )
+		{
+			out.clear();
+			for ( int i = sent; i < kTotal and out.size() < 16; i++ )
+				out.add( &i, sizeof( i ), &addr );
+			
+			for ( int done = 0; done < out.size(); )
+			{
+				int res = sender.sendmmsg( out, done );
+				if ( res <= 0 )
+					TestFailed( "sendmmsg failed: %s", strerror( errno ) );
+				done += res;
+			}
+			sent += out.size();
+			
+			// Don't overrun the receive buffer
+			for ( int i = 0; i < 500 and mDatagrams < sent; i++ )
+				usleep( 1000 );
+		}
+		
+		receiver.setSelector( NULL, NULL );
+		
+		if ( mDatagrams != kTotal or mBadDatagrams != 0 )
+			TestFailed( "Received %d datagrams, %d bad", mDatagrams, 
+						mBadDatagrams );
+	}
+	
+	//! Connect client to addr and wait for the server to accept it
+	void acceptFrom( Socket &client, const Socket::Address &addr )
+	{
+		mAccepted = NULL;
+		if ( client.connectMs( addr, 2000 ) != 0 )
+			TestFailed( "Failed to connect to %s: %s", addr.getName(), 
+						strerror( errno ) );
+		
+		for ( int i = 0; i < 500 and mAccepted == NULL; i++ )
+			usleep( 10000 );
+		
+		if ( mAccepted == NULL )
+			TestFailed( "Never accepted from %s", addr.getName() );
+	}
+	
+	void dropAccepted()
+	{
+		mAccepted->setSelector( NULL, NULL );
+		delete mAccepted;
+		mAccepted = NULL;
+	}
+	
+	// Both families through one dual stack server, racing connects and 
+	//  joining an IPv6 group
+	void ipv6Test()
+	{
+		Socket::Address v6( "::1", 80 );
+		Socket::Address v4( "127.0.0.1", 80 );
+		
+		if ( not v6.isIPv6() or strcmp( v6.getName(), "::1" ) != 0 or 
+			 v6.getPort() != 80 or v4.isIPv6() or v4 == v6 or 
+			 not ( v6 == Socket::Address( "0:0::1", 80 ) ) )
+			TestFailed( "Bad addresses" );
+		
+		mServer = jh_new ServerSocket();
+		
+		if ( mServer->bindDualStack( 0 ) != 0 or mServer->listen( 8 ) != 0 )
+			TestFailed( "Failed to listen" );
+		
+		if ( mServer->getFamily() != AF_INET6 )
+		{
+			LOG_NOTICE( "No IPv6, skipping" );
+			delete mServer;
+			return;
+		}
+		
+		mServer->setSelector( this, &mSelector );
+		
+		Socket::Address local;
+		mServer->getLocalAddress( local );
+		v6.setPort( local.getPort() );
+		v4.setPort( local.getPort() );
+		
+		Socket client6;
+		acceptFrom( client6, v6 );
+		
+		Socket::Address remote;
+		mAccepted->getRemoteAddress( remote );
+		if ( client6.getFamily() != AF_INET6 or not remote.isIPv6() or 
+			 strcmp( remote.getName(), "::1" ) != 0 )
+			TestFailed( "IPv6 client came from %s", remote.getName() );
+		
+		char c = 'x';
+		if ( client6.write( &c, 1 ) != 1 )
+			TestFailed( "Write on IPv6 failed" );
+		dropAccepted();
+		
+		// IPv4 gets in too, as a mapped address
+		Socket client4;
+		acceptFrom( client4, v4 );
+		mAccepted->getRemoteAddress( remote );
+		if ( client4.getFamily() != AF_INET or 
+			 strcmp( remote.getName(), "::ffff:127.0.0.1" ) != 0 )
+			TestFailed( "IPv4 client came from %s", remote.getName() );
+		dropAccepted();
+		
+		// The first address never answers (or fails), the second shouldn't
+		//  have to wait for it
+		JetHead::vector<Socket::Address> addrs;
+		addrs.push_back( Socket::Address( "10.255.255.1", v4.getPort() ) );
+		addrs.push_back( v6 );
+		
+		Socket raced;
+		uint64_t start = TimeUtils::getMonotonicMicros();
+		mAccepted = NULL;
+		if ( raced.connectMs( addrs, 5000 ) != 0 )
+			TestFailed( "Racing connect failed: %s", strerror( errno ) );
+		
+		uint64_t elapsed = ( TimeUtils::getMonotonicMicros() - start ) / 1000;
+		if ( elapsed > 2000 or raced.getFamily() != AF_INET6 )
+			TestFailed( "Racing connect took %d ms", (int)elapsed );
+		
+		for ( int i = 0; i < 500 and mAccepted == NULL; i++ )
+			usleep( 10000 );
+		if ( mAccepted != NULL )
+			dropAccepted();
+		
+		// By name
+		Socket named;
+		if ( named.connect( "localhost", v4.getPort(), 2000 ) != 0 )
+			TestFailed( "Failed to connect to localhost" );
+		
+		for ( int i = 0; i < 500 and mAccepted == NULL; i++ )
+			usleep( 10000 );
+		if ( mAccepted != NULL )
+			dropAccepted();
+		
+		mServer->setSelector( NULL, NULL );
+		delete mServer;
+		
+		// UDP over IPv6
+		ServerSocket receiver( false );
+		Socket sender( false );
+		
+		if ( receiver.bind( Socket::Address( "::1", 0 ) ) != 0 )
+			TestFailed( "Failed to bind UDP" );
+		
+		receiver.getLocalAddress( local );
+		if ( sender.sendto( "hello", 5, local ) != 5 )
+			TestFailed( "sendto failed: %s", strerror( errno ) );
+		
+		char buf[ 16 ];
+		receiver.setReadTimeoutMs( 1000 );
+		if ( receiver.recvfrom( buf, sizeof( buf ), remote ) != 5 or 
+			 not remote.isIPv6() )
+			TestFailed( "recvfrom failed" );
+		
+		// Not every test machine can route IPv6 multicast, so only check 
+		//  that leaving undoes joining
+		MulticastSocket group;
+		group.bind( Socket::Address( 0, AF_INET6 ) );
+		if ( group.joinGroup( Socket::Address( "ff15::4a48" ) ) == 0 )
+		{
+			if ( group.leaveGroup() != 0 )
+				TestFailed( "Failed to leave IPv6 group" );
+		}
+		else
+		{
+			LOG_NOTICE( "Can't join IPv6 group: %s", strerror( errno ) );
+		}
+	}
+	
+	// A file goes out with sendFile and lands in another with spliceTo, 
+	//  never passing through a buffer of ours
+	void sendFileTest()
+	{
+		static const int kTotal = 4 * 1024 * 1024;
+		static const int kOffset = 1000;
+		const char *in_name = "sendfile.tmp";
+		const char *out_name = "splice.tmp";
+		
+		File in;
+		if ( in.open( in_name, File::OF_RDWR | File::OF_CREATE | 
+					  File::OF_TRUNC ) != kNoError )
+			TestFailed( "Failed to create %s", in_name );
+		
+		uint8_t buf[ 4096 ];
+		for ( int written = 0; written < kOffset + kTotal; )
+		{
+			for ( int i = 0; i < (int)sizeof( buf ); i++ )
+				buf[ i ] = (uint8_t)( ( written + i ) * 7 );
+			written += in.write( buf, sizeof( buf ) );
+		}
+		
+		File out;
+		if ( out.open( out_name, File::OF_RDWR | File::OF_CREATE | 
+					   File::OF_TRUNC ) != kNoError )
+			TestFailed( "Failed to create %s", out_name );
+		
+		Socket client;
+		connectPair( client );
+		mAccepted->setSelector( NULL, NULL );
+		client.setNonBlocking( true );
+		
+		int64_t sent = 0;
+		int64_t received = 0;
+		while ( received < kTotal )
+		{
+			int64_t res = client.sendFile( in, kOffset + sent, kTotal - sent );
+			if ( res < 0 )
+				TestFailed( "sendFile failed: %s", strerror( errno ) );
+			sent += res;
+			
+			// Everything sent is on its way so this never waits long
+			res = mAccepted->spliceTo( out, sent - received );
+			if ( res != sent - received )
+				TestFailed( "spliceTo got %d of %d", (int)res, 
+							(int)( sent - received ) );
+			received += res;
+		}
+		
+		if ( out.getLength() != kTotal )
+			TestFailed( "Output is %d bytes", (int)out.getLength() );
+		
+		out.setPos( 0 );
+		for ( int total = 0; total < kTotal; )
+		{
+			int res = out.read( buf, sizeof( buf ) );
+			if ( res <= 0 )
+				TestFailed( "Read back failed at %d", total );
+			
+			for ( int i = 0; i < res; i++ )
+			{
+				if ( buf[ i ] != (uint8_t)( ( kOffset + total + i ) * 7 ) )
+					TestFailed( "Bad byte at %d", total + i );
+			}
+			total += res;
+		}
+		
+		// Nothing more to come, so a short count rather than waiting forever
+		client.close();
+		if ( mAccepted->spliceTo( out, 100 ) != 0 )
+			TestFailed( "spliceTo after close didn't see the end" );
+		
+		closePair();
+		unlink( in_name );
+		unlink( out_name );
+	}
+	
+	// Several buffers go in one writev, which carries on after short sends
+	void writevTest()
+	{
+		Socket client;
+		connectPair( client );
+		mAccepted->setSelector( NULL, NULL );
+		mAccepted->setReadTimeout( 5 );
+		
+		// Buffers of odd sizes that together count up from 0
+		static const int kNumBuffers = 5;
+		static const int kBufferSize = 1024 * 1024 + 7;
+		static const int kTotal = kNumBuffers * kBufferSize;
+		uint8_t *data = jh_new uint8_t[ kTotal ];
+		struct iovec iov[ kNumBuffers ];
+		
+		for ( int i = 0; i < kTotal; i++ )
+			data[ i ] = (uint8_t)i;
+		
+		for ( int i = 0; i < kNumBuffers; i++ )
+		{
+			iov[ i ].iov_base = data + i * kBufferSize;
+			iov[ i ].iov_len = kBufferSize;
+		}
+		
+		// Nobody reads on the other end so this only gets partway
+		client.setWriteTimeoutMs( 200 );
+		int res = client.writev( iov, kNumBuffers );
+		
+		if ( res <= 0 or res >= kTotal )
+			TestFailed( "writev returned %d", res );
+		
+		readPattern( *mAccepted, res, 0 );
+		delete [] data;
+		
+		// A header and body go out together, exactly as built
+		HttpResponse response;
+		response.setResponseCode( 200 );
+		response.addFieldDecimal( HttpFieldMap::kFieldContentLength, 5 );
+		
+		JHSTD::string expected( response.getHeader() );
+		expected += "hello";
+		
+		res = response.send( &client, (const uint8_t*)"hello", 5 );
+		if ( res != (int)expected.size() )
+			TestFailed( "send returned %d not %d", res, 
+						(int)expected.size() );
+		
+		char buf[ 256 ];
+		int total = 0;
+		while ( total < res )
+		{
+			int len = mAccepted->read( buf + total, sizeof( buf ) - total );
+			if ( len <= 0 )
+				TestFailed( "Read failed after %d bytes", total );
+			total += len;
+		}
+		
+		if ( memcmp( buf, expected.data(), total ) != 0 )
+			TestFailed( "Sent %.*s", total, buf );
+		
+		closePair();
+	}
+};
+
+static const int gNumTests = 7;
+
+int main( int argc, char*argv[] )
+{
+	TestRunner runner( argv[ 0 ] );
+	
+	TestCase *test_set[ gNumTests ];
+
+	for ( int i = 0; i < gNumTests; i++ )
+		test_set[ i ] = jh_new SocketTest3( i );
+	
+	runner.RunAll( test_set, gNumTests );
+
+	return 0;
+}
@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <unistd.h>
+#include "TcpServer.h"
+#include "jh_memory.h"
+#include "logging.h"
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_INFO );
+
+#include "TestCase.h"
+
+using namespace JetHead;
+
+class TcpServerTest : public TestCase, public TcpServerListener
+{
+public:
+	TcpServerTest( int test_id ) : TestCase( "TcpServerTest" ), mTest( test_id ),
+		mOpened( 0 ), mClosed( 0 ), mWritable( 0 ), mWritten( 0 )
+	{
+		char name[ 32 ];
+		sprintf( name, "TcpServerTest%d", test_id );
+		SetTestName( name );
+	}
+
+	virtual ~TcpServerTest() {}
+	
+private:
+	int mTest;
+	
+	volatile int mOpened;
+	volatile int mClosed;
+	volatile int mWritable;
+	
+	//! Bytes written by the server in backpressureTest
+	volatile int mWritten;
+	
+	static const int kNumClients = 200;
+	//! Has to be more than the kernel will buffer on loopback
+	static const int kBulkSize = 16 * 1024 * 1024;
+	
+	void Run()
+	{
+		switch( mTest )
+		{
+			case 0:
+				echoTest();
+				break;
+			case 1:
+				backpressureTest();
+				break;
+			case 2:
+				idleTest();
+				break;
+			case 3:
+				drainTest();
+				break;
+		}
+
+		TestPassed();
+	}
+
+	bool handleConnection( TcpConnection *conn )
+	{
+		__sync_add_and_fetch( &mOpened, 1 );
+		
+		if ( mTest == 1 )
+			writeBulk( conn );
+		
+		return true;
+	}
+	
+	void handleData( TcpConnection *conn )
+	{
+		char buf[ 256 ];
+		int res;
+		
+		while ( ( res = conn->read( buf, sizeof( buf ) ) ) > 0 )
+			conn->write( buf, res );
+	}
+	
+	void handleWritable( TcpConnection *conn )
+	{
+		__sync_add_and_fetch( &mWritable, 1 );
+		writeBulk( conn );
+	}
+	
+	void handleClose( TcpConnection *conn )
+	{
+		__sync_add_and_fetch( &mClosed, 1 );
+	}
+	
+	void handleDrain( TcpConnection *conn )
+	{
+		conn->write( "bye", 3 );
+		conn->close();
+	}
+	
+	//! Write until we have sent kBulkSize or the connection blocks
+	void writeBulk( TcpConnection *conn )
+	{
+		char buf[ 4096 ];
+		memset( buf, 'x', sizeof( buf ) );
+		
+		while ( mWritten < kBulkSize and not conn->isWriteBlocked() )
+		{
+			int len = kBulkSize - mWritten;
+			if ( len > (int)sizeof( buf ) )
+				len = sizeof( buf );
+			
+			int res = conn->write( buf, len );
+			if ( res < 0 )
+				return;
+			mWritten += res;
+		}
+		
+		if ( mWritten == kBulkSize )
+			conn->close();
+	}
+	
+	//! Wait up to 5 seconds for value to become expected
+	bool waitFor( volatile int &value, int expected )
+	{
+		for ( int i = 0; i < 500 and value != expected; i++ )
+			usleep( 10000 );
+		return value == expected;
+	}
+
+	Socket *connect( TcpServer &server )
+	{
+		Socket *sock = jh_new Socket();
+		
+		if ( sock->connect( Socket::Address( "127.0.0.1", 
+											 server.getPort() ) ) != 0 )
+			TestFailed( "Failed to connect to %d", server.getPort() );
+		
+		sock->setReadTimeout( 5 );
+		return sock;
+	}
+	
+	//! Read until len bytes arrive or the other side closes
+	int readAll( Socket *sock, char *buf, int len )
+	{
+		int total = 0;
+		while ( total < len )
+		{
+			int res = sock->read( buf + total, len - total );
+			if ( res <= 0 )
+				break;
+			total += res;
+		}
+		return total;
+	}
+	
+	// Lots of connections spread over several workers and acceptors, each
+	//  echoing back what it is sent.
+	void echoTest()
+	{
+		TcpServer server( this, 3, 2, "EchoServer" );
+		
+		if ( server.start( Socket::Address( "127.0.0.1", 0 ) ) != 0 )
+			TestFailed( "Failed to start" );
+		
+		if ( server.getPort() == 0 )
+			TestFailed( "No port" );
+		
+		Socket *clients[ kNumClients ];
+		
+		for ( int i = 0; i < kNumClients; i++ )
+			clients[ i ] = connect( server );
+
+		if ( not waitFor( mOpened, kNumClients ) )
+			TestFailed( "Only %d of %d connections", mOpened, kNumClients );
+		
+		if ( server.getNumConnections() != kNumClients )
+			TestFailed( "Server has %d connections", server.getNumConnections() );
+		
+		for ( int i = 0; i < kNumClients; i++ )
+		{
+			char msg[ 32 ];
+			char reply[ 32 ];
+			int len = sprintf( msg, "hello %d", i );
+			
+			if ( clients[ i ]->write( msg, len ) != len )
+				TestFailed( "Write failed" );
+			
+			if ( readAll( clients[ i ], reply, len ) != len or 
+				 memcmp( msg, reply, len ) != 0 )
+				TestFailed( "Bad echo on client %d", i );
+		}
+		
+		for ( int i = 0; i < kNumClients; i++ )
+			delete clients[ i ];
+		
+		if ( not waitFor( mClosed, kNumClients ) )
+			TestFailed( "Only %d of %d closed", mClosed, kNumClients );
+
+		if ( server.getNumConnections() != 0 )
+			TestFailed( "Server has %d connections", server.getNumConnections() );
+		
+		server.stop();
+	}
+	
+	// The server writes much more than its queue holds to a client that 
+	//  isn't reading, it should block and then resume as the client reads.
+	void backpressureTest()
+	{
+		TcpServer server( this, 1, 1, "BulkServer" );
+		server.setWriteBufferSize( 16 * 1024 );
+		server.setWriteWatermarks( 4 * 1024, 16 * 1024 );
+		
+		if ( server.start( Socket::Address( "127.0.0.1", 0 ) ) != 0 )
+			TestFailed( "Failed to start" );
+		
+		Socket *client = connect( server );
+		
+		if ( not waitFor( mOpened, 1 ) )
+			TestFailed( "No connection" );
+		
+		// Give the server time to fill the socket and its queue
+		usleep( 100000 );
+		
+		if ( mWritten >= kBulkSize )
+			TestFailed( "Wrote everything without blocking" );
+		
+		char *buf = jh_new char[ kBulkSize + 1 ];
+		int res = readAll( client, buf, kBulkSize + 1 );
+		delete [] buf;
+		
+		if ( res != kBulkSize )
+			TestFailed( "Read %d expected %d", res, kBulkSize );
+		
+		if ( mWritable == 0 )
+			TestFailed( "handleWritable never called" );
+		
+		if ( not waitFor( mClosed, 1 ) )
+			TestFailed( "Connection didn't close" );
+		
+		delete client;
+		server.stop();
+	}
+	
+	// Connections that do nothing get closed.
+	void idleTest()
+	{
+		TcpServer server( this, 2, 1, "IdleServer" );
+		server.setIdleTimeout( 200 );
+		
+		if ( server.start( Socket::Address( "127.0.0.1", 0 ) ) != 0 )
+			TestFailed( "Failed to start" );
+		
+		Socket *busy = connect( server );
+		Socket *idle = connect( server );
+		
+		if ( not waitFor( mOpened, 2 ) )
+			TestFailed( "No connections" );
+		
+		// Keep one connection busy while the other goes idle
+		for ( int i = 0; i < 10; i++ )
+		{
+			char c = 'a';
+			busy->write( &c, 1 );
+			if ( busy->read( &c, 1 ) != 1 )
+				TestFailed( "Busy connection closed" );
+			usleep( 50000 );
+		}
+		
+		if ( not waitFor( mClosed, 1 ) )
+			TestFailed( "Idle connection not closed" );
+		
+		char c;
+		if ( idle->read( &c, 1 ) != 0 )
+			TestFailed( "Idle connection still open" );
+		
+		if ( server.getNumConnections() != 1 )
+			TestFailed( "Server has %d connections", server.getNumConnections() );
+		
+		delete busy;
+		delete idle;
+		server.stop();
+	}
+	
+	// Stopping the server lets every connection say goodbye.
+	void drainTest()
+	{
+		TcpServer server( this, 2, 1, "DrainServer" );
+		
+		if ( server.start( Socket::Address( "127.0.0.1", 0 ) ) != 0 )
+			TestFailed( "Failed to start" );
+		
+		Socket *clients[ kNumClients ];
+		
+		for ( int i = 0; i < kNumClients; i++ )
+			clients[ i ] = connect( server );
+		
+		if ( not waitFor( mOpened, kNumClients ) )
+			TestFailed( "Only %d of %d connections", mOpened, kNumClients );
+		
+		server.stop( 2000 );
+		
+		if ( mClosed != kNumClients )
+			TestFailed( "Only %d of %d closed", mClosed, kNumClients );
+		
+		for ( int i = 0; i < kNumClients; i++ )
+		{
+			char buf[ 8 ];
+			if ( readAll( clients[ i ], buf, sizeof( buf ) ) != 3 or
+				 memcmp( buf, "bye", 3 ) != 0 )
+				TestFailed( "Client %d didn't get goodbye", i );
+			
+			delete clients[ i ];
+		}
+	}
+};
+
+static const int gNumTests = 4;
+
+int main( int argc, char*argv[] )
+{
+	TestRunner runner( argv[ 0 ] );
+	
+	TestCase *test_set[ gNumTests ];
+
+	for ( int i = 0; i < gNumTests; i++ )
+		test_set[ i ] = jh_new TcpServerTest( i );
+	
+	runner.RunAll( test_set, gNumTests );
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "Selector.h"
+#include "EventAgent.h"
+#include "EventThread.h"
+#include "Metrics.h"
+#include "Timer.h"
+#include "TimerManager.h"
+#include "jh_memory.h"
+#include "logging.h"
+
+#include <unistd.h>
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_INFO );
+
+#include "TestCase.h"
+
+enum {
+	EVENT_ID_TIMED
+};
+
+struct TimedEvent : public Event
+{
+	TimedEvent() : Event( EVENT_ID_TIMED ) {}
+	SMART_CASTABLE( EVENT_ID_TIMED );
+};
+
+class TimerTest : public TestCase, public TimerListener
+{
+public:
+	TimerTest( int test_id ) : TestCase( "TimerTest" ), mTest( test_id ),
+		mSelector( "TimerTest" ), mEvents( 0 ), mAgentCalls( 0 ), 
+		mTimeouts( 0 ), mPendingSeen( 0 )
+	{
+		char name[ 32 ];
+		sprintf( name, "TimerTest%d", test_id );
+		SetTestName( name );
+	}
+
+	virtual ~TimerTest() {}
+	
+private:
+	int mTest;
+	Selector mSelector;
+	
+	volatile int mEvents;
+	volatile int mAgentCalls;
+	volatile int mTimeouts;
+	volatile int mPendingSeen;
+	SmartPtr<Gauge> mPending;
+	
+	void Run()
+	{
+		EventMethod<TimerTest, TimedEvent> handler( this, 
+											&TimerTest::handleEvent, 
+											&mSelector );
+		
+		switch( mTest )
+		{
+			case 0:
+				removeTest();
+				break;
+			case 1:
+				listenerTest();
+				break;
+		}
+		
+		mSelector.removeAll();
+		TestPassed();
+	}
+	
+	void handleEvent( TimedEvent *ev )
+	{
+		mEvents++;
+	}
+	
+	void handleAgent()
+	{
+		mAgentCalls++;
+	}
+	
+	void onTimeout( uint32_t private_data )
+	{
+		if ( mPending != NULL )
+			mPendingSeen = mPending->getValue();
+		
+		// Waits for the selector thread, which has to get at the timer
+		mSelector.remove( TimedEvent::GetEventId() );
+		mTimeouts++;
+	}
+	
+	// Removing through a dispatcher reaches timers that came from 
+	//  TimerManager, not only the ones it was told about
+	void removeTest()
+	{
+		TimerManager *manager = TimerManager::getInstance();
+		SmartPtr<Timer> timer = manager->getTimer( 20 );
+		
+		manager->getDefaultTimer()->sendTimedEvent( jh_new TimedEvent, 
+													&mSelector, 200 );
+		timer->sendTimedEvent( jh_new TimedEvent, &mSelector, 200 );
+		mSelector.remove( TimedEvent::GetEventId() );
+		
+		// A listener alongside the agent has no event to look at
+		SmartPtr<AsyncEventAgent> agent = 
+			jh_new AsyncEventAgent0<TimerTest>( this, &TimerTest::handleAgent );
+		agent->sendPeriodically( &mSelector, 50, timer );
+		manager->getDefaultTimer()->addTimer( this, 100, 0 );
+		mSelector.removeAgentsByReceiver( this );
+		
+		usleep( 400 * 1000 );
+		
+		if ( mEvents != 0 )
+			TestFailed( "%d removed events were delivered", mEvents );
+		
+		if ( mAgentCalls != 0 )
+			TestFailed( "Removed periodic agent ran %d times", mAgentCalls );
+		
+		if ( mTimeouts != 1 )
+			TestFailed( "Listener called %d times", mTimeouts );
+	}
+	
+	// Listeners are called without the timer's lock, so they can wait on
+	//  threads that need it, and a periodic one is set up again first
+	void listenerTest()
+	{
+		SmartPtr<Timer> timer = TimerManager::getInstance()->getTimer( 30 );
+		mPending = MetricsRegistry::getInstance()->getGauge( 
+			"jh_timer_pending", "tick_ms=\"30\"" );
+		
+		timer->addPeriodicTimer( this, 60, 0 );
+		
+		for ( int i = 0; i < 200 and mTimeouts < 3; i++ )
+			usleep( 10000 );
+		
+		// Stops the clock thread, so no more calls
+		timer = NULL;
+		
+		if ( mTimeouts < 3 )
+			TestFailed( "Listener called %d times in 2 seconds", mTimeouts );
+		
+		if ( mPendingSeen != 1 )
+			TestFailed( "%d timers pending while the listener ran", 
+						mPendingSeen );
+		
+		mPending = NULL;
+	}
+};
+
+static const int gNumTests = 2;
+
+int main( int argc, char*argv[] )
+{
+	TestRunner runner( argv[ 0 ] );
+	
+	TestCase *test_set[ gNumTests ];
+
+	for ( int i = 0; i < gNumTests; i++ )
+		test_set[ i ] = jh_new TimerTest( i );
+	
+	runner.RunAll( test_set, gNumTests );
+
+	return 0;
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2010, JetHead Development, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the JetHead Development nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <unistd.h>
+#include "TraceRecorder.h"
+#include "EventThread.h"
+#include "jh_memory.h"
+#include "logging.h"
+
+SET_LOG_CAT( LOG_CAT_ALL );
+SET_LOG_LEVEL( LOG_LVL_INFO );
+
+#include "TestCase.h"
+
+static const char *kTraceFile = "/tmp/jh_trace_test.json";
+
+class TraceTest : public TestCase
+{
+public:
+	TraceTest( int test_id ) : TestCase( "TraceTest" ), mTest( test_id )
+	{
+		char name[ 32 ];
+		sprintf( name, "TraceTest%d", test_id );
+		SetTestName( name );
+	}
+
+	virtual ~TraceTest() {}
+	
+private:
+	int mTest;
+	
+	void Run()
+	{
+		switch( mTest )
+		{
+			case 0:
+				spanTest();
+				break;
+			case 1:
+				flowTest();
+				break;
+			case 2:
+				wrapTest();
+				break;
+		}
+
+		TestPassed();
+	}
+
+	//! Write the trace to kTraceFile and read it back into out
+	void readTrace( JHSTD::string &out )
+	{
+		if ( TraceRecorder::writeJson( kTraceFile ) != 0 )
+			TestFailed( "Failed to write %s", kTraceFile );
+		
+		FILE *in = fopen( kTraceFile, "r" );
+		char buf[ 4096 ];
+		size_t len;
+		
+		out.clear();
+		while ( ( len = fread( buf, 1, sizeof( buf ), in ) ) > 0 )
+			out.append( buf, len );
+		
+		fclose( in );
+		unlink( kTraceFile );
+	}
+	
+	int count( const JHSTD::string &trace, const char *str )
+	{
+		int res = 0;
+		size_t pos = 0;
+		
+		while ( ( pos = trace.find( str, pos ) ) != JHSTD::string::npos )
+		{
+			res++;
+			pos++;
+		}
+		
+		return res;
+	}
+	
+	void spanThread()
+	{
+		TraceSpan span( "spanThread", 7 );
+		usleep( 2000 );
+	}
+
+	void spanTest()
+	{
+		{
+			TraceSpan span( "before start" );
+		}
+		
+		TraceRecorder::start();
+		
+		{
+			TraceSpan outer( "outer" );
+			TraceSpan inner( "inner \"quoted\"" );
+		}
+		
+		Runnable<TraceTest> thread( "TraceSpanThread", this, 
+									&TraceTest::spanThread );
+		thread.Start();
+		thread.Join();
+
+		TraceRecorder::stop();
+
+		{
+			TraceSpan span( "after stop" );
+		}
+		
+		JHSTD::string trace;
+		readTrace( trace );
+		
+		if ( trace.find( "{\"traceEvents\":[" ) != 0 )
+			TestFailed( "Bad trace header:\n%s", trace.c_str() );
+		
+		if ( count( trace, "\"name\":\"outer\",\"ph\":\"X\"" ) != 1 or
+			 count( trace, "\"name\":\"inner \\\"quoted\\\"\"" ) != 1 )
+			TestFailed( "Missing spans:\n%s", trace.c_str() );
+		
+		if ( count( trace, "\"args\":{\"arg\":7}" ) != 1 )
+			TestFailed( "Missing span arg:\n%s", trace.c_str() );
+		
+		if ( count( trace, "\"args\":{\"name\":\"TraceSpanThread\"}" ) != 1 )
+			TestFailed( "Missing thread name:\n%s", trace.c_str() );
+		
+		if ( count( trace, "before start" ) != 0 or 
+			 count( trace, "after stop" ) != 0 )
+			TestFailed( "Recorded while stopped:\n%s", trace.c_str() );
+	}
+	
+	void handleAgent() {}
+	
+	void flowTest()
+	{
+		EventThread thread( "TraceFlowThread" );
+		
+		TraceRecorder::start();
+		
+		for ( int i = 0; i < 3; i++ )
+		{
+			SyncEventAgent0<TraceTest> *agent = jh_new 
+				SyncEventAgent0<TraceTest>( this, &TraceTest::handleAgent );
+			agent->send( &thread );
+		}
+		
+		// Make sure the last handleEvent has finished
+		usleep( 10000 );
+		TraceRecorder::stop();
+		
+		JHSTD::string trace;
+		readTrace( trace );
+		
+		// One flow per event, starting on our thread and ending on the 
+		//  dispatcher's.
+		if ( count( trace, "\"ph\":\"s\"" ) != 3 or
+			 count( trace, "\"ph\":\"f\"" ) != 3 or 
+			 count( trace, "\"bp\":\"e\"" ) != 3 )
+			TestFailed( "Expected 3 flows:\n%s", trace.c_str() );
+		
+		if ( count( trace, "\"name\":\"EventDispatcher::handleEvent\"" ) != 3 or
+			 count( trace, "\"name\":\"EventAgent::deliver\"" ) != 3 )
+			TestFailed( "Expected 3 handled events:\n%s", trace.c_str() );
+	}
+	
+	void wrapTest()
+	{
+		// Spans are recorded into the buffer for this thread, which was 
+		//  created by an earlier test with the default size.  Use a new 
+		//  thread so the small size applies.
+		TraceRecorder::start( 4 );
+		
+		Runnable<TraceTest> thread( "TraceWrapThread", this, 
+									&TraceTest::wrapThread );
+		thread.Start();
+		thread.Join();
+		
+		TraceRecorder::stop();
+		
+		JHSTD::string trace;
+		readTrace( trace );
+		
+		// With JH_TRACE_EVENTS the thread records its own spans after ours
+		//  so we can only be sure the oldest were dropped.
+		if ( count( trace, "\"name\":\"wrap\"" ) > 4 )
+			TestFailed( "Expected at most 4 spans:\n%s", trace.c_str() );
+		
+		if ( count( trace, "\"args\":{\"arg\":0}" ) != 0 or 
+			 count( trace, "\"args\":{\"arg\":5}" ) != 0 )
+			TestFailed( "Kept the oldest spans:\n%s", trace.c_str() );
+		
+		if ( count( trace, "\"args\":{\"name\":\"TraceWrapThread\"}" ) != 1 )
+			TestFailed( "Missing wrap thread:\n%s", trace.c_str() );
+	}
+	
+	void wrapThread()
+	{
+		for ( int i = 0; i < 10; i++ )
+			TraceSpan span( "wrap", i );
+	}
+};
+
+static const int gNumTests = 3;
+
+int main( int argc, char*argv[] )
+{
+	TestRunner runner( argv[ 0 ] );
+	
+	TestCase *test_set[ gNumTests ];
+
+	for ( int i = 0; i < gNumTests; i++ )
+		test_set[ i ] = jh_new TraceTest( i );
+	
+	runner.RunAll( test_set, gNumTests );
+
+	return 0;
+}
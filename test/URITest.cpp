@@ -26,7 +26,9 @@
  */
 
 #include "URI.h"
+#include "URIView.h"
 #include <unistd.h>
+#include <string.h>
 
 #include "logging.h"
 #include "jh_memory.h"
@@ -108,6 +110,9 @@ private:
 		case 3:
 			Test4();
 			break;
+		case 4:
+			Test5();
+			break;
 		default:
 			break;
 		}
@@ -335,9 +340,155 @@ private:
 			
 		TestPassed();
 	}
+
+	//! Does part hold str, a NULL str means the part should be empty
+	void checkPart( const URIView::Part &part, const char *str, 
+					const char *name, int i )
+	{
+		if ( not part.equals( str != NULL ? str : "" ) )
+			TestFailed( "Failed to validate %s for view %d (%s)", name, i, 
+						part.str().c_str() );
+	}
+	
+	void Test5()
+	{
+		URIView::Part value;
+		
+		// A URIView should see the same parts as URI without copying
+		for ( int i = 0; i < JH_ARRAY_SIZE( test_urls ); i++ )
+		{
+			const char *str = test_urls[ i ].string;
+			URIView view( str );
+			
+			checkPart( view.getScheme(), test_urls[ i ].scheme, "scheme", i );
+			checkPart( view.getAuthority(), test_urls[ i ].authority, 
+					   "authority", i );
+			checkPart( view.getHost(), test_urls[ i ].host, "host", i );
+			checkPart( view.getQuery(), test_urls[ i ].query, "query", i );
+			checkPart( view.getFragment(), test_urls[ i ].fragment, 
+					   "fragment", i );
+			
+			if ( test_urls[ i ].path != NULL )
+				checkPart( view.getPath(), test_urls[ i ].path, "path", i );
+			
+			if ( view.getScheme().mData != str and not 
+				 view.getScheme().empty() )
+				TestFailed( "View %d copied its scheme", i );
+			
+			if ( test_urls[ i ].port != 0 and 
+				 view.getPort() != test_urls[ i ].port )
+				TestFailed( "Failed to validate port for view %d", i );
+			
+			if ( test_urls[ i ].param1 != NULL and 
+				 ( not view.findParam( test_urls[ i ].param1, value ) or 
+				   not value.equals( test_urls[ i ].p1_value ) ) )
+				TestFailed( "Failed to validate param1 for view %d", i );
+			
+			if ( test_urls[ i ].param2 != NULL and 
+				 ( not view.findParam( test_urls[ i ].param2, value ) or 
+				   not value.equals( test_urls[ i ].p2_value ) ) )
+				TestFailed( "Failed to validate param2 for view %d", i );
+			
+			if ( view.isRelative() != test_urls[ i ].relative )
+				TestFailed( "Failed to validate relative for view %d", i );
+		}
+		
+		// Only as much of the string as asked for
+		const char *twice = "/a?b=c/a?b=c";
+		URIView half( twice, 6 );
+		
+		checkPart( half.getPath(), "/a", "path", 100 );
+		checkPart( half.getQuery(), "b=c", "query", 100 );
+		
+		// Query parameters in order, with and without values
+		URIView params( "/p?a=1&&flag&b=x=y&=z#top" );
+		const char *keys[] = { "a", "flag", "b", "" };
+		const char *values[] = { "1", "", "x=y", "z" };
+		URIView::Param param;
+		int pos = 0;
+		int n = 0;
+		
+		while ( params.nextParam( pos, param ) )
+		{
+			if ( n >= JH_ARRAY_SIZE( keys ) or 
+				 not param.mKey.equals( keys[ n ] ) or 
+				 not param.mValue.equals( values[ n ] ) )
+				TestFailed( "Bad param %d %s", n, param.mKey.str().c_str() );
+			n++;
+		}
+		
+		if ( n != JH_ARRAY_SIZE( keys ) )
+			TestFailed( "Got %d params", n );
+		
+		checkPart( params.getFragment(), "top", "fragment", 101 );
+		
+		if ( not params.hasQuery() or not params.hasFragment() or 
+			 URIView( "/p" ).hasQuery() or not URIView( "/p?" ).hasQuery() )
+			TestFailed( "Failed to validate hasQuery/hasFragment" );
+		
+		// Decoding is up to the caller
+		URIView coded( "/a%20b?q=x+y%2Fz&bad=%2" );
+		JHSTD::string decoded;
+		char buf[ 8 ];
+		
+		if ( not coded.getPath().isEncoded() or 
+			 not coded.getPath().decode( decoded ) or decoded != "/a b" )
+			TestFailed( "Failed to decode path (%s)", decoded.c_str() );
+		
+		if ( not coded.findParam( "q", value ) or 
+			 not value.decode( decoded, true ) or decoded != "x y/z" )
+			TestFailed( "Failed to decode param (%s)", decoded.c_str() );
+		
+		if ( value.decode( buf, sizeof( buf ) ) != 5 or 
+			 strncmp( buf, "x+y/z", 5 ) != 0 or 
+			 value.decode( buf, 4 ) != -1 )
+			TestFailed( "Failed to decode param into buffer" );
+		
+		if ( not coded.findParam( "bad", value ) or value.decode( decoded ) or 
+			 URIView::Part( "%zz", 3 ).decode( buf, sizeof( buf ) ) != -1 )
+			TestFailed( "Decoded a bad escape" );
+		
+		// Ports, IPv6 hosts and paths with colons in them
+		URIView v6( "http://[::1]:8080/x" );
+		checkPart( v6.getHost(), "[::1]", "host", 102 );
+		
+		if ( v6.getPort() != 8080 or URIView( "http://h/" ).getPort() != -1 or
+			 URIView( "http://h:/" ).getPort() != 0 )
+			TestFailed( "Failed to validate ports" );
+		
+		URIView colon( "/at?t=10:30" );
+		checkPart( colon.getScheme(), NULL, "scheme", 103 );
+		checkPart( colon.getPath(), "/at", "path", 103 );
+		
+		URIView noPath( "http://h?a=b#c" );
+		checkPart( noPath.getAuthority(), "h", "authority", 104 );
+		checkPart( noPath.getPath(), NULL, "path", 104 );
+		checkPart( noPath.getQuery(), "a=b", "query", 104 );
+		
+		// URI parses the same way and finds its params when asked
+		URI uri( "http://h?a=b#c" );
+		
+		if ( uri.getAuthority() != "h" or uri.getQueryParam( "a" ) != "b" or
+			 uri.getFragment() != "c" or uri.getPort() != 80 )
+			TestFailed( "URI parsed %s differently", uri.getString().c_str() );
+		
+		URI copy( uri );
+		copy.appendQueryParam( "d", "e" );
+		
+		if ( copy.getString() != "http://h?a=b&d=e#c" or 
+			 copy.getQueryParam( "a" ) != "b" )
+			TestFailed( "Appended to %s", copy.getString().c_str() );
+		
+		copy.removeQueryParam( "a" );
+		
+		if ( copy.getString() != "http://h?d=e#c" )
+			TestFailed( "Removed from %s", copy.getString().c_str() );
+		
+		TestPassed();
+	}
 };
 
-static const int gNumTests = 4;
+static const int gNumTests = 5;
 
 int main( int argc, char*argv[] )
 {
@@ -31,6 +31,7 @@
 #include <string.h>
 
 #include "Regex.h"
+#include "RegexSet.h"
 
 SET_LOG_CAT( LOG_CAT_ALL );
 SET_LOG_LEVEL( LOG_LVL_INFO );
@@ -107,6 +108,16 @@ TestGroup gParseTests[] = {
 	{ "(ab|cd|efg)", "efg", true, { "efg", NULL, NULL, NULL, NULL } },			// group testing - with backtracking
 	{ "(ab|cd|efg)", "fg", false, { NULL, NULL, NULL, NULL, NULL } },			// group testing - with backtracking
 	{ "(ab|cd|efg)+", "abcd", true, { "ab", "cd", NULL, NULL, NULL } },			// group testing - with backtracking
+	{ "(a|ab)(c|bcd)", "abcd", true, { "a", "bcd", NULL, NULL, NULL } },		// first alternative that works wins
+	{ "((a)|b)+", "ab", true, { "a", "a", "b", NULL, NULL } },			// groups in the order they opened
+	{ "(a|aa)+c", "aaac", true, { "a", "a", "a", NULL, NULL } },
+	{ "(a*)*b", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", false, { NULL, NULL, NULL, NULL, NULL } },	// exponential for a backtracker
+	{ "a*a*a*a*a*a*a*a*a*a*b", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", false, { NULL, NULL, NULL, NULL, NULL } },
+	{ "x{2,}y", "xxxy", true, { NULL, NULL, NULL, NULL, NULL } },
+	{ "x{3,}y", "xxy", false, { NULL, NULL, NULL, NULL, NULL } },
+	{ "[a-z]*", "", true, { NULL, NULL, NULL, NULL, NULL } },
+	{ "\\w+@\\w+\\.com", "bob@example.com", true, { NULL, NULL, NULL, NULL, NULL } },
+	{ "(\\d+)\\.(\\d+)", "1.25 rest", true, { "1", "25", NULL, NULL, NULL } },
 };
 
 class RegexPrepareTest : public TestCase
@@ -188,6 +199,17 @@ private:
 			TestFailed( "Parse failed to match expected result" );
 		}			
 
+		int groups = 0;
+		
+		for ( int i = 0; i < 5; i++ )
+		{
+			if ( gParseTests[ mTestNum ].groups[ i ] != NULL )
+				groups++;
+		}
+		
+		if ( r.getNumGroups() != groups )
+			TestFailed( "Found %d groups, expected %d", r.getNumGroups(), groups );
+		
 		for ( int i = 0; i < 5; i++ )
 		{
 			if ( gParseTests[ mTestNum ].groups[ i ] != NULL )
@@ -206,12 +228,416 @@ private:
 	}
 };
 
+class RegexEngineTest : public TestCase
+{
+public:
+	RegexEngineTest( int number ) : 
+		TestCase( "RegexEngineTest" ), mTestNum( number ) 
+	{
+		char name[ 32 ];
+		snprintf( name, 32, "RegexEngineTest%d", number );
+		name[ 31 ] = '\0';
+		SetTestName( name );	
+	}
+
+	virtual ~RegexEngineTest() {}
+	
+	static const int kNumTests = 4;
+	
+private:
+	static const int kNumThreads = 4;
+	
+	int mTestNum;
+	
+	// Shared by the threads of sharedTest
+	Regex		mShared;
+	RegexSet	mSharedSet;
+	int			mErrors;
+	
+	void Run()
+	{
+		switch ( mTestNum )
+		{
+			case 0:
+				reuseTest();
+				break;
+			case 1:
+				cacheTest();
+				break;
+			case 2:
+				longTest();
+				break;
+			case 3:
+				sharedTest();
+				break;
+		}
+		
+		TestPassed();
+	}
+	
+	// One Regex prepared and parsed many times
+	void reuseTest()
+	{
+		Regex r( "([a-z]+)=(\\d*)" );
+		
+		if ( not r.parse( "abc=12" ) or r.getNumGroups() != 2 or 
+			 r.getData( 0 ) != "abc" or r.getData( 1 ) != "12" )
+			TestFailed( "First parse" );
+		
+		if ( r.parse( "=12" ) or r.getNumGroups() != 0 or r.getData( 0 ) != "" )
+			TestFailed( "Failed parse kept groups" );
+		
+		if ( not r.parse( "x=" ) or r.getData( 0 ) != "x" or 
+			 r.getData( 1 ) != "" or r.getData( 2 ) != "" )
+			TestFailed( "Third parse" );
+		
+		if ( r.prepare( "[0-9]+" ) != JetHead::kNoError or 
+			 not r.parse( "42" ) or r.parse( "abc" ) or r.getNumGroups() != 0 )
+			TestFailed( "Prepared again" );
+		
+		if ( r.prepare( "*a" ) == JetHead::kNoError or r.parse( "a" ) or
+			 r.prepare( "a{2" ) == JetHead::kNoError )
+			TestFailed( "Bad RE prepared" );
+		
+		// One RegexMatch going back and forth between two Regexes
+		Regex a( "(a+)" );
+		Regex b( "(b+)c" );
+		RegexMatch match;
+		
+		if ( not a.parse( "aab", match ) or match.getData( 0 ) != "aa" or
+			 not b.parse( "bbc", match ) or match.getData( 0 ) != "bb" or
+			 a.parse( "b", match ) or match.matched() or 
+			 match.getNumGroups() != 0 or
+			 not a.parse( "a", match ) or match.getData( 0 ) != "a" )
+			TestFailed( "RegexMatch shared between Regexes" );
+		
+		if ( a.getNumGroups() != 0 or a.getData( 0 ) != "" )
+			TestFailed( "Parse with a RegexMatch changed the Regex" );
+	}
+	
+	// Enough DFA states to overflow the cache, checked against the Pike VM
+	void cacheTest()
+	{
+		Regex dfa( "[ab]*a[ab]{14}c" );
+		Regex pike( "([ab]*)a[ab]{14}c" );
+		uint32_t seed = 1;
+		
+		for ( int n = 0; n < 20; n++ )
+		{
+			std::string s;
+			
+			for ( int i = 0; i < 3000; i++ )
+			{
+				seed = seed * 1103515245 + 12345;
+				s += ( seed >> 16 ) & 1 ? 'a' : 'b';
+			}
+			
+			s += 'c';
+			bool expect = s[ s.size() - 16 ] == 'a';
+			
+			if ( dfa.parse( s ) != expect or pike.parse( s ) != expect )
+				TestFailed( "String %d should %s", n, expect ? "match" : "fail" );
+			
+			if ( expect and pike.getData( 0 ).size() != s.size() - 16 )
+				TestFailed( "String %d group is %d long", n, 
+							(int)pike.getData( 0 ).size() );
+		}
+	}
+	
+	// Inputs a backtracker never finishes, linear time here
+	void longTest()
+	{
+		std::string s( 100000, 'a' );
+		Regex nested( "(a*)*b" );
+		Regex optional( "a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?aaaaaaaaaaaaaaaaaaaab" );
+		
+		if ( nested.parse( s ) or optional.parse( s ) )
+			TestFailed( "Matched without a b" );
+		
+		s += 'b';
+		
+		if ( not nested.parse( s ) or nested.getData( 0 ).size() != 100000 )
+			TestFailed( "Failed to match with a b" );
+	}
+	
+	// One Regex and one RegexSet used by several threads at once
+	void sharedTest()
+	{
+		Runnable<RegexEngineTest> *threads[ kNumThreads ];
+		
+		if ( mShared.prepare( "([a-z]+)=(\\d+);" ) != JetHead::kNoError or 
+			 mSharedSet.add( "[a-z]+=" ) != 0 or mSharedSet.add( "\\d;" ) != 1 )
+			TestFailed( "Prepare failed" );
+		
+		mErrors = 0;
+		
+		for ( int i = 0; i < kNumThreads; i++ )
+		{
+			threads[ i ] = jh_new Runnable<RegexEngineTest>( "RegexShared", 
+				this, &RegexEngineTest::sharedMain );
+			threads[ i ]->Start();
+		}
+		
+		for ( int i = 0; i < kNumThreads; i++ )
+		{
+			threads[ i ]->Join();
+			delete threads[ i ];
+		}
+		
+		if ( mErrors != 0 )
+			TestFailed( "%d wrong results", mErrors );
+	}
+	
+	void sharedMain()
+	{
+		RegexMatch match;
+		RegexProgram::Cache cache;
+		JetHead::vector<int> matches;
+		uint32_t seed = (uint32_t)(uintptr_t)&match;
+		
+		for ( int n = 0; n < 20000; n++ )
+		{
+			std::string name;
+			std::string value;
+			
+			seed = seed * 1103515245 + 12345;
+			name.assign( 1 + ( seed >> 16 ) % 8, 'a' + n % 26 );
+			
+			// Every fifth one has no value and doesn't match
+			if ( n % 5 != 0 )
+			{
+				seed = seed * 1103515245 + 12345;
+				value.assign( 1 + ( seed >> 16 ) % 6, '0' + n % 10 );
+			}
+			
+			std::string s = name + "=" + value + ";";
+			bool expect = not value.empty();
+			
+			if ( mShared.parse( s, match ) != expect or 
+				 ( expect and ( match.getData( 0 ) != name or 
+								match.getData( 1 ) != value ) ) )
+				__sync_fetch_and_add( &mErrors, 1 );
+			
+			if ( not mSharedSet.search( s, matches, cache ) or 
+				 (int)matches.size() != ( expect ? 2 : 1 ) )
+				__sync_fetch_and_add( &mErrors, 1 );
+		}
+	}
+};
+
+class RegexSetTest : public TestCase
+{
+public:
+	RegexSetTest( int number ) : 
+		TestCase( "RegexSetTest" ), mTestNum( number ) 
+	{
+		char name[ 32 ];
+		snprintf( name, 32, "RegexSetTest%d", number );
+		name[ 31 ] = '\0';
+		SetTestName( name );	
+	}
+
+	virtual ~RegexSetTest() {}
+	
+	static const int kNumTests = 3;
+	
+private:
+	int mTestNum;
+	
+	void Run()
+	{
+		switch ( mTestNum )
+		{
+			case 0:
+				matchTest();
+				break;
+			case 1:
+				searchTest();
+				break;
+			case 2:
+				compareTest();
+				break;
+		}
+		
+		TestPassed();
+	}
+	
+	//! matches as a string of indexes, "0,2"
+	std::string indexes( const JetHead::vector<int> &matches )
+	{
+		std::string res;
+		
+		for ( unsigned i = 0; i < matches.size(); i++ )
+		{
+			char buf[ 16 ];
+			snprintf( buf, sizeof( buf ), "%s%d", i > 0 ? "," : "", 
+					  matches[ i ] );
+			res += buf;
+		}
+		
+		return res;
+	}
+	
+	void check( RegexSet &set, bool search, const char *str, 
+				const char *expect )
+	{
+		JetHead::vector<int> matches;
+		bool res = search ? set.search( str, matches ) : 
+			set.match( str, matches );
+		
+		if ( res != ( *expect != '\0' ) or indexes( matches ) != expect )
+			TestFailed( "%s \"%s\" gave \"%s\", expected \"%s\"", 
+						search ? "search" : "match", str, 
+						indexes( matches ).c_str(), expect );
+	}
+	
+	void matchTest()
+	{
+		RegexSet set;
+		JetHead::vector<int> matches;
+		
+		if ( set.match( "abc", matches ) or not matches.empty() )
+			TestFailed( "Empty set matched" );
+		
+		if ( set.add( "GET /" ) != 0 or set.add( "(GET|HEAD) /api/" ) != 1 or
+			 set.add( "[A-Z]+ /api/v\\d+/users" ) != 2 or 
+			 set.add( "POST" ) != 3 or set.size() != 4 )
+			TestFailed( "Add failed" );
+		
+		check( set, false, "GET /index.html", "0" );
+		check( set, false, "GET /api/v2/users/7", "0,1,2" );
+		check( set, false, "HEAD /api/v1/users", "1,2" );
+		check( set, false, "POST /api/v1/users", "2,3" );
+		check( set, false, "PUT /api/v1/items", "" );
+		check( set, false, " GET /", "" );
+		
+		if ( set.add( "a{2" ) != -1 or set.size() != 4 or 
+			 set.getPrepareError().mErrorString.empty() )
+			TestFailed( "Bad RE added" );
+		
+		// Adding after a match builds the program again
+		if ( set.add( "PUT" ) != 4 )
+			TestFailed( "Add after match failed" );
+		
+		check( set, false, "PUT /api/v1/items", "4" );
+		check( set, false, "POST /api/v1/users", "2,3" );
+	}
+	
+	void searchTest()
+	{
+		RegexSet one;
+		
+		// A single possible first byte is found with memchr
+		one.add( "#\\d+" );
+		check( one, true, "see issue #12 and #13", "0" );
+		check( one, true, "no issue here, #", "" );
+		check( one, true, "#1", "0" );
+		check( one, false, "see #12", "" );
+		
+		RegexSet set;
+		set.add( "timeout after \\d+ms" );
+		set.add( "ERROR" );
+		set.add( "WARN(ING)?" );
+		set.add( "x*y" );
+		
+		check( set, true, "2024 INFO all good", "" );
+		check( set, true, "2024 ERROR: timeout after 30ms", "0,1" );
+		check( set, true, "WARNING: timeout after ms", "2" );
+		check( set, true, "ERRORWARNy", "1,2,3" );
+		check( set, true, "ERRO", "" );
+		
+		// Matches nothing, so no byte can be skipped
+		set.add( "z*" );
+		check( set, true, "", "4" );
+		check( set, true, "ERROR", "1,4" );
+		
+		std::string log( 100000, '.' );
+		log += "timeout after 5ms";
+		JetHead::vector<int> matches;
+		
+		if ( one.search( log, matches ) )
+			TestFailed( "Long search found a #" );
+		
+		if ( not set.search( log, matches ) or indexes( matches ) != "0,4" )
+			TestFailed( "Long search gave %s", indexes( matches ).c_str() );
+	}
+	
+	// Random strings through a set and through each of its REs alone
+	void compareTest()
+	{
+		static const char *regexes[] = {
+			"a*b", "(ab|ba)+c", "[ab]{3}", "b?a?c", "[^a]+", "aab*c*", "cc"
+		};
+		RegexSet set;
+		Regex single[ JH_ARRAY_SIZE( regexes ) ];
+		uint32_t seed = 7;
+		
+		for ( int i = 0; i < JH_ARRAY_SIZE( regexes ); i++ )
+		{
+			set.add( regexes[ i ] );
+			single[ i ].prepare( regexes[ i ] );
+		}
+		
+		for ( int n = 0; n < 2000; n++ )
+		{
+			std::string s;
+			int len = n % 12;
+			
+			for ( int i = 0; i < len; i++ )
+			{
+				seed = seed * 1103515245 + 12345;
+				s += "abc"[ ( seed >> 16 ) % 3 ];
+			}
+			
+			JetHead::vector<int> expect;
+			JetHead::vector<int> matches;
+			
+			for ( int i = 0; i < JH_ARRAY_SIZE( regexes ); i++ )
+			{
+				if ( single[ i ].parse( s ) )
+					expect.push_back( i );
+			}
+			
+			set.match( s, matches );
+			
+			if ( indexes( matches ) != indexes( expect ) )
+				TestFailed( "\"%s\" gave %s, expected %s", s.c_str(), 
+							indexes( matches ).c_str(), 
+							indexes( expect ).c_str() );
+			
+			expect.clear();
+			
+			for ( int i = 0; i < JH_ARRAY_SIZE( regexes ); i++ )
+			{
+				for ( unsigned start = 0; start <= s.size(); start++ )
+				{
+					if ( single[ i ].parse( s.substr( start ) ) )
+					{
+						expect.push_back( i );
+						break;
+					}
+				}
+			}
+			
+			set.search( s, matches );
+			
+			if ( indexes( matches ) != indexes( expect ) )
+				TestFailed( "Search \"%s\" gave %s, expected %s", s.c_str(), 
+							indexes( matches ).c_str(), 
+							indexes( expect ).c_str() );
+		}
+	}
+};
+
 int main( int argc, char*argv[] )
 {
 	TestRunner runner( argv[ 0 ] );
 	int i = 0;
 	
-	TestCase *test_set[ JH_ARRAY_SIZE( gPrepareTests ) + JH_ARRAY_SIZE( gParseTests ) ];
+	const int num_tests = JH_ARRAY_SIZE( gPrepareTests ) + 
+		JH_ARRAY_SIZE( gParseTests ) + RegexEngineTest::kNumTests +
+		RegexSetTest::kNumTests;
+	TestCase *test_set[ num_tests ];
 
 	for ( ; i < JH_ARRAY_SIZE( gPrepareTests ); i++ )
 		test_set[ i ] = jh_new RegexPrepareTest( i );
@@ -219,7 +645,13 @@ int main( int argc, char*argv[] )
 	for ( int j = 0; j < JH_ARRAY_SIZE( gParseTests ); j++, i++ )
 		test_set[ i ] = jh_new RegexParseTest( j );
 	
-	runner.RunAll( test_set, JH_ARRAY_SIZE( gPrepareTests ) + JH_ARRAY_SIZE( gParseTests ) );
+	for ( int j = 0; j < RegexEngineTest::kNumTests; j++, i++ )
+		test_set[ i ] = jh_new RegexEngineTest( j );
+	
+	for ( int j = 0; j < RegexSetTest::kNumTests; j++, i++ )
+		test_set[ i ] = jh_new RegexSetTest( j );
+	
+	runner.RunAll( test_set, num_tests );
 
 	return 0;
 }
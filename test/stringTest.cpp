@@ -25,6 +25,16 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
  
+// TestCase.h uses std::string whichever string is being tested
+#include <string>
+
+// Must come before anything includes jh_string.h
+#define TEST_JH_STRING	1
+
+#ifdef TEST_JH_STRING
+#define USE_JETHEAD_STRING
+#endif
+
 #include "logging.h"
 #include "jh_memory.h"
 
@@ -36,12 +46,6 @@ SET_LOG_LEVEL( LOG_LVL_INFO );
 
 #include "TestCase.h"
 
-#define TEST_JH_STRING	1
-
-#ifdef TEST_JH_STRING
-#define USE_JETHEAD_STRING
-#endif
-
 #include "jh_string.h"
 
 using namespace JHSTD;
@@ -61,8 +65,14 @@ public:
 	virtual ~StringTest() {}
 	
 private:
+	static const int kNumThreads = 4;
+	
 	int mTestNum;
 	
+	// Shared by the threads of Test14
+	string	mShared;
+	int		mErrors;
+	
 	void Run()
 	{	
 		switch( mTestNum )
@@ -103,6 +113,12 @@ private:
 		case 11:
 			Test12();
 			break;
+		case 12:
+			Test13();
+			break;
+		case 13:
+			Test14();
+			break;
 		default:
 			break;
 		}
@@ -785,9 +801,149 @@ private:
 			
 		TestPassed();
 	}
+
+	void Test13()
+	{
+		// Short strings inline, long ones shared, and searching to the end
+		string small = "Content-Type";
+		string copy = small;
+		
+		copy[ 0 ] = 'c';
+		
+		if ( small != "Content-Type" || copy != "content-Type" )
+			TestFailed( "Inline copy not independent" );
+		
+		string big( "0123456789abcdefghijklmnopqrstuvwxyz" );
+		string big2 = big;
+		
+		if ( big.data() != big2.data() )
+			TestFailed( "Long copy not shared" );
+		
+		big2 += "!";
+		
+		if ( big.data() == big2.data() || big != "0123456789abcdefghijklmnopqrstuvwxyz" ||
+			 big2 != "0123456789abcdefghijklmnopqrstuvwxyz!" )
+			TestFailed( "Long copy not copied on write" );
+		
+		big2 = big;
+		big2[ 1 ] = '-';
+		
+		if ( big[ 1 ] != '1' || big2[ 1 ] != '-' )
+			TestFailed( "operator[] wrote to a shared string" );
+		
+		// Growing through the inline size and shrinking back
+		string grow;
+		
+		for ( int i = 0; i < 100; i++ )
+		{
+			grow += (char)( 'a' + i % 26 );
+			
+			if ( (int)grow.length() != i + 1 || grow[ i ] != 'a' + i % 26 ||
+				 grow.c_str()[ i + 1 ] != '\0' )
+				TestFailed( "Append %d failed", i );
+		}
+		
+		string shared = grow;
+		shared.erase( 5 );
+		
+		if ( shared != "abcde" || grow.length() != 100 )
+			TestFailed( "Erase of shared string failed" );
+		
+		grow.clear();
+		
+		if ( !grow.empty() || shared != "abcde" )
+			TestFailed( "Clear failed" );
+		
+		// Appending and assigning a string to itself
+		string self = "abcdefghijklmnopqrstuvwxyz";
+		self.append( self );
+		self.append( self.c_str() + 50, 2 );
+		
+		if ( self != "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzyz" )
+			TestFailed( "Self append failed: %s", self.c_str() );
+		
+		self.assign( self.c_str() + 26, 3 );
+		
+		if ( self != "abc" )
+			TestFailed( "Self assign failed: %s", self.c_str() );
+		
+		self.insert( 1, self );
+		
+		if ( self != "aabcbc" )
+			TestFailed( "Self insert failed: %s", self.c_str() );
+		
+		string text = "GET /index.html HTTP/1.1";
+		
+		if ( text.find( "1.1" ) != 21 || text.find( "1.1", 22 ) != string::npos ||
+			 text.find( "" ) != 0 || text.find( "", 24 ) != 24 || 
+			 text.find( "", 25 ) != string::npos || 
+			 text.find( "HTTP/1.1 " ) != string::npos ||
+			 text.find( '1', 22 ) != 23 || text.find( 'x', 30 ) != string::npos )
+			TestFailed( "find at the end failed" );
+		
+		if ( text.rfind( "GET" ) != 0 || text.rfind( "1" ) != 23 || 
+			 text.rfind( "1", 22 ) != 21 || text.rfind( 'G', 0 ) != 0 ||
+			 text.rfind( "GET /index.html HTTP/1.1 " ) != string::npos )
+			TestFailed( "rfind at the ends failed" );
+		
+		if ( string().rfind( 'a' ) != string::npos || 
+			 string().find_last_of( "ab" ) != string::npos )
+			TestFailed( "Search of empty string found something" );
+		
+		if ( string( "abc" ).compare( string( "abcd" ) ) >= 0 ||
+			 string( "abd" ).compare( "abcd" ) <= 0 || string( "" ) != "" )
+			TestFailed( "compare failed" );
+		
+		TestPassed();
+	}
+	
+	void Test14()
+	{
+		// Copies of one long string made and dropped by many threads at once
+		Runnable<StringTest> *threads[ kNumThreads ];
+		
+		mShared.resize( 1000, 'x' );
+		mErrors = 0;
+		
+		for ( int i = 0; i < kNumThreads; i++ )
+		{
+			threads[ i ] = jh_new Runnable<StringTest>( "StringShared", this, 
+				&StringTest::sharedMain );
+			threads[ i ]->Start();
+		}
+		
+		for ( int i = 0; i < kNumThreads; i++ )
+		{
+			threads[ i ]->Join();
+			delete threads[ i ];
+		}
+		
+		if ( mErrors != 0 )
+			TestFailed( "%d bad copies", mErrors );
+		
+		if ( mShared.length() != 1000 || mShared.find_first_of( "y" ) != string::npos )
+			TestFailed( "Shared string was changed" );
+		
+		TestPassed();
+	}
+	
+	void sharedMain()
+	{
+		for ( int i = 0; i < 100000; i++ )
+		{
+			const string copy = mShared;
+			string copy2( copy );
+			
+			if ( i % 10 == 0 )
+				copy2[ i % 1000 ] = 'y';
+			
+			if ( copy.length() != 1000 || copy[ i % 1000 ] != 'x' )
+				__sync_fetch_and_add( &mErrors, 1 );
+		}
+	}
 };
 
-static const int gNumTests = 12;
+static const int gNumTests = 14;
 
 int main( int argc, char*argv[] )
 {